@@ -0,0 +1,231 @@
+#include "batcher.h"
+#include "flightrec.h"
+#include "static_pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct batcher {
+    module_loader_t *loader;
+    /* ops handle, resolved lazily and again after a reload */
+    module_symbol_t ops;
+    bool resolved;
+    size_t max_items;
+    uint64_t max_delay_ns;
+    batcher_result_fn on_result;
+    void *ctx;
+    size_t count;
+    uint64_t oldest_ns;
+    module_item_t *items;
+    int *results;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef KMODLIKE_STATIC
+/* a batcher with room for the largest batch the static build allows */
+typedef struct {
+    batcher_t batcher;
+    module_item_t items[KMODLIKE_STATIC_BATCH_ITEMS];
+    int results[KMODLIKE_STATIC_BATCH_ITEMS];
+} batcher_slot_t;
+
+STATIC_POOL_DEFINE(g_batcher_pool, batcher_slot_t, KMODLIKE_STATIC_BATCHERS);
+
+static batcher_t *batcher_alloc(size_t max_items)
+{
+    batcher_slot_t *slot;
+
+    if (max_items > KMODLIKE_STATIC_BATCH_ITEMS) {
+        return NULL;
+    }
+    slot = static_pool_get(&g_batcher_pool);
+    if (slot == NULL) {
+        return NULL;
+    }
+    memset(&slot->batcher, 0, sizeof(slot->batcher));
+    slot->batcher.items = slot->items;
+    slot->batcher.results = slot->results;
+    return &slot->batcher;
+}
+
+static void batcher_free(batcher_t *batcher)
+{
+    /* the batcher is the first member of its slot */
+    static_pool_put(&g_batcher_pool, batcher);
+}
+#else
+static batcher_t *batcher_alloc(size_t max_items)
+{
+    batcher_t *batcher;
+
+    batcher = calloc(1U, sizeof(*batcher));
+    if (batcher == NULL) {
+        return NULL;
+    }
+
+    batcher->items = calloc(max_items, sizeof(*batcher->items));
+    batcher->results = calloc(max_items, sizeof(*batcher->results));
+    if (batcher->items == NULL || batcher->results == NULL) {
+        free(batcher->items);
+        free(batcher->results);
+        free(batcher);
+        return NULL;
+    }
+    return batcher;
+}
+
+static void batcher_free(batcher_t *batcher)
+{
+    free(batcher->items);
+    free(batcher->results);
+    free(batcher);
+}
+#endif
+
+batcher_t *batcher_create(module_loader_t *loader, size_t max_items, uint32_t max_delay_ms,
+        batcher_result_fn on_result, void *ctx)
+{
+    batcher_t *batcher;
+
+    if (loader == NULL || max_items == 0U || max_items > BATCHER_MAX_ITEMS) {
+        return NULL;
+    }
+
+    batcher = batcher_alloc(max_items);
+    if (batcher == NULL) {
+        return NULL;
+    }
+
+    batcher->loader = loader;
+    batcher->resolved = false;
+    batcher->max_items = max_items;
+    batcher->max_delay_ns = (uint64_t)max_delay_ms * 1000000ULL;
+    batcher->on_result = on_result;
+    batcher->ctx = ctx;
+    batcher->count = 0U;
+
+    return batcher;
+}
+
+void batcher_destroy(batcher_t *batcher)
+{
+    if (batcher == NULL) {
+        return;
+    }
+
+    batcher_flush(batcher);
+    batcher_free(batcher);
+}
+
+/* pin the module and return its table, re-resolving once after a reload */
+static module_error_t pin_ops(batcher_t *batcher, const module_ops_t **ops)
+{
+    module_error_t err;
+    int attempt;
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        if (!batcher->resolved) {
+            err = module_loader_resolve_ops(batcher->loader, &batcher->ops);
+            if (err != MODULE_ERR_SUCCESS) {
+                return err;
+            }
+            batcher->resolved = true;
+        }
+
+        err = module_symbol_pin(&batcher->ops);
+        if (err == MODULE_ERR_SUCCESS) {
+            *ops = batcher->ops.addr;
+            return MODULE_ERR_SUCCESS;
+        }
+        if (err != MODULE_ERR_STALE_HANDLE) {
+            return err;
+        }
+        batcher->resolved = false;
+    }
+
+    return MODULE_ERR_STALE_HANDLE;
+}
+
+module_error_t batcher_flush(batcher_t *batcher)
+{
+    const module_ops_t *ops = NULL;
+    module_error_t err;
+    size_t done = 0U;
+    size_t i;
+
+    if (batcher == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    if (batcher->count == 0U) {
+        return MODULE_ERR_SUCCESS;
+    }
+
+    err = pin_ops(batcher, &ops);
+    if (err == MODULE_ERR_SUCCESS) {
+        if (ops->process_batch == NULL) {
+            err = MODULE_ERR_MISSING_SYMBOL;
+        } else {
+            flightrec_record(FLIGHTREC_CALL, batcher->ops.generation, batcher->count, "batch");
+            done = ops->process_batch(batcher->items, batcher->count, batcher->results);
+        }
+        module_symbol_unpin(&batcher->ops);
+    }
+
+    /* items the module did not get to: busy, or the error of the dispatch */
+    for (i = (done < batcher->count) ? done : batcher->count; i < batcher->count; i++) {
+        batcher->results[i] = (err != MODULE_ERR_SUCCESS) ? (int)err : (int)MODULE_ERR_IN_USE;
+    }
+
+    if (batcher->on_result != NULL) {
+        for (i = 0U; i < batcher->count; i++) {
+            batcher->on_result(batcher->ctx, &batcher->items[i], batcher->results[i]);
+        }
+    }
+
+    batcher->count = 0U;
+    return err;
+}
+
+module_error_t batcher_submit(batcher_t *batcher, const module_item_t *item)
+{
+    if (batcher == NULL || item == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    if (batcher->count == 0U) {
+        batcher->oldest_ns = now_ns();
+    }
+    batcher->items[batcher->count++] = *item;
+
+    if (batcher->count == batcher->max_items) {
+        return batcher_flush(batcher);
+    }
+    return batcher_poll(batcher);
+}
+
+module_error_t batcher_poll(batcher_t *batcher)
+{
+    if (batcher == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    if (batcher->count == 0U || batcher->max_delay_ns == 0U ||
+            now_ns() - batcher->oldest_ns < batcher->max_delay_ns) {
+        return MODULE_ERR_SUCCESS;
+    }
+    return batcher_flush(batcher);
+}
+
+size_t batcher_pending(const batcher_t *batcher)
+{
+    return (batcher != NULL) ? batcher->count : 0U;
+}
@@ -0,0 +1,77 @@
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include "module_loader.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* upper bound for batcher_create max_items */
+#define BATCHER_MAX_ITEMS 4096U
+
+/**
+ * result callback, called once per submitted item after its batch ran
+ * @param ctx user context from batcher_create()
+ * @param item the submitted item
+ * @param result 0 or a negative error: the module result, MODULE_ERR_IN_USE for
+ *        items the module left unprocessed, or the dispatch error for all items
+ */
+typedef void (*batcher_result_fn)(void *ctx, const module_item_t *item, int result);
+
+struct batcher;
+
+typedef struct batcher batcher_t;
+
+/**
+ * create a batcher that feeds one module through ops->process_batch
+ * a batch is dispatched when max_items are queued or the oldest item is
+ * older than max_delay_ms; one pin covers the whole batch
+ * not thread-safe, use one batcher per producer thread
+ * @param loader module loader instance
+ * @param max_items batch size bound, 1..BATCHER_MAX_ITEMS (KMODLIKE_STATIC_BATCH_ITEMS
+ *        in the static build)
+ * @param max_delay_ms age bound checked by submit and poll, 0 disables it
+ * @param on_result result callback or NULL
+ * @param ctx user context for on_result
+ * @return batcher or NULL on error
+ */
+batcher_t *batcher_create(module_loader_t *loader, size_t max_items, uint32_t max_delay_ms,
+        batcher_result_fn on_result, void *ctx);
+
+/**
+ * flush pending items and free the batcher
+ * @param batcher batcher or NULL
+ */
+void batcher_destroy(batcher_t *batcher);
+
+/**
+ * queue one item, dispatches when a bound is reached
+ * item data must stay valid until its result is reported
+ * @param batcher batcher instance
+ * @param item work item
+ * @return error code of the dispatch, MODULE_ERR_SUCCESS if none happened
+ */
+module_error_t batcher_submit(batcher_t *batcher, const module_item_t *item);
+
+/**
+ * dispatch queued items if the oldest one reached max_delay_ms
+ * call periodically from the producer thread
+ * @param batcher batcher instance
+ * @return error code of the dispatch
+ */
+module_error_t batcher_poll(batcher_t *batcher);
+
+/**
+ * dispatch all queued items now
+ * on error every queued item is reported with the error code
+ * @param batcher batcher instance
+ * @return error code
+ */
+module_error_t batcher_flush(batcher_t *batcher);
+
+/**
+ * @param batcher batcher instance
+ * @return number of queued items
+ */
+size_t batcher_pending(const batcher_t *batcher);
+
+#endif /* BATCHER_H */
@@ -0,0 +1,307 @@
+#include "flightrec.h"
+#include "kmod_atomic.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FLIGHTREC_MASK (FLIGHTREC_EVENTS - 1U)
+#define FLIGHTREC_LINE_MAX 160U
+
+/* one cache line per event */
+typedef struct {
+    /* position + 1 once written, 0 while being written */
+    _Atomic uint64_t seq;
+    uint64_t ts_ns;
+    uint64_t arg0;
+    uint64_t arg1;
+    uint32_t type;
+    uint32_t tid;
+    char text[FLIGHTREC_TEXT_MAX];
+} flightrec_event_t;
+
+typedef struct {
+    const char *name;
+    const char *arg0;
+    const char *arg1;
+    /* arg0 holds a negative error code */
+    bool arg0_signed;
+    /* arg1 is an address */
+    bool arg1_hex;
+} flightrec_format_t;
+
+/* arg names are omitted from the dump when NULL */
+static const flightrec_format_t FORMATS[FLIGHTREC_TYPE_COUNT] = {
+    [FLIGHTREC_LOAD] = {"load", "err", "dur_ns", true, false},
+    [FLIGHTREC_UNLOAD] = {"unload", "err", "dur_ns", true, false},
+    [FLIGHTREC_SYMBOL] = {"symbol", "err", NULL, true, false},
+    [FLIGHTREC_REF_GET] = {"ref_get", "refs", NULL, false, false},
+    [FLIGHTREC_REF_PUT] = {"ref_put", "refs", NULL, false, false},
+    [FLIGHTREC_CALL] = {"call", "gen", "items", false, false},
+    [FLIGHTREC_CRASH] = {"crash", "crashes", NULL, false, false},
+    [FLIGHTREC_RPC] = {"rpc", "ret", "dur_ns", true, false},
+    [FLIGHTREC_SIGNAL] = {"signal", "signo", "addr", false, true},
+    [FLIGHTREC_STUCK] = {"stuck", "calls", "tasks", false, false},
+};
+
+_Static_assert((FLIGHTREC_EVENTS & FLIGHTREC_MASK) == 0U,
+        "FLIGHTREC_EVENTS must be a power of two");
+
+static flightrec_event_t g_ring[FLIGHTREC_EVENTS];
+/* plain in the single-threaded build, a racing signal handler may reuse a slot */
+static KMOD_ATOMIC(uint64_t) g_head = 0U;
+static _Thread_local uint32_t t_tid = 0U;
+
+static uint32_t current_tid(void)
+{
+    if (t_tid == 0U) {
+        t_tid = (uint32_t)syscall(SYS_gettid);
+    }
+    return t_tid;
+}
+
+void flightrec_record(flightrec_type_t type, uint64_t arg0, uint64_t arg1,
+        const char *text)
+{
+    flightrec_event_t *ev;
+    struct timespec ts;
+    uint64_t pos;
+    size_t len = 0U;
+
+    pos = kmod_atomic_fetch_add(&g_head, 1U, memory_order_relaxed);
+    ev = &g_ring[pos & FLIGHTREC_MASK];
+
+    atomic_store_explicit(&ev->seq, 0U, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ev->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    ev->arg0 = arg0;
+    ev->arg1 = arg1;
+    ev->type = (uint32_t)type;
+    ev->tid = current_tid();
+
+    if (text != NULL) {
+        len = strlen(text);
+        if (len > FLIGHTREC_TEXT_MAX - 1U) {
+            /* keep the tail, it is the informative part of a path */
+            text += len - (FLIGHTREC_TEXT_MAX - 1U);
+            len = FLIGHTREC_TEXT_MAX - 1U;
+        }
+        memcpy(ev->text, text, len);
+    }
+    ev->text[len] = '\0';
+
+    atomic_store_explicit(&ev->seq, pos + 1U, memory_order_release);
+}
+
+/* copy the event at pos, false if it was overwritten or is being written */
+static bool read_event(uint64_t pos, flightrec_event_t *out)
+{
+    const flightrec_event_t *ev = &g_ring[pos & FLIGHTREC_MASK];
+    uint64_t seq;
+
+    seq = atomic_load_explicit(&ev->seq, memory_order_acquire);
+    if (seq != pos + 1U) {
+        return false;
+    }
+
+    out->ts_ns = ev->ts_ns;
+    out->arg0 = ev->arg0;
+    out->arg1 = ev->arg1;
+    out->type = ev->type;
+    out->tid = ev->tid;
+    memcpy(out->text, ev->text, sizeof(out->text));
+    out->text[sizeof(out->text) - 1U] = '\0';
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&ev->seq, memory_order_relaxed) == seq;
+}
+
+/* async-signal-safe formatting helpers, no stdio */
+static size_t put_str(char *buf, size_t pos, size_t size, const char *s)
+{
+    while (*s != '\0' && pos + 1U < size) {
+        buf[pos++] = *s++;
+    }
+    return pos;
+}
+
+static size_t put_u64(char *buf, size_t pos, size_t size, uint64_t v, uint32_t width,
+        char pad)
+{
+    char tmp[24];
+    uint32_t n = 0U;
+
+    do {
+        tmp[n++] = (char)('0' + (v % 10U));
+        v /= 10U;
+    } while (v != 0U);
+
+    while (width > n && pos + 1U < size) {
+        buf[pos++] = pad;
+        width--;
+    }
+    while (n > 0U && pos + 1U < size) {
+        buf[pos++] = tmp[--n];
+    }
+    return pos;
+}
+
+static size_t put_hex(char *buf, size_t pos, size_t size, uint64_t v)
+{
+    static const char digits[] = "0123456789abcdef";
+    int shift;
+
+    pos = put_str(buf, pos, size, "0x");
+    for (shift = 60; shift > 0 && ((v >> shift) & 0xfU) == 0U; shift -= 4) {
+    }
+    for (; shift >= 0 && pos + 1U < size; shift -= 4) {
+        buf[pos++] = digits[(v >> shift) & 0xfU];
+    }
+    return pos;
+}
+
+/* "[ seconds.micros] tid=N name text arg0=v arg1=v\n" */
+static size_t format_event(const flightrec_event_t *ev, char *buf, size_t size)
+{
+    const flightrec_format_t *fmt;
+    size_t pos = 0U;
+
+    if (ev->type == 0U || ev->type >= FLIGHTREC_TYPE_COUNT) {
+        return 0U;
+    }
+    fmt = &FORMATS[ev->type];
+
+    pos = put_str(buf, pos, size, "[");
+    pos = put_u64(buf, pos, size, ev->ts_ns / 1000000000ULL, 6U, ' ');
+    pos = put_str(buf, pos, size, ".");
+    pos = put_u64(buf, pos, size, (ev->ts_ns % 1000000000ULL) / 1000U, 6U, '0');
+    pos = put_str(buf, pos, size, "] tid=");
+    pos = put_u64(buf, pos, size, ev->tid, 0U, ' ');
+    pos = put_str(buf, pos, size, " ");
+    pos = put_str(buf, pos, size, fmt->name);
+    if (ev->text[0] != '\0') {
+        pos = put_str(buf, pos, size, " ");
+        pos = put_str(buf, pos, size, ev->text);
+    }
+    if (fmt->arg0 != NULL) {
+        pos = put_str(buf, pos, size, " ");
+        pos = put_str(buf, pos, size, fmt->arg0);
+        pos = put_str(buf, pos, size, "=");
+        if (fmt->arg0_signed && (int64_t)ev->arg0 < 0) {
+            pos = put_str(buf, pos, size, "-");
+            pos = put_u64(buf, pos, size, (uint64_t)(-(int64_t)ev->arg0), 0U, ' ');
+        } else {
+            pos = put_u64(buf, pos, size, ev->arg0, 0U, ' ');
+        }
+    }
+    if (fmt->arg1 != NULL) {
+        pos = put_str(buf, pos, size, " ");
+        pos = put_str(buf, pos, size, fmt->arg1);
+        pos = put_str(buf, pos, size, "=");
+        if (fmt->arg1_hex) {
+            pos = put_hex(buf, pos, size, ev->arg1);
+        } else {
+            pos = put_u64(buf, pos, size, ev->arg1, 0U, ' ');
+        }
+    }
+    pos = put_str(buf, pos, size, "\n");
+    buf[pos] = '\0';
+    return pos;
+}
+
+/* first retained position for a limit of max_events, 0 means all */
+static uint64_t first_pos(uint64_t head, size_t max_events)
+{
+    uint64_t count = (head < FLIGHTREC_EVENTS) ? head : FLIGHTREC_EVENTS;
+
+    if (max_events != 0U && max_events < count) {
+        count = max_events;
+    }
+    return head - count;
+}
+
+size_t flightrec_dump_fd(int fd)
+{
+    flightrec_event_t ev;
+    char line[FLIGHTREC_LINE_MAX];
+    uint64_t head;
+    uint64_t pos;
+    size_t count = 0U;
+    size_t len;
+    ssize_t ret;
+
+    head = kmod_atomic_load(&g_head, memory_order_acquire);
+    for (pos = first_pos(head, 0U); pos < head; pos++) {
+        if (!read_event(pos, &ev)) {
+            continue;
+        }
+        len = format_event(&ev, line, sizeof(line));
+        if (len == 0U) {
+            continue;
+        }
+        ret = write(fd, line, len);
+        if (ret < 0) {
+            break;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+size_t flightrec_dump_buf(char *buf, size_t size, size_t max_events)
+{
+    flightrec_event_t ev;
+    uint64_t head;
+    uint64_t pos;
+    size_t used = 0U;
+    size_t count = 0U;
+    size_t len;
+
+    if (buf == NULL || size == 0U) {
+        return 0U;
+    }
+    buf[0] = '\0';
+
+    head = kmod_atomic_load(&g_head, memory_order_acquire);
+    for (pos = first_pos(head, max_events); pos < head; pos++) {
+        if (size - used < FLIGHTREC_LINE_MAX) {
+            break;
+        }
+        if (!read_event(pos, &ev)) {
+            continue;
+        }
+        len = format_event(&ev, buf + used, size - used);
+        used += len;
+        count += (len > 0U) ? 1U : 0U;
+    }
+
+    return count;
+}
+
+int flightrec_dump_file(const char *path)
+{
+    size_t count;
+    int fd;
+
+    if (path == NULL) {
+        return -1;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    count = flightrec_dump_fd(fd);
+    if (close(fd) != 0) {
+        return -1;
+    }
+    return (int)count;
+}
@@ -0,0 +1,61 @@
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ring capacity, power of two */
+#define FLIGHTREC_EVENTS 4096U
+#define FLIGHTREC_TEXT_MAX 24U
+/* events returned by the rpc command by default */
+#define FLIGHTREC_RPC_DEFAULT_EVENTS 256U
+
+typedef enum {
+    FLIGHTREC_LOAD = 1,
+    FLIGHTREC_UNLOAD,
+    FLIGHTREC_SYMBOL,
+    FLIGHTREC_REF_GET,
+    FLIGHTREC_REF_PUT,
+    FLIGHTREC_CALL,
+    FLIGHTREC_CRASH,
+    FLIGHTREC_RPC,
+    FLIGHTREC_SIGNAL,
+    FLIGHTREC_STUCK,
+    FLIGHTREC_TYPE_COUNT
+} flightrec_type_t;
+
+/**
+ * record one event, lock-free and safe from any thread or signal handler
+ * meaning of arg0 and arg1 depends on type, see flightrec.c
+ * @param type event type
+ * @param arg0 first argument
+ * @param arg1 second argument
+ * @param text short label, only the last FLIGHTREC_TEXT_MAX - 1 chars are kept
+ */
+void flightrec_record(flightrec_type_t type, uint64_t arg0, uint64_t arg1,
+        const char *text);
+
+/**
+ * write all retained events oldest first, async-signal-safe
+ * @param fd output descriptor
+ * @return number of events written
+ */
+size_t flightrec_dump_fd(int fd);
+
+/**
+ * format the most recent events oldest first into a buffer
+ * @param buf output buffer
+ * @param size buffer size
+ * @param max_events limit, 0 for all retained events
+ * @return number of events written
+ */
+size_t flightrec_dump_buf(char *buf, size_t size, size_t max_events);
+
+/**
+ * write all retained events to a file
+ * @param path output path
+ * @return number of events written, -1 on error
+ */
+int flightrec_dump_file(const char *path);
+
+#endif /* FLIGHTREC_H */
@@ -0,0 +1,544 @@
+#include "host_arena.h"
+#include "static_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* class of chunks holding one large block */
+#define CLASS_LARGE HOST_ARENA_CLASSES
+/* room for chunk_t, keeps the first block 64 byte aligned */
+#define CHUNK_HEADER 64U
+
+typedef struct block {
+    struct block *next;
+} block_t;
+
+typedef struct chunk {
+    struct chunk *next;
+    struct chunk *prev;
+    uint32_t cls;
+    /* bytes taken from the system */
+    size_t size;
+} chunk_t;
+
+_Static_assert(sizeof(chunk_t) <= CHUNK_HEADER, "chunk header too large");
+_Static_assert((HOST_ARENA_CACHE_SLOTS & (HOST_ARENA_CACHE_SLOTS - 1U)) == 0U,
+        "cache slots must be a power of two");
+
+/*
+ * blocks one thread keeps for one arena, valid while arena_id is alive
+ * the counters are written by the owning thread only and summed by
+ * host_arena_get_stats, so alloc and free need no atomic read-modify-write
+ */
+typedef struct cache {
+    uint64_t arena_id;
+    /* other caches of the same arena, under its lock */
+    struct cache *next;
+    struct cache *prev;
+    /* moved to the module (+) or back from it (-) by this thread */
+    _Atomic int64_t bytes;
+    _Atomic int64_t objects;
+    block_t *head[HOST_ARENA_CLASSES];
+    uint32_t count[HOST_ARENA_CLASSES];
+} cache_t;
+
+struct host_arena {
+    pthread_mutex_t lock;
+    /* never reused, thread caches of destroyed arenas never match again */
+    uint64_t id;
+    struct host_arena *registry_next;
+    block_t *free[HOST_ARENA_CLASSES];
+    char *bump[HOST_ARENA_CLASSES];
+    char *bump_end[HOST_ARENA_CLASSES];
+    chunk_t *chunks;
+    uint64_t reserved;
+    cache_t *caches;
+    /* large blocks and the counters of detached caches */
+    int64_t bytes;
+    int64_t objects;
+    module_alloc_ops_t ops;
+};
+
+static _Thread_local cache_t t_cache[HOST_ARENA_CACHE_SLOTS];
+static _Thread_local bool t_cache_registered = false;
+
+/* live arenas, a thread detaching a cache checks its arena is still here */
+static pthread_mutex_t g_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_arena_t *g_registry = NULL;
+static uint64_t g_next_id = 1U;
+/* returns the caches of an exiting thread */
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_cache_key;
+
+#ifdef KMODLIKE_STATIC
+typedef struct {
+    _Alignas(HOST_ARENA_CHUNK_SIZE) unsigned char bytes[HOST_ARENA_CHUNK_SIZE];
+} chunk_storage_t;
+
+STATIC_POOL_DEFINE(g_arena_pool, host_arena_t, KMODLIKE_STATIC_ARENAS);
+STATIC_POOL_DEFINE(g_chunk_pool, chunk_storage_t, KMODLIKE_STATIC_ARENA_CHUNKS);
+
+static host_arena_t *arena_alloc(void)
+{
+    host_arena_t *arena = static_pool_get(&g_arena_pool);
+
+    if (arena != NULL) {
+        memset(arena, 0, sizeof(*arena));
+    }
+    return arena;
+}
+
+static void arena_free(host_arena_t *arena)
+{
+    static_pool_put(&g_arena_pool, arena);
+}
+
+/* large blocks are limited to one chunk */
+static void *chunk_alloc(size_t size)
+{
+    return (size <= HOST_ARENA_CHUNK_SIZE) ? static_pool_get(&g_chunk_pool) : NULL;
+}
+
+static void chunk_free(chunk_t *chunk)
+{
+    static_pool_put(&g_chunk_pool, chunk);
+}
+#else
+static host_arena_t *arena_alloc(void)
+{
+    return calloc(1U, sizeof(host_arena_t));
+}
+
+static void arena_free(host_arena_t *arena)
+{
+    free(arena);
+}
+
+static void *chunk_alloc(size_t size)
+{
+    void *mem;
+
+    return (posix_memalign(&mem, HOST_ARENA_CHUNK_SIZE, size) == 0) ? mem : NULL;
+}
+
+static void chunk_free(chunk_t *chunk)
+{
+    free(chunk);
+}
+#endif
+
+static uint32_t class_of(size_t size)
+{
+    if (size <= HOST_ARENA_MIN_CLASS) {
+        return 0U;
+    }
+    return (uint32_t)(64 - __builtin_clzll((unsigned long long)(size - 1U))) - 4U;
+}
+
+static size_t class_size(uint32_t cls)
+{
+    return (size_t)HOST_ARENA_MIN_CLASS << cls;
+}
+
+/* blocks of cls a thread cache holds at most */
+static uint32_t cache_max(uint32_t cls)
+{
+    uint32_t n = (HOST_ARENA_CACHE_BYTES / HOST_ARENA_MIN_CLASS) >> cls;
+
+    return (n < HOST_ARENA_CACHE_MIN) ? HOST_ARENA_CACHE_MIN : n;
+}
+
+static chunk_t *chunk_of(const void *ptr)
+{
+    return (chunk_t *)((uintptr_t)ptr & ~(uintptr_t)(HOST_ARENA_CHUNK_SIZE - 1U));
+}
+
+/* called with the arena lock held */
+static chunk_t *chunk_new(host_arena_t *arena, uint32_t cls, size_t size)
+{
+    chunk_t *chunk;
+
+    chunk = chunk_alloc(size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->cls = cls;
+    chunk->size = size;
+    chunk->prev = NULL;
+    chunk->next = arena->chunks;
+    if (chunk->next != NULL) {
+        chunk->next->prev = chunk;
+    }
+    arena->chunks = chunk;
+    arena->reserved += size;
+    return chunk;
+}
+
+/* move half a cache of cls from the arena to the cache */
+static bool cache_refill(host_arena_t *arena, cache_t *cache, uint32_t cls)
+{
+    uint32_t batch = cache_max(cls) / 2U;
+    size_t size = class_size(cls);
+    chunk_t *chunk;
+    block_t *b;
+    uint32_t n = 0U;
+
+    pthread_mutex_lock(&arena->lock);
+    while (n < batch && arena->free[cls] != NULL) {
+        b = arena->free[cls];
+        arena->free[cls] = b->next;
+        b->next = cache->head[cls];
+        cache->head[cls] = b;
+        n++;
+    }
+    while (n < batch) {
+        if (arena->bump[cls] == arena->bump_end[cls]) {
+            chunk = chunk_new(arena, cls, HOST_ARENA_CHUNK_SIZE);
+            if (chunk == NULL) {
+                break;
+            }
+            arena->bump[cls] = (char *)chunk + CHUNK_HEADER;
+            arena->bump_end[cls] = arena->bump[cls] +
+                    ((HOST_ARENA_CHUNK_SIZE - CHUNK_HEADER) / size) * size;
+        }
+        b = (block_t *)(void *)arena->bump[cls];
+        arena->bump[cls] += size;
+        b->next = cache->head[cls];
+        cache->head[cls] = b;
+        n++;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    cache->count[cls] += n;
+    return n != 0U;
+}
+
+/* unlink blocks keep..count of cls from the cache, returns the first of them */
+static block_t *cache_take(cache_t *cache, uint32_t cls, uint32_t keep, block_t **last)
+{
+    block_t *first;
+    block_t *b;
+    uint32_t i;
+
+    if (keep == 0U) {
+        first = cache->head[cls];
+        cache->head[cls] = NULL;
+    } else {
+        b = cache->head[cls];
+        for (i = 1U; i < keep; i++) {
+            b = b->next;
+        }
+        first = b->next;
+        b->next = NULL;
+    }
+    b = first;
+    while (b->next != NULL) {
+        b = b->next;
+    }
+    *last = b;
+    cache->count[cls] = keep;
+    return first;
+}
+
+/* give blocks keep..count of cls back to the arena */
+static void cache_spill(host_arena_t *arena, cache_t *cache, uint32_t cls, uint32_t keep)
+{
+    block_t *first;
+    block_t *last;
+
+    first = cache_take(cache, cls, keep, &last);
+    pthread_mutex_lock(&arena->lock);
+    last->next = arena->free[cls];
+    arena->free[cls] = first;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * hand everything the cache holds back to its arena if it is still alive,
+ * blocks and counters of a destroyed arena are simply forgotten
+ */
+static void cache_release(cache_t *cache)
+{
+    host_arena_t *owner;
+    block_t *first;
+    block_t *last;
+    uint32_t cls;
+
+    if (cache->arena_id == 0U) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_registry_lock);
+    for (owner = g_registry; owner != NULL; owner = owner->registry_next) {
+        if (owner->id == cache->arena_id) {
+            break;
+        }
+    }
+    if (owner != NULL) {
+        pthread_mutex_lock(&owner->lock);
+        for (cls = 0U; cls < HOST_ARENA_CLASSES; cls++) {
+            if (cache->count[cls] != 0U) {
+                first = cache_take(cache, cls, 0U, &last);
+                last->next = owner->free[cls];
+                owner->free[cls] = first;
+            }
+        }
+        owner->bytes += atomic_load_explicit(&cache->bytes, memory_order_relaxed);
+        owner->objects += atomic_load_explicit(&cache->objects, memory_order_relaxed);
+        if (cache->prev != NULL) {
+            cache->prev->next = cache->next;
+        } else {
+            owner->caches = cache->next;
+        }
+        if (cache->next != NULL) {
+            cache->next->prev = cache->prev;
+        }
+        pthread_mutex_unlock(&owner->lock);
+    }
+    pthread_mutex_unlock(&g_registry_lock);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void release_thread_caches(void *arg)
+{
+    uint32_t i;
+
+    (void)arg;
+    for (i = 0U; i < HOST_ARENA_CACHE_SLOTS; i++) {
+        cache_release(&t_cache[i]);
+    }
+}
+
+static void make_cache_key(void)
+{
+    pthread_key_create(&g_cache_key, release_thread_caches);
+}
+
+/* hand the slot to another arena */
+static void cache_switch(cache_t *cache, host_arena_t *arena)
+{
+    if (!t_cache_registered) {
+        pthread_once(&g_key_once, make_cache_key);
+        pthread_setspecific(g_cache_key, t_cache);
+        t_cache_registered = true;
+    }
+
+    cache_release(cache);
+    cache->arena_id = arena->id;
+    pthread_mutex_lock(&arena->lock);
+    cache->next = arena->caches;
+    if (cache->next != NULL) {
+        cache->next->prev = cache;
+    }
+    arena->caches = cache;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/* only the owning thread writes, a plain add is enough */
+static void cache_count(cache_t *cache, int64_t bytes, int64_t objects)
+{
+    atomic_store_explicit(&cache->bytes,
+            atomic_load_explicit(&cache->bytes, memory_order_relaxed) + bytes,
+            memory_order_relaxed);
+    atomic_store_explicit(&cache->objects,
+            atomic_load_explicit(&cache->objects, memory_order_relaxed) + objects,
+            memory_order_relaxed);
+}
+
+static cache_t *cache_for(host_arena_t *arena)
+{
+    cache_t *cache = &t_cache[arena->id & (HOST_ARENA_CACHE_SLOTS - 1U)];
+
+    if (cache->arena_id != arena->id) {
+        cache_switch(cache, arena);
+    }
+    return cache;
+}
+
+static void *alloc_large(host_arena_t *arena, size_t size)
+{
+    chunk_t *chunk;
+
+    if (size > SIZE_MAX - CHUNK_HEADER) {
+        return NULL;
+    }
+    pthread_mutex_lock(&arena->lock);
+    chunk = chunk_new(arena, CLASS_LARGE, CHUNK_HEADER + size);
+    if (chunk != NULL) {
+        arena->bytes += (int64_t)size;
+        arena->objects++;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    return (char *)chunk + CHUNK_HEADER;
+}
+
+static void free_large(host_arena_t *arena, chunk_t *chunk)
+{
+    pthread_mutex_lock(&arena->lock);
+    if (chunk->prev != NULL) {
+        chunk->prev->next = chunk->next;
+    } else {
+        arena->chunks = chunk->next;
+    }
+    if (chunk->next != NULL) {
+        chunk->next->prev = chunk->prev;
+    }
+    arena->reserved -= chunk->size;
+    arena->bytes -= (int64_t)(chunk->size - CHUNK_HEADER);
+    arena->objects--;
+    pthread_mutex_unlock(&arena->lock);
+    chunk_free(chunk);
+}
+
+void *host_arena_alloc(host_arena_t *arena, size_t size)
+{
+    cache_t *cache;
+    block_t *b;
+    uint32_t cls;
+
+    if (arena == NULL || size == 0U) {
+        return NULL;
+    }
+    if (size > HOST_ARENA_MAX_SMALL) {
+        return alloc_large(arena, size);
+    }
+
+    cls = class_of(size);
+    cache = cache_for(arena);
+    if (cache->head[cls] == NULL && !cache_refill(arena, cache, cls)) {
+        return NULL;
+    }
+    b = cache->head[cls];
+    cache->head[cls] = b->next;
+    cache->count[cls]--;
+    cache_count(cache, (int64_t)class_size(cls), 1);
+    return b;
+}
+
+void host_arena_free(host_arena_t *arena, void *ptr)
+{
+    chunk_t *chunk;
+    cache_t *cache;
+    block_t *b = ptr;
+    uint32_t cls;
+
+    if (arena == NULL || ptr == NULL) {
+        return;
+    }
+    chunk = chunk_of(ptr);
+    if (chunk->cls == CLASS_LARGE) {
+        free_large(arena, chunk);
+        return;
+    }
+
+    cls = chunk->cls;
+    cache = cache_for(arena);
+    cache_count(cache, -(int64_t)class_size(cls), -1);
+    b->next = cache->head[cls];
+    cache->head[cls] = b;
+    if (++cache->count[cls] >= cache_max(cls)) {
+        cache_spill(arena, cache, cls, cache_max(cls) / 2U);
+    }
+}
+
+static void *ops_alloc(void *ctx, size_t size)
+{
+    return host_arena_alloc(ctx, size);
+}
+
+static void ops_free(void *ctx, void *ptr)
+{
+    host_arena_free(ctx, ptr);
+}
+
+host_arena_t *host_arena_create(void)
+{
+    host_arena_t *arena;
+
+    arena = arena_alloc();
+    if (arena == NULL) {
+        return NULL;
+    }
+    if (pthread_mutex_init(&arena->lock, NULL) != 0) {
+        arena_free(arena);
+        return NULL;
+    }
+    arena->ops.ctx = arena;
+    arena->ops.alloc = ops_alloc;
+    arena->ops.free = ops_free;
+
+    pthread_mutex_lock(&g_registry_lock);
+    arena->id = g_next_id++;
+    arena->registry_next = g_registry;
+    g_registry = arena;
+    pthread_mutex_unlock(&g_registry_lock);
+    return arena;
+}
+
+void host_arena_destroy(host_arena_t *arena)
+{
+    host_arena_t **link;
+    chunk_t *chunk;
+    chunk_t *next;
+
+    if (arena == NULL) {
+        return;
+    }
+
+    /* from here on no cache flush can reach the arena */
+    pthread_mutex_lock(&g_registry_lock);
+    for (link = &g_registry; *link != NULL; link = &(*link)->registry_next) {
+        if (*link == arena) {
+            *link = arena->registry_next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_registry_lock);
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        chunk_free(chunk);
+    }
+    pthread_mutex_destroy(&arena->lock);
+    arena_free(arena);
+}
+
+const module_alloc_ops_t *host_arena_ops(host_arena_t *arena)
+{
+    return (arena != NULL) ? &arena->ops : NULL;
+}
+
+void host_arena_get_stats(host_arena_t *arena, host_arena_stats_t *stats)
+{
+    const cache_t *cache;
+    int64_t bytes;
+    int64_t objects;
+
+    if (stats == NULL) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (arena == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    bytes = arena->bytes;
+    objects = arena->objects;
+    for (cache = arena->caches; cache != NULL; cache = cache->next) {
+        bytes += atomic_load_explicit(&cache->bytes, memory_order_relaxed);
+        objects += atomic_load_explicit(&cache->objects, memory_order_relaxed);
+    }
+    stats->reserved_bytes = arena->reserved;
+    pthread_mutex_unlock(&arena->lock);
+
+    /* a free racing with the alloc on another thread can show up first */
+    stats->bytes = (bytes > 0) ? (uint64_t)bytes : 0U;
+    stats->objects = (objects > 0) ? (uint64_t)objects : 0U;
+}
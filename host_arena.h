@@ -0,0 +1,72 @@
+#ifndef HOST_ARENA_H
+#define HOST_ARENA_H
+
+#include "module_interface.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* chunks are aligned to their size, free finds the header by masking */
+#define HOST_ARENA_CHUNK_SIZE (64U * 1024U)
+/* size classes 16, 32, ... 2048 bytes, larger blocks get a chunk each */
+#define HOST_ARENA_MIN_CLASS 16U
+#define HOST_ARENA_CLASSES 8U
+#define HOST_ARENA_MAX_SMALL (HOST_ARENA_MIN_CLASS << (HOST_ARENA_CLASSES - 1U))
+/* arenas a thread caches blocks for at once */
+#define HOST_ARENA_CACHE_SLOTS 8U
+/* bytes per class a thread keeps for one arena, at least 8 blocks,
+ * half of them move per refill or spill */
+#define HOST_ARENA_CACHE_BYTES (32U * 1024U)
+#define HOST_ARENA_CACHE_MIN 8U
+
+struct host_arena;
+
+typedef struct host_arena host_arena_t;
+
+/* counters of one arena */
+typedef struct {
+    /* handed to the module and not freed yet */
+    uint64_t bytes;
+    uint64_t objects;
+    /* chunks taken from the system */
+    uint64_t reserved_bytes;
+} host_arena_stats_t;
+
+/**
+ * create an empty arena, chunks are taken on first use
+ * @return arena or NULL on error
+ */
+host_arena_t *host_arena_create(void);
+
+/**
+ * release every chunk of the arena at once, blocks still held are freed too
+ * no thread may use the arena anymore
+ * @param arena arena or NULL
+ */
+void host_arena_destroy(host_arena_t *arena);
+
+/**
+ * @param arena arena instance
+ * @return table handed to the module in module_init_args_t.alloc
+ */
+const module_alloc_ops_t *host_arena_ops(host_arena_t *arena);
+
+/**
+ * @param arena arena instance
+ * @param size requested size
+ * @return 16 byte aligned block or NULL
+ */
+void *host_arena_alloc(host_arena_t *arena, size_t size);
+
+/**
+ * @param arena arena the block came from
+ * @param ptr block or NULL
+ */
+void host_arena_free(host_arena_t *arena, void *ptr);
+
+/**
+ * @param arena arena or NULL, NULL reads as all zero
+ * @param stats output counters
+ */
+void host_arena_get_stats(host_arena_t *arena, host_arena_stats_t *stats);
+
+#endif /* HOST_ARENA_H */
@@ -0,0 +1,216 @@
+#include "host_clock.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HOST_CLOCK_HAVE_TSC 1
+#endif
+
+#define NS_PER_SEC 1000000000ULL
+/* fixed point of the cycles to nanoseconds factor */
+#define TSC_SHIFT 32U
+/* below this the counter is not worth calibrating */
+#define TSC_MIN_HZ 100000000ULL
+/* reads bracketing one TSC sample, the tightest pair wins */
+#define TSC_SAMPLE_TRIES 8
+#define CPUID_INVARIANT_TSC (1U << 8)
+#define CLOCKSOURCE_PATH "/sys/devices/system/clocksource/clocksource0/current_clocksource"
+
+static pthread_once_t g_clock_once = PTHREAD_ONCE_INIT;
+static host_clock_source_t g_source = HOST_CLOCK_SOURCE_VDSO;
+static uint64_t g_tsc_hz;
+/* ns = g_base_ns + ((tsc - g_base_tsc) * g_mult) >> TSC_SHIFT */
+static uint64_t g_base_tsc;
+static uint64_t g_base_ns;
+static uint64_t g_mult;
+static module_clock_ops_t g_ops;
+
+static uint64_t read_clock(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t coarse_ns(void)
+{
+    return read_clock(CLOCK_MONOTONIC_COARSE);
+}
+
+uint64_t host_clock_vdso_ns(void)
+{
+    return read_clock(CLOCK_MONOTONIC_RAW);
+}
+
+/* without a TSC one cycle is one nanosecond */
+static uint64_t identity_to_ns(uint64_t cycles)
+{
+    return cycles;
+}
+
+#ifdef HOST_CLOCK_HAVE_TSC
+static uint64_t tsc_cycles(void)
+{
+    return __rdtsc();
+}
+
+static uint64_t tsc_to_ns(uint64_t cycles)
+{
+    return (uint64_t)(((unsigned __int128)cycles * g_mult) >> TSC_SHIFT);
+}
+
+static uint64_t tsc_now_ns(void)
+{
+    return g_base_ns + tsc_to_ns(__rdtsc() - g_base_tsc);
+}
+
+/*
+ * the cpu promises a constant rate through P- and C-states, and the kernel
+ * still runs its own clock on it, so it found the counters in sync
+ */
+static bool tsc_usable(void)
+{
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    char name[32];
+    FILE *f;
+    bool kernel_tsc = true;
+
+    if (__get_cpuid(0x80000000U, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007U) {
+        return false;
+    }
+    __get_cpuid(0x80000007U, &eax, &ebx, &ecx, &edx);
+    if ((edx & CPUID_INVARIANT_TSC) == 0U) {
+        return false;
+    }
+
+    f = fopen(CLOCKSOURCE_PATH, "r");
+    if (f != NULL) {
+        if (fgets(name, sizeof(name), f) != NULL) {
+            kernel_tsc = (strncmp(name, "tsc", 3U) == 0);
+        }
+        fclose(f);
+    }
+    return kernel_tsc;
+}
+
+/* TSC and CLOCK_MONOTONIC_RAW read at the same instant, as close as we get */
+static void sample(uint64_t *tsc, uint64_t *ns)
+{
+    uint64_t before;
+    uint64_t after;
+    uint64_t t;
+    uint64_t best = UINT64_MAX;
+    int i;
+
+    *tsc = 0U;
+    *ns = 0U;
+    for (i = 0; i < TSC_SAMPLE_TRIES; i++) {
+        before = host_clock_vdso_ns();
+        t = __rdtsc();
+        after = host_clock_vdso_ns();
+        if (after - before < best) {
+            best = after - before;
+            *tsc = t;
+            *ns = before + (after - before) / 2U;
+        }
+    }
+}
+
+static bool tsc_calibrate(void)
+{
+    struct timespec delay = { 0, (long)HOST_CLOCK_CALIBRATE_MS * 1000000L };
+    uint64_t tsc0;
+    uint64_t ns0;
+    uint64_t tsc1;
+    uint64_t ns1;
+
+    sample(&tsc0, &ns0);
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+        continue;
+    }
+    sample(&tsc1, &ns1);
+    if (tsc1 <= tsc0 || ns1 <= ns0) {
+        return false;
+    }
+
+    g_tsc_hz = (uint64_t)(((unsigned __int128)(tsc1 - tsc0) * NS_PER_SEC) / (ns1 - ns0));
+    if (g_tsc_hz < TSC_MIN_HZ) {
+        g_tsc_hz = 0U;
+        return false;
+    }
+    g_mult = (uint64_t)((((unsigned __int128)(ns1 - ns0)) << TSC_SHIFT) / (tsc1 - tsc0));
+    g_base_tsc = tsc1;
+    g_base_ns = ns1;
+    return true;
+}
+#endif
+
+static void clock_init_once(void)
+{
+    g_ops.coarse_ns = coarse_ns;
+    g_ops.now_ns = host_clock_vdso_ns;
+    g_ops.cycles = host_clock_vdso_ns;
+    g_ops.cycles_to_ns = identity_to_ns;
+
+#ifdef HOST_CLOCK_HAVE_TSC
+    if (tsc_usable() && tsc_calibrate()) {
+        g_source = HOST_CLOCK_SOURCE_TSC;
+        g_ops.now_ns = tsc_now_ns;
+        g_ops.cycles = tsc_cycles;
+        g_ops.cycles_to_ns = tsc_to_ns;
+    }
+#endif
+}
+
+void host_clock_init(void)
+{
+    pthread_once(&g_clock_once, clock_init_once);
+}
+
+host_clock_source_t host_clock_source(void)
+{
+    host_clock_init();
+    return g_source;
+}
+
+const char *host_clock_source_name(host_clock_source_t source)
+{
+    switch (source) {
+    case HOST_CLOCK_SOURCE_TSC:
+        return "tsc";
+    case HOST_CLOCK_SOURCE_VDSO:
+        return "vdso";
+    default:
+        return "unknown";
+    }
+}
+
+uint64_t host_clock_tsc_hz(void)
+{
+    host_clock_init();
+    return g_tsc_hz;
+}
+
+const module_clock_ops_t *host_clock_ops(void)
+{
+    host_clock_init();
+    return &g_ops;
+}
+
+int host_clock_get_time(struct timespec *ts)
+{
+    if (ts == NULL) {
+        return -1;
+    }
+    return (clock_gettime(CLOCK_MONOTONIC, ts) == 0) ? 0 : -1;
+}
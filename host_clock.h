@@ -0,0 +1,59 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include "module_interface.h"
+#include <stdint.h>
+#include <time.h>
+
+/* length of the TSC calibration against CLOCK_MONOTONIC_RAW */
+#define HOST_CLOCK_CALIBRATE_MS 20U
+
+/* where now_ns and cycles come from */
+typedef enum {
+    HOST_CLOCK_SOURCE_VDSO = 0,
+    HOST_CLOCK_SOURCE_TSC
+} host_clock_source_t;
+
+/**
+ * pick the clock source once, calibrating the TSC when it is invariant
+ * and the kernel trusts it; later calls return immediately
+ */
+void host_clock_init(void);
+
+/**
+ * @return clock source chosen by host_clock_init
+ */
+host_clock_source_t host_clock_source(void);
+
+/**
+ * @param source clock source
+ * @return printable name of the source
+ */
+const char *host_clock_source_name(host_clock_source_t source);
+
+/**
+ * @return calibrated TSC frequency in Hz, 0 when the TSC is not used
+ */
+uint64_t host_clock_tsc_hz(void);
+
+/**
+ * initializes the clock on first use
+ * @return table handed to modules in module_init_args_t.clock
+ */
+const module_clock_ops_t *host_clock_ops(void);
+
+/**
+ * module_init_args_t.get_time, CLOCK_MONOTONIC as modules always got it;
+ * the fast clock is only offered through module_init_args_t.clock
+ * @param ts output time
+ * @return 0 on success, -1 on error
+ */
+int host_clock_get_time(struct timespec *ts);
+
+/**
+ * fine clock through the vDSO whatever the source, for comparison
+ * @return CLOCK_MONOTONIC_RAW in nanoseconds
+ */
+uint64_t host_clock_vdso_ns(void);
+
+#endif /* HOST_CLOCK_H */
@@ -0,0 +1,749 @@
+#include "host_pool.h"
+#include "module_error.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* initial deque capacity, grows by doubling */
+#define DEQUE_INITIAL_SLOTS 16U
+/* parallel_for chunks per worker when the module passes grain 0 */
+#define PFOR_CHUNKS_PER_THREAD 4U
+
+typedef struct pool_task {
+    struct pool_task *next;
+    module_task_fn fn;
+    void *arg;
+    /* called instead of fn when the task is dropped, may be NULL */
+    void (*cancel)(void *arg);
+    /* called after fn was left through host_pool_abandon_task(), may be NULL */
+    void (*abandon)(void *arg);
+} pool_task_t;
+
+/*
+ * a client is scheduled through tokens: each token in a worker deque is
+ * the right to run one task of the client, at most max_concurrency tokens
+ * exist, so the cap holds without workers ever blocking on a client
+ */
+struct host_pool_client {
+    host_pool_t *pool;
+    module_pool_ops_t ops;
+    /* opaque tag of the module the tasks belong to, see host_pool_current_owner() */
+    void *owner;
+    pthread_mutex_t lock;
+    /* signalled when running drops to 0 */
+    pthread_cond_t idle;
+    pool_task_t *head;
+    pool_task_t *tail;
+    uint32_t max_concurrency;
+    uint32_t tokens;
+    uint32_t running;
+    bool closing;
+    /* freed by the last token when destroyed with tokens outstanding */
+    bool destroyed;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t cancelled;
+    uint64_t abandoned;
+};
+
+/* ring of client tokens, the owner pops the back, thieves the front */
+typedef struct {
+    pthread_mutex_t lock;
+    host_pool_client_t **slots;
+    size_t cap;
+    size_t head;
+    size_t count;
+} worker_deque_t;
+
+struct host_pool {
+    uint32_t threads;
+    pthread_t *tids;
+    worker_deque_t *deques;
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    /* tokens sitting in deques, read by idle workers before sleeping */
+    atomic_size_t queued;
+    atomic_uint next_deque;
+    bool stop;
+};
+
+typedef struct {
+    host_pool_t *pool;
+    uint32_t index;
+} worker_arg_t;
+
+/* the pool and deque of the calling worker, submissions stay local */
+static _Thread_local host_pool_t *t_pool;
+static _Thread_local uint32_t t_worker;
+/* set while a worker runs a task, the jump target of host_pool_abandon_task() */
+static _Thread_local sigjmp_buf t_task_jmp;
+static _Thread_local volatile sig_atomic_t t_in_task;
+/* owner of the client whose task runs on this worker */
+static _Thread_local void *volatile t_task_owner;
+
+static int deque_push(worker_deque_t *dq, host_pool_client_t *client, bool front)
+{
+    host_pool_client_t **slots;
+    size_t cap;
+    size_t i;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        cap = (dq->cap == 0U) ? DEQUE_INITIAL_SLOTS : dq->cap * 2U;
+        slots = malloc(cap * sizeof(*slots));
+        if (slots == NULL) {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (i = 0U; i < dq->count; i++) {
+            slots[i] = dq->slots[(dq->head + i) % dq->cap];
+        }
+        free(dq->slots);
+        dq->slots = slots;
+        dq->cap = cap;
+        dq->head = 0U;
+    }
+    if (front) {
+        dq->head = (dq->head + dq->cap - 1U) % dq->cap;
+        dq->slots[dq->head] = client;
+    } else {
+        dq->slots[(dq->head + dq->count) % dq->cap] = client;
+    }
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static host_pool_client_t *deque_pop(worker_deque_t *dq, bool front)
+{
+    host_pool_client_t *client = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0U) {
+        if (front) {
+            client = dq->slots[dq->head];
+            dq->head = (dq->head + 1U) % dq->cap;
+        } else {
+            client = dq->slots[(dq->head + dq->count - 1U) % dq->cap];
+        }
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return client;
+}
+
+static void free_client(host_pool_client_t *client)
+{
+    pthread_cond_destroy(&client->idle);
+    pthread_mutex_destroy(&client->lock);
+    free(client);
+}
+
+/* give a token back, called with client->lock held, true if the client must be freed */
+static bool drop_token_locked(host_pool_client_t *client)
+{
+    client->tokens--;
+    return client->tokens == 0U && client->destroyed;
+}
+
+/*
+ * put a token of the client into a deque and wake a worker
+ * requeued tokens go to the front, behind the work of other clients
+ */
+static void schedule(host_pool_t *pool, host_pool_client_t *client, bool requeue)
+{
+    uint32_t index;
+    bool release;
+
+    if (t_pool == pool) {
+        index = t_worker;
+    } else {
+        index = atomic_fetch_add_explicit(&pool->next_deque, 1U, memory_order_relaxed) %
+                pool->threads;
+    }
+
+    if (deque_push(&pool->deques[index], client, requeue) != 0) {
+        /* out of memory: the token is lost, the next submit schedules a new one */
+        pthread_mutex_lock(&client->lock);
+        release = drop_token_locked(client);
+        pthread_mutex_unlock(&client->lock);
+        if (release) {
+            free_client(client);
+        }
+        return;
+    }
+
+    atomic_fetch_add(&pool->queued, 1U);
+    pthread_mutex_lock(&pool->wake_lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->wake_lock);
+}
+
+/* own deque first, newest token first, then steal the oldest from the others */
+static host_pool_client_t *take(host_pool_t *pool, uint32_t self)
+{
+    host_pool_client_t *client;
+    uint32_t i;
+
+    client = deque_pop(&pool->deques[self], false);
+    for (i = 1U; client == NULL && i < pool->threads; i++) {
+        client = deque_pop(&pool->deques[(self + i) % pool->threads], true);
+    }
+    if (client != NULL) {
+        atomic_fetch_sub(&pool->queued, 1U);
+    }
+    return client;
+}
+
+/* false when the task was abandoned from a signal handler */
+static bool run_task(const pool_task_t *task)
+{
+    if (sigsetjmp(t_task_jmp, 1) != 0) {
+        t_in_task = 0;
+        if (task->abandon != NULL) {
+            task->abandon(task->arg);
+        }
+        return false;
+    }
+    t_in_task = 1;
+    task->fn(task->arg);
+    t_in_task = 0;
+    return true;
+}
+
+/* run one task of the client with its token, then pass the token on or drop it */
+static void run_token(host_pool_t *pool, host_pool_client_t *client)
+{
+    pool_task_t *task = NULL;
+    bool completed;
+    bool release;
+
+    pthread_mutex_lock(&client->lock);
+    if (!client->closing && client->head != NULL) {
+        task = client->head;
+        client->head = task->next;
+        if (client->head == NULL) {
+            client->tail = NULL;
+        }
+        client->running++;
+    }
+    if (task == NULL) {
+        release = drop_token_locked(client);
+        pthread_mutex_unlock(&client->lock);
+        if (release) {
+            free_client(client);
+        }
+        return;
+    }
+    pthread_mutex_unlock(&client->lock);
+
+    t_task_owner = client->owner;
+    completed = run_task(task);
+    t_task_owner = NULL;
+    free(task);
+
+    pthread_mutex_lock(&client->lock);
+    client->running--;
+    if (completed) {
+        client->completed++;
+    } else {
+        client->abandoned++;
+    }
+    if (client->running == 0U) {
+        pthread_cond_broadcast(&client->idle);
+    }
+    if (!client->closing && client->head != NULL) {
+        pthread_mutex_unlock(&client->lock);
+        schedule(pool, client, true);
+        return;
+    }
+    release = drop_token_locked(client);
+    pthread_mutex_unlock(&client->lock);
+    if (release) {
+        free_client(client);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    worker_arg_t *wa = arg;
+    host_pool_t *pool = wa->pool;
+    host_pool_client_t *client;
+    bool stop;
+
+    t_pool = pool;
+    t_worker = wa->index;
+    free(wa);
+
+    for (;;) {
+        client = take(pool, t_worker);
+        if (client != NULL) {
+            run_token(pool, client);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->wake_lock);
+        while (atomic_load(&pool->queued) == 0U && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->wake_lock);
+        }
+        stop = pool->stop && atomic_load(&pool->queued) == 0U;
+        pthread_mutex_unlock(&pool->wake_lock);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int submit_task(host_pool_client_t *client, module_task_fn fn, void *arg,
+        void (*cancel)(void *), void (*abandon)(void *))
+{
+    pool_task_t *task;
+    bool start;
+
+    if (fn == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    task = malloc(sizeof(*task));
+    if (task == NULL) {
+        return MODULE_ERR_MEMORY;
+    }
+    task->next = NULL;
+    task->fn = fn;
+    task->arg = arg;
+    task->cancel = cancel;
+    task->abandon = abandon;
+
+    pthread_mutex_lock(&client->lock);
+    if (client->closing) {
+        pthread_mutex_unlock(&client->lock);
+        free(task);
+        return MODULE_ERR_NOT_LOADED;
+    }
+    if (client->tail != NULL) {
+        client->tail->next = task;
+    } else {
+        client->head = task;
+    }
+    client->tail = task;
+    client->submitted++;
+    start = client->tokens < client->max_concurrency;
+    if (start) {
+        client->tokens++;
+    }
+    pthread_mutex_unlock(&client->lock);
+
+    if (start) {
+        schedule(client->pool, client, false);
+    }
+    return MODULE_ERR_SUCCESS;
+}
+
+static int pool_submit(void *ctx, module_task_fn fn, void *arg)
+{
+    if (ctx == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    return submit_task(ctx, fn, arg, NULL, NULL);
+}
+
+int host_pool_client_submit(host_pool_client_t *client, module_task_fn fn, void *arg,
+        void (*cancel)(void *arg))
+{
+    if (client == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    return submit_task(client, fn, arg, cancel, NULL);
+}
+
+void host_pool_abandon_task(void)
+{
+    if (t_in_task != 0) {
+        siglongjmp(t_task_jmp, 1);
+    }
+}
+
+void *host_pool_current_owner(void)
+{
+    return (t_in_task != 0) ? t_task_owner : NULL;
+}
+
+/*
+ * parallel_for: the caller and up to max_concurrency helpers claim chunks
+ * through one atomic index, the job lives until the last of them lets go
+ */
+typedef struct {
+    atomic_size_t next_chunk;
+    atomic_uint refs;
+    size_t chunks;
+    size_t n;
+    size_t grain;
+    module_range_fn fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    size_t done;
+    /* a chunk was abandoned, guarded by lock */
+    bool failed;
+} pfor_job_t;
+
+static void pfor_put(pfor_job_t *job)
+{
+    if (atomic_fetch_sub(&job->refs, 1U) == 1U) {
+        pthread_cond_destroy(&job->done_cond);
+        pthread_mutex_destroy(&job->lock);
+        free(job);
+    }
+}
+
+static void pfor_run(pfor_job_t *job)
+{
+    size_t chunk;
+    size_t begin;
+    size_t end;
+
+    for (;;) {
+        chunk = atomic_fetch_add(&job->next_chunk, 1U);
+        if (chunk >= job->chunks) {
+            break;
+        }
+        begin = chunk * job->grain;
+        end = (job->n - begin < job->grain) ? job->n : begin + job->grain;
+        job->fn(job->arg, begin, end);
+
+        pthread_mutex_lock(&job->lock);
+        if (++job->done == job->chunks) {
+            pthread_cond_signal(&job->done_cond);
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+static void pfor_task(void *arg)
+{
+    pfor_run(arg);
+    pfor_put(arg);
+}
+
+static void pfor_cancel(void *arg)
+{
+    pfor_put(arg);
+}
+
+/*
+ * a chunk faulted in module code on a helper: count it as done and hand
+ * out no more chunks, so the caller wakes up instead of waiting forever
+ */
+static void pfor_abandon(void *arg)
+{
+    pfor_job_t *job = arg;
+    size_t claimed;
+
+    claimed = atomic_exchange(&job->next_chunk, job->chunks);
+    pthread_mutex_lock(&job->lock);
+    job->failed = true;
+    job->done += 1U + ((claimed < job->chunks) ? job->chunks - claimed : 0U);
+    if (job->done >= job->chunks) {
+        pthread_cond_signal(&job->done_cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+    pfor_put(job);
+}
+
+static int pool_parallel_for(void *ctx, size_t n, size_t grain, module_range_fn fn, void *arg)
+{
+    host_pool_client_t *client = ctx;
+    pfor_job_t *job;
+    size_t helpers;
+    size_t i;
+    bool failed;
+
+    if (client == NULL || fn == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    if (n == 0U) {
+        return MODULE_ERR_SUCCESS;
+    }
+
+    if (grain == 0U) {
+        grain = n / ((size_t)client->pool->threads * PFOR_CHUNKS_PER_THREAD);
+        grain = (grain == 0U) ? 1U : grain;
+    }
+
+    job = calloc(1U, sizeof(*job));
+    if (job == NULL) {
+        return MODULE_ERR_MEMORY;
+    }
+    job->chunks = n / grain + ((n % grain != 0U) ? 1U : 0U);
+    job->n = n;
+    job->grain = grain;
+    job->fn = fn;
+    job->arg = arg;
+    job->done = 0U;
+    atomic_init(&job->next_chunk, 0U);
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->done_cond, NULL);
+
+    /* the caller works too, so one chunk fewer helpers than chunks */
+    helpers = job->chunks - 1U;
+    if (helpers > client->max_concurrency) {
+        helpers = client->max_concurrency;
+    }
+    if (helpers > client->pool->threads) {
+        helpers = client->pool->threads;
+    }
+
+    /* a dropped helper only gives back its reference, the caller covers its chunks */
+    atomic_init(&job->refs, (unsigned int)(1U + helpers));
+    for (i = 0U; i < helpers; i++) {
+        if (submit_task(client, pfor_task, job, pfor_cancel, pfor_abandon) !=
+                MODULE_ERR_SUCCESS) {
+            pfor_put(job);
+        }
+    }
+
+    pfor_run(job);
+
+    pthread_mutex_lock(&job->lock);
+    while (job->done < job->chunks) {
+        pthread_cond_wait(&job->done_cond, &job->lock);
+    }
+    failed = job->failed;
+    pthread_mutex_unlock(&job->lock);
+
+    pfor_put(job);
+    return failed ? MODULE_ERR_CRASHED : MODULE_ERR_SUCCESS;
+}
+
+static uint32_t pool_concurrency(void *ctx)
+{
+    host_pool_client_t *client = ctx;
+
+    if (client == NULL) {
+        return 0U;
+    }
+    return (client->max_concurrency < client->pool->threads) ? client->max_concurrency :
+            client->pool->threads;
+}
+
+/* join the first started workers and free the pool */
+static void stop_pool(host_pool_t *pool, uint32_t started)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&pool->wake_lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->wake_lock);
+
+    for (i = 0U; i < started; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+    for (i = 0U; i < pool->threads; i++) {
+        free(pool->deques[i].slots);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->wake_lock);
+    free(pool->deques);
+    free(pool->tids);
+    free(pool);
+}
+
+host_pool_t *host_pool_create(uint32_t threads)
+{
+    host_pool_t *pool;
+    worker_arg_t *wa;
+    long online;
+    uint32_t i;
+
+    if (threads == 0U) {
+        online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? (uint32_t)online : 1U;
+    }
+    if (threads > HOST_POOL_MAX_THREADS) {
+        threads = HOST_POOL_MAX_THREADS;
+    }
+
+    pool = calloc(1U, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->tids = calloc(threads, sizeof(*pool->tids));
+    pool->deques = calloc(threads, sizeof(*pool->deques));
+    if (pool->tids == NULL || pool->deques == NULL) {
+        free(pool->tids);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->wake_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    atomic_init(&pool->queued, 0U);
+    atomic_init(&pool->next_deque, 0U);
+    pool->stop = false;
+    for (i = 0U; i < threads; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+    /* workers index the deques with pool->threads, set it before they start */
+    pool->threads = threads;
+
+    for (i = 0U; i < threads; i++) {
+        wa = malloc(sizeof(*wa));
+        if (wa != NULL) {
+            wa->pool = pool;
+            wa->index = i;
+        }
+        if (wa == NULL || pthread_create(&pool->tids[i], NULL, worker_main, wa) != 0) {
+            free(wa);
+            stop_pool(pool, i);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void host_pool_destroy(host_pool_t *pool)
+{
+    if (pool != NULL) {
+        stop_pool(pool, pool->threads);
+    }
+}
+
+uint32_t host_pool_threads(const host_pool_t *pool)
+{
+    return (pool != NULL) ? pool->threads : 0U;
+}
+
+host_pool_client_t *host_pool_client_create(host_pool_t *pool, uint32_t max_concurrency)
+{
+    host_pool_client_t *client;
+
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    client = calloc(1U, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->idle, NULL);
+    client->pool = pool;
+    client->max_concurrency = (max_concurrency == 0U) ? UINT32_MAX : max_concurrency;
+    client->ops.ctx = client;
+    client->ops.submit = pool_submit;
+    client->ops.parallel_for = pool_parallel_for;
+    client->ops.concurrency = pool_concurrency;
+    return client;
+}
+
+void host_pool_client_set_owner(host_pool_client_t *client, void *owner)
+{
+    if (client != NULL) {
+        client->owner = owner;
+    }
+}
+
+const module_pool_ops_t *host_pool_client_ops(host_pool_client_t *client)
+{
+    return (client != NULL) ? &client->ops : NULL;
+}
+
+bool host_pool_client_close(host_pool_client_t *client, uint32_t timeout_ms)
+{
+    struct timespec deadline;
+    pool_task_t *task;
+    pool_task_t *next;
+    bool idle;
+
+    if (client == NULL) {
+        return true;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    client->closing = true;
+    task = client->head;
+    client->head = NULL;
+    client->tail = NULL;
+    pthread_mutex_unlock(&client->lock);
+
+    /* queued tasks never run, their tokens are dropped by the workers */
+    for (; task != NULL; task = next) {
+        next = task->next;
+        if (task->cancel != NULL) {
+            task->cancel(task->arg);
+        }
+        free(task);
+        pthread_mutex_lock(&client->lock);
+        client->cancelled++;
+        pthread_mutex_unlock(&client->lock);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(timeout_ms / 1000U);
+    deadline.tv_nsec += (long)(timeout_ms % 1000U) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    while (client->running != 0U) {
+        if (timeout_ms == 0U) {
+            pthread_cond_wait(&client->idle, &client->lock);
+        } else if (pthread_cond_timedwait(&client->idle, &client->lock, &deadline) ==
+                ETIMEDOUT) {
+            break;
+        }
+    }
+    idle = client->running == 0U;
+    pthread_mutex_unlock(&client->lock);
+    return idle;
+}
+
+void host_pool_client_destroy(host_pool_client_t *client)
+{
+    bool release;
+
+    if (client == NULL) {
+        return;
+    }
+
+    /* tokens still in deques hold the client, the last one frees it */
+    pthread_mutex_lock(&client->lock);
+    client->closing = true;
+    client->destroyed = true;
+    release = client->tokens == 0U;
+    pthread_mutex_unlock(&client->lock);
+    if (release) {
+        free_client(client);
+    }
+}
+
+void host_pool_client_get_stats(host_pool_client_t *client, host_pool_client_stats_t *stats)
+{
+    if (client == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    stats->submitted = client->submitted;
+    stats->completed = client->completed;
+    stats->cancelled = client->cancelled;
+    stats->abandoned = client->abandoned;
+    stats->running = client->running;
+    pthread_mutex_unlock(&client->lock);
+}
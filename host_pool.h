@@ -0,0 +1,122 @@
+#ifndef HOST_POOL_H
+#define HOST_POOL_H
+
+#include "module_interface.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* upper bound for host_pool_create threads */
+#define HOST_POOL_MAX_THREADS 256U
+/* per-module cap used by the daemon */
+#define HOST_POOL_DEFAULT_MODULE_CONCURRENCY 4U
+
+struct host_pool;
+struct host_pool_client;
+
+typedef struct host_pool host_pool_t;
+/* one module's view of the pool, owns its queued tasks */
+typedef struct host_pool_client host_pool_client_t;
+
+/* counters of one client */
+typedef struct {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t cancelled;
+    /* tasks left through host_pool_abandon_task() */
+    uint64_t abandoned;
+    uint32_t running;
+} host_pool_client_stats_t;
+
+/**
+ * start a work-stealing pool
+ * every worker owns a deque of clients with queued work and steals from
+ * the others when its own is empty
+ * @param threads worker count, 0 for the number of online cpus
+ * @return pool or NULL on error
+ */
+host_pool_t *host_pool_create(uint32_t threads);
+
+/**
+ * stop and join the workers, all clients must be closed before
+ * @param pool pool or NULL
+ */
+void host_pool_destroy(host_pool_t *pool);
+
+/**
+ * @param pool pool instance
+ * @return worker count
+ */
+uint32_t host_pool_threads(const host_pool_t *pool);
+
+/**
+ * create a client for one module
+ * @param pool pool instance
+ * @param max_concurrency most tasks of the client running at once, 0 for no cap
+ * @return client or NULL on error
+ */
+host_pool_client_t *host_pool_client_create(host_pool_t *pool, uint32_t max_concurrency);
+
+/**
+ * tag the tasks of a client with the module they run for
+ * set before the client is handed out
+ * @param client client instance
+ * @param owner opaque tag returned by host_pool_current_owner()
+ */
+void host_pool_client_set_owner(host_pool_client_t *client, void *owner);
+
+/**
+ * @param client client instance
+ * @return table handed to the module in module_init_args_t.pool
+ */
+const module_pool_ops_t *host_pool_client_ops(host_pool_client_t *client);
+
+/**
+ * queue a task from the host side, for services built on the pool
+ * @param client client instance
+ * @param fn task
+ * @param arg task argument
+ * @param cancel called with arg instead of fn if the task is dropped, or NULL
+ * @return error code, MODULE_ERR_NOT_LOADED once the client is closing
+ */
+int host_pool_client_submit(host_pool_client_t *client, module_task_fn fn, void *arg,
+        void (*cancel)(void *arg));
+
+/**
+ * leave the task running on the calling worker, async-signal-safe
+ * meant for fatal signal handlers: a worker that faulted inside module code
+ * jumps back to its loop instead of faulting again
+ * @return only when the caller is not inside a pool task
+ */
+void host_pool_abandon_task(void);
+
+/**
+ * owner of the task running on the calling worker, async-signal-safe
+ * lets a fatal signal handler blame a module whose task faulted in libc
+ * @return tag from host_pool_client_set_owner(), NULL outside a pool task
+ */
+void *host_pool_current_owner(void);
+
+/**
+ * refuse new work, drop queued tasks and wait for running ones
+ * must not be called from a task of the same client
+ * @param client client instance
+ * @param timeout_ms give up after this long, 0 waits forever
+ * @return true when no task of the client is running anymore
+ */
+bool host_pool_client_close(host_pool_client_t *client, uint32_t timeout_ms);
+
+/**
+ * free a closed client
+ * tokens still queued keep it alive, the worker dropping the last one frees it
+ * @param client client or NULL
+ */
+void host_pool_client_destroy(host_pool_client_t *client);
+
+/**
+ * @param client client instance
+ * @param stats output counters
+ */
+void host_pool_client_get_stats(host_pool_client_t *client, host_pool_client_stats_t *stats);
+
+#endif /* HOST_POOL_H */
@@ -0,0 +1,603 @@
+#include "host_reactor.h"
+#include "module_error.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* initial registration table size, grows by doubling */
+#define REG_TABLE_INITIAL 64U
+/* ids carry a 31 bit generation above the table index, so they stay positive */
+#define REG_GENERATION_MASK 0x7fffffffU
+/* epoll data of the internal wakeup eventfd, never a valid registration id */
+#define REACTOR_WAKE_ID 0U
+
+typedef struct registration {
+    /* registrations of the same client */
+    struct registration *client_next;
+    struct registration *client_prev;
+    host_reactor_t *reactor;
+    host_reactor_client_t *client;
+    module_io_fn fn;
+    void *arg;
+    int fd;
+    /* MODULE_IO_* bits the module asked for */
+    uint32_t events;
+    /* MODULE_IO_* bits reported by epoll, handed to the next callback */
+    uint32_t ready;
+    uint32_t index;
+    uint32_t generation;
+    /* callbacks queued or running on the pool */
+    uint32_t dispatched;
+    /* the fd is an eventfd created by add_event, closed with the entry */
+    bool owned;
+    /* not removed yet */
+    bool live;
+} registration_t;
+
+struct host_reactor_client {
+    host_reactor_t *reactor;
+    host_pool_client_t *pool;
+    module_reactor_ops_t ops;
+    registration_t *regs;
+    bool closing;
+};
+
+struct host_reactor {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int epfd;
+    /* wakes the reactor thread for shutdown */
+    int wakefd;
+    bool stop;
+    /*
+     * live entries by index, epoll carries the id so an event for a removed
+     * registration never reaches a reused entry
+     */
+    registration_t **table;
+    uint32_t *generations;
+    uint32_t *free_list;
+    uint32_t free_count;
+    uint32_t table_size;
+    host_reactor_stats_t stats;
+};
+
+static uint64_t reg_id(const registration_t *reg)
+{
+    /* index + 1, so that 0 stays free for the wakeup fd */
+    return ((uint64_t)reg->generation << 32) | ((uint64_t)reg->index + 1U);
+}
+
+/* live registration of the id, called with the lock held */
+static registration_t *lookup(host_reactor_t *reactor, uint64_t id)
+{
+    uint32_t index = (uint32_t)(id & 0xffffffffU);
+    uint32_t generation = (uint32_t)(id >> 32);
+    registration_t *reg;
+
+    if (index == 0U || index > reactor->table_size) {
+        return NULL;
+    }
+    index--;
+    if (reactor->generations[index] != generation) {
+        return NULL;
+    }
+    reg = reactor->table[index];
+    return (reg != NULL && reg->live) ? reg : NULL;
+}
+
+static uint32_t to_epoll(uint32_t events)
+{
+    uint32_t ep = EPOLLONESHOT;
+
+    if ((events & MODULE_IO_READ) != 0U) {
+        ep |= EPOLLIN;
+    }
+    if ((events & MODULE_IO_WRITE) != 0U) {
+        ep |= EPOLLOUT;
+    }
+    return ep;
+}
+
+static uint32_t from_epoll(uint32_t ep)
+{
+    uint32_t events = 0U;
+
+    if ((ep & EPOLLIN) != 0U) {
+        events |= MODULE_IO_READ;
+    }
+    if ((ep & EPOLLOUT) != 0U) {
+        events |= MODULE_IO_WRITE;
+    }
+    if ((ep & (EPOLLERR | EPOLLHUP)) != 0U) {
+        events |= MODULE_IO_ERROR;
+    }
+    return events;
+}
+
+/* one-shot arm, so a registration has at most one callback in flight */
+static int epoll_arm(host_reactor_t *reactor, registration_t *reg, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll(reg->events);
+    ev.data.u64 = reg_id(reg);
+    return epoll_ctl(reactor->epfd, op, reg->fd, &ev);
+}
+
+static void client_unlink(registration_t *reg)
+{
+    if (reg->client == NULL) {
+        return;
+    }
+    if (reg->client_prev != NULL) {
+        reg->client_prev->client_next = reg->client_next;
+    } else {
+        reg->client->regs = reg->client_next;
+    }
+    if (reg->client_next != NULL) {
+        reg->client_next->client_prev = reg->client_prev;
+    }
+    reg->client_next = NULL;
+    reg->client_prev = NULL;
+    reg->client = NULL;
+}
+
+/* free an entry nobody refers to anymore, called with the lock held */
+static void maybe_free(host_reactor_t *reactor, registration_t *reg)
+{
+    if (reg->live || reg->dispatched != 0U) {
+        return;
+    }
+    if (reg->owned) {
+        close(reg->fd);
+    }
+    reactor->table[reg->index] = NULL;
+    reactor->generations[reg->index] =
+            (reactor->generations[reg->index] + 1U) & REG_GENERATION_MASK;
+    reactor->free_list[reactor->free_count++] = reg->index;
+    free(reg);
+}
+
+/* take the registration out of epoll for good, called with the lock held */
+static void kill_registration(host_reactor_t *reactor, registration_t *reg)
+{
+    reg->live = false;
+    /* fails harmlessly when the module already closed its fd */
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, reg->fd, NULL);
+    client_unlink(reg);
+    reactor->stats.removed++;
+    reactor->stats.registered--;
+    maybe_free(reactor, reg);
+}
+
+static void io_task(void *arg)
+{
+    registration_t *reg = arg;
+    host_reactor_t *reactor = reg->reactor;
+    module_io_fn fn;
+    void *fn_arg;
+    uint64_t value;
+    uint32_t events;
+    bool run;
+
+    pthread_mutex_lock(&reactor->lock);
+    run = reg->live;
+    events = reg->ready;
+    reg->ready = 0U;
+    fn = reg->fn;
+    fn_arg = reg->arg;
+    pthread_mutex_unlock(&reactor->lock);
+
+    if (run) {
+        /* reset the eventfd counter, notifications before this point are merged */
+        if (reg->owned && read(reg->fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            events |= MODULE_IO_ERROR;
+        }
+        fn(fn_arg, reg->fd, events);
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    reg->dispatched--;
+    if (reg->live) {
+        epoll_arm(reactor, reg, EPOLL_CTL_MOD);
+    }
+    maybe_free(reactor, reg);
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+static void io_cancel(void *arg)
+{
+    registration_t *reg = arg;
+    host_reactor_t *reactor = reg->reactor;
+
+    pthread_mutex_lock(&reactor->lock);
+    reg->dispatched--;
+    maybe_free(reactor, reg);
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+static void *reactor_thread(void *arg)
+{
+    host_reactor_t *reactor = arg;
+    struct epoll_event events[HOST_REACTOR_MAX_EVENTS];
+    registration_t *reg;
+    int n;
+    int i;
+
+    for (;;) {
+        n = epoll_wait(reactor->epfd, events, (int)HOST_REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        pthread_mutex_lock(&reactor->lock);
+        if (reactor->stop) {
+            pthread_mutex_unlock(&reactor->lock);
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (events[i].data.u64 == REACTOR_WAKE_ID) {
+                continue;
+            }
+            reg = lookup(reactor, events[i].data.u64);
+            if (reg == NULL) {
+                continue;
+            }
+            reg->ready |= from_epoll(events[i].events);
+            reg->dispatched++;
+            reactor->stats.dispatched++;
+            if (host_pool_client_submit(reg->client->pool, io_task, reg, io_cancel) !=
+                    MODULE_ERR_SUCCESS) {
+                reg->dispatched--;
+            }
+        }
+        pthread_mutex_unlock(&reactor->lock);
+    }
+    return NULL;
+}
+
+static void close_fds(host_reactor_t *reactor)
+{
+    if (reactor->epfd >= 0) {
+        close(reactor->epfd);
+    }
+    if (reactor->wakefd >= 0) {
+        close(reactor->wakefd);
+    }
+}
+
+host_reactor_t *host_reactor_create(void)
+{
+    host_reactor_t *reactor;
+    struct epoll_event ev;
+
+    reactor = calloc(1U, sizeof(*reactor));
+    if (reactor == NULL) {
+        return NULL;
+    }
+
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wakefd = eventfd(0U, EFD_CLOEXEC | EFD_NONBLOCK);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = REACTOR_WAKE_ID;
+    if (reactor->epfd < 0 || reactor->wakefd < 0 ||
+            epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakefd, &ev) != 0) {
+        close_fds(reactor);
+        free(reactor);
+        return NULL;
+    }
+
+    pthread_mutex_init(&reactor->lock, NULL);
+    reactor->stop = false;
+    if (pthread_create(&reactor->thread, NULL, reactor_thread, reactor) != 0) {
+        pthread_mutex_destroy(&reactor->lock);
+        close_fds(reactor);
+        free(reactor);
+        return NULL;
+    }
+    return reactor;
+}
+
+void host_reactor_destroy(host_reactor_t *reactor)
+{
+    uint64_t one = 1U;
+    uint32_t i;
+
+    if (reactor == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    reactor->stop = true;
+    pthread_mutex_unlock(&reactor->lock);
+    if (write(reactor->wakefd, &one, sizeof(one)) < 0) {
+        /* the counter is already non-zero, the thread wakes anyway */
+    }
+    pthread_join(reactor->thread, NULL);
+
+    for (i = 0U; i < reactor->table_size; i++) {
+        if (reactor->table[i] != NULL && reactor->table[i]->owned) {
+            close(reactor->table[i]->fd);
+        }
+        free(reactor->table[i]);
+    }
+    free(reactor->table);
+    free(reactor->generations);
+    free(reactor->free_list);
+    close_fds(reactor);
+    pthread_mutex_destroy(&reactor->lock);
+    free(reactor);
+}
+
+void host_reactor_get_stats(host_reactor_t *reactor, host_reactor_stats_t *stats)
+{
+    if (reactor == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    *stats = reactor->stats;
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+/* double the entry table, called with the lock held */
+static int grow_table(host_reactor_t *reactor)
+{
+    uint32_t size = (reactor->table_size == 0U) ? REG_TABLE_INITIAL : reactor->table_size * 2U;
+    registration_t **table;
+    uint32_t *generations;
+    uint32_t *free_list;
+    uint32_t i;
+
+    table = realloc(reactor->table, size * sizeof(*table));
+    if (table == NULL) {
+        return -1;
+    }
+    reactor->table = table;
+    generations = realloc(reactor->generations, size * sizeof(*generations));
+    if (generations == NULL) {
+        return -1;
+    }
+    reactor->generations = generations;
+    free_list = realloc(reactor->free_list, size * sizeof(*free_list));
+    if (free_list == NULL) {
+        return -1;
+    }
+    reactor->free_list = free_list;
+
+    for (i = reactor->table_size; i < size; i++) {
+        reactor->table[i] = NULL;
+        reactor->generations[i] = 1U;
+    }
+    for (i = size; i > reactor->table_size; i--) {
+        reactor->free_list[reactor->free_count++] = i - 1U;
+    }
+    reactor->table_size = size;
+    return 0;
+}
+
+static int64_t add_registration(host_reactor_client_t *client, int fd, uint32_t events,
+        bool owned, module_io_fn fn, void *arg)
+{
+    host_reactor_t *reactor;
+    registration_t *reg;
+    int64_t id;
+
+    if (client == NULL || fn == NULL || fd < 0 ||
+            (events & ~(MODULE_IO_READ | MODULE_IO_WRITE)) != 0U) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    reactor = client->reactor;
+
+    reg = calloc(1U, sizeof(*reg));
+    if (reg == NULL) {
+        return MODULE_ERR_MEMORY;
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    if (client->closing) {
+        pthread_mutex_unlock(&reactor->lock);
+        free(reg);
+        return MODULE_ERR_NOT_LOADED;
+    }
+    if (reactor->free_count == 0U && grow_table(reactor) != 0) {
+        pthread_mutex_unlock(&reactor->lock);
+        free(reg);
+        return MODULE_ERR_MEMORY;
+    }
+
+    reg->index = reactor->free_list[reactor->free_count - 1U];
+    reg->generation = reactor->generations[reg->index];
+    reg->reactor = reactor;
+    reg->fn = fn;
+    reg->arg = arg;
+    reg->fd = fd;
+    reg->events = events;
+    reg->owned = owned;
+    reg->live = true;
+
+    if (epoll_arm(reactor, reg, EPOLL_CTL_ADD) != 0) {
+        pthread_mutex_unlock(&reactor->lock);
+        free(reg);
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    reactor->free_count--;
+    reactor->table[reg->index] = reg;
+
+    reg->client = client;
+    reg->client_next = client->regs;
+    if (reg->client_next != NULL) {
+        reg->client_next->client_prev = reg;
+    }
+    client->regs = reg;
+
+    reactor->stats.added++;
+    reactor->stats.registered++;
+    id = (int64_t)reg_id(reg);
+    pthread_mutex_unlock(&reactor->lock);
+    return id;
+}
+
+static int64_t reactor_add(void *ctx, int fd, uint32_t events, module_io_fn fn, void *arg)
+{
+    return add_registration(ctx, fd, events, false, fn, arg);
+}
+
+static int64_t reactor_add_event(void *ctx, module_io_fn fn, void *arg)
+{
+    int64_t id;
+    int fd;
+
+    fd = eventfd(0U, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0) {
+        return MODULE_ERR_MEMORY;
+    }
+    id = add_registration(ctx, fd, MODULE_IO_READ, true, fn, arg);
+    if (id < 0) {
+        close(fd);
+    }
+    return id;
+}
+
+/* live registration of the client, called with the lock held */
+static registration_t *client_lookup(host_reactor_client_t *client, int64_t id)
+{
+    registration_t *reg;
+
+    if (id <= 0) {
+        return NULL;
+    }
+    reg = lookup(client->reactor, (uint64_t)id);
+    return (reg != NULL && reg->client == client) ? reg : NULL;
+}
+
+static int reactor_modify(void *ctx, int64_t id, uint32_t events)
+{
+    host_reactor_client_t *client = ctx;
+    registration_t *reg;
+    int ret = MODULE_ERR_INVALID_PARAM;
+
+    if (client == NULL || (events & ~(MODULE_IO_READ | MODULE_IO_WRITE)) != 0U) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    pthread_mutex_lock(&client->reactor->lock);
+    reg = client_lookup(client, id);
+    if (reg != NULL && !reg->owned) {
+        reg->events = events;
+        /* a callback in flight re-arms with the new events when it returns */
+        if (reg->dispatched != 0U || epoll_arm(client->reactor, reg, EPOLL_CTL_MOD) == 0) {
+            ret = MODULE_ERR_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&client->reactor->lock);
+    return ret;
+}
+
+static int reactor_remove(void *ctx, int64_t id)
+{
+    host_reactor_client_t *client = ctx;
+    registration_t *reg;
+    int ret = MODULE_ERR_INVALID_PARAM;
+
+    if (client == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    pthread_mutex_lock(&client->reactor->lock);
+    reg = client_lookup(client, id);
+    if (reg != NULL) {
+        kill_registration(client->reactor, reg);
+        ret = MODULE_ERR_SUCCESS;
+    }
+    pthread_mutex_unlock(&client->reactor->lock);
+    return ret;
+}
+
+static int reactor_notify(void *ctx, int64_t id)
+{
+    host_reactor_client_t *client = ctx;
+    registration_t *reg;
+    uint64_t one = 1U;
+    int ret = MODULE_ERR_INVALID_PARAM;
+
+    if (client == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    pthread_mutex_lock(&client->reactor->lock);
+    reg = client_lookup(client, id);
+    if (reg != NULL && reg->owned) {
+        /* EAGAIN means the counter is saturated, a wakeup is pending anyway */
+        if (write(reg->fd, &one, sizeof(one)) == (ssize_t)sizeof(one) || errno == EAGAIN) {
+            ret = MODULE_ERR_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&client->reactor->lock);
+    return ret;
+}
+
+host_reactor_client_t *host_reactor_client_create(host_reactor_t *reactor,
+        host_pool_client_t *pool)
+{
+    host_reactor_client_t *client;
+
+    if (reactor == NULL || pool == NULL) {
+        return NULL;
+    }
+
+    client = calloc(1U, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+
+    client->reactor = reactor;
+    client->pool = pool;
+    client->regs = NULL;
+    client->closing = false;
+    client->ops.ctx = client;
+    client->ops.add = reactor_add;
+    client->ops.modify = reactor_modify;
+    client->ops.remove = reactor_remove;
+    client->ops.add_event = reactor_add_event;
+    client->ops.notify = reactor_notify;
+    return client;
+}
+
+const module_reactor_ops_t *host_reactor_client_ops(host_reactor_client_t *client)
+{
+    return (client != NULL) ? &client->ops : NULL;
+}
+
+void host_reactor_client_close(host_reactor_client_t *client)
+{
+    host_reactor_t *reactor;
+
+    if (client == NULL) {
+        return;
+    }
+    reactor = client->reactor;
+
+    pthread_mutex_lock(&reactor->lock);
+    client->closing = true;
+    while (client->regs != NULL) {
+        kill_registration(reactor, client->regs);
+    }
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+void host_reactor_client_destroy(host_reactor_client_t *client)
+{
+    free(client);
+}
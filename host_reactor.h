@@ -0,0 +1,73 @@
+#ifndef HOST_REACTOR_H
+#define HOST_REACTOR_H
+
+#include "host_pool.h"
+#include "module_interface.h"
+#include <stdint.h>
+
+/* events taken from epoll per wakeup */
+#define HOST_REACTOR_MAX_EVENTS 64U
+
+struct host_reactor;
+struct host_reactor_client;
+
+typedef struct host_reactor host_reactor_t;
+/* one module's registrations */
+typedef struct host_reactor_client host_reactor_client_t;
+
+/* counters of one reactor */
+typedef struct {
+    uint64_t added;
+    uint64_t removed;
+    uint64_t dispatched;
+    uint32_t registered;
+} host_reactor_stats_t;
+
+/**
+ * start the reactor thread on a new epoll instance
+ * the thread only waits for readiness, callbacks run on the pool of their client
+ * @return reactor or NULL on error
+ */
+host_reactor_t *host_reactor_create(void);
+
+/**
+ * stop the reactor thread, all clients must be closed before
+ * @param reactor reactor or NULL
+ */
+void host_reactor_destroy(host_reactor_t *reactor);
+
+/**
+ * @param reactor reactor instance
+ * @param stats output counters
+ */
+void host_reactor_get_stats(host_reactor_t *reactor, host_reactor_stats_t *stats);
+
+/**
+ * create a client for one module, its callbacks are submitted to pool
+ * @param reactor reactor instance
+ * @param pool pool client of the same module
+ * @return client or NULL on error
+ */
+host_reactor_client_t *host_reactor_client_create(host_reactor_t *reactor,
+        host_pool_client_t *pool);
+
+/**
+ * @param client client instance
+ * @return table handed to the module in module_init_args_t.reactor
+ */
+const module_reactor_ops_t *host_reactor_client_ops(host_reactor_client_t *client);
+
+/**
+ * remove every registration of the client from epoll and refuse new ones
+ * callbacks already queued on the pool are dropped by closing the pool client
+ * @param client client or NULL
+ */
+void host_reactor_client_close(host_reactor_client_t *client);
+
+/**
+ * free a closed client
+ * @param client client or NULL
+ */
+void host_reactor_client_destroy(host_reactor_client_t *client);
+
+#endif /* HOST_REACTOR_H */
@@ -0,0 +1,560 @@
+#include "host_timer.h"
+#include "module_error.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WHEEL_SLOTS (1U << HOST_TIMER_WHEEL_BITS)
+#define WHEEL_MASK ((uint64_t)WHEEL_SLOTS - 1U)
+/* ticks covered by all levels, longer delays are parked in the top level */
+#define WHEEL_RANGE (1ULL << (HOST_TIMER_WHEEL_BITS * HOST_TIMER_WHEEL_LEVELS))
+/* initial timer table size, grows by doubling */
+#define TIMER_TABLE_INITIAL 64U
+/* ids carry a 31 bit generation above the table index, so they stay positive */
+#define TIMER_GENERATION_MASK 0x7fffffffU
+
+typedef struct wheel_timer {
+    /* wheel slot list */
+    struct wheel_timer *next;
+    struct wheel_timer *prev;
+    /* timers of the same client */
+    struct wheel_timer *client_next;
+    struct wheel_timer *client_prev;
+    host_timer_wheel_t *wheel;
+    host_timer_client_t *client;
+    module_timer_fn fn;
+    void *arg;
+    uint64_t expires;
+    uint32_t period;
+    uint32_t index;
+    uint32_t generation;
+    /* fires queued on the pool and not run yet */
+    uint32_t dispatched;
+    /* wheel slot while armed */
+    uint8_t level;
+    uint8_t slot;
+    /* linked into a wheel slot */
+    bool armed;
+    /* not cancelled, one-shot timers also not fired yet */
+    bool live;
+} wheel_timer_t;
+
+struct host_timer_client {
+    host_timer_wheel_t *wheel;
+    host_pool_client_t *pool;
+    module_timer_ops_t ops;
+    wheel_timer_t *timers;
+    bool closing;
+};
+
+struct host_timer_wheel {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    struct timespec epoch;
+    /* last processed tick */
+    uint64_t tick;
+    wheel_timer_t *slots[HOST_TIMER_WHEEL_LEVELS][WHEEL_SLOTS];
+    /*
+     * live entries by index, ids are checked against the generation so a
+     * stale id never reaches a reused entry
+     */
+    wheel_timer_t **table;
+    uint32_t *generations;
+    uint32_t *free_list;
+    uint32_t free_count;
+    uint32_t table_size;
+    host_timer_stats_t stats;
+};
+
+static uint64_t current_tick(const host_timer_wheel_t *wheel)
+{
+    struct timespec ts;
+    int64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns = (int64_t)(ts.tv_sec - wheel->epoch.tv_sec) * 1000000000LL +
+            (int64_t)(ts.tv_nsec - wheel->epoch.tv_nsec);
+    return (uint64_t)ns / 1000000ULL / HOST_TIMER_TICK_MS;
+}
+
+/* file the timer into the level whose slot span covers its remaining delay */
+static void arm(host_timer_wheel_t *wheel, wheel_timer_t *t)
+{
+    uint64_t expires = t->expires;
+    uint64_t delta;
+    uint32_t level;
+    uint32_t slot;
+
+    if (expires <= wheel->tick) {
+        expires = wheel->tick + 1U;
+    }
+    delta = expires - wheel->tick;
+    if (delta >= WHEEL_RANGE) {
+        expires = wheel->tick + WHEEL_RANGE - 1U;
+        delta = WHEEL_RANGE - 1U;
+    }
+
+    for (level = 0U; level < HOST_TIMER_WHEEL_LEVELS - 1U; level++) {
+        if (delta < (1ULL << (HOST_TIMER_WHEEL_BITS * (level + 1U)))) {
+            break;
+        }
+    }
+    slot = (uint32_t)((expires >> (HOST_TIMER_WHEEL_BITS * level)) & WHEEL_MASK);
+
+    t->prev = NULL;
+    t->next = wheel->slots[level][slot];
+    if (t->next != NULL) {
+        t->next->prev = t;
+    }
+    wheel->slots[level][slot] = t;
+    t->level = (uint8_t)level;
+    t->slot = (uint8_t)slot;
+    t->armed = true;
+    wheel->stats.armed++;
+}
+
+static void disarm(host_timer_wheel_t *wheel, wheel_timer_t *t)
+{
+    if (!t->armed) {
+        return;
+    }
+    if (t->prev != NULL) {
+        t->prev->next = t->next;
+    } else {
+        wheel->slots[t->level][t->slot] = t->next;
+    }
+    if (t->next != NULL) {
+        t->next->prev = t->prev;
+    }
+    t->next = NULL;
+    t->prev = NULL;
+    t->armed = false;
+    wheel->stats.armed--;
+}
+
+static void client_unlink(wheel_timer_t *t)
+{
+    if (t->client == NULL) {
+        return;
+    }
+    if (t->client_prev != NULL) {
+        t->client_prev->client_next = t->client_next;
+    } else {
+        t->client->timers = t->client_next;
+    }
+    if (t->client_next != NULL) {
+        t->client_next->client_prev = t->client_prev;
+    }
+    t->client_next = NULL;
+    t->client_prev = NULL;
+    t->client = NULL;
+}
+
+/* free an entry nobody refers to anymore, called with the wheel lock held */
+static void maybe_free(host_timer_wheel_t *wheel, wheel_timer_t *t)
+{
+    if (t->live || t->armed || t->dispatched != 0U) {
+        return;
+    }
+    wheel->table[t->index] = NULL;
+    wheel->generations[t->index] = (wheel->generations[t->index] + 1U) & TIMER_GENERATION_MASK;
+    wheel->free_list[wheel->free_count++] = t->index;
+    free(t);
+}
+
+/* stop a live timer for good, called with the wheel lock held */
+static void kill_timer(host_timer_wheel_t *wheel, wheel_timer_t *t)
+{
+    t->live = false;
+    disarm(wheel, t);
+    client_unlink(t);
+    maybe_free(wheel, t);
+}
+
+/* the pool runs this for each fire, a cancel in between suppresses the call */
+static void fire_task(void *arg)
+{
+    wheel_timer_t *t = arg;
+    host_timer_wheel_t *wheel = t->wheel;
+    module_timer_fn fn;
+    void *fn_arg;
+    bool run;
+
+    pthread_mutex_lock(&wheel->lock);
+    t->dispatched--;
+    run = t->live;
+    fn = t->fn;
+    fn_arg = t->arg;
+    if (run) {
+        wheel->stats.fired++;
+        if (t->period == 0U) {
+            t->live = false;
+            client_unlink(t);
+        }
+    }
+    maybe_free(wheel, t);
+    pthread_mutex_unlock(&wheel->lock);
+
+    if (run) {
+        fn(fn_arg);
+    }
+}
+
+static void fire_cancel(void *arg)
+{
+    wheel_timer_t *t = arg;
+    host_timer_wheel_t *wheel = t->wheel;
+
+    pthread_mutex_lock(&wheel->lock);
+    t->dispatched--;
+    maybe_free(wheel, t);
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/* hand an expired timer to the pool, periodic ones are filed again */
+static void expire(host_timer_wheel_t *wheel, wheel_timer_t *t)
+{
+    t->dispatched++;
+    if (host_pool_client_submit(t->client->pool, fire_task, t, fire_cancel) !=
+            MODULE_ERR_SUCCESS) {
+        t->dispatched--;
+    }
+
+    if (t->period != 0U) {
+        t->expires = wheel->tick + t->period;
+        arm(wheel, t);
+    }
+    maybe_free(wheel, t);
+}
+
+/* move the timers of a higher level slot down to the levels below */
+static void cascade(host_timer_wheel_t *wheel, uint32_t level, uint32_t slot)
+{
+    wheel_timer_t *t = wheel->slots[level][slot];
+    wheel_timer_t *next;
+
+    wheel->slots[level][slot] = NULL;
+    for (; t != NULL; t = next) {
+        next = t->next;
+        t->armed = false;
+        wheel->stats.armed--;
+        arm(wheel, t);
+    }
+}
+
+static void advance(host_timer_wheel_t *wheel)
+{
+    wheel_timer_t *t;
+    wheel_timer_t *next;
+    uint32_t level;
+    uint32_t slot;
+
+    wheel->tick++;
+
+    /* a level wraps when all bits below it are zero */
+    for (level = 1U; level < HOST_TIMER_WHEEL_LEVELS; level++) {
+        if ((wheel->tick & ((1ULL << (HOST_TIMER_WHEEL_BITS * level)) - 1U)) != 0U) {
+            break;
+        }
+        cascade(wheel, level,
+                (uint32_t)((wheel->tick >> (HOST_TIMER_WHEEL_BITS * level)) & WHEEL_MASK));
+    }
+
+    slot = (uint32_t)(wheel->tick & WHEEL_MASK);
+    t = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    for (; t != NULL; t = next) {
+        next = t->next;
+        t->next = NULL;
+        t->prev = NULL;
+        t->armed = false;
+        wheel->stats.armed--;
+        expire(wheel, t);
+    }
+}
+
+/* ticks until the next level 0 slot with timers, or until the next cascade */
+static uint64_t idle_ticks(const host_timer_wheel_t *wheel)
+{
+    uint64_t ticks;
+
+    for (ticks = 1U; ticks <= WHEEL_SLOTS; ticks++) {
+        if (wheel->slots[0][(wheel->tick + ticks) & WHEEL_MASK] != NULL ||
+                ((wheel->tick + ticks) & WHEEL_MASK) == 0U) {
+            break;
+        }
+    }
+    return ticks;
+}
+
+static void *timer_thread(void *arg)
+{
+    host_timer_wheel_t *wheel = arg;
+    struct timespec deadline;
+    uint64_t now;
+    uint64_t wake_ms;
+
+    pthread_mutex_lock(&wheel->lock);
+    while (!wheel->stop) {
+        now = current_tick(wheel);
+        while (wheel->tick < now) {
+            advance(wheel);
+        }
+
+        if (wheel->stats.armed == 0U) {
+            pthread_cond_wait(&wheel->cond, &wheel->lock);
+            continue;
+        }
+
+        wake_ms = (wheel->tick + idle_ticks(wheel)) * HOST_TIMER_TICK_MS;
+        deadline.tv_sec = wheel->epoch.tv_sec + (time_t)(wake_ms / 1000U);
+        deadline.tv_nsec = wheel->epoch.tv_nsec + (long)(wake_ms % 1000U) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wheel->cond, &wheel->lock, &deadline);
+    }
+    pthread_mutex_unlock(&wheel->lock);
+    return NULL;
+}
+
+host_timer_wheel_t *host_timer_wheel_create(void)
+{
+    host_timer_wheel_t *wheel;
+    pthread_condattr_t attr;
+
+    wheel = calloc(1U, sizeof(*wheel));
+    if (wheel == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&wheel->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wheel->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    clock_gettime(CLOCK_MONOTONIC, &wheel->epoch);
+    wheel->tick = 0U;
+    wheel->stop = false;
+
+    if (pthread_create(&wheel->thread, NULL, timer_thread, wheel) != 0) {
+        pthread_cond_destroy(&wheel->cond);
+        pthread_mutex_destroy(&wheel->lock);
+        free(wheel);
+        return NULL;
+    }
+    return wheel;
+}
+
+void host_timer_wheel_destroy(host_timer_wheel_t *wheel)
+{
+    uint32_t i;
+
+    if (wheel == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&wheel->lock);
+    wheel->stop = true;
+    pthread_cond_signal(&wheel->cond);
+    pthread_mutex_unlock(&wheel->lock);
+    pthread_join(wheel->thread, NULL);
+
+    for (i = 0U; i < wheel->table_size; i++) {
+        free(wheel->table[i]);
+    }
+    free(wheel->table);
+    free(wheel->generations);
+    free(wheel->free_list);
+    pthread_cond_destroy(&wheel->cond);
+    pthread_mutex_destroy(&wheel->lock);
+    free(wheel);
+}
+
+void host_timer_wheel_get_stats(host_timer_wheel_t *wheel, host_timer_stats_t *stats)
+{
+    if (wheel == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&wheel->lock);
+    *stats = wheel->stats;
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/* double the entry table, called with the wheel lock held */
+static int grow_table(host_timer_wheel_t *wheel)
+{
+    uint32_t size = (wheel->table_size == 0U) ? TIMER_TABLE_INITIAL : wheel->table_size * 2U;
+    wheel_timer_t **table;
+    uint32_t *generations;
+    uint32_t *free_list;
+    uint32_t i;
+
+    table = realloc(wheel->table, size * sizeof(*table));
+    if (table == NULL) {
+        return -1;
+    }
+    wheel->table = table;
+    generations = realloc(wheel->generations, size * sizeof(*generations));
+    if (generations == NULL) {
+        return -1;
+    }
+    wheel->generations = generations;
+    free_list = realloc(wheel->free_list, size * sizeof(*free_list));
+    if (free_list == NULL) {
+        return -1;
+    }
+    wheel->free_list = free_list;
+
+    for (i = wheel->table_size; i < size; i++) {
+        wheel->table[i] = NULL;
+        wheel->generations[i] = 1U;
+    }
+    /* hand out low indices first */
+    for (i = size; i > wheel->table_size; i--) {
+        wheel->free_list[wheel->free_count++] = i - 1U;
+    }
+    wheel->table_size = size;
+    return 0;
+}
+
+static int64_t timer_start(void *ctx, uint32_t delay_ms, uint32_t period_ms, module_timer_fn fn,
+        void *arg)
+{
+    host_timer_client_t *client = ctx;
+    host_timer_wheel_t *wheel;
+    wheel_timer_t *t;
+
+    if (client == NULL || fn == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    wheel = client->wheel;
+
+    t = calloc(1U, sizeof(*t));
+    if (t == NULL) {
+        return MODULE_ERR_MEMORY;
+    }
+
+    pthread_mutex_lock(&wheel->lock);
+    if (client->closing) {
+        pthread_mutex_unlock(&wheel->lock);
+        free(t);
+        return MODULE_ERR_NOT_LOADED;
+    }
+    if (wheel->free_count == 0U && grow_table(wheel) != 0) {
+        pthread_mutex_unlock(&wheel->lock);
+        free(t);
+        return MODULE_ERR_MEMORY;
+    }
+
+    t->index = wheel->free_list[--wheel->free_count];
+    t->generation = wheel->generations[t->index];
+    wheel->table[t->index] = t;
+    t->wheel = wheel;
+    t->fn = fn;
+    t->arg = arg;
+    t->live = true;
+    t->period = (period_ms + HOST_TIMER_TICK_MS - 1U) / HOST_TIMER_TICK_MS;
+    /* the tick in progress counts as started, round the delay up */
+    t->expires = current_tick(wheel) + (delay_ms + HOST_TIMER_TICK_MS - 1U) /
+            HOST_TIMER_TICK_MS;
+
+    t->client = client;
+    t->client_next = client->timers;
+    if (t->client_next != NULL) {
+        t->client_next->client_prev = t;
+    }
+    client->timers = t;
+
+    arm(wheel, t);
+    wheel->stats.started++;
+    pthread_cond_signal(&wheel->cond);
+    pthread_mutex_unlock(&wheel->lock);
+
+    return (int64_t)(((uint64_t)t->generation << 32) | t->index);
+}
+
+static int timer_cancel(void *ctx, int64_t id)
+{
+    host_timer_client_t *client = ctx;
+    host_timer_wheel_t *wheel;
+    wheel_timer_t *t;
+    uint32_t index = (uint32_t)((uint64_t)id & 0xffffffffU);
+    uint32_t generation = (uint32_t)((uint64_t)id >> 32);
+    int ret = MODULE_ERR_INVALID_PARAM;
+
+    if (client == NULL || id <= 0) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    wheel = client->wheel;
+
+    pthread_mutex_lock(&wheel->lock);
+    if (index < wheel->table_size && wheel->generations[index] == generation) {
+        t = wheel->table[index];
+        if (t != NULL && t->live && t->client == client) {
+            kill_timer(wheel, t);
+            wheel->stats.cancelled++;
+            ret = MODULE_ERR_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&wheel->lock);
+    return ret;
+}
+
+host_timer_client_t *host_timer_client_create(host_timer_wheel_t *wheel,
+        host_pool_client_t *pool)
+{
+    host_timer_client_t *client;
+
+    if (wheel == NULL || pool == NULL) {
+        return NULL;
+    }
+
+    client = calloc(1U, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+
+    client->wheel = wheel;
+    client->pool = pool;
+    client->timers = NULL;
+    client->closing = false;
+    client->ops.ctx = client;
+    client->ops.start = timer_start;
+    client->ops.cancel = timer_cancel;
+    return client;
+}
+
+const module_timer_ops_t *host_timer_client_ops(host_timer_client_t *client)
+{
+    return (client != NULL) ? &client->ops : NULL;
+}
+
+void host_timer_client_close(host_timer_client_t *client)
+{
+    host_timer_wheel_t *wheel;
+
+    if (client == NULL) {
+        return;
+    }
+    wheel = client->wheel;
+
+    pthread_mutex_lock(&wheel->lock);
+    client->closing = true;
+    while (client->timers != NULL) {
+        kill_timer(wheel, client->timers);
+        wheel->stats.cancelled++;
+    }
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+void host_timer_client_destroy(host_timer_client_t *client)
+{
+    free(client);
+}
@@ -0,0 +1,77 @@
+#ifndef HOST_TIMER_H
+#define HOST_TIMER_H
+
+#include "host_pool.h"
+#include "module_interface.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* wheel resolution */
+#define HOST_TIMER_TICK_MS 1U
+/* slots per level and levels, delays up to 2^24 ticks without re-cascading */
+#define HOST_TIMER_WHEEL_BITS 6U
+#define HOST_TIMER_WHEEL_LEVELS 4U
+
+struct host_timer_wheel;
+struct host_timer_client;
+
+typedef struct host_timer_wheel host_timer_wheel_t;
+/* one module's timers */
+typedef struct host_timer_client host_timer_client_t;
+
+/* counters of one wheel */
+typedef struct {
+    uint64_t started;
+    uint64_t fired;
+    uint64_t cancelled;
+    uint32_t armed;
+} host_timer_stats_t;
+
+/**
+ * start the timer thread of a hierarchical timer wheel
+ * the thread only moves timers, callbacks run on the pool of their client
+ * @return wheel or NULL on error
+ */
+host_timer_wheel_t *host_timer_wheel_create(void);
+
+/**
+ * stop the timer thread, all clients must be closed before
+ * @param wheel wheel or NULL
+ */
+void host_timer_wheel_destroy(host_timer_wheel_t *wheel);
+
+/**
+ * @param wheel wheel instance
+ * @param stats output counters
+ */
+void host_timer_wheel_get_stats(host_timer_wheel_t *wheel, host_timer_stats_t *stats);
+
+/**
+ * create a client for one module, its callbacks are submitted to pool
+ * @param wheel wheel instance
+ * @param pool pool client of the same module
+ * @return client or NULL on error
+ */
+host_timer_client_t *host_timer_client_create(host_timer_wheel_t *wheel,
+        host_pool_client_t *pool);
+
+/**
+ * @param client client instance
+ * @return table handed to the module in module_init_args_t.timers
+ */
+const module_timer_ops_t *host_timer_client_ops(host_timer_client_t *client);
+
+/**
+ * cancel every timer of the client and refuse new ones
+ * callbacks already queued on the pool are dropped by closing the pool client
+ * @param client client or NULL
+ */
+void host_timer_client_close(host_timer_client_t *client);
+
+/**
+ * free a closed client
+ * @param client client or NULL
+ */
+void host_timer_client_destroy(host_timer_client_t *client);
+
+#endif /* HOST_TIMER_H */
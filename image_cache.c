@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include "image_cache.h"
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    image_key_t key;
+    void *handle;
+    uint64_t bytes;
+    /* put order, the smallest is evicted first */
+    uint64_t stamp;
+    char path[IMAGE_CACHE_PATH_MAX];
+} image_entry_t;
+
+typedef struct {
+    uintptr_t base;
+    const char *name;
+    uint64_t bytes;
+} image_size_ctx_t;
+
+/* fixed table, so the static build caches without allocating */
+static image_entry_t g_entries[IMAGE_CACHE_MAX_ENTRIES];
+static image_cache_stats_t g_stats;
+static uint64_t g_next_stamp;
+static pthread_mutex_t g_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int image_size_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    image_size_ctx_t *ctx = data;
+    ElfW(Half) i;
+
+    (void)size;
+
+    if (info->dlpi_addr != ctx->base || info->dlpi_name == NULL ||
+            strcmp(info->dlpi_name, ctx->name) != 0) {
+        return 0;
+    }
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            ctx->bytes += info->dlpi_phdr[i].p_memsz;
+        }
+    }
+    return 1;
+}
+
+/* mapped size of an image, 0 if it cannot be found */
+static uint64_t image_size(void *handle)
+{
+    struct link_map *lm = NULL;
+    image_size_ctx_t ctx;
+
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &lm) != 0 || lm == NULL) {
+        return 0U;
+    }
+    ctx.base = (uintptr_t)lm->l_addr;
+    ctx.name = lm->l_name;
+    ctx.bytes = 0U;
+    dl_iterate_phdr(image_size_cb, &ctx);
+    return ctx.bytes;
+}
+
+static bool key_equal(const image_key_t *a, const image_key_t *b)
+{
+    return a->dev == b->dev && a->ino == b->ino && a->mtime_ns == b->mtime_ns &&
+            a->size == b->size && a->mode == b->mode;
+}
+
+/* drop entry i, called with the mutex held; closes the image if asked */
+static void drop_entry(uint32_t i, bool close)
+{
+    if (close) {
+        dlclose(g_entries[i].handle);
+        g_stats.evictions++;
+    }
+    g_stats.bytes -= g_entries[i].bytes;
+    g_entries[i] = g_entries[--g_stats.entries];
+}
+
+/* close the oldest entries until at most limit are left, with the mutex held */
+static void shrink(uint32_t limit)
+{
+    uint32_t oldest;
+    uint32_t i;
+
+    while (g_stats.entries > limit) {
+        oldest = 0U;
+        for (i = 1U; i < g_stats.entries; i++) {
+            if (g_entries[i].stamp < g_entries[oldest].stamp) {
+                oldest = i;
+            }
+        }
+        drop_entry(oldest, true);
+    }
+}
+
+void image_cache_set_capacity(uint32_t capacity)
+{
+    if (capacity > IMAGE_CACHE_MAX_ENTRIES) {
+        capacity = IMAGE_CACHE_MAX_ENTRIES;
+    }
+
+    pthread_mutex_lock(&g_cache_mutex);
+    g_stats.capacity = capacity;
+    shrink(capacity);
+    pthread_mutex_unlock(&g_cache_mutex);
+}
+
+int image_cache_key(const char *path, image_key_t *key)
+{
+    struct stat st;
+
+    if (path == NULL || key == NULL || stat(path, &st) != 0) {
+        return -1;
+    }
+    key->dev = (uint64_t)st.st_dev;
+    key->ino = (uint64_t)st.st_ino;
+    key->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL +
+            (uint64_t)st.st_mtim.tv_nsec;
+    key->size = (uint64_t)st.st_size;
+    key->mode = 0U;
+    return 0;
+}
+
+void *image_cache_take(const char *path, const image_key_t *key)
+{
+    void *handle = NULL;
+    uint32_t i;
+
+    if (path == NULL || key == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_cache_mutex);
+    if (g_stats.capacity == 0U) {
+        pthread_mutex_unlock(&g_cache_mutex);
+        return NULL;
+    }
+
+    for (i = 0U; i < g_stats.entries; i++) {
+        if (key_equal(&g_entries[i].key, key)) {
+            handle = g_entries[i].handle;
+            drop_entry(i, false);
+            g_stats.hits++;
+            pthread_mutex_unlock(&g_cache_mutex);
+            return handle;
+        }
+    }
+
+    /* the loader matches by name and inode, a cached old image would win */
+    i = 0U;
+    while (i < g_stats.entries) {
+        if (strcmp(g_entries[i].path, path) == 0 ||
+                (g_entries[i].key.dev == key->dev && g_entries[i].key.ino == key->ino)) {
+            drop_entry(i, true);
+        } else {
+            i++;
+        }
+    }
+    g_stats.misses++;
+    pthread_mutex_unlock(&g_cache_mutex);
+    return NULL;
+}
+
+bool image_cache_put(const char *path, const image_key_t *key, void *handle)
+{
+    size_t path_len;
+    uint64_t bytes;
+    uint32_t i;
+
+    if (path == NULL || key == NULL || handle == NULL) {
+        return false;
+    }
+    path_len = strlen(path);
+    if (path_len >= IMAGE_CACHE_PATH_MAX) {
+        return false;
+    }
+
+    /* walks the program headers, keep it outside the mutex */
+    bytes = image_size(handle);
+
+    pthread_mutex_lock(&g_cache_mutex);
+    if (g_stats.capacity == 0U) {
+        pthread_mutex_unlock(&g_cache_mutex);
+        return false;
+    }
+    /* two loaders of one file share the image, one entry keeps it mapped */
+    for (i = 0U; i < g_stats.entries; i++) {
+        if (g_entries[i].handle == handle) {
+            pthread_mutex_unlock(&g_cache_mutex);
+            return false;
+        }
+    }
+
+    shrink(g_stats.capacity - 1U);
+    i = g_stats.entries++;
+    g_entries[i].key = *key;
+    g_entries[i].handle = handle;
+    g_entries[i].bytes = bytes;
+    g_entries[i].stamp = g_next_stamp++;
+    memcpy(g_entries[i].path, path, path_len + 1U);
+    g_stats.bytes += bytes;
+    pthread_mutex_unlock(&g_cache_mutex);
+    return true;
+}
+
+void image_cache_get_stats(image_cache_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_cache_mutex);
+    *stats = g_stats;
+    pthread_mutex_unlock(&g_cache_mutex);
+}
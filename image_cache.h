@@ -0,0 +1,77 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* upper bound for image_cache_set_capacity() */
+#define IMAGE_CACHE_MAX_ENTRIES 32U
+#define IMAGE_CACHE_PATH_MAX 256U
+
+/*
+ * identity of a module file, a rewritten or replaced file gets a new key
+ * so its old image is never handed out again
+ */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t mtime_ns;
+    uint64_t size;
+    /* dlopen mode, set by the caller; an image bound another way is reopened */
+    uint32_t mode;
+} image_key_t;
+
+typedef struct {
+    /* loads served from the cache, dlopen skipped */
+    uint64_t hits;
+    /* loads that had to dlopen while the cache was enabled */
+    uint64_t misses;
+    /* images closed to make room, for a changed file or on disable */
+    uint64_t evictions;
+    uint32_t entries;
+    uint32_t capacity;
+    /* PT_LOAD bytes of the images kept mapped */
+    uint64_t bytes;
+} image_cache_stats_t;
+
+/**
+ * bound the number of unloaded images kept mapped, 0 disables the cache
+ * and closes every cached image; disabled by default since a cached image
+ * keeps its static data, modules have to set up all state in module_init
+ * @param capacity entries, at most IMAGE_CACHE_MAX_ENTRIES
+ */
+void image_cache_set_capacity(uint32_t capacity);
+
+/**
+ * @param path module file
+ * @param key output identity, with mode 0
+ * @return 0 on success, -1 if the file cannot be stat'ed
+ */
+int image_cache_key(const char *path, image_key_t *key);
+
+/**
+ * take a cached image of the file out of the cache
+ * on a miss, cached images of the same path or inode are closed first,
+ * dlopen would otherwise return such a stale image for a changed file
+ * @param path module file, as passed to dlopen
+ * @param key identity from image_cache_key()
+ * @return dlopen handle, owned by the caller, or NULL
+ */
+void *image_cache_take(const char *path, const image_key_t *key);
+
+/**
+ * keep an unloaded image mapped, evicting the least recently cached one
+ * when full; module_fini must have run already
+ * @param path module file it was loaded from
+ * @param key identity taken before it was loaded
+ * @param handle dlopen handle, owned by the cache on success
+ * @return true if cached, false if the caller still has to dlclose it
+ */
+bool image_cache_put(const char *path, const image_key_t *key, void *handle);
+
+/**
+ * @param stats output counters
+ */
+void image_cache_get_stats(image_cache_stats_t *stats);
+
+#endif /* IMAGE_CACHE_H */
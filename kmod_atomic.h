@@ -0,0 +1,67 @@
+#ifndef KMOD_ATOMIC_H
+#define KMOD_ATOMIC_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * atomics of the loader hot path
+ * KMODLIKE_SINGLE_THREADED turns them into plain loads and stores, the
+ * memory order argument is kept so both variants read the same; anything a
+ * signal handler writes stays a real _Atomic instead
+ */
+
+#ifdef KMODLIKE_SINGLE_THREADED
+
+#define KMOD_ATOMIC(type) type
+
+static inline unsigned int kmod_fetch_add_uint(unsigned int *p, unsigned int v)
+{
+    unsigned int old = *p;
+
+    *p = old + v;
+    return old;
+}
+
+static inline unsigned int kmod_fetch_sub_uint(unsigned int *p, unsigned int v)
+{
+    unsigned int old = *p;
+
+    *p = old - v;
+    return old;
+}
+
+static inline uint64_t kmod_fetch_add_u64(uint64_t *p, uint64_t v)
+{
+    uint64_t old = *p;
+
+    *p = old + v;
+    return old;
+}
+
+/* the loader counts in unsigned int and uint64_t only */
+#define kmod_fetch_add(p, v) _Generic((p), \
+        unsigned int *: kmod_fetch_add_uint, \
+        default: kmod_fetch_add_u64)((p), (v))
+
+#define kmod_atomic_init(p, v) ((void)(*(p) = (v)))
+#define kmod_atomic_load(p, mo) ((void)(mo), *(p))
+#define kmod_atomic_store(p, v, mo) ((void)(mo), (void)(*(p) = (v)))
+#define kmod_atomic_fetch_add(p, v, mo) ((void)(mo), kmod_fetch_add((p), (v)))
+#define kmod_atomic_fetch_sub(p, v, mo) ((void)(mo), kmod_fetch_sub_uint((p), (v)))
+#define kmod_atomic_fence(mo) ((void)(mo))
+
+#else
+
+#define KMOD_ATOMIC(type) _Atomic(type)
+
+#define kmod_atomic_init(p, v) atomic_init((p), (v))
+#define kmod_atomic_load(p, mo) atomic_load_explicit((p), (mo))
+#define kmod_atomic_store(p, v, mo) atomic_store_explicit((p), (v), (mo))
+#define kmod_atomic_fetch_add(p, v, mo) atomic_fetch_add_explicit((p), (v), (mo))
+#define kmod_atomic_fetch_sub(p, v, mo) atomic_fetch_sub_explicit((p), (v), (mo))
+#define kmod_atomic_fence(mo) atomic_thread_fence(mo)
+
+#endif /* KMODLIKE_SINGLE_THREADED */
+
+#endif /* KMOD_ATOMIC_H */
@@ -0,0 +1,207 @@
+#include "lock_prof.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    atomic_uint_fast64_t sum_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[LOCK_PROF_BUCKETS];
+} hist_counters_t;
+
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t acquisitions;
+    atomic_uint_fast64_t contended;
+    hist_counters_t wait;
+    hist_counters_t hold;
+} site_counters_t;
+
+static const char *const SITE_NAMES[LOCK_SITE_COUNT] = {
+    [LOCK_SITE_LOADER_LOAD] = "loader.load",
+    [LOCK_SITE_LOADER_UNLOAD] = "loader.unload",
+    [LOCK_SITE_LOADER_SYMBOL] = "loader.get_symbol",
+    [LOCK_SITE_LOADER_CALL] = "loader.call",
+    [LOCK_SITE_LOADER_REF] = "loader.ref",
+    [LOCK_SITE_LOADER_QUERY] = "loader.query",
+    [LOCK_SITE_RPC_REGISTER] = "rpc.register",
+    [LOCK_SITE_RPC_DISPATCH] = "rpc.dispatch",
+    [LOCK_SITE_RPC_HELP] = "rpc.help",
+    [LOCK_SITE_RPC_LIFECYCLE] = "rpc.lifecycle",
+};
+
+static site_counters_t g_sites[LOCK_SITE_COUNT];
+
+#ifdef KMODLIKE_LOCK_PROFILING
+/* built in means wanted, runtime can still switch it off */
+static atomic_bool g_enabled = ATOMIC_VAR_INIT(true);
+#else
+static atomic_bool g_enabled = ATOMIC_VAR_INIT(false);
+#endif
+
+static void hist_read(hist_counters_t *h, lock_prof_hist_t *out)
+{
+    uint32_t i;
+
+    out->sum_ns = atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+    out->max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    for (i = 0U; i < LOCK_PROF_BUCKETS; i++) {
+        out->buckets[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    }
+}
+
+static void hist_reset(hist_counters_t *h)
+{
+    uint32_t i;
+
+    atomic_store_explicit(&h->sum_ns, 0U, memory_order_relaxed);
+    atomic_store_explicit(&h->max_ns, 0U, memory_order_relaxed);
+    for (i = 0U; i < LOCK_PROF_BUCKETS; i++) {
+        atomic_store_explicit(&h->buckets[i], 0U, memory_order_relaxed);
+    }
+}
+
+bool lock_prof_is_compiled(void)
+{
+#ifdef KMODLIKE_LOCK_PROFILING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void lock_prof_set_enabled(bool enabled)
+{
+    if (lock_prof_is_compiled()) {
+        atomic_store(&g_enabled, enabled);
+    }
+}
+
+bool lock_prof_is_enabled(void)
+{
+    return atomic_load_explicit(&g_enabled, memory_order_relaxed);
+}
+
+void lock_prof_reset(void)
+{
+    uint32_t i;
+
+    for (i = 0U; i < LOCK_SITE_COUNT; i++) {
+        atomic_store_explicit(&g_sites[i].acquisitions, 0U, memory_order_relaxed);
+        atomic_store_explicit(&g_sites[i].contended, 0U, memory_order_relaxed);
+        hist_reset(&g_sites[i].wait);
+        hist_reset(&g_sites[i].hold);
+    }
+}
+
+int lock_prof_read(lock_site_t site, lock_prof_site_stats_t *out)
+{
+    site_counters_t *s;
+
+    if ((uint32_t)site >= LOCK_SITE_COUNT || out == NULL) {
+        return -1;
+    }
+
+    s = &g_sites[site];
+    out->acquisitions = atomic_load_explicit(&s->acquisitions, memory_order_relaxed);
+    out->contended = atomic_load_explicit(&s->contended, memory_order_relaxed);
+    hist_read(&s->wait, &out->wait);
+    hist_read(&s->hold, &out->hold);
+    return 0;
+}
+
+const char *lock_prof_site_name(lock_site_t site)
+{
+    if ((uint32_t)site >= LOCK_SITE_COUNT) {
+        return "unknown";
+    }
+    return SITE_NAMES[site];
+}
+
+#ifdef KMODLIKE_LOCK_PROFILING
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void hist_add(hist_counters_t *h, uint64_t ns)
+{
+    uint_fast64_t max;
+    uint32_t bucket = 0U;
+    uint64_t v = ns;
+
+    while (v > 1U && bucket < LOCK_PROF_BUCKETS - 1U) {
+        v >>= 1U;
+        bucket++;
+    }
+
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1U, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ns, ns, memory_order_relaxed);
+
+    max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&h->max_ns, &max, ns,
+                memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+int lock_prof_mutex_init(lock_prof_mutex_t *m)
+{
+    m->acquired_ns = 0U;
+    m->site = LOCK_SITE_COUNT;
+    return pthread_mutex_init(&m->mutex, NULL);
+}
+
+int lock_prof_mutex_destroy(lock_prof_mutex_t *m)
+{
+    return pthread_mutex_destroy(&m->mutex);
+}
+
+void lock_prof_lock(lock_prof_mutex_t *m, lock_site_t site)
+{
+    site_counters_t *s;
+    uint64_t start;
+    uint64_t acquired;
+
+    if (!lock_prof_is_enabled() || (uint32_t)site >= LOCK_SITE_COUNT) {
+        pthread_mutex_lock(&m->mutex);
+        m->acquired_ns = 0U;
+        return;
+    }
+
+    s = &g_sites[site];
+
+    /* uncontended fast path costs a trylock and one clock read */
+    if (pthread_mutex_trylock(&m->mutex) == 0) {
+        acquired = now_ns();
+        hist_add(&s->wait, 0U);
+    } else {
+        start = now_ns();
+        pthread_mutex_lock(&m->mutex);
+        acquired = now_ns();
+        atomic_fetch_add_explicit(&s->contended, 1U, memory_order_relaxed);
+        hist_add(&s->wait, acquired - start);
+    }
+
+    atomic_fetch_add_explicit(&s->acquisitions, 1U, memory_order_relaxed);
+    m->acquired_ns = acquired;
+    m->site = site;
+}
+
+void lock_prof_unlock(lock_prof_mutex_t *m)
+{
+    uint64_t acquired = m->acquired_ns;
+    lock_site_t site = m->site;
+
+    m->acquired_ns = 0U;
+    if (acquired != 0U && (uint32_t)site < LOCK_SITE_COUNT) {
+        hist_add(&g_sites[site].hold, now_ns() - acquired);
+    }
+    pthread_mutex_unlock(&m->mutex);
+}
+
+#endif /* KMODLIKE_LOCK_PROFILING */
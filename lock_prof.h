@@ -0,0 +1,151 @@
+#ifndef LOCK_PROF_H
+#define LOCK_PROF_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* log2 buckets, same layout as stats_latency_t */
+#define LOCK_PROF_BUCKETS 40U
+
+/* instrumented lock sites, hold time is charged to the acquiring site */
+typedef enum {
+    LOCK_SITE_LOADER_LOAD = 0,
+    LOCK_SITE_LOADER_UNLOAD,
+    LOCK_SITE_LOADER_SYMBOL,
+    LOCK_SITE_LOADER_CALL,
+    LOCK_SITE_LOADER_REF,
+    LOCK_SITE_LOADER_QUERY,
+    LOCK_SITE_RPC_REGISTER,
+    LOCK_SITE_RPC_DISPATCH,
+    LOCK_SITE_RPC_HELP,
+    LOCK_SITE_RPC_LIFECYCLE,
+    LOCK_SITE_COUNT
+} lock_site_t;
+
+typedef struct {
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LOCK_PROF_BUCKETS];
+} lock_prof_hist_t;
+
+typedef struct {
+    uint64_t acquisitions;
+    uint64_t contended;
+    lock_prof_hist_t wait;
+    lock_prof_hist_t hold;
+} lock_prof_site_stats_t;
+
+#if defined(KMODLIKE_LOCK_PROFILING) && defined(KMODLIKE_SINGLE_THREADED)
+#error "KMODLIKE_LOCK_PROFILING has no locks to profile with KMODLIKE_SINGLE_THREADED"
+#endif
+
+#ifdef KMODLIKE_LOCK_PROFILING
+
+typedef struct {
+    pthread_mutex_t mutex;
+    /* written by the holder only */
+    uint64_t acquired_ns;
+    lock_site_t site;
+} lock_prof_mutex_t;
+
+#define LOCK_PROF_MUTEX_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, 0U, LOCK_SITE_COUNT}
+
+int lock_prof_mutex_init(lock_prof_mutex_t *m);
+int lock_prof_mutex_destroy(lock_prof_mutex_t *m);
+
+/**
+ * lock and record acquisition, contention and wait time for a site
+ * @param m mutex
+ * @param site acquiring site
+ */
+void lock_prof_lock(lock_prof_mutex_t *m, lock_site_t site);
+
+/**
+ * unlock and record hold time for the acquiring site
+ * @param m mutex
+ */
+void lock_prof_unlock(lock_prof_mutex_t *m);
+
+#elif defined(KMODLIKE_SINGLE_THREADED)
+
+/* one thread owns every loader, there is nothing to exclude */
+typedef struct {
+    char unused;
+} lock_prof_mutex_t;
+
+#define LOCK_PROF_MUTEX_INITIALIZER {0}
+
+static inline int lock_prof_mutex_init(lock_prof_mutex_t *m)
+{
+    (void)m;
+    return 0;
+}
+
+static inline int lock_prof_mutex_destroy(lock_prof_mutex_t *m)
+{
+    (void)m;
+    return 0;
+}
+
+static inline void lock_prof_lock(lock_prof_mutex_t *m, lock_site_t site)
+{
+    (void)m;
+    (void)site;
+}
+
+static inline void lock_prof_unlock(lock_prof_mutex_t *m)
+{
+    (void)m;
+}
+
+#else
+
+/* compiled out: plain pthread calls, no overhead */
+typedef pthread_mutex_t lock_prof_mutex_t;
+
+#define LOCK_PROF_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define lock_prof_mutex_init(m) pthread_mutex_init((m), NULL)
+#define lock_prof_mutex_destroy(m) pthread_mutex_destroy(m)
+#define lock_prof_lock(m, site) pthread_mutex_lock(m)
+#define lock_prof_unlock(m) pthread_mutex_unlock(m)
+
+#endif /* KMODLIKE_LOCK_PROFILING */
+
+/**
+ * check whether instrumentation is built in
+ * @return true if built with KMODLIKE_LOCK_PROFILING
+ */
+bool lock_prof_is_compiled(void);
+
+/**
+ * enable or disable recording at runtime, no-op when compiled out
+ * @param enabled new state
+ */
+void lock_prof_set_enabled(bool enabled);
+
+/**
+ * @return true if recording is active
+ */
+bool lock_prof_is_enabled(void);
+
+/**
+ * zero all site counters
+ */
+void lock_prof_reset(void);
+
+/**
+ * copy counters of one site, values are read without a lock
+ * @param site lock site
+ * @param out counters
+ * @return 0 on success, -1 on invalid site
+ */
+int lock_prof_read(lock_site_t site, lock_prof_site_stats_t *out);
+
+/**
+ * @param site lock site
+ * @return static site name, e.g. "loader.load"
+ */
+const char *lock_prof_site_name(lock_site_t site);
+
+#endif /* LOCK_PROF_H */
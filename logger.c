@@ -0,0 +1,750 @@
+#include "logger.h"
+#include "module_interface.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOGGER_RING_SIZE 1024U
+#define LOGGER_RING_MASK (LOGGER_RING_SIZE - 1U)
+#define LOGGER_MAX_ARGS 8U
+#define LOGGER_STR_MAX 128U
+#define LOGGER_LINE_MAX 512U
+#define LOGGER_BATCH_SIZE 16384U
+#define LOGGER_SPEC_MAX 32U
+#define LOGGER_FLUSH_INTERVAL_NS 5000000L
+
+/* record flags */
+#define LOGGER_REC_PREFORMATTED 0x01U
+#define LOGGER_REC_TRUNCATED 0x02U
+
+typedef struct {
+    atomic_size_t seq;
+    const char *fmt;
+    const char *func;
+    uint8_t level;
+    uint8_t flags;
+    uint8_t nargs;
+    uint8_t str_used;
+    uint64_t args[LOGGER_MAX_ARGS];
+    char str[LOGGER_STR_MAX];
+} logger_record_t;
+
+/* parsed printf conversion specification */
+typedef struct {
+    const char *start;
+    size_t len;
+    char conv;
+    char length;
+    uint8_t stars;
+    bool has_precision_star;
+} logger_spec_t;
+
+atomic_int g_logger_level = ATOMIC_VAR_INIT(LOGGER_LEVEL_INFO);
+
+static logger_record_t g_ring[LOGGER_RING_SIZE];
+static atomic_size_t g_head = ATOMIC_VAR_INIT(0);
+/* written by the consumer only, read for queue depth */
+static atomic_size_t g_tail = ATOMIC_VAR_INIT(0);
+static atomic_bool g_running = ATOMIC_VAR_INIT(false);
+/* writers between their g_running check and ring_publish */
+static atomic_uint g_writers = ATOMIC_VAR_INIT(0U);
+static atomic_uint_fast64_t g_dropped = ATOMIC_VAR_INIT(0);
+static pthread_t g_thread;
+static int g_fd = STDERR_FILENO;
+
+static const char *const LEVEL_NAMES[] = {
+    "error", "warn", "info", "debug"
+};
+
+#define LEVEL_NAMES_COUNT (sizeof(LEVEL_NAMES) / sizeof(LEVEL_NAMES[0]))
+
+/* parse next conversion after p, returns pointer past it or NULL */
+static const char *next_spec(const char *p, logger_spec_t *spec)
+{
+    const char *q;
+
+    q = strchr(p, '%');
+    if (q == NULL) {
+        return NULL;
+    }
+
+    spec->start = q;
+    spec->length = '\0';
+    spec->stars = 0U;
+    spec->has_precision_star = false;
+    q++;
+
+    while (*q != '\0' && strchr("-+ #0'", *q) != NULL) {
+        q++;
+    }
+    if (*q == '*') {
+        spec->stars++;
+        q++;
+    }
+    while (*q >= '0' && *q <= '9') {
+        q++;
+    }
+    if (*q == '.') {
+        q++;
+        if (*q == '*') {
+            spec->stars++;
+            spec->has_precision_star = true;
+            q++;
+        }
+        while (*q >= '0' && *q <= '9') {
+            q++;
+        }
+    }
+
+    switch (*q) {
+    case 'h':
+        q++;
+        spec->length = 'h';
+        if (*q == 'h') {
+            q++;
+            spec->length = 'H';
+        }
+        break;
+    case 'l':
+        q++;
+        spec->length = 'l';
+        if (*q == 'l') {
+            q++;
+            spec->length = 'L';
+        }
+        break;
+    case 'z':
+    case 'j':
+    case 't':
+    case 'L':
+        spec->length = (*q == 'L') ? 'D' : *q;
+        q++;
+        break;
+    default:
+        break;
+    }
+
+    spec->conv = *q;
+    if (*q != '\0') {
+        q++;
+    }
+    spec->len = (size_t)(q - spec->start);
+    return q;
+}
+
+static void capture_string(logger_record_t *rec, const char *s, uint64_t *out)
+{
+    size_t len;
+    size_t left;
+
+    if (s == NULL) {
+        s = "(null)";
+    }
+
+    left = LOGGER_STR_MAX - rec->str_used;
+    if (left == 0U) {
+        *out = (uint64_t)(LOGGER_STR_MAX - 1U);
+        rec->flags |= LOGGER_REC_TRUNCATED;
+        return;
+    }
+
+    len = strnlen(s, left - 1U);
+    memcpy(&rec->str[rec->str_used], s, len);
+    rec->str[rec->str_used + len] = '\0';
+    *out = (uint64_t)rec->str_used;
+    rec->str_used = (uint8_t)(rec->str_used + len + 1U);
+}
+
+/* copy raw arguments described by fmt into the record */
+static void capture_args(logger_record_t *rec, const char *fmt, va_list ap)
+{
+    logger_spec_t spec;
+    const char *p = fmt;
+    uint8_t i;
+
+    rec->nargs = 0U;
+    rec->str_used = 0U;
+    rec->str[LOGGER_STR_MAX - 1U] = '\0';
+
+    while ((p = next_spec(p, &spec)) != NULL) {
+        if (spec.conv == '%') {
+            continue;
+        }
+        if (rec->nargs + spec.stars + 1U > LOGGER_MAX_ARGS) {
+            rec->flags |= LOGGER_REC_TRUNCATED;
+            return;
+        }
+        for (i = 0U; i < spec.stars; i++) {
+            rec->args[rec->nargs++] = (uint64_t)(int64_t)va_arg(ap, int);
+        }
+
+        switch (spec.conv) {
+        case 'd':
+        case 'i':
+            switch (spec.length) {
+            case 'l':
+                rec->args[rec->nargs] = (uint64_t)(int64_t)va_arg(ap, long);
+                break;
+            case 'L':
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, long long);
+                break;
+            case 'z':
+                rec->args[rec->nargs] = (uint64_t)(int64_t)va_arg(ap, ssize_t);
+                break;
+            case 'j':
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, intmax_t);
+                break;
+            case 't':
+                rec->args[rec->nargs] = (uint64_t)(int64_t)va_arg(ap, ptrdiff_t);
+                break;
+            default:
+                rec->args[rec->nargs] = (uint64_t)(int64_t)va_arg(ap, int);
+                break;
+            }
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        case 'c':
+            switch (spec.length) {
+            case 'l':
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, unsigned long);
+                break;
+            case 'L':
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, unsigned long long);
+                break;
+            case 'z':
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, size_t);
+                break;
+            case 'j':
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, uintmax_t);
+                break;
+            case 't':
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, ptrdiff_t);
+                break;
+            default:
+                rec->args[rec->nargs] = (uint64_t)va_arg(ap, unsigned int);
+                break;
+            }
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (spec.length == 'D') {
+                rec->flags |= LOGGER_REC_TRUNCATED;
+                return;
+            }
+            {
+                double d = va_arg(ap, double);
+                memcpy(&rec->args[rec->nargs], &d, sizeof(d));
+            }
+            break;
+        case 's':
+            capture_string(rec, va_arg(ap, const char *), &rec->args[rec->nargs]);
+            break;
+        case 'p':
+            rec->args[rec->nargs] = (uint64_t)(uintptr_t)va_arg(ap, void *);
+            break;
+        default:
+            /* %n and unknown conversions: stop here */
+            rec->flags |= LOGGER_REC_TRUNCATED;
+            return;
+        }
+        rec->nargs++;
+    }
+}
+
+/* build spec string with '*' replaced by captured values */
+static size_t build_spec(const logger_spec_t *spec, const uint64_t *stars,
+        char *out, size_t out_size)
+{
+    size_t i;
+    size_t pos = 0U;
+    uint8_t star = 0U;
+    int len;
+
+    for (i = 0U; i < spec->len && pos + 1U < out_size; i++) {
+        char c = spec->start[i];
+
+        if (c != '*') {
+            out[pos++] = c;
+            continue;
+        }
+
+        if (spec->has_precision_star && star + 1U == spec->stars) {
+            /* negative precision means precision omitted */
+            if ((int)(int64_t)stars[star] < 0) {
+                if (pos > 0U && out[pos - 1U] == '.') {
+                    pos--;
+                }
+                star++;
+                continue;
+            }
+        }
+
+        len = snprintf(&out[pos], out_size - pos, "%d", (int)(int64_t)stars[star]);
+        if (len < 0 || (size_t)len >= out_size - pos) {
+            break;
+        }
+        pos += (size_t)len;
+        star++;
+    }
+
+    out[pos] = '\0';
+    return pos;
+}
+
+static int render_one(char *out, size_t left, const char *sp,
+        const logger_spec_t *spec, const logger_record_t *rec, uint64_t arg)
+{
+    double d;
+
+    switch (spec->conv) {
+    case 'd':
+    case 'i':
+        switch (spec->length) {
+        case 'l':
+            return snprintf(out, left, sp, (long)(int64_t)arg);
+        case 'L':
+            return snprintf(out, left, sp, (long long)(int64_t)arg);
+        case 'z':
+            return snprintf(out, left, sp, (ssize_t)(int64_t)arg);
+        case 'j':
+            return snprintf(out, left, sp, (intmax_t)(int64_t)arg);
+        case 't':
+            return snprintf(out, left, sp, (ptrdiff_t)(int64_t)arg);
+        default:
+            return snprintf(out, left, sp, (int)(int64_t)arg);
+        }
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+        switch (spec->length) {
+        case 'l':
+            return snprintf(out, left, sp, (unsigned long)arg);
+        case 'L':
+            return snprintf(out, left, sp, (unsigned long long)arg);
+        case 'z':
+            return snprintf(out, left, sp, (size_t)arg);
+        case 'j':
+            return snprintf(out, left, sp, (uintmax_t)arg);
+        case 't':
+            return snprintf(out, left, sp, (ptrdiff_t)arg);
+        default:
+            return snprintf(out, left, sp, (unsigned int)arg);
+        }
+    case 's':
+        return snprintf(out, left, sp, &rec->str[arg]);
+    case 'p':
+        return snprintf(out, left, sp, (void *)(uintptr_t)arg);
+    default:
+        memcpy(&d, &arg, sizeof(d));
+        return snprintf(out, left, sp, d);
+    }
+}
+
+/* format record into out as "func: message\n" */
+static size_t render_record(const logger_record_t *rec, char *out, size_t out_size)
+{
+    logger_spec_t spec;
+    char sp[LOGGER_SPEC_MAX];
+    const char *p;
+    const char *lit;
+    size_t pos;
+    uint8_t argi = 0U;
+    int len;
+
+    len = snprintf(out, out_size, "%s: ", rec->func);
+    if (len < 0 || (size_t)len >= out_size) {
+        return 0U;
+    }
+    pos = (size_t)len;
+
+    if ((rec->flags & LOGGER_REC_PREFORMATTED) != 0U) {
+        len = snprintf(&out[pos], out_size - pos, "%s", rec->str);
+        pos += (len < 0) ? 0U : (size_t)len;
+    } else {
+        lit = rec->fmt;
+        p = rec->fmt;
+        while ((p = next_spec(p, &spec)) != NULL) {
+            size_t lit_len = (size_t)(spec.start - lit);
+
+            if (pos + lit_len >= out_size) {
+                lit_len = out_size - pos - 1U;
+            }
+            memcpy(&out[pos], lit, lit_len);
+            pos += lit_len;
+            lit = p;
+
+            if (spec.conv == '%') {
+                if (pos + 1U < out_size) {
+                    out[pos++] = '%';
+                }
+                continue;
+            }
+            if (argi + spec.stars + 1U > rec->nargs) {
+                lit = spec.start + strlen(spec.start);
+                break;
+            }
+
+            build_spec(&spec, &rec->args[argi], sp, sizeof(sp));
+            argi = (uint8_t)(argi + spec.stars);
+            len = render_one(&out[pos], out_size - pos, sp, &spec, rec, rec->args[argi]);
+            argi++;
+            if (len > 0) {
+                pos += ((size_t)len >= out_size - pos) ? out_size - pos - 1U : (size_t)len;
+            }
+        }
+
+        len = snprintf(&out[pos], out_size - pos, "%s", lit);
+        pos += (len < 0) ? 0U : (((size_t)len >= out_size - pos) ? out_size - pos - 1U : (size_t)len);
+    }
+
+    if ((rec->flags & LOGGER_REC_TRUNCATED) != 0U && pos + 4U < out_size) {
+        memcpy(&out[pos], "...", 3U);
+        pos += 3U;
+    }
+    if (pos + 1U >= out_size) {
+        pos = out_size - 2U;
+    }
+    out[pos++] = '\n';
+    out[pos] = '\0';
+    return pos;
+}
+
+static void write_all(const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0U) {
+        ret = write(g_fd, buf, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += ret;
+        len -= (size_t)ret;
+    }
+}
+
+/* claim a ring slot, returns NULL if the ring is full */
+static logger_record_t *ring_claim(size_t *pos_out)
+{
+    logger_record_t *rec;
+    size_t pos;
+    size_t seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&g_head, memory_order_relaxed);
+    for (;;) {
+        rec = &g_ring[pos & LOGGER_RING_MASK];
+        seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&g_head, &pos, pos + 1U,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                *pos_out = pos;
+                return rec;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&g_dropped, 1U, memory_order_relaxed);
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&g_head, memory_order_relaxed);
+        }
+    }
+}
+
+static void ring_publish(logger_record_t *rec, size_t pos)
+{
+    atomic_store_explicit(&rec->seq, pos + 1U, memory_order_release);
+}
+
+/* drain ring into batch buffer, returns number of records written */
+static size_t ring_drain(char *batch, size_t batch_size)
+{
+    logger_record_t *rec;
+    size_t tail = atomic_load_explicit(&g_tail, memory_order_relaxed);
+    size_t used = 0U;
+    size_t count = 0U;
+
+    for (;;) {
+        rec = &g_ring[tail & LOGGER_RING_MASK];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) != tail + 1U) {
+            break;
+        }
+
+        if (batch_size - used < LOGGER_LINE_MAX) {
+            write_all(batch, used);
+            used = 0U;
+        }
+        used += render_record(rec, &batch[used], LOGGER_LINE_MAX);
+
+        atomic_store_explicit(&rec->seq, tail + LOGGER_RING_SIZE, memory_order_release);
+        tail++;
+        atomic_store_explicit(&g_tail, tail, memory_order_relaxed);
+        count++;
+    }
+
+    if (used > 0U) {
+        write_all(batch, used);
+    }
+    return count;
+}
+
+/*
+ * enter the ring, false when the logger is stopped and the caller writes
+ * synchronously; count first, then check, so logger_deinit either sees the
+ * writer or the writer sees g_running cleared
+ */
+static bool writer_enter(void)
+{
+    atomic_fetch_add(&g_writers, 1U);
+    if (atomic_load(&g_running)) {
+        return true;
+    }
+    atomic_fetch_sub_explicit(&g_writers, 1U, memory_order_release);
+    return false;
+}
+
+static void writer_exit(void)
+{
+    atomic_fetch_sub_explicit(&g_writers, 1U, memory_order_release);
+}
+
+static void *logger_thread(void *arg)
+{
+    static char batch[LOGGER_BATCH_SIZE];
+    struct timespec ts;
+
+    (void)arg;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = LOGGER_FLUSH_INTERVAL_NS;
+
+    while (atomic_load(&g_running)) {
+        if (ring_drain(batch, sizeof(batch)) == 0U) {
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    /* writers that saw g_running publish what they claimed, after that
+     * every claimed slot is published and one drain empties the ring */
+    while (atomic_load(&g_writers) != 0U) {
+        if (ring_drain(batch, sizeof(batch)) == 0U) {
+            sched_yield();
+        }
+    }
+    ring_drain(batch, sizeof(batch));
+    return NULL;
+}
+
+int logger_init(int fd)
+{
+    size_t i;
+
+    if (fd < 0 || atomic_load(&g_running)) {
+        return -1;
+    }
+
+    for (i = 0U; i < LOGGER_RING_SIZE; i++) {
+        atomic_store_explicit(&g_ring[i].seq, i, memory_order_relaxed);
+    }
+    atomic_store(&g_head, 0U);
+    atomic_store(&g_tail, 0U);
+    g_fd = fd;
+
+    atomic_store(&g_running, true);
+    if (pthread_create(&g_thread, NULL, logger_thread, NULL) != 0) {
+        atomic_store(&g_running, false);
+        g_fd = STDERR_FILENO;
+        return -1;
+    }
+
+    return 0;
+}
+
+void logger_deinit(void)
+{
+    if (!atomic_load(&g_running)) {
+        return;
+    }
+
+    atomic_store(&g_running, false);
+    pthread_join(g_thread, NULL);
+    g_fd = STDERR_FILENO;
+}
+
+void logger_set_level(logger_level_t level)
+{
+    atomic_store_explicit(&g_logger_level, (int)level, memory_order_relaxed);
+}
+
+logger_level_t logger_get_level(void)
+{
+    return (logger_level_t)atomic_load_explicit(&g_logger_level, memory_order_relaxed);
+}
+
+int logger_level_from_string(const char *name, logger_level_t *level)
+{
+    size_t i;
+
+    if (name == NULL || level == NULL) {
+        return -1;
+    }
+
+    for (i = 0U; i < LEVEL_NAMES_COUNT; i++) {
+        if (strcmp(name, LEVEL_NAMES[i]) == 0 ||
+                (name[0] == (char)('0' + i) && name[1] == '\0')) {
+            *level = (logger_level_t)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *logger_level_to_string(logger_level_t level)
+{
+    if ((size_t)level >= LEVEL_NAMES_COUNT) {
+        return "unknown";
+    }
+    return LEVEL_NAMES[level];
+}
+
+void logger_write(logger_level_t level, const char *func, const char *fmt, ...)
+{
+    logger_record_t *rec;
+    size_t pos;
+    va_list ap;
+
+    if (fmt == NULL) {
+        return;
+    }
+
+    if (!writer_enter()) {
+        char line[LOGGER_LINE_MAX];
+        int len;
+        int len2;
+
+        len = snprintf(line, sizeof(line), "%s: ", func);
+        if (len < 0 || (size_t)len >= sizeof(line) - 1U) {
+            return;
+        }
+        va_start(ap, fmt);
+        len2 = vsnprintf(&line[len], sizeof(line) - (size_t)len - 1U, fmt, ap);
+        va_end(ap);
+        if (len2 > 0) {
+            len += ((size_t)len2 >= sizeof(line) - (size_t)len - 1U) ?
+                (int)(sizeof(line) - (size_t)len - 2U) : len2;
+        }
+        line[len++] = '\n';
+        write_all(line, (size_t)len);
+        return;
+    }
+
+    rec = ring_claim(&pos);
+    if (rec == NULL) {
+        writer_exit();
+        return;
+    }
+
+    rec->fmt = fmt;
+    rec->func = func;
+    rec->level = (uint8_t)level;
+    rec->flags = 0U;
+
+    va_start(ap, fmt);
+    capture_args(rec, fmt, ap);
+    va_end(ap);
+
+    ring_publish(rec, pos);
+    writer_exit();
+}
+
+void logger_module_log(int level, const char *fmt, ...)
+{
+    logger_record_t *rec;
+    logger_level_t lvl;
+    size_t pos;
+    va_list ap;
+    char text[LOGGER_STR_MAX];
+
+    switch (level) {
+    case MODULE_LOG_ERROR:
+        lvl = LOGGER_LEVEL_ERROR;
+        break;
+    case MODULE_LOG_INFO:
+        lvl = LOGGER_LEVEL_INFO;
+        break;
+    default:
+        lvl = LOGGER_LEVEL_DEBUG;
+        break;
+    }
+
+    if (fmt == NULL || !LOGGER_ENABLED(lvl)) {
+        return;
+    }
+
+    if (!writer_enter()) {
+        va_start(ap, fmt);
+        vsnprintf(text, sizeof(text), fmt, ap);
+        va_end(ap);
+        logger_write(lvl, "module", "%s", text);
+        return;
+    }
+
+    rec = ring_claim(&pos);
+    if (rec == NULL) {
+        writer_exit();
+        return;
+    }
+
+    rec->fmt = NULL;
+    rec->func = "module";
+    rec->level = (uint8_t)lvl;
+    rec->flags = LOGGER_REC_PREFORMATTED;
+    rec->nargs = 0U;
+
+    va_start(ap, fmt);
+    if (vsnprintf(rec->str, sizeof(rec->str), fmt, ap) >= (int)sizeof(rec->str)) {
+        rec->flags |= LOGGER_REC_TRUNCATED;
+    }
+    va_end(ap);
+
+    ring_publish(rec, pos);
+    writer_exit();
+}
+
+uint64_t logger_get_dropped(void)
+{
+    return (uint64_t)atomic_load_explicit(&g_dropped, memory_order_relaxed);
+}
+
+size_t logger_get_queue_depth(void)
+{
+    size_t head = atomic_load_explicit(&g_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&g_tail, memory_order_relaxed);
+
+    return (head > tail) ? head - tail : 0U;
+}
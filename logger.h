@@ -0,0 +1,105 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    LOGGER_LEVEL_ERROR = 0,
+    LOGGER_LEVEL_WARN = 1,
+    LOGGER_LEVEL_INFO = 2,
+    LOGGER_LEVEL_DEBUG = 3
+} logger_level_t;
+
+/* current level threshold, read by LOGGER_ENABLED() on the hot path */
+extern atomic_int g_logger_level;
+
+#define LOGGER_ENABLED(level) \
+    ((int)(level) <= atomic_load_explicit(&g_logger_level, memory_order_relaxed))
+
+/* single branch when the level is disabled, arguments are not evaluated */
+#define LOGGER_WRITE(level, fmt, ...) \
+    do { \
+        if (LOGGER_ENABLED(level)) { \
+            logger_write((level), __func__, fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * start background flush thread
+ * records written before init (or after deinit) are formatted synchronously
+ * @param fd output file descriptor (usually STDERR_FILENO)
+ * @return 0 on success, -1 on error
+ */
+int logger_init(int fd);
+
+/**
+ * flush pending records and stop background thread
+ * waits for writers that already entered the ring, later writes go
+ * straight to stderr
+ */
+void logger_deinit(void);
+
+/**
+ * set level threshold, records above it cost a single branch
+ * @param level new threshold
+ */
+void logger_set_level(logger_level_t level);
+
+/**
+ * get level threshold
+ * @return current threshold
+ */
+logger_level_t logger_get_level(void);
+
+/**
+ * parse level name ("error", "warn", "info", "debug") or number
+ * @param name level name
+ * @param level output level
+ * @return 0 on success, -1 on unknown name
+ */
+int logger_level_from_string(const char *name, logger_level_t *level);
+
+/**
+ * get level name
+ * @param level log level
+ * @return static string
+ */
+const char *logger_level_to_string(logger_level_t level);
+
+/**
+ * record format string id and raw arguments into ring buffer
+ * fmt and func must have static storage duration, they are formatted later
+ * %s arguments are copied, %n and long double are not supported
+ * drops the record if the ring is full
+ * @param level log level
+ * @param func caller name
+ * @param fmt printf-style format string
+ */
+void logger_write(logger_level_t level, const char *func, const char *fmt, ...)
+        __attribute__((format(printf, 3, 4)));
+
+/**
+ * log callback for module_init_args_t.log
+ * module format strings live in module memory which may be unmapped
+ * before the flush thread runs, so the message is formatted eagerly
+ * @param level MODULE_LOG_* level
+ * @param fmt printf-style format string
+ */
+void logger_module_log(int level, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+/**
+ * get number of records dropped because the ring was full
+ * @return dropped record count
+ */
+uint64_t logger_get_dropped(void);
+
+/**
+ * get number of records waiting for the logger thread
+ * @return approximate ring occupancy
+ */
+size_t logger_get_queue_depth(void);
+
+#endif /* LOGGER_H */
@@ -1,7 +1,20 @@
+#define _GNU_SOURCE
+#include "flightrec.h"
+#include "host_clock.h"
+#include "host_pool.h"
+#include "host_reactor.h"
+#include "host_timer.h"
+#include "image_cache.h"
+#include "logger.h"
+#include "manifest.h"
+#include "metrics.h"
 #include "module_loader.h"
 #include "module_interface.h"
+#include "module_reaper.h"
 #include "rpc.h"
 #include "rpc_commands.h"
+#include "stats.h"
+#include "top.h"
 
 #include <errno.h>
 #include <pthread.h>
@@ -11,13 +24,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <ucontext.h>
 #include <unistd.h>
 
+#ifdef KMODLIKE_SINGLE_THREADED
+/* the daemon loop and the rpc thread share the loader */
+#error "the daemon is multi-threaded, build only the library with KMODLIKE_SINGLE_THREADED"
+#endif
+
 #define DAEMON_LOOP_INTERVAL_SEC 1U
 
 typedef struct {
     module_loader_t *module_loader;
-    atomic_bool fatal_signal_received;
+    /* shared by all modules instead of threads of their own */
+    host_pool_t *pool;
+    host_timer_wheel_t *timers;
+    host_reactor_t *reactor;
+    /* modules loaded at startup, each on its own loader */
+    manifest_t *manifest;
+    /* unloads idle lazy manifest modules, NULL when disabled */
+    module_reaper_t *reaper;
+    /* MODULE_LOAD_* bits every loader gets */
+    uint32_t load_flags;
 } app_context_t;
 
 static const char *signal_name(int sig)
@@ -40,18 +69,81 @@ static const char *signal_name(int sig)
     }
 }
 
-static app_context_t *g_app_context = NULL;
+/* the fatal path dumps the flight recorder once per crash */
+static atomic_bool g_flightrec_dumped = ATOMIC_VAR_INIT(false);
+
+/* program counter at the fault, 0 on unknown platforms */
+static uintptr_t fault_pc(const void *context)
+{
+    const ucontext_t *uc = context;
 
+    if (uc == NULL) {
+        return 0U;
+    }
+#if defined(__x86_64__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return (uintptr_t)uc->uc_mcontext.pc;
+#else
+    return 0U;
+#endif
+}
+
+static void write_str(const char *s)
+{
+    if (write(STDERR_FILENO, s, strlen(s)) < 0) {
+        return;
+    }
+}
+
+/*
+ * async-signal-safe: no locks and no stdio
+ * the pc names the code that faulted, si_addr only the memory it touched,
+ * so a host bug dereferencing a pointer into a module is not blamed on it;
+ * si_addr is meaningless for kill(2), sigqueue(3) and abort()
+ */
 static void fatal_signal_handler(int sig, siginfo_t *info, void *context)
 {
-    (void)info;
-    (void)context;
+    struct sigaction sa;
+    module_loader_t *loader;
+    bool fatal;
+    uintptr_t addr = (info != NULL && info->si_code > 0) ? (uintptr_t)info->si_addr : 0U;
+
+    loader = module_loader_find_by_fault(fault_pc(context), info);
+    /* nobody else would unload a module whose init or fini faulted */
+    fatal = loader == NULL || module_loader_in_init_or_fini();
+
+    /* a module thread keeps faulting until the main loop unloads it,
+     * a pool worker leaves the module task and goes back to its loop */
+    if (loader != NULL && !module_loader_signal_crash(loader)) {
+        host_pool_abandon_task();
+        if (!fatal) {
+            return;
+        }
+    }
 
-    if (g_app_context != NULL && g_app_context->module_loader != NULL &&
-            module_loader_get_state(g_app_context->module_loader) == MODULE_STATE_LOADED) {
-        fprintf(stderr, "fatal signal %s received from module\n", signal_name(sig));
-        atomic_store(&g_app_context->fatal_signal_received, true);
+    flightrec_record(FLIGHTREC_SIGNAL, (uint64_t)sig, (uint64_t)addr, signal_name(sig));
+    if (!atomic_exchange(&g_flightrec_dumped, true)) {
+        write_str("flight recorder, oldest first:\n");
+        flightrec_dump_fd(STDERR_FILENO);
     }
+
+    write_str("fatal signal ");
+    write_str(signal_name(sig));
+    write_str((loader != NULL) ? " raised by module code\n" : " raised by host code\n");
+    if (!fatal) {
+        host_pool_abandon_task();
+        return;
+    }
+
+    /* host crash or a fault in init or fini: let the default action terminate the process */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+    raise(sig);
 }
 
 static const int FATAL_SIGNALS[] = {
@@ -60,13 +152,11 @@ static const int FATAL_SIGNALS[] = {
 
 #define FATAL_SIGNALS_COUNT (sizeof(FATAL_SIGNALS) / sizeof(FATAL_SIGNALS[0]))
 
-static void setup_signal_handlers(app_context_t *ctx)
+static void setup_signal_handlers(void)
 {
     struct sigaction sa;
     size_t i;
 
-    g_app_context = ctx;
-
     memset(&sa, 0, sizeof(sa));
     sa.sa_sigaction = fatal_signal_handler;
     sa.sa_flags = SA_SIGINFO;
@@ -81,18 +171,221 @@ static void setup_signal_handlers(app_context_t *ctx)
     }
 }
 
+/* commands forwarded to the daemon by client mode */
+static const char *const CLIENT_COMMANDS[] = {
+    "insmod", "rmmod", "loglevel", "trace", "metrics", "lockprof", "flightrec"
+};
+
+#define CLIENT_COMMANDS_COUNT (sizeof(CLIENT_COMMANDS) / sizeof(CLIENT_COMMANDS[0]))
+
+static bool is_client_command(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < CLIENT_COMMANDS_COUNT; i++) {
+        if (strcmp(name, CLIENT_COMMANDS[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* daemon options come in pairs, -1 on anything else */
+static int parse_daemon_options(int argc, char **argv, const char **metrics_socket,
+        const char **manifest_path, uint32_t *manifest_threads, uint32_t *idle_unload_sec,
+        uint32_t *image_cache, uint32_t *load_flags)
+{
+    int i;
+
+    for (i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            return -1;
+        }
+        if (strcmp(argv[i], "--metrics-socket") == 0) {
+            *metrics_socket = argv[i + 1];
+        } else if (strcmp(argv[i], "--manifest") == 0) {
+            *manifest_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--manifest-threads") == 0) {
+            *manifest_threads = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--idle-unload-sec") == 0) {
+            *idle_unload_sec = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--image-cache") == 0) {
+            *image_cache = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--prefault") == 0) {
+            if (strcmp(argv[i + 1], "off") == 0) {
+                *load_flags = 0U;
+            } else if (strcmp(argv[i + 1], "on") == 0) {
+                *load_flags = MODULE_LOAD_PREFAULT;
+            } else if (strcmp(argv[i + 1], "huge") == 0) {
+                *load_flags = MODULE_LOAD_PREFAULT | MODULE_LOAD_HUGE_TEXT;
+            } else {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* hand each manifest loader the same host services as the default one */
+static void setup_manifest_loader(void *arg, module_loader_t *loader)
+{
+    app_context_t *ctx = arg;
+
+    module_loader_set_pool(loader, ctx->pool, HOST_POOL_DEFAULT_MODULE_CONCURRENCY);
+    module_loader_set_timers(loader, ctx->timers);
+    module_loader_set_reactor(loader, ctx->reactor);
+    module_loader_set_load_flags(loader, ctx->load_flags);
+}
+
+/* stats slot of a manifest module, the default loader keeps slot 0 */
+static uint32_t manifest_slot(uint32_t index)
+{
+    return STATS_DEFAULT_SLOT + 1U + index;
+}
+
+static int start_manifest(app_context_t *ctx, const char *path, uint32_t threads)
+{
+    manifest_module_info_t info;
+    manifest_report_t report;
+    module_loader_stats_t ls;
+    module_init_args_t init_args;
+    char error[256];
+    uint32_t i;
+
+    ctx->manifest = manifest_read(path, error, sizeof(error));
+    if (ctx->manifest == NULL) {
+        fprintf(stderr, "bad manifest: %s\n", error);
+        return -1;
+    }
+    /* the modules past the last slot still load, they are only missing from stats */
+    if (manifest_count(ctx->manifest) > 0U &&
+            manifest_slot(manifest_count(ctx->manifest) - 1U) >= STATS_MAX_MODULES) {
+        manifest_get_module(ctx->manifest, STATS_MAX_MODULES - manifest_slot(0U), &info);
+        fprintf(stderr, "manifest: %u modules but %u stats slots, %s and the %u after it "
+                "get no stats, top or metrics\n", manifest_count(ctx->manifest),
+                STATS_MAX_MODULES - manifest_slot(0U), info.name,
+                manifest_count(ctx->manifest) - (STATS_MAX_MODULES - manifest_slot(0U)) - 1U);
+    }
+
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_2;
+    init_args.size = (uint32_t)sizeof(init_args);
+    init_args.log = logger_module_log;
+    init_args.get_time = host_clock_get_time;
+    init_args.clock = host_clock_ops();
+    manifest_start(ctx->manifest, &init_args, setup_manifest_loader, ctx, threads);
+
+    for (i = 0U; i < manifest_count(ctx->manifest); i++) {
+        manifest_get_module(ctx->manifest, i, &info);
+        if (info.err == MODULE_ERR_SUCCESS && info.lazy) {
+            fprintf(stderr, "manifest: %s registered, loads on first use\n", info.name);
+        } else if (info.err == MODULE_ERR_SUCCESS) {
+            module_loader_get_stats(info.loader, &ls);
+            fprintf(stderr, "manifest: %s loaded in %llu us (dlopen %llu, resolve %llu, "
+                    "prefault %llu, init %llu), ready at %llu us\n", info.name,
+                    (unsigned long long)(info.load_ns / 1000U),
+                    (unsigned long long)(ls.load_phase_ns[MODULE_LOAD_PHASE_DLOPEN] / 1000U),
+                    (unsigned long long)(ls.load_phase_ns[MODULE_LOAD_PHASE_RESOLVE] / 1000U),
+                    (unsigned long long)(ls.load_phase_ns[MODULE_LOAD_PHASE_PREFAULT] / 1000U),
+                    (unsigned long long)(ls.load_phase_ns[MODULE_LOAD_PHASE_INIT] / 1000U),
+                    (unsigned long long)(info.end_ns / 1000U));
+            if (ls.unindexed) {
+                fprintf(stderr, "manifest: %s: crash attribution unavailable, faults on "
+                        "its own threads terminate the daemon\n", info.name);
+            }
+        } else {
+            fprintf(stderr, "manifest: %s failed: %s (%s)\n", info.name, info.path,
+                    module_error_to_string(info.err));
+        }
+        if (manifest_slot(i) < STATS_MAX_MODULES) {
+            stats_publish_loader(manifest_slot(i), info.loader);
+        }
+    }
+    manifest_get_report(ctx->manifest, &report);
+    fprintf(stderr, "manifest: %u of %u modules loaded, %u lazy, in %llu ms on %u threads, "
+            "serial %llu ms, critical path %llu ms\n",
+            report.loaded, report.modules, report.lazy,
+            (unsigned long long)(report.wall_ns / 1000000U),
+            report.threads, (unsigned long long)(report.sum_ns / 1000000U),
+            (unsigned long long)(report.critical_path_ns / 1000000U));
+    return 0;
+}
+
+/* watch the lazy manifest modules, the others are never reaped */
+static void start_reaper(app_context_t *ctx, uint32_t idle_unload_sec)
+{
+    manifest_module_info_t info;
+    uint32_t i;
+
+    ctx->reaper = module_reaper_create(idle_unload_sec * 1000U, 0U);
+    if (ctx->reaper == NULL) {
+        fprintf(stderr, "failed to start idle reaper, idle modules stay loaded\n");
+        return;
+    }
+    for (i = 0U; i < manifest_count(ctx->manifest); i++) {
+        manifest_get_module(ctx->manifest, i, &info);
+        if (info.lazy && info.err == MODULE_ERR_SUCCESS) {
+            module_reaper_add(ctx->reaper, info.loader);
+        }
+    }
+    fprintf(stderr, "lazy modules idle for %u s are unloaded\n", idle_unload_sec);
+}
+
+/* the library only counts what a crashed module left behind, say it here */
+static void report_crash_unload(const char *name, const module_loader_t *loader)
+{
+    module_loader_stats_t ls;
+
+    if (module_loader_get_stats(loader, &ls) != MODULE_ERR_SUCCESS) {
+        return;
+    }
+    if (ls.stuck_calls != 0U) {
+        fprintf(stderr, "%s: %u calls stuck in the crashed module\n", name, ls.stuck_calls);
+    }
+    if (ls.stuck_tasks != 0U) {
+        fprintf(stderr, "%s: %u pool tasks stuck in the crashed module\n", name,
+                ls.stuck_tasks);
+    }
+}
+
+/* crash recovery and stats of the manifest loaders, from the daemon loop
+ * slots gets the loader of every manifest stats slot for stats_publish_memory */
+static void poll_manifest(app_context_t *ctx, module_loader_t **slots)
+{
+    manifest_module_info_t info;
+    uint32_t i;
+
+    for (i = 0U; i < manifest_count(ctx->manifest); i++) {
+        manifest_get_module(ctx->manifest, i, &info);
+        if (module_loader_crash_pending(info.loader)) {
+            fprintf(stderr, "fatal signal received from %s, unloading...\n", info.name);
+            module_loader_mark_crashed(info.loader);
+            module_loader_unload(info.loader);
+            report_crash_unload(info.name, info.loader);
+            atomic_store(&g_flightrec_dumped, false);
+        }
+        if (manifest_slot(i) < STATS_MAX_MODULES) {
+            stats_publish_loader(manifest_slot(i), info.loader);
+            slots[manifest_slot(i)] = info.loader;
+        }
+    }
+}
+
 static int run_rpc_client(int argc, char **argv)
 {
-    char response[MAX_PACKET_SIZE];
+    static char response[RPC_MAX_REPLY_SIZE];
     char socket_path[RPC_SOCKET_PATH_MAX];
     char tmp_path[RPC_SOCKET_PATH_MAX];
     int32_t ret;
     char *rpc_argv[MAX_ARGS];
     int32_t rpc_argc = 0;
     const char *base;
+    int i;
 
     if (argc < 2) {
-        fprintf(stderr, "usage: %s insmod <path> | %s rmmod\n", argv[0], argv[0]);
+        fprintf(stderr, "usage: %s <command> [args...]\n", argv[0]);
         return 1;
     }
 
@@ -106,15 +399,14 @@ static int run_rpc_client(int argc, char **argv)
     base = (base != NULL) ? base + 1 : argv[0];
     snprintf(tmp_path, sizeof(tmp_path), "/tmp/%s.sock", base);
 
-    rpc_argv[rpc_argc++] = argv[1];
+    if (strcmp(argv[1], "insmod") == 0 && argc < 3) {
+        fprintf(stderr, "usage: %s insmod <path>\n", argv[0]);
+        return 1;
+    }
 
-    if (strcmp(argv[1], "insmod") == 0) {
-        if (argc >= 3) {
-            rpc_argv[rpc_argc++] = argv[2];
-        } else {
-            fprintf(stderr, "usage: %s insmod <path>\n", argv[0]);
-            return 1;
-        }
+    /* forward command name and its arguments */
+    for (i = 1; i < argc && rpc_argc < MAX_ARGS - 1; i++) {
+        rpc_argv[rpc_argc++] = argv[i];
     }
 
     /* Try /var/run first, then /tmp fallback */
@@ -137,14 +429,39 @@ static int run_rpc_client(int argc, char **argv)
 
 int main(int argc, char **argv)
 {
+    const char *metrics_socket = NULL;
+    const char *manifest_path = NULL;
+    uint32_t manifest_threads = 0U;
+    uint32_t idle_unload_sec = 0U;
+    uint32_t image_cache = 0U;
+    uint32_t load_flags = 0U;
+
     if (argc > 1) {
-        if (strcmp(argv[1], "insmod") == 0 || strcmp(argv[1], "rmmod") == 0) {
+        if (strcmp(argv[1], "top") == 0) {
+            return top_run(NULL,
+                    argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : TOP_DEFAULT_INTERVAL_MS,
+                    argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : 0U);
+        } else if (is_client_command(argv[1])) {
             return run_rpc_client(argc, argv);
-        } else {
-            fprintf(stderr, "usage: %s [insmod <path>|rmmod]\n", argv[0]);
+        } else if (parse_daemon_options(argc, argv, &metrics_socket, &manifest_path,
+                &manifest_threads, &idle_unload_sec, &image_cache, &load_flags) != 0) {
+            fprintf(stderr, "usage: %s [insmod <path>|rmmod|loglevel [level]|trace ...|metrics|lockprof ...|flightrec ...|top]\n",
+                    argv[0]);
             fprintf(stderr, "  without arguments: run as daemon with rpc server\n");
+            fprintf(stderr, "  --metrics-socket <path>: run as daemon, serve metrics on a unix stream socket\n");
+            fprintf(stderr, "  --manifest <path>: run as daemon, load the listed modules in parallel first\n");
+            fprintf(stderr, "  --manifest-threads <n>: loading threads, default one per online cpu\n");
+            fprintf(stderr, "  --idle-unload-sec <n>: unload lazy manifest modules unused for n seconds\n");
+            fprintf(stderr, "  --image-cache <n>: keep up to n unloaded module images mapped for fast reload\n");
+            fprintf(stderr, "  --prefault <off|on|huge>: map module images in at load, huge also puts text on huge pages\n");
             fprintf(stderr, "  insmod <path>: load module via rpc and exit\n");
             fprintf(stderr, "  rmmod: unload module via rpc and exit\n");
+            fprintf(stderr, "  loglevel [error|warn|info|debug]: get or set daemon log level\n");
+            fprintf(stderr, "  trace [rate <n>|dump <path>|clear]: control request tracing\n");
+            fprintf(stderr, "  metrics: print counters in prometheus text format\n");
+            fprintf(stderr, "  lockprof [on|off|reset]: lock contention profile\n");
+            fprintf(stderr, "  flightrec [<events>|dump <path>]: recent loader and rpc events\n");
+            fprintf(stderr, "  top [interval_ms] [iterations]: live view of the stats segment\n");
             return 1;
         }
     }
@@ -152,9 +469,18 @@ int main(int argc, char **argv)
     app_context_t ctx;
 
     ctx.module_loader = NULL;
-    atomic_store(&ctx.fatal_signal_received, false);
+    ctx.pool = NULL;
+    ctx.timers = NULL;
+    ctx.reactor = NULL;
+    ctx.manifest = NULL;
+    ctx.reaper = NULL;
+    ctx.load_flags = load_flags;
 
-    setup_signal_handlers(&ctx);
+    setup_signal_handlers();
+
+    if (logger_init(STDERR_FILENO) != 0) {
+        fprintf(stderr, "failed to start async logger, logging synchronously\n");
+    }
 
     ctx.module_loader = module_loader_create();
     if (ctx.module_loader == NULL) {
@@ -162,9 +488,56 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    module_loader_set_load_flags(ctx.module_loader, ctx.load_flags);
+
+    /* calibrate now rather than on the first insmod */
+    host_clock_init();
+#ifndef KMODLIKE_STATIC
+    /* these grow on demand, the static build runs without them */
+    ctx.pool = host_pool_create(0U);
+    if (ctx.pool == NULL) {
+        fprintf(stderr, "failed to start host thread pool, modules get none\n");
+    }
+    module_loader_set_pool(ctx.module_loader, ctx.pool, HOST_POOL_DEFAULT_MODULE_CONCURRENCY);
+    ctx.timers = host_timer_wheel_create();
+    if (ctx.timers == NULL) {
+        fprintf(stderr, "failed to start timer wheel, modules get no timers\n");
+    }
+    module_loader_set_timers(ctx.module_loader, ctx.timers);
+    ctx.reactor = host_reactor_create();
+    if (ctx.reactor == NULL) {
+        fprintf(stderr, "failed to start reactor, modules get no fd events\n");
+    }
+    module_loader_set_reactor(ctx.module_loader, ctx.reactor);
+#endif
+
+    if (stats_init(NULL) != 0) {
+        fprintf(stderr, "failed to publish stats segment %s: %s\n",
+                STATS_SHM_DEFAULT_NAME, strerror(errno));
+    }
+    stats_publish_loader(STATS_DEFAULT_SLOT, ctx.module_loader);
+    /* before the manifest, so reaped modules come back from the cache too */
+    image_cache_set_capacity(image_cache);
+
+    if (manifest_path != NULL && start_manifest(&ctx, manifest_path, manifest_threads) != 0) {
+        module_loader_destroy(ctx.module_loader);
+        host_reactor_destroy(ctx.reactor);
+        host_timer_wheel_destroy(ctx.timers);
+        host_pool_destroy(ctx.pool);
+        return 1;
+    }
+    if (ctx.manifest != NULL && idle_unload_sec > 0U) {
+        start_reaper(&ctx, idle_unload_sec);
+    }
+
     if (rpc_init(NULL, ctx.module_loader) == NULL) {
         fprintf(stderr, "failed to initialize rpc server\n");
+        module_reaper_destroy(ctx.reaper);
+        manifest_destroy(ctx.manifest);
         module_loader_destroy(ctx.module_loader);
+        host_reactor_destroy(ctx.reactor);
+        host_timer_wheel_destroy(ctx.timers);
+        host_pool_destroy(ctx.pool);
         return 1;
     }
 
@@ -172,6 +545,11 @@ int main(int argc, char **argv)
 
     register_str_func("insmod", rpc_insmod_func);
     register_str_func("rmmod", rpc_rmmod_func);
+    register_str_func("loglevel", rpc_loglevel_func);
+    register_str_func("trace", rpc_trace_func);
+    register_str_func("metrics", rpc_metrics_func);
+    register_str_func("lockprof", rpc_lockprof_func);
+    register_str_func("flightrec", rpc_flightrec_func);
     register_str_func("help", help_func);
 
     {
@@ -183,30 +561,66 @@ int main(int argc, char **argv)
             fprintf(stderr, "kmodlike daemon started\n");
         }
     }
+    if (metrics_socket != NULL) {
+        if (metrics_listener_start(metrics_socket) == 0) {
+            fprintf(stderr, "metrics served on %s\n", metrics_socket);
+        } else {
+            fprintf(stderr, "failed to serve metrics on %s: %s\n", metrics_socket,
+                    strerror(errno));
+        }
+    }
     fprintf(stderr, "use: ./kmodlike insmod mod.so or ./kmodlike rmmod\n");
 
     while (1) {
+        module_loader_t *slots[STATS_MAX_MODULES] = { NULL };
+
         sleep((unsigned int)DAEMON_LOOP_INTERVAL_SEC);
+        poll_manifest(&ctx, slots);
 
-        if (atomic_load(&ctx.fatal_signal_received)) {
+        if (module_loader_crash_pending(ctx.module_loader)) {
             fprintf(stderr, "fatal signal received from module, unloading...\n");
+            module_loader_mark_crashed(ctx.module_loader);
             module_loader_unload(ctx.module_loader);
+            report_crash_unload("module", ctx.module_loader);
+            stats_publish_loader(STATS_DEFAULT_SLOT, ctx.module_loader);
             fprintf(stderr, "module crashed and was unloaded\n");
-            atomic_store(&ctx.fatal_signal_received, false);
+            atomic_store(&g_flightrec_dumped, false);
             continue;
         }
 
         if (module_loader_get_state(ctx.module_loader) == MODULE_STATE_LOADED) {
+            struct timespec t_start;
+            struct timespec t_end;
+
+            clock_gettime(CLOCK_MONOTONIC, &t_start);
             if (module_loader_call_hello(ctx.module_loader) != MODULE_ERR_SUCCESS) {
                 fprintf(stderr, "module not_loaded\n");
+            } else {
+                clock_gettime(CLOCK_MONOTONIC, &t_end);
+                stats_record_module_call(STATS_DEFAULT_SLOT,
+                        (uint64_t)(t_end.tv_sec - t_start.tv_sec) * 1000000000ULL +
+                        (uint64_t)t_end.tv_nsec - (uint64_t)t_start.tv_nsec);
             }
         } else {
             fprintf(stderr, "module not_loaded\n");
         }
+        stats_publish_loader(STATS_DEFAULT_SLOT, ctx.module_loader);
+        slots[STATS_DEFAULT_SLOT] = ctx.module_loader;
+        stats_publish_memory(slots, STATS_MAX_MODULES);
+        stats_publish_locks();
+        stats_publish_image_cache();
     }
 
+    module_reaper_destroy(ctx.reaper);
+    manifest_destroy(ctx.manifest);
     module_loader_destroy(ctx.module_loader);
+    host_reactor_destroy(ctx.reactor);
+    host_timer_wheel_destroy(ctx.timers);
+    host_pool_destroy(ctx.pool);
     rpc_deinit();
+    metrics_listener_stop();
+    stats_deinit();
+    logger_deinit();
 
     return 0;
 }
@@ -0,0 +1,660 @@
+#include "manifest.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* largest manifest file read by manifest_read() */
+#define MANIFEST_FILE_MAX (MANIFEST_MAX_MODULES * MANIFEST_LINE_MAX)
+
+typedef struct {
+    char name[MANIFEST_NAME_MAX];
+    char path[MANIFEST_PATH_MAX];
+    char params[MANIFEST_PARAMS_MAX];
+    /* dependency names as written, resolved into deps */
+    char dep_names[MANIFEST_MAX_DEPS][MANIFEST_NAME_MAX];
+    uint32_t deps[MANIFEST_MAX_DEPS];
+    uint32_t dep_count;
+    uint32_t line;
+    bool lazy;
+    bool bind_set;
+    /* MODULE_LOAD_* bits from the options, added to what setup sets */
+    uint32_t load_flags;
+    module_loader_t *loader;
+    module_error_t err;
+    /* dependencies not finished yet, guarded by the manifest mutex */
+    uint32_t pending;
+    bool dep_failed;
+    uint64_t load_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} entry_t;
+
+struct manifest {
+    entry_t entries[MANIFEST_MAX_MODULES];
+    uint32_t count;
+    /* dependencies before dependents */
+    uint32_t order[MANIFEST_MAX_MODULES];
+    bool started;
+    manifest_report_t report;
+    /* run state of manifest_start() */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    /* every module is queued exactly once, so a plain array is enough */
+    uint32_t ready[MANIFEST_MAX_MODULES];
+    uint32_t ready_head;
+    uint32_t ready_tail;
+    uint32_t done;
+    uint64_t base_ns;
+    module_init_args_t args;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void set_error(char *error, size_t error_size, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (error == NULL || error_size == 0U) {
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(error, error_size, fmt, ap);
+    va_end(ap);
+}
+
+/* copy the next whitespace-delimited token, false if it does not fit */
+static bool next_token(const char **cursor, const char *end, char *out, size_t out_size)
+{
+    const char *p = *cursor;
+    size_t len = 0U;
+
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    while (p + len < end && !isspace((unsigned char)p[len])) {
+        len++;
+    }
+    *cursor = p + len;
+    if (len >= out_size) {
+        return false;
+    }
+    memcpy(out, p, len);
+    out[len] = '\0';
+    return true;
+}
+
+static int find_entry(const manifest_t *manifest, const char *name)
+{
+    uint32_t i;
+
+    for (i = 0U; i < manifest->count; i++) {
+        if (strcmp(manifest->entries[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool parse_after(entry_t *entry, const char *list, char *error, size_t error_size)
+{
+    const char *p = list;
+    const char *comma;
+    size_t len;
+
+    if (*p == '\0') {
+        set_error(error, error_size, "line %u: bad dependency name", entry->line);
+        return false;
+    }
+    while (*p != '\0') {
+        comma = strchr(p, ',');
+        len = comma != NULL ? (size_t)(comma - p) : strlen(p);
+        if (len == 0U || len >= MANIFEST_NAME_MAX) {
+            set_error(error, error_size, "line %u: bad dependency name", entry->line);
+            return false;
+        }
+        if (entry->dep_count == MANIFEST_MAX_DEPS) {
+            set_error(error, error_size, "line %u: more than %u dependencies",
+                    entry->line, MANIFEST_MAX_DEPS);
+            return false;
+        }
+        memcpy(entry->dep_names[entry->dep_count], p, len);
+        entry->dep_names[entry->dep_count][len] = '\0';
+        entry->dep_count++;
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return true;
+}
+
+static bool parse_line(manifest_t *manifest, const char *line, const char *end,
+        uint32_t line_no, char *error, size_t error_size)
+{
+    entry_t *entry;
+    const char *p = line;
+    const char *mark;
+    char option[MANIFEST_LINE_MAX];
+    size_t len;
+
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (p == end || *p == '#') {
+        return true;
+    }
+    if (manifest->count == MANIFEST_MAX_MODULES) {
+        set_error(error, error_size, "line %u: more than %u modules", line_no,
+                MANIFEST_MAX_MODULES);
+        return false;
+    }
+
+    entry = &manifest->entries[manifest->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->line = line_no;
+    if (!next_token(&p, end, entry->name, sizeof(entry->name))) {
+        set_error(error, error_size, "line %u: module name too long", line_no);
+        return false;
+    }
+    if (!next_token(&p, end, entry->path, sizeof(entry->path)) || entry->path[0] == '\0') {
+        set_error(error, error_size, "line %u: missing or too long module path", line_no);
+        return false;
+    }
+    if (strchr(entry->name, ',') != NULL) {
+        set_error(error, error_size, "line %u: ',' in module name", line_no);
+        return false;
+    }
+    if (find_entry(manifest, entry->name) >= 0) {
+        set_error(error, error_size, "line %u: duplicate module '%s'", line_no, entry->name);
+        return false;
+    }
+
+    /* options until the first token that is not one */
+    for (;;) {
+        mark = p;
+        if (!next_token(&p, end, option, sizeof(option))) {
+            p = mark;
+            break;
+        }
+        if (strncmp(option, "after=", 6U) == 0 && entry->dep_count == 0U) {
+            if (!parse_after(entry, option + 6, error, error_size)) {
+                return false;
+            }
+        } else if (strcmp(option, "lazy") == 0 && !entry->lazy) {
+            entry->lazy = true;
+        } else if (strncmp(option, "bind=", 5U) == 0 && !entry->bind_set) {
+            if (strcmp(option + 5, "now") == 0) {
+                entry->load_flags |= MODULE_LOAD_BIND_NOW;
+            } else if (strcmp(option + 5, "lazy") != 0) {
+                set_error(error, error_size, "line %u: bind must be now or lazy", line_no);
+                return false;
+            }
+            entry->bind_set = true;
+        } else if (strcmp(option, "global") == 0 &&
+                (entry->load_flags & MODULE_LOAD_GLOBAL) == 0U) {
+            entry->load_flags |= MODULE_LOAD_GLOBAL;
+        } else if (strcmp(option, "deepbind") == 0 &&
+                (entry->load_flags & MODULE_LOAD_DEEPBIND) == 0U) {
+            entry->load_flags |= MODULE_LOAD_DEEPBIND;
+        } else {
+            p = mark;
+            break;
+        }
+    }
+
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    len = (size_t)(end - p);
+    while (len > 0U && isspace((unsigned char)p[len - 1U])) {
+        len--;
+    }
+    if (len >= sizeof(entry->params)) {
+        set_error(error, error_size, "line %u: params longer than %u bytes", line_no,
+                MANIFEST_PARAMS_MAX - 1U);
+        return false;
+    }
+    memcpy(entry->params, p, len);
+    entry->params[len] = '\0';
+
+    manifest->count++;
+    return true;
+}
+
+/* resolve dependency names and order the modules, Kahn's algorithm */
+static bool resolve(manifest_t *manifest, char *error, size_t error_size)
+{
+    uint32_t indegree[MANIFEST_MAX_MODULES];
+    uint32_t ordered = 0U;
+    uint32_t head = 0U;
+    uint32_t i;
+    uint32_t j;
+    uint32_t d;
+    int idx;
+
+    for (i = 0U; i < manifest->count; i++) {
+        entry_t *entry = &manifest->entries[i];
+
+        for (j = 0U; j < i; j++) {
+            if (strcmp(manifest->entries[j].path, entry->path) == 0) {
+                /* dlopen would hand both loaders the same image */
+                set_error(error, error_size, "line %u: '%s' loads the same path as '%s'",
+                        entry->line, entry->name, manifest->entries[j].name);
+                return false;
+            }
+        }
+        for (d = 0U; d < entry->dep_count; d++) {
+            idx = find_entry(manifest, entry->dep_names[d]);
+            if (idx < 0) {
+                set_error(error, error_size, "line %u: unknown dependency '%s'",
+                        entry->line, entry->dep_names[d]);
+                return false;
+            }
+            if (manifest->entries[idx].lazy && !entry->lazy) {
+                set_error(error, error_size, "line %u: '%s' depends on lazy module '%s'",
+                        entry->line, entry->name, entry->dep_names[d]);
+                return false;
+            }
+            entry->deps[d] = (uint32_t)idx;
+        }
+        indegree[i] = entry->dep_count;
+        if (indegree[i] == 0U) {
+            manifest->order[ordered++] = i;
+        }
+    }
+
+    while (head < ordered) {
+        uint32_t done = manifest->order[head++];
+
+        for (i = 0U; i < manifest->count; i++) {
+            for (d = 0U; d < manifest->entries[i].dep_count; d++) {
+                if (manifest->entries[i].deps[d] == done && --indegree[i] == 0U) {
+                    manifest->order[ordered++] = i;
+                }
+            }
+        }
+    }
+
+    if (ordered != manifest->count) {
+        for (i = 0U; i < manifest->count; i++) {
+            if (indegree[i] != 0U) {
+                set_error(error, error_size, "line %u: dependency cycle through '%s'",
+                        manifest->entries[i].line, manifest->entries[i].name);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+manifest_t *manifest_parse(const char *text, char *error, size_t error_size)
+{
+    manifest_t *manifest;
+    const char *line;
+    const char *end;
+    uint32_t line_no = 0U;
+
+    if (text == NULL) {
+        set_error(error, error_size, "no manifest text");
+        return NULL;
+    }
+
+    manifest = calloc(1, sizeof(*manifest));
+    if (manifest == NULL) {
+        set_error(error, error_size, "out of memory");
+        return NULL;
+    }
+
+    line = text;
+    while (*line != '\0') {
+        end = strchr(line, '\n');
+        if (end == NULL) {
+            end = line + strlen(line);
+        }
+        line_no++;
+        if ((size_t)(end - line) >= MANIFEST_LINE_MAX) {
+            set_error(error, error_size, "line %u: longer than %u bytes", line_no,
+                    MANIFEST_LINE_MAX - 1U);
+            free(manifest);
+            return NULL;
+        }
+        if (!parse_line(manifest, line, end, line_no, error, error_size)) {
+            free(manifest);
+            return NULL;
+        }
+        line = *end == '\n' ? end + 1 : end;
+    }
+
+    if (!resolve(manifest, error, error_size)) {
+        free(manifest);
+        return NULL;
+    }
+    if (pthread_mutex_init(&manifest->mutex, NULL) != 0) {
+        set_error(error, error_size, "mutex init failed");
+        free(manifest);
+        return NULL;
+    }
+    if (pthread_cond_init(&manifest->cond, NULL) != 0) {
+        set_error(error, error_size, "condition init failed");
+        pthread_mutex_destroy(&manifest->mutex);
+        free(manifest);
+        return NULL;
+    }
+    return manifest;
+}
+
+manifest_t *manifest_read(const char *path, char *error, size_t error_size)
+{
+    manifest_t *manifest;
+    FILE *f;
+    char *text;
+    size_t len;
+
+    if (path == NULL) {
+        set_error(error, error_size, "no manifest path");
+        return NULL;
+    }
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        set_error(error, error_size, "%s: %s", path, strerror(errno));
+        return NULL;
+    }
+    text = malloc(MANIFEST_FILE_MAX + 1U);
+    if (text == NULL) {
+        set_error(error, error_size, "out of memory");
+        fclose(f);
+        return NULL;
+    }
+    len = fread(text, 1, MANIFEST_FILE_MAX + 1U, f);
+    if (ferror(f) || len > MANIFEST_FILE_MAX) {
+        set_error(error, error_size, "%s: %s", path,
+                ferror(f) ? "read error" : "file too large");
+        free(text);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    text[len] = '\0';
+
+    manifest = manifest_parse(text, error, error_size);
+    free(text);
+    return manifest;
+}
+
+static void run_entry(manifest_t *manifest, entry_t *entry)
+{
+    module_init_args_t args;
+    uint64_t start;
+
+    start = now_ns();
+    entry->start_ns = start - manifest->base_ns;
+    if (entry->dep_failed) {
+        entry->err = MODULE_ERR_DEPENDENCY_FAILED;
+    } else {
+        args = manifest->args;
+        if (entry->params[0] != '\0') {
+            args.user_data = entry->params;
+        }
+        entry->err = entry->lazy ?
+                module_loader_register_lazy(entry->loader, entry->path, &args) :
+                module_loader_load(entry->loader, entry->path, &args);
+    }
+    entry->end_ns = now_ns() - manifest->base_ns;
+    entry->load_ns = entry->dep_failed ? 0U : entry->end_ns - entry->start_ns;
+}
+
+/* called with the mutex held: release dependents of a finished module */
+static void finish_entry(manifest_t *manifest, uint32_t index)
+{
+    bool failed = manifest->entries[index].err != MODULE_ERR_SUCCESS;
+    uint32_t i;
+    uint32_t d;
+
+    for (i = 0U; i < manifest->count; i++) {
+        entry_t *entry = &manifest->entries[i];
+
+        for (d = 0U; d < entry->dep_count; d++) {
+            if (entry->deps[d] != index) {
+                continue;
+            }
+            if (failed) {
+                entry->dep_failed = true;
+            }
+            if (--entry->pending == 0U) {
+                manifest->ready[manifest->ready_tail++] = i;
+            }
+        }
+    }
+    manifest->done++;
+    pthread_cond_broadcast(&manifest->cond);
+}
+
+static void *worker(void *arg)
+{
+    manifest_t *manifest = arg;
+    uint32_t index;
+
+    pthread_mutex_lock(&manifest->mutex);
+    for (;;) {
+        while (manifest->ready_head == manifest->ready_tail &&
+                manifest->done < manifest->count) {
+            pthread_cond_wait(&manifest->cond, &manifest->mutex);
+        }
+        if (manifest->ready_head == manifest->ready_tail) {
+            break;
+        }
+        index = manifest->ready[manifest->ready_head++];
+        pthread_mutex_unlock(&manifest->mutex);
+
+        run_entry(manifest, &manifest->entries[index]);
+
+        pthread_mutex_lock(&manifest->mutex);
+        finish_entry(manifest, index);
+    }
+    pthread_mutex_unlock(&manifest->mutex);
+    return NULL;
+}
+
+static void build_report(manifest_t *manifest, uint32_t threads)
+{
+    uint64_t finish[MANIFEST_MAX_MODULES];
+    manifest_report_t *report = &manifest->report;
+    uint32_t i;
+    uint32_t d;
+
+    memset(report, 0, sizeof(*report));
+    report->modules = manifest->count;
+    report->threads = threads;
+    report->wall_ns = now_ns() - manifest->base_ns;
+
+    /* dependencies come first in order, their finish time is known */
+    for (i = 0U; i < manifest->count; i++) {
+        uint32_t index = manifest->order[i];
+        const entry_t *entry = &manifest->entries[index];
+        uint64_t ready = 0U;
+
+        for (d = 0U; d < entry->dep_count; d++) {
+            if (finish[entry->deps[d]] > ready) {
+                ready = finish[entry->deps[d]];
+            }
+        }
+        finish[index] = ready + entry->load_ns;
+        if (finish[index] > report->critical_path_ns) {
+            report->critical_path_ns = finish[index];
+        }
+        report->sum_ns += entry->load_ns;
+        if (entry->err != MODULE_ERR_SUCCESS) {
+            report->failed++;
+        } else if (entry->lazy) {
+            report->lazy++;
+        } else {
+            report->loaded++;
+        }
+    }
+}
+
+module_error_t manifest_start(manifest_t *manifest, const module_init_args_t *args,
+        manifest_setup_fn setup, void *ctx, uint32_t threads)
+{
+    pthread_t tids[MANIFEST_MAX_MODULES];
+    uint32_t spawned = 0U;
+    size_t size;
+    uint32_t i;
+    long cpus;
+
+    if (manifest == NULL || manifest->started) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+    manifest->started = true;
+
+    for (i = 0U; i < manifest->count; i++) {
+        entry_t *entry = &manifest->entries[i];
+
+        entry->loader = module_loader_create();
+        if (entry->loader == NULL) {
+            return MODULE_ERR_MEMORY;
+        }
+        if (setup != NULL) {
+            setup(ctx, entry->loader);
+        }
+        if (entry->load_flags != 0U && module_loader_set_load_flags(entry->loader,
+                    module_loader_get_load_flags(entry->loader) | entry->load_flags) !=
+                MODULE_ERR_SUCCESS) {
+            return MODULE_ERR_INVALID_PARAM;
+        }
+        entry->pending = entry->dep_count;
+        if (entry->pending == 0U) {
+            manifest->ready[manifest->ready_tail++] = i;
+        }
+    }
+
+    /* a version 1 struct may end at user_data, size is read from version 2 only */
+    memset(&manifest->args, 0, sizeof(manifest->args));
+    manifest->args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    if (args != NULL) {
+        size = MODULE_INIT_ARGS_SIZE_V1;
+        if (args->version >= MODULE_INIT_ARGS_VERSION_2 && args->size > size) {
+            size = (args->size < sizeof(manifest->args)) ? args->size : sizeof(manifest->args);
+        }
+        memcpy(&manifest->args, args, size);
+    }
+
+    if (threads == 0U) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (uint32_t)cpus : 1U;
+    }
+    if (threads > manifest->count) {
+        threads = manifest->count;
+    }
+#ifdef KMODLIKE_SINGLE_THREADED
+    threads = 1U;
+#endif
+
+    manifest->base_ns = now_ns();
+    /* the caller is a worker too */
+    for (i = 1U; i < threads; i++) {
+        if (pthread_create(&tids[spawned], NULL, worker, manifest) != 0) {
+            break;
+        }
+        spawned++;
+    }
+    worker(manifest);
+    for (i = 0U; i < spawned; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    build_report(manifest, spawned + 1U);
+
+    for (i = 0U; i < manifest->count; i++) {
+        if (manifest->entries[i].err != MODULE_ERR_SUCCESS) {
+            return manifest->entries[i].err;
+        }
+    }
+    return MODULE_ERR_SUCCESS;
+}
+
+void manifest_stop(manifest_t *manifest)
+{
+    uint32_t i;
+
+    if (manifest == NULL) {
+        return;
+    }
+    for (i = manifest->count; i > 0U; i--) {
+        entry_t *entry = &manifest->entries[manifest->order[i - 1U]];
+
+        /* also drops lazy registrations, nothing loads after stop */
+        if (entry->loader != NULL &&
+                (module_loader_get_state(entry->loader) != MODULE_STATE_UNLOADED ||
+                module_loader_is_lazy(entry->loader))) {
+            module_loader_unload(entry->loader);
+        }
+    }
+}
+
+void manifest_destroy(manifest_t *manifest)
+{
+    uint32_t i;
+
+    if (manifest == NULL) {
+        return;
+    }
+    manifest_stop(manifest);
+    for (i = 0U; i < manifest->count; i++) {
+        module_loader_destroy(manifest->entries[i].loader);
+    }
+    pthread_cond_destroy(&manifest->cond);
+    pthread_mutex_destroy(&manifest->mutex);
+    free(manifest);
+}
+
+uint32_t manifest_count(const manifest_t *manifest)
+{
+    return manifest != NULL ? manifest->count : 0U;
+}
+
+module_error_t manifest_get_module(const manifest_t *manifest, uint32_t index,
+        manifest_module_info_t *info)
+{
+    const entry_t *entry;
+
+    if (manifest == NULL || info == NULL || index >= manifest->count) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    entry = &manifest->entries[index];
+    info->name = entry->name;
+    info->path = entry->path;
+    info->loader = entry->loader;
+    info->err = entry->err;
+    info->dep_count = entry->dep_count;
+    info->lazy = entry->lazy;
+    info->load_flags = entry->load_flags;
+    info->load_ns = entry->load_ns;
+    info->start_ns = entry->start_ns;
+    info->end_ns = entry->end_ns;
+    return MODULE_ERR_SUCCESS;
+}
+
+void manifest_get_report(const manifest_t *manifest, manifest_report_t *report)
+{
+    if (manifest == NULL || report == NULL) {
+        return;
+    }
+    *report = manifest->report;
+}
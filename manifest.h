@@ -0,0 +1,136 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "module_interface.h"
+#include "module_loader.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define MANIFEST_MAX_MODULES 64U
+#define MANIFEST_MAX_DEPS 8U
+#define MANIFEST_NAME_MAX 32U
+#define MANIFEST_PATH_MAX 256U
+#define MANIFEST_PARAMS_MAX 256U
+#define MANIFEST_LINE_MAX 1024U
+
+struct manifest;
+
+/*
+ * modules to load at startup, one per line:
+ *   <name> <path> [after=<name>[,<name>...]] [lazy] [bind=now|lazy] [global]
+ *       [deepbind] [params...]
+ * blank lines and lines starting with # are skipped. the rest of the line
+ * after the path and the options is handed to module_init as
+ * module_init_args_t.user_data, a NUL-terminated string. a lazy module is
+ * only registered at start and loaded by its first user, nothing eager may
+ * depend on it. bind, global and deepbind pick the dlopen mode, see
+ * module_loader_set_load_flags()
+ */
+typedef struct manifest manifest_t;
+
+/* called once per module loader before loading starts, e.g. to attach host services */
+typedef void (*manifest_setup_fn)(void *ctx, module_loader_t *loader);
+
+/* outcome and timings of one module, times relative to the start of manifest_start() */
+typedef struct {
+    const char *name;
+    const char *path;
+    module_loader_t *loader;
+    /* MODULE_ERR_DEPENDENCY_FAILED when skipped for a failed dependency */
+    module_error_t err;
+    uint32_t dep_count;
+    /* registered with module_loader_register_lazy() */
+    bool lazy;
+    /* MODULE_LOAD_* bits from the options */
+    uint32_t load_flags;
+    /* dlopen and module_init, registration only for lazy modules */
+    uint64_t load_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} manifest_module_info_t;
+
+typedef struct {
+    uint32_t modules;
+    uint32_t loaded;
+    /* registered for loading on first use */
+    uint32_t lazy;
+    uint32_t failed;
+    uint32_t threads;
+    /* manifest_start() from call to return */
+    uint64_t wall_ns;
+    /* sum of every load_ns, the serial startup cost */
+    uint64_t sum_ns;
+    /* longest chain of load_ns along dependencies, the bound for wall_ns */
+    uint64_t critical_path_ns;
+} manifest_report_t;
+
+/**
+ * parse manifest text, resolve dependencies and reject cycles
+ * @param text manifest contents
+ * @param error message with the line number on failure, or NULL
+ * @param error_size size of error
+ * @return manifest or NULL on error
+ */
+manifest_t *manifest_parse(const char *text, char *error, size_t error_size);
+
+/**
+ * read and parse a manifest file
+ * @param path manifest file
+ * @param error message on failure, or NULL
+ * @param error_size size of error
+ * @return manifest or NULL on error
+ */
+manifest_t *manifest_read(const char *path, char *error, size_t error_size);
+
+/**
+ * unload every module still loaded and free the manifest
+ * @param manifest manifest or NULL
+ */
+void manifest_destroy(manifest_t *manifest);
+
+/**
+ * load all modules, each on its own loader, following the dependency DAG
+ * a module is loaded once everything it depends on is loaded; independent
+ * modules are loaded in parallel on up to threads threads, the caller being one
+ * of them. dependents of a failed module are skipped
+ * @param manifest parsed manifest, started at most once
+ * @param args init args template for every module, user_data is replaced
+ *        by the module params when it has any; NULL for plain version 1 args
+ * @param setup called for each new loader before loading, or NULL
+ * @param ctx context for setup
+ * @param threads loading threads, 0 for the number of online cpus
+ * @return MODULE_ERR_SUCCESS if every module loaded, else the error of the
+ *         first module in manifest order that did not
+ */
+module_error_t manifest_start(manifest_t *manifest, const module_init_args_t *args,
+        manifest_setup_fn setup, void *ctx, uint32_t threads);
+
+/**
+ * unload dependents before their dependencies, lazy registrations included
+ * loaders stay valid until manifest_destroy()
+ * @param manifest manifest instance
+ */
+void manifest_stop(manifest_t *manifest);
+
+/**
+ * @param manifest manifest instance
+ * @return number of modules, in manifest order
+ */
+uint32_t manifest_count(const manifest_t *manifest);
+
+/**
+ * @param manifest manifest instance
+ * @param index module index below manifest_count()
+ * @param info output, strings point into the manifest
+ * @return error code
+ */
+module_error_t manifest_get_module(const manifest_t *manifest, uint32_t index,
+        manifest_module_info_t *info);
+
+/**
+ * @param manifest manifest instance
+ * @param report totals of the last manifest_start()
+ */
+void manifest_get_report(const manifest_t *manifest, manifest_report_t *report);
+
+#endif /* MANIFEST_H */
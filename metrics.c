@@ -0,0 +1,545 @@
+#include "metrics.h"
+#include "logger.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* first exported histogram bucket, 2^10 ns ~ 1us, lower samples fold into it */
+#define METRICS_HIST_FIRST 9U
+#define METRICS_LABELS_MAX (STATS_PATH_MAX * 2U + 32U)
+#define METRICS_REQUEST_MAX 512U
+#define METRICS_POLL_MS 1000
+#define METRICS_RECV_TIMEOUT_US 100000
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} metrics_out_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+    size_t offset;
+} module_counter_t;
+
+static const module_counter_t MODULE_COUNTERS[] = {
+    {"kmodlike_module_loads_total", "Successful module loads, including restarts",
+        offsetof(stats_module_t, load_count)},
+    {"kmodlike_module_load_failures_total", "Failed module loads",
+        offsetof(stats_module_t, load_failures)},
+    {"kmodlike_module_unloads_total", "Module unloads",
+        offsetof(stats_module_t, unload_count)},
+    {"kmodlike_module_idle_unloads_total", "Unloads of lazy modules left idle",
+        offsetof(stats_module_t, idle_unload_count)},
+    {"kmodlike_module_crashes_total", "Fatal signals attributed to the module",
+        offsetof(stats_module_t, crash_count)},
+    {"kmodlike_module_calls_total", "Calls into the module through the loader",
+        offsetof(stats_module_t, calls)},
+};
+
+/* module_load_phase_t order */
+static const char *const g_load_phase_names[MODULE_LOAD_PHASE_COUNT] = {
+    "dlopen", "resolve", "prefault", "init",
+};
+
+/* one snapshot for all renderers, too large for the stack */
+static stats_segment_t g_snap;
+static pthread_mutex_t g_render_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char g_listener_buf[METRICS_BUF_SIZE];
+static char g_listener_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int g_listen_fd = -1;
+static pthread_t g_listener_thread;
+static atomic_bool g_listening = ATOMIC_VAR_INIT(false);
+
+static void out_printf(metrics_out_t *out, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+static void out_printf(metrics_out_t *out, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    if (out->overflow) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    ret = vsnprintf(out->buf + out->len, out->size - out->len, fmt, ap);
+    va_end(ap);
+
+    if (ret < 0 || (size_t)ret >= out->size - out->len) {
+        out->overflow = true;
+        return;
+    }
+    out->len += (size_t)ret;
+}
+
+static void out_family(metrics_out_t *out, const char *name, const char *type,
+        const char *help)
+{
+    out_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* slot="N",path="..." with label value escaping */
+static void module_labels(char *labels, size_t size, uint32_t slot, const char *path)
+{
+    size_t pos;
+    int ret;
+
+    ret = snprintf(labels, size, "slot=\"%u\",path=\"", slot);
+    if (ret < 0 || (size_t)ret >= size) {
+        labels[0] = '\0';
+        return;
+    }
+    pos = (size_t)ret;
+
+    for (; *path != '\0' && pos + 3U < size; path++) {
+        if (*path == '\\' || *path == '"') {
+            labels[pos++] = '\\';
+            labels[pos++] = *path;
+        } else if (*path == '\n') {
+            labels[pos++] = '\\';
+            labels[pos++] = 'n';
+        } else {
+            labels[pos++] = *path;
+        }
+    }
+    labels[pos++] = '"';
+    labels[pos] = '\0';
+}
+
+static void out_histogram(metrics_out_t *out, const char *name, const char *labels,
+        const stats_latency_t *lat)
+{
+    const char *sep = (labels[0] != '\0') ? "," : "";
+    const char *open = (labels[0] != '\0') ? "{" : "";
+    const char *close = (labels[0] != '\0') ? "}" : "";
+    uint64_t cumulative = 0U;
+    uint32_t i;
+
+    for (i = 0U; i < STATS_LATENCY_BUCKETS - 1U; i++) {
+        cumulative += lat->buckets[i];
+        if (i < METRICS_HIST_FIRST) {
+            continue;
+        }
+        out_printf(out, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, sep,
+                (double)(1ULL << (i + 1U)) / 1e9, (unsigned long long)cumulative);
+    }
+    out_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+            (unsigned long long)lat->count);
+    out_printf(out, "%s_sum%s%s%s %.9f\n", name, open, labels, close,
+            (double)lat->sum_ns / 1e9);
+    out_printf(out, "%s_count%s%s%s %llu\n", name, open, labels, close,
+            (unsigned long long)lat->count);
+}
+
+static void render_modules(metrics_out_t *out, const stats_segment_t *snap)
+{
+    char labels[METRICS_LABELS_MAX];
+    const stats_module_t *m;
+    uint32_t count;
+    uint32_t phase;
+    uint32_t i;
+    size_t c;
+
+    count = (snap->module_count < STATS_MAX_MODULES) ? snap->module_count :
+        STATS_MAX_MODULES;
+
+    out_family(out, "kmodlike_module_loaded", "gauge", "1 if the module is loaded");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            out_printf(out, "kmodlike_module_loaded{%s} %d\n", labels,
+                    m->state == MODULE_STATE_LOADED ? 1 : 0);
+        }
+    }
+
+    for (c = 0U; c < sizeof(MODULE_COUNTERS) / sizeof(MODULE_COUNTERS[0]); c++) {
+        out_family(out, MODULE_COUNTERS[c].name, "counter", MODULE_COUNTERS[c].help);
+        for (i = 0U; i < count; i++) {
+            m = &snap->modules[i];
+            if (m->in_use != 0U) {
+                module_labels(labels, sizeof(labels), i, m->path);
+                out_printf(out, "%s{%s} %llu\n", MODULE_COUNTERS[c].name, labels,
+                        (unsigned long long)*(const uint64_t *)(const void *)
+                        ((const char *)m + MODULE_COUNTERS[c].offset));
+            }
+        }
+    }
+
+    out_family(out, "kmodlike_module_refs", "gauge", "Outstanding module references");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            out_printf(out, "kmodlike_module_refs{%s} %lld\n", labels,
+                    (long long)m->ref_count);
+        }
+    }
+
+    out_family(out, "kmodlike_module_resident_bytes", "gauge",
+            "Resident memory of the module image");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            out_printf(out, "kmodlike_module_resident_bytes{%s} %llu\n", labels,
+                    (unsigned long long)m->rss_kb * 1024ULL);
+        }
+    }
+
+    out_family(out, "kmodlike_module_heap_bytes", "gauge",
+            "Bytes the module holds from its arena");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            out_printf(out, "kmodlike_module_heap_bytes{%s} %llu\n", labels,
+                    (unsigned long long)m->heap_bytes);
+        }
+    }
+
+    out_family(out, "kmodlike_module_heap_objects", "gauge",
+            "Blocks the module holds from its arena");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            out_printf(out, "kmodlike_module_heap_objects{%s} %llu\n", labels,
+                    (unsigned long long)m->heap_objects);
+        }
+    }
+
+    out_family(out, "kmodlike_module_heap_reserved_bytes", "gauge",
+            "Memory the module arena took from the system");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            out_printf(out, "kmodlike_module_heap_reserved_bytes{%s} %llu\n", labels,
+                    (unsigned long long)m->heap_reserved_bytes);
+        }
+    }
+
+    out_family(out, "kmodlike_module_load_phase_seconds", "gauge",
+            "Time the last load of the module spent in each phase");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            for (phase = 0U; phase < MODULE_LOAD_PHASE_COUNT; phase++) {
+                out_printf(out, "kmodlike_module_load_phase_seconds{%s,phase=\"%s\"} %.9f\n",
+                        labels, g_load_phase_names[phase],
+                        (double)m->load_phase_ns[phase] / 1e9);
+            }
+        }
+    }
+
+    out_family(out, "kmodlike_module_call_latency_seconds", "histogram",
+            "Latency of timed calls into the module");
+    for (i = 0U; i < count; i++) {
+        m = &snap->modules[i];
+        if (m->in_use != 0U) {
+            module_labels(labels, sizeof(labels), i, m->path);
+            out_histogram(out, "kmodlike_module_call_latency_seconds", labels,
+                    &m->call_latency);
+        }
+    }
+}
+
+static void render_locks(metrics_out_t *out, const stats_segment_t *snap)
+{
+    char labels[STATS_LOCK_NAME_MAX + 16U];
+    const stats_lock_t *lk;
+    uint32_t count;
+    uint32_t i;
+
+    /* nothing is recorded unless built with lock profiling */
+    if ((snap->lock_flags & STATS_LOCK_COMPILED) == 0U) {
+        return;
+    }
+
+    count = (snap->lock_count < STATS_MAX_LOCK_SITES) ? snap->lock_count :
+        STATS_MAX_LOCK_SITES;
+
+    out_family(out, "kmodlike_lock_profiling_enabled", "gauge",
+            "1 if lock profiling is recording");
+    out_printf(out, "kmodlike_lock_profiling_enabled %d\n",
+            (snap->lock_flags & STATS_LOCK_ENABLED) != 0U ? 1 : 0);
+
+    out_family(out, "kmodlike_lock_acquisitions_total", "counter",
+            "Lock acquisitions per site");
+    for (i = 0U; i < count; i++) {
+        lk = &snap->locks[i];
+        out_printf(out, "kmodlike_lock_acquisitions_total{site=\"%s\"} %llu\n", lk->name,
+                (unsigned long long)lk->acquisitions);
+    }
+
+    out_family(out, "kmodlike_lock_contended_total", "counter",
+            "Lock acquisitions that had to wait");
+    for (i = 0U; i < count; i++) {
+        lk = &snap->locks[i];
+        out_printf(out, "kmodlike_lock_contended_total{site=\"%s\"} %llu\n", lk->name,
+                (unsigned long long)lk->contended);
+    }
+
+    /* histograms only for sites that were used, keeps scrapes small */
+    out_family(out, "kmodlike_lock_wait_seconds", "histogram", "Time spent acquiring");
+    for (i = 0U; i < count; i++) {
+        lk = &snap->locks[i];
+        if (lk->acquisitions != 0U) {
+            snprintf(labels, sizeof(labels), "site=\"%s\"", lk->name);
+            out_histogram(out, "kmodlike_lock_wait_seconds", labels, &lk->wait);
+        }
+    }
+
+    out_family(out, "kmodlike_lock_hold_seconds", "histogram", "Time the lock was held");
+    for (i = 0U; i < count; i++) {
+        lk = &snap->locks[i];
+        if (lk->acquisitions != 0U) {
+            snprintf(labels, sizeof(labels), "site=\"%s\"", lk->name);
+            out_histogram(out, "kmodlike_lock_hold_seconds", labels, &lk->hold);
+        }
+    }
+}
+
+static void render_image_cache(metrics_out_t *out, const stats_segment_t *snap)
+{
+    const stats_image_cache_t *cache = &snap->image_cache;
+
+    /* disabled and never used, nothing worth a scrape */
+    if (cache->capacity == 0U && cache->hits == 0U && cache->misses == 0U) {
+        return;
+    }
+
+    out_family(out, "kmodlike_image_cache_hits_total", "counter",
+            "Module loads that reused a cached image without dlopen");
+    out_printf(out, "kmodlike_image_cache_hits_total %llu\n",
+            (unsigned long long)cache->hits);
+    out_family(out, "kmodlike_image_cache_misses_total", "counter",
+            "Module loads that had to dlopen with the cache enabled");
+    out_printf(out, "kmodlike_image_cache_misses_total %llu\n",
+            (unsigned long long)cache->misses);
+    out_family(out, "kmodlike_image_cache_evictions_total", "counter",
+            "Cached images closed for room, a changed file or on disable");
+    out_printf(out, "kmodlike_image_cache_evictions_total %llu\n",
+            (unsigned long long)cache->evictions);
+    out_family(out, "kmodlike_image_cache_entries", "gauge", "Unloaded images kept mapped");
+    out_printf(out, "kmodlike_image_cache_entries %u\n", cache->entries);
+    out_family(out, "kmodlike_image_cache_bytes", "gauge",
+            "Mapped size of the cached images");
+    out_printf(out, "kmodlike_image_cache_bytes %llu\n", (unsigned long long)cache->bytes);
+}
+
+size_t metrics_render(char *buf, size_t size)
+{
+    metrics_out_t out;
+    const stats_segment_t *snap = &g_snap;
+
+    if (buf == NULL || size == 0U) {
+        return 0U;
+    }
+
+    out.buf = buf;
+    out.size = size;
+    out.len = 0U;
+    out.overflow = false;
+
+    pthread_mutex_lock(&g_render_mutex);
+    if (stats_snapshot(&g_snap) != 0) {
+        pthread_mutex_unlock(&g_render_mutex);
+        buf[0] = '\0';
+        return 0U;
+    }
+
+    out_family(&out, "kmodlike_uptime_seconds", "gauge", "Seconds since daemon start");
+    out_printf(&out, "kmodlike_uptime_seconds %.3f\n",
+            (double)(snap->update_ns - snap->start_ns) / 1e9);
+    out_family(&out, "kmodlike_resident_bytes", "gauge", "Resident memory of the daemon");
+    out_printf(&out, "kmodlike_resident_bytes %llu\n",
+            (unsigned long long)snap->process_rss_kb * 1024ULL);
+
+    out_family(&out, "kmodlike_rpc_requests_total", "counter", "Handled rpc requests");
+    out_printf(&out, "kmodlike_rpc_requests_total %llu\n",
+            (unsigned long long)snap->rpc.requests);
+    out_family(&out, "kmodlike_rpc_errors_total", "counter", "Failed rpc requests");
+    out_printf(&out, "kmodlike_rpc_errors_total %llu\n",
+            (unsigned long long)snap->rpc.errors);
+    out_family(&out, "kmodlike_rpc_received_bytes_total", "counter",
+            "Bytes received in rpc requests");
+    out_printf(&out, "kmodlike_rpc_received_bytes_total %llu\n",
+            (unsigned long long)snap->rpc.bytes_in);
+    out_family(&out, "kmodlike_rpc_latency_seconds", "histogram",
+            "Time from rpc receive to reply");
+    out_histogram(&out, "kmodlike_rpc_latency_seconds", "", &snap->rpc.latency);
+
+    render_modules(&out, snap);
+    render_locks(&out, snap);
+    render_image_cache(&out, snap);
+    pthread_mutex_unlock(&g_render_mutex);
+
+    out_family(&out, "kmodlike_logger_queue_depth", "gauge",
+            "Log records waiting for the logger thread");
+    out_printf(&out, "kmodlike_logger_queue_depth %zu\n", logger_get_queue_depth());
+    out_family(&out, "kmodlike_logger_dropped_total", "counter",
+            "Log records dropped because the ring was full");
+    out_printf(&out, "kmodlike_logger_dropped_total %llu\n",
+            (unsigned long long)logger_get_dropped());
+
+    if (out.overflow) {
+        buf[0] = '\0';
+        return 0U;
+    }
+    return out.len;
+}
+
+static void send_all(int fd, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0U) {
+        ret = send(fd, buf, len, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += ret;
+        len -= (size_t)ret;
+    }
+}
+
+static void serve_client(int fd)
+{
+    char request[METRICS_REQUEST_MAX];
+    char header[128];
+    struct timeval tv;
+    ssize_t got;
+    size_t len;
+    int hlen;
+
+    /* plain readers send nothing, do not wait long for them */
+    tv.tv_sec = 0;
+    tv.tv_usec = METRICS_RECV_TIMEOUT_US;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    got = recv(fd, request, sizeof(request), 0);
+
+    len = metrics_render(g_listener_buf, sizeof(g_listener_buf));
+
+    if (got >= 4 && memcmp(request, "GET ", 4U) == 0) {
+        hlen = snprintf(header, sizeof(header),
+                "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                len > 0U ? "200 OK" : "503 Service Unavailable", len);
+        if (hlen > 0 && (size_t)hlen < sizeof(header)) {
+            send_all(fd, header, (size_t)hlen);
+        }
+    }
+    send_all(fd, g_listener_buf, len);
+}
+
+static void *listener_thread(void *arg)
+{
+    struct pollfd pfd;
+    int client;
+    int ready;
+
+    (void)arg;
+
+    pfd.fd = g_listen_fd;
+    pfd.events = POLLIN;
+
+    while (atomic_load(&g_listening)) {
+        ready = poll(&pfd, 1, METRICS_POLL_MS);
+        if (ready <= 0) {
+            continue;
+        }
+
+        client = accept(g_listen_fd, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        serve_client(client);
+        close(client);
+    }
+
+    return NULL;
+}
+
+int metrics_listener_start(const char *path)
+{
+    struct sockaddr_un addr;
+    size_t path_len;
+    int fd;
+
+    if (path == NULL || atomic_load(&g_listening)) {
+        return -1;
+    }
+
+    path_len = strlen(path);
+    if (path_len >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, path_len + 1U);
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    memcpy(g_listener_path, path, path_len + 1U);
+    g_listen_fd = fd;
+    atomic_store(&g_listening, true);
+
+    if (pthread_create(&g_listener_thread, NULL, listener_thread, NULL) != 0) {
+        atomic_store(&g_listening, false);
+        close(fd);
+        unlink(path);
+        g_listen_fd = -1;
+        g_listener_path[0] = '\0';
+        return -1;
+    }
+
+    return 0;
+}
+
+void metrics_listener_stop(void)
+{
+    if (!atomic_load(&g_listening)) {
+        return;
+    }
+
+    atomic_store(&g_listening, false);
+    pthread_join(g_listener_thread, NULL);
+
+    close(g_listen_fd);
+    g_listen_fd = -1;
+    unlink(g_listener_path);
+    g_listener_path[0] = '\0';
+}
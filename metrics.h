@@ -0,0 +1,35 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+/*
+ * worst case: every STATS_MAX_MODULES slot with a STATS_PATH_MAX path that
+ * escapes to twice its length, plus both histograms of every lock site of
+ * a KMODLIKE_LOCK_PROFILING build, is about 350 KiB
+ */
+#define METRICS_BUF_SIZE (512U * 1024U)
+
+/**
+ * render daemon counters in prometheus text exposition format
+ * reads the stats segment and logger counters, does not allocate
+ * @param buf output buffer
+ * @param size buffer size, METRICS_BUF_SIZE fits every stats segment
+ * @return length written, 0 if stats are disabled or buf is too small
+ */
+size_t metrics_render(char *buf, size_t size);
+
+/**
+ * start a unix stream listener serving metrics_render() output
+ * plain connections get the text body, "GET" requests an http/1.0 reply
+ * @param path socket path
+ * @return 0 on success, -1 on error
+ */
+int metrics_listener_start(const char *path);
+
+/**
+ * stop the listener and remove its socket
+ */
+void metrics_listener_stop(void);
+
+#endif /* METRICS_H */
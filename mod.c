@@ -15,6 +15,9 @@
 static atomic_bool g_module_active = ATOMIC_VAR_INIT(false);
 /* ID потока для возможности его завершения */
 static pthread_t g_thread = 0;
+/* таймер хоста вместо отдельного потока, если хост его предоставляет */
+static const module_timer_ops_t *g_timers = NULL;
+static int64_t g_timer_id = 0;
 
 /* Функция модуля, печатающая hello world */
 __attribute__((visibility("default")))
@@ -43,6 +46,33 @@ static void *mod_crash_thread(void *arg) {
     return NULL;
 }
 
+/* обработчик таймера хоста: то же, что и поток, но без собственного потока */
+static void mod_crash_timer(void *arg) {
+    (void)arg;
+
+    if (!atomic_load(&g_module_active)) {
+        return;
+    }
+
+    /* намеренно вызываем SIGSEGV, хост покидает задачу и выгружает модуль */
+    int *p = NULL;
+    *p = 42;
+}
+
+/* таблица функций модуля, хост вызывает через нее без поиска символов по имени */
+static const module_ops_t g_ops = {
+    .version = MODULE_OPS_VERSION_CURRENT,
+    .size = sizeof(module_ops_t),
+    .hello = mod_hello,
+};
+
+/* get module ops table */
+__attribute__((visibility("default")))
+const module_ops_t *module_get_ops(void)
+{
+    return &g_ops;
+}
+
 /* get module interface version */
 __attribute__((visibility("default")))
 uint32_t module_get_interface_version(void)
@@ -50,6 +80,13 @@ uint32_t module_get_interface_version(void)
     return MODULE_INTERFACE_VERSION_CURRENT;
 }
 
+/* ask for version 2 init args, the host timers come with them */
+__attribute__((visibility("default")))
+uint32_t module_get_init_args_version(void)
+{
+    return MODULE_INIT_ARGS_VERSION_2;
+}
+
 /* module initialization function */
 __attribute__((visibility("default")))
 int module_init(const void *init_args)
@@ -62,12 +99,26 @@ int module_init(const void *init_args)
 
     /* если переданы аргументы, можно использовать функции логирования */
     args = (const module_init_args_t *)init_args;
-    if (args != NULL && args->version == MODULE_INIT_ARGS_VERSION_CURRENT) {
+    if (args != NULL && args->version >= MODULE_INIT_ARGS_VERSION_1) {
         if (args->log != NULL) {
             args->log(0, "module initializing");
         }
     }
 
+    /* таймер хоста: один поток таймеров на все модули вместо потока на модуль */
+    if (args != NULL && MODULE_INIT_ARGS_HAS(args, timers) && args->timers != NULL) {
+        g_timers = args->timers;
+        g_timer_id = g_timers->start(g_timers->ctx, MODULE_CRASH_DELAY_SEC * 1000U, 0U,
+                mod_crash_timer, NULL);
+        if (g_timer_id > 0) {
+            if (args->log != NULL) {
+                args->log(0, "module initialized");
+            }
+            return 0;
+        }
+        g_timers = NULL;
+    }
+
     /* создаем joinable поток (не detached!), чтобы можно было его завершить */
     if (pthread_create(&g_thread, NULL, mod_crash_thread, NULL) != 0) {
         g_thread = 0;
@@ -91,6 +142,13 @@ void module_fini(void)
     /* сбрасываем флаг активности, чтобы поток не вызывал фатальные сигналы */
     atomic_store(&g_module_active, false);
 
+    /* таймер хост отменяет и сам, но модуль убирает за собой */
+    if (g_timers != NULL) {
+        g_timers->cancel(g_timers->ctx, g_timer_id);
+        g_timers = NULL;
+        g_timer_id = 0;
+    }
+
     /* явно завершаем поток, если он еще работает */
     if (g_thread != 0) {
         pthread_cancel(g_thread);
@@ -25,6 +25,12 @@ const char *module_error_to_string(module_error_t err)
         return "module interface version mismatch";
     case MODULE_ERR_IN_USE:
         return "module is in use and cannot be unloaded";
+    case MODULE_ERR_STALE_HANDLE:
+        return "symbol handle belongs to an unloaded module generation";
+    case MODULE_ERR_DEPENDENCY_FAILED:
+        return "a module it depends on failed to load";
+    case MODULE_ERR_CRASHED:
+        return "module code raised a fatal signal while running it";
     default:
         return "unknown error";
     }
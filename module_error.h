@@ -14,7 +14,10 @@ typedef enum {
     MODULE_ERR_MEMORY = -7,
     MODULE_ERR_THREAD = -8,
     MODULE_ERR_VERSION_MISMATCH = -9,
-    MODULE_ERR_IN_USE = -10
+    MODULE_ERR_IN_USE = -10,
+    MODULE_ERR_STALE_HANDLE = -11,
+    MODULE_ERR_DEPENDENCY_FAILED = -12,
+    MODULE_ERR_CRASHED = -13
 } module_error_t;
 
 const char *module_error_to_string(module_error_t err);
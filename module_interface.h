@@ -1,6 +1,7 @@
 #ifndef MODULE_INTERFACE_H
 #define MODULE_INTERFACE_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -8,24 +9,199 @@
 #define MODULE_INTERFACE_VERSION_1 1U
 #define MODULE_INTERFACE_VERSION_CURRENT MODULE_INTERFACE_VERSION_1
 
-/* module init args structure version */
+/* module init args structure version
+ * callers and modules written against the version 1 layout compare with
+ * MODULE_INIT_ARGS_VERSION_CURRENT, so it stays 1; version 2 is opted into
+ * explicitly on both sides, see module_init_args_t
+ */
 #define MODULE_INIT_ARGS_VERSION_1 1U
+#define MODULE_INIT_ARGS_VERSION_2 2U
 #define MODULE_INIT_ARGS_VERSION_CURRENT MODULE_INIT_ARGS_VERSION_1
 
-/* module init args structure */
+/* log levels for module_init_args_t.log */
+#define MODULE_LOG_INFO 0
+#define MODULE_LOG_ERROR 1
+#define MODULE_LOG_DEBUG 2
+
+/* task for module_pool_ops_t.submit */
+typedef void (*module_task_fn)(void *arg);
+/* chunk [begin, end) of a module_pool_ops_t.parallel_for range */
+typedef void (*module_range_fn)(void *arg, size_t begin, size_t end);
+
+/* host thread pool, shared by all modules
+ * ctx identifies the calling module and is passed back as the first argument
+ * tasks still queued when the module unloads or crashes are dropped,
+ * unload waits for running ones before module_fini
+ */
+typedef struct {
+    void *ctx;
+    /* queue fn(arg), returns 0 or a negative error once the module is unloading */
+    int (*submit)(void *ctx, module_task_fn fn, void *arg);
+    /* split [0, n) into chunks of grain items (0 picks one) and run them on the
+     * pool and the calling thread, returns when every chunk is done; a chunk
+     * that crashed on the pool stops the rest and fails the call */
+    int (*parallel_for)(void *ctx, size_t n, size_t grain, module_range_fn fn, void *arg);
+    /* most tasks of this module running at once */
+    uint32_t (*concurrency)(void *ctx);
+} module_pool_ops_t;
+
+/* timer callback, runs on the host thread pool */
+typedef void (*module_timer_fn)(void *arg);
+
+/* host timer service, one timer thread for all modules
+ * ctx identifies the calling module and is passed back as the first argument
+ * timers still armed when the module unloads or crashes are cancelled
+ */
+typedef struct {
+    void *ctx;
+    /* fire fn(arg) after delay_ms, then every period_ms unless it is 0
+     * returns a timer id > 0 or a negative error */
+    int64_t (*start)(void *ctx, uint32_t delay_ms, uint32_t period_ms, module_timer_fn fn,
+            void *arg);
+    /* stop a timer, a callback already running finishes
+     * returns 0 or a negative error for unknown or finished timers */
+    int (*cancel)(void *ctx, int64_t id);
+} module_timer_ops_t;
+
+/* readiness bits for module_reactor_ops_t */
+#define MODULE_IO_READ 1U
+#define MODULE_IO_WRITE 2U
+/* error or hangup, reported whether or not it was asked for */
+#define MODULE_IO_ERROR 4U
+
+/* readiness callback, runs on the host thread pool */
+typedef void (*module_io_fn)(void *arg, int fd, uint32_t events);
+
+/* host epoll reactor, one reactor thread for all modules
+ * ctx identifies the calling module and is passed back as the first argument
+ * a registration has at most one callback in flight, it is re-armed when the
+ * callback returns; registrations left at unload or crash are removed
+ */
+typedef struct {
+    void *ctx;
+    /* watch fd for MODULE_IO_READ and/or MODULE_IO_WRITE, the fd stays owned
+     * by the module; returns a registration id > 0 or a negative error */
+    int64_t (*add)(void *ctx, int fd, uint32_t events, module_io_fn fn, void *arg);
+    /* change the watched events of a registration */
+    int (*modify)(void *ctx, int64_t id, uint32_t events);
+    /* stop watching, a callback already running finishes */
+    int (*remove)(void *ctx, int64_t id);
+    /* host-owned eventfd, fn runs after notify(); returns a registration id */
+    int64_t (*add_event)(void *ctx, module_io_fn fn, void *arg);
+    /* wake an add_event registration, safe from any thread */
+    int (*notify)(void *ctx, int64_t id);
+} module_reactor_ops_t;
+
+/* host clock, readings in nanoseconds, shared by all modules so there is no ctx
+ * now_ns and cycles read the calibrated TSC when the cpu has an invariant one
+ * and go through the vDSO otherwise
+ * coarse_ns and now_ns have different time bases, never subtract one from
+ * the other: coarse_ns is slewed by NTP like CLOCK_MONOTONIC and get_time,
+ * now_ns is not and drifts away from them
+ */
+typedef struct {
+    /* CLOCK_MONOTONIC_COARSE, resolution of a scheduler tick, cheapest */
+    uint64_t (*coarse_ns)(void);
+    /* origin and rate of CLOCK_MONOTONIC_RAW, full resolution */
+    uint64_t (*now_ns)(void);
+    /* free running counter for short intervals, convert differences with cycles_to_ns */
+    uint64_t (*cycles)(void);
+    uint64_t (*cycles_to_ns)(uint64_t cycles);
+} module_clock_ops_t;
+
+/* host allocator, one arena per loaded module
+ * ctx identifies the calling module and is passed back as the first argument
+ * memory may be freed from any thread; whatever the module still holds at
+ * unload or crash is released with the arena after module_fini
+ */
+typedef struct {
+    void *ctx;
+    /* 16 byte aligned block, NULL when size is 0 or memory runs out */
+    void *(*alloc)(void *ctx, size_t size);
+    /* return a block of this module, NULL is ignored */
+    void (*free)(void *ctx, void *ptr);
+} module_alloc_ops_t;
+
+/* module init args structure
+ * version 1 ends at user_data, version 2 appends size and the host services
+ * and later fields are appended behind them
+ * a caller sets version to MODULE_INIT_ARGS_VERSION_2 and size to pass the
+ * appended fields, a version 1 struct is read up to user_data only
+ * a module exports module_get_init_args_version() to get version 2 args and
+ * reads an appended field only when MODULE_INIT_ARGS_HAS() says the host
+ * passed it, every other module gets version 1 args
+ */
 typedef struct {
     uint32_t version;
     void (*log)(int level, const char *fmt, ...);
     int (*get_time)(struct timespec *ts);
     void *user_data;
+    /* version 2 */
+    /* sizeof(module_init_args_t) as seen by the host */
+    uint32_t size;
+    /* thread pool, NULL when the host runs none */
+    const module_pool_ops_t *pool;
+    /* timers, NULL when the host runs none */
+    const module_timer_ops_t *timers;
+    /* fd readiness, NULL when the host runs no reactor */
+    const module_reactor_ops_t *reactor;
+    /* clock, NULL when the host offers none */
+    const module_clock_ops_t *clock;
+    /* per-module heap, NULL when the host keeps none */
+    const module_alloc_ops_t *alloc;
 } module_init_args_t;
 
+#define MODULE_INIT_ARGS_SIZE_V1 (offsetof(module_init_args_t, user_data) + sizeof(void *))
+#define MODULE_INIT_ARGS_HAS(args, field) \
+        ((args)->version >= MODULE_INIT_ARGS_VERSION_2 && \
+         (args)->size >= offsetof(module_init_args_t, field) + sizeof((args)->field))
+
+/* module ops table versions */
+#define MODULE_OPS_VERSION_1 1U
+#define MODULE_OPS_VERSION_2 2U
+#define MODULE_OPS_VERSION_CURRENT MODULE_OPS_VERSION_2
+
+/* work item for process_batch, data stays owned by the host */
+typedef struct {
+    const void *data;
+    size_t len;
+    /* opaque to the module, returned to the host with the result */
+    uint64_t tag;
+} module_item_t;
+
+/* module ops table
+ * returned by the optional module_get_ops() export, validated once at load
+ * the table only grows: fields of later versions are appended, size tells
+ * the host how much of it the module was built with, missing slots are NULL
+ */
+typedef struct {
+    uint32_t version;
+    /* sizeof(module_ops_t) as seen by the module */
+    uint32_t size;
+    /* version 1 */
+    void (*hello)(void);
+    /* version 2 */
+    /* process n items in one call, results[i] gets 0 or a negative error for items[i]
+     * returns the number of items processed, the rest are reported as failed */
+    size_t (*process_batch)(const module_item_t *items, size_t n, int *results);
+} module_ops_t;
+
+#define MODULE_OPS_SIZE_V1 (offsetof(module_ops_t, hello) + sizeof(void (*)(void)))
+#define MODULE_OPS_SIZE_V2 (offsetof(module_ops_t, process_batch) + \
+        sizeof(size_t (*)(const module_item_t *, size_t, int *)))
+
 /* get module interface version
  * must be implemented by every module
  * returns interface version number
  */
 uint32_t module_get_interface_version(void);
 
+/* get the init args version the module reads
+ * optional, without it module_init gets version 1 args
+ * @return MODULE_INIT_ARGS_VERSION_2 to get size and the host services
+ */
+uint32_t module_get_init_args_version(void);
+
 /* module initialization function
  * must be implemented by every module
  * called after module is loaded
@@ -40,5 +216,11 @@ int module_init(const void *init_args);
  */
 void module_fini(void);
 
+/* get module ops table
+ * optional, the host calls through it instead of looking up symbols by name
+ * @return table with static storage duration
+ */
+const module_ops_t *module_get_ops(void);
+
 #endif /* MODULE_INTERFACE_H */
 
@@ -1,47 +1,306 @@
 #include "module_loader.h"
+#include "flightrec.h"
+#include "image_cache.h"
+#include "kmod_atomic.h"
+#include "lock_prof.h"
+#include "module_map.h"
+#include "prefault.h"
+#include "static_pool.h"
+#include "trace.h"
 
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MODULE_PATH_MAX 256U
 #define MODULE_PATH_MIN 1U
 
+#ifdef RTLD_DEEPBIND
+#define LOAD_FLAGS_SUPPORTED 0x1fU
+#else
+#define LOAD_FLAGS_SUPPORTED (0x1fU & ~MODULE_LOAD_DEEPBIND)
+#endif
+
+/*
+ * state word: generation in the high 32 bits, last error in bits 8..23,
+ * state in the low byte. one atomic load gives a consistent view, so
+ * queries and signal handlers never take the mutex
+ */
+#define WORD_STATE_MASK 0xffULL
+#define WORD_ERROR_SHIFT 8U
+#define WORD_ERROR_MASK 0xffffULL
+#define WORD_GENERATION_SHIFT 32U
+
+/* threads spread over pin slots, a slot is shared only past this many threads */
+#define PIN_SLOTS 16U
+/* nested calls into modules remembered per thread for fault attribution */
+#define CALL_DEPTH_MAX 8U
+/* a caller pinned inside a crashed module never returns, do not wait for it forever */
+#define DRAIN_CRASHED_TIMEOUT_MS 1000U
+#define DRAIN_POLL_US 100U
+
+/* written by the threads of one slot only, so a pin stays on its own line */
+typedef struct {
+    _Alignas(64) KMOD_ATOMIC(unsigned int) count;
+    /* calls into the module made by the threads of this slot */
+    KMOD_ATOMIC(uint_fast64_t) calls;
+} pin_slot_t;
+
 struct module_loader {
-    void *handle;
+    /* stored before the state word goes LOADED, so a LOADED reader sees it */
+    KMOD_ATOMIC(void *) handle;
     uint32_t (*get_version_func)(void);
     int (*init_func)(const void *);
     void (*fini_func)(void);
     void (*hello_func)(void);
+    /* copy of the module table, zero when the module exports none */
+    module_ops_t ops;
     uint32_t interface_version;
-    pthread_mutex_t mutex;
-    bool loaded;
+    lock_prof_mutex_t mutex;
+    /* atomic in every build, the fatal signal handler moves it to CRASHED */
+    _Atomic(uint64_t) state_word;
     int ref_count;
     char path[MODULE_PATH_MAX];
-    module_error_t last_error;
+    /* identity of the file at load, the image cache key at unload */
+    image_key_t image_key;
+    bool image_keyed;
+    /* recorded by register_lazy, loaded by the first user */
+    bool lazy;
+    bool lazy_has_args;
+    char lazy_path[MODULE_PATH_MAX];
+    module_init_args_t lazy_args;
+    uint64_t load_count;
+    uint64_t load_failures;
+    uint64_t unload_count;
+    uint64_t crash_count;
+    uint64_t idle_unload_count;
+    /*
+     * last use as seen by reap_idle: call_count() already counts every use, so the
+     * hot path pays nothing extra and reap_idle stamps the time it sees
+     * the counter move. under the mutex
+     */
+    uint_fast64_t idle_calls;
+    uint64_t idle_since_ns;
+    /* calls in flight through symbol handles, drained by unload */
+    pin_slot_t pins[PIN_SLOTS];
+    /*
+     * pins of callers that never came back from a crashed module, given up
+     * on by drain_pins. later drains and reap_idle do not wait for them.
+     * under the mutex
+     */
+    uint32_t stuck_pins;
+    /* pool tasks still running when the last unload gave up on them */
+    uint32_t stuck_tasks;
+    /* loaded module missing from the crash index, its pc is never recognised */
+    bool unindexed;
+    /*
+     * set from the fatal signal handler, cleared by mark_crashed
+     * a real atomic even in the single-threaded build
+     */
+    atomic_bool crash_pending;
+    /* host services handed to module_init, the args outlive the module */
+    host_pool_t *pool;
+    uint32_t pool_max_concurrency;
+    host_pool_client_t *pool_client;
+    host_timer_wheel_t *timers;
+    host_timer_client_t *timer_client;
+    host_reactor_t *reactor;
+    host_reactor_client_t *reactor_client;
+    host_arena_t *arena;
+    /* highest init args version the module reads, from module_get_init_args_version */
+    uint32_t init_args_version;
+    module_init_args_t init_args;
+    /* MODULE_LOAD_* bits for modules loaded from now on */
+    uint32_t load_flags;
+    /* what the last load prefaulted, zero while unloaded */
+    prefault_result_t prefault;
+    uint64_t load_phase_ns[MODULE_LOAD_PHASE_COUNT];
 };
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static KMOD_ATOMIC(unsigned int) g_next_pin_slot = 0U;
+static _Thread_local uint32_t t_pin_slot = PIN_SLOTS;
+
+static uint32_t pin_slot(void)
+{
+    if (t_pin_slot == PIN_SLOTS) {
+        t_pin_slot = kmod_atomic_fetch_add(&g_next_pin_slot, 1U,
+                memory_order_relaxed) % PIN_SLOTS;
+    }
+    return t_pin_slot;
+}
+
+/* one more call into the module, counted on the pin slot of this thread */
+static void count_call(module_loader_t *loader)
+{
+    kmod_atomic_fetch_add(&loader->pins[pin_slot()].calls, 1U, memory_order_relaxed);
+}
+
+/*
+ * modules the calling thread is inside of, innermost last, so a fault in
+ * libc called by a module (memcpy, abort, assert) is still blamed on it;
+ * only written by the owning thread and read by its signal handlers
+ */
+static _Thread_local module_loader_t *volatile t_call_stack[CALL_DEPTH_MAX];
+static _Thread_local volatile uint32_t t_call_depth;
+/* set while this thread runs module_init or module_fini */
+static _Thread_local volatile sig_atomic_t t_in_init_or_fini;
+
+static void enter_module(module_loader_t *loader)
+{
+    if (t_call_depth < CALL_DEPTH_MAX) {
+        t_call_stack[t_call_depth] = loader;
+    }
+    atomic_signal_fence(memory_order_release);
+    t_call_depth++;
+}
+
+static void leave_module(void)
+{
+    if (t_call_depth > 0U) {
+        t_call_depth--;
+    }
+}
+
+static module_loader_t *current_module(void)
+{
+    uint32_t depth = t_call_depth;
+
+    if (depth == 0U) {
+        return NULL;
+    }
+    return t_call_stack[((depth > CALL_DEPTH_MAX) ? CALL_DEPTH_MAX : depth) - 1U];
+}
+
+static uint_fast64_t call_count(const module_loader_t *loader)
+{
+    module_loader_t *l = (module_loader_t *)loader;
+    uint_fast64_t sum = 0U;
+    uint32_t i;
+
+    for (i = 0U; i < PIN_SLOTS; i++) {
+        sum += kmod_atomic_load(&l->pins[i].calls, memory_order_relaxed);
+    }
+    return sum;
+}
+
+static uint64_t word_pack(module_state_t state, module_error_t err, uint32_t generation)
+{
+    return ((uint64_t)generation << WORD_GENERATION_SHIFT) |
+            (((uint64_t)(uint16_t)(int16_t)err & WORD_ERROR_MASK) << WORD_ERROR_SHIFT) |
+            ((uint64_t)state & WORD_STATE_MASK);
+}
+
+static module_state_t word_state(uint64_t word)
+{
+    return (module_state_t)(word & WORD_STATE_MASK);
+}
+
+static module_error_t word_error(uint64_t word)
+{
+    return (module_error_t)(int16_t)(uint16_t)((word >> WORD_ERROR_SHIFT) & WORD_ERROR_MASK);
+}
+
+static uint32_t word_generation(uint64_t word)
+{
+    return (uint32_t)(word >> WORD_GENERATION_SHIFT);
+}
+
+static uint64_t load_word(const module_loader_t *loader)
+{
+    return atomic_load_explicit(&((module_loader_t *)loader)->state_word,
+            memory_order_acquire);
+}
+
+/* record the last error, lock-free so it works outside the mutex */
+static void set_error(module_loader_t *loader, module_error_t err)
+{
+    uint64_t word = atomic_load_explicit(&loader->state_word, memory_order_relaxed);
+
+    while (!atomic_compare_exchange_weak_explicit(&loader->state_word, &word,
+                word_pack(word_state(word), err, word_generation(word)),
+                memory_order_release, memory_order_relaxed)) {
+    }
+}
+
+/*
+ * state transition, called with the mutex held
+ * a CAS loop because the signal handler may move LOADED to CRASHED concurrently
+ * new_generation starts a new module instance
+ */
+static void set_state(module_loader_t *loader, module_state_t state, module_error_t err,
+        bool new_generation)
+{
+    uint64_t word = atomic_load_explicit(&loader->state_word, memory_order_relaxed);
+    uint32_t generation;
+
+    do {
+        generation = word_generation(word) + (new_generation ? 1U : 0U);
+    } while (!atomic_compare_exchange_weak_explicit(&loader->state_word, &word,
+                word_pack(state, err, generation),
+                memory_order_release, memory_order_relaxed));
+}
+
+#ifdef KMODLIKE_STATIC
+STATIC_POOL_DEFINE(g_loader_pool, module_loader_t, KMODLIKE_STATIC_LOADERS);
+
+static module_loader_t *loader_alloc(void)
+{
+    module_loader_t *loader = static_pool_get(&g_loader_pool);
+
+    if (loader != NULL) {
+        memset(loader, 0, sizeof(*loader));
+    }
+    return loader;
+}
+
+static void loader_free(module_loader_t *loader)
+{
+    static_pool_put(&g_loader_pool, loader);
+}
+#else
+static module_loader_t *loader_alloc(void)
+{
+    return calloc(1U, sizeof(module_loader_t));
+}
+
+static void loader_free(module_loader_t *loader)
+{
+    free(loader);
+}
+#endif
+
 module_loader_t *module_loader_create(void)
 {
     module_loader_t *loader;
 
-    loader = calloc(1U, sizeof(*loader));
+    loader = loader_alloc();
     if (loader == NULL) {
         return NULL;
     }
 
-    if (pthread_mutex_init(&loader->mutex, NULL) != 0) {
-        free(loader);
+    if (lock_prof_mutex_init(&loader->mutex) != 0) {
+        loader_free(loader);
         return NULL;
     }
 
-    loader->loaded = false;
+    kmod_atomic_init(&loader->handle, NULL);
+    atomic_init(&loader->state_word,
+            word_pack(MODULE_STATE_UNLOADED, MODULE_ERR_SUCCESS, 0U));
     loader->ref_count = 0;
-    loader->last_error = MODULE_ERR_SUCCESS;
     loader->interface_version = 0U;
     loader->get_version_func = NULL;
     loader->init_func = NULL;
@@ -57,283 +316,1115 @@ void module_loader_destroy(module_loader_t *loader)
         return;
     }
 
-    pthread_mutex_lock(&loader->mutex);
-    if (loader->loaded) {
-        pthread_mutex_unlock(&loader->mutex);
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    if (loader->handle != NULL) {
+        lock_prof_unlock(&loader->mutex);
         module_loader_unload(loader);
     } else {
-        pthread_mutex_unlock(&loader->mutex);
+        lock_prof_unlock(&loader->mutex);
     }
 
-    pthread_mutex_destroy(&loader->mutex);
-    free(loader);
+    lock_prof_mutex_destroy(&loader->mutex);
+    loader_free(loader);
 }
 
-module_error_t module_loader_load(module_loader_t *loader, const char *path,
-        const module_init_args_t *init_args)
+/*
+ * copy the optional ops table, the prefix both sides know
+ * slots of later versions than the module stay NULL
+ */
+static module_error_t resolve_ops(module_loader_t *loader, void *handle)
 {
-    module_error_t ret;
-    size_t path_len;
-    void *handle;
-    uint32_t module_version;
+    const module_ops_t *(*get_ops)(void);
+    const module_ops_t *ops;
+    size_t size;
 
-    if (loader == NULL) {
-        return MODULE_ERR_INVALID_PARAM;
-    }
+    memset(&loader->ops, 0, sizeof(loader->ops));
 
-    if (path == NULL) {
-        loader->last_error = MODULE_ERR_INVALID_PARAM;
-        return MODULE_ERR_INVALID_PARAM;
+    get_ops = (const module_ops_t *(*)(void))dlsym(handle, "module_get_ops");
+    if (get_ops == NULL) {
+        return MODULE_ERR_SUCCESS;
     }
 
-    path_len = strlen(path);
-    if (path_len < MODULE_PATH_MIN || path_len >= MODULE_PATH_MAX) {
-        loader->last_error = MODULE_ERR_INVALID_PARAM;
-        return MODULE_ERR_INVALID_PARAM;
+    ops = get_ops();
+    if (ops == NULL || ops->version < MODULE_OPS_VERSION_1 || ops->size < MODULE_OPS_SIZE_V1) {
+        return MODULE_ERR_VERSION_MISMATCH;
     }
 
-    pthread_mutex_lock(&loader->mutex);
-
-    if (loader->handle != NULL) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_ALREADY_LOADED;
-        return MODULE_ERR_ALREADY_LOADED;
+    size = (ops->size < sizeof(loader->ops)) ? ops->size : sizeof(loader->ops);
+    memcpy(&loader->ops, ops, size);
+    loader->ops.size = (uint32_t)size;
+    if (loader->ops.version > MODULE_OPS_VERSION_CURRENT) {
+        loader->ops.version = MODULE_OPS_VERSION_CURRENT;
     }
+    return MODULE_ERR_SUCCESS;
+}
 
-    handle = dlopen(path, RTLD_LAZY);
-    if (handle == NULL) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_DLOPEN_FAILED;
-        return MODULE_ERR_DLOPEN_FAILED;
-    }
+/* resolve interface symbols from a freshly opened handle */
+static module_error_t resolve_symbols(module_loader_t *loader, void *handle,
+        uint32_t *module_version)
+{
+    uint32_t (*get_args_version)(void);
 
     loader->get_version_func = (uint32_t (*)(void))dlsym(handle,
             "module_get_interface_version");
     if (loader->get_version_func == NULL) {
-        dlclose(handle);
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_MISSING_SYMBOL;
         return MODULE_ERR_MISSING_SYMBOL;
     }
 
-    module_version = loader->get_version_func();
-    if (module_version != MODULE_INTERFACE_VERSION_CURRENT) {
-        dlclose(handle);
+    *module_version = loader->get_version_func();
+    if (*module_version != MODULE_INTERFACE_VERSION_CURRENT) {
         loader->get_version_func = NULL;
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_VERSION_MISMATCH;
         return MODULE_ERR_VERSION_MISMATCH;
     }
 
     loader->init_func = (int (*)(const void *))dlsym(handle, "module_init");
     if (loader->init_func == NULL) {
-        dlclose(handle);
         loader->get_version_func = NULL;
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_MISSING_SYMBOL;
         return MODULE_ERR_MISSING_SYMBOL;
     }
 
     loader->fini_func = (void (*)(void))dlsym(handle, "module_fini");
     if (loader->fini_func == NULL) {
-        dlclose(handle);
         loader->get_version_func = NULL;
         loader->init_func = NULL;
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_MISSING_SYMBOL;
         return MODULE_ERR_MISSING_SYMBOL;
     }
 
-    loader->hello_func = (void (*)(void))dlsym(handle, "mod_hello");
+    /* optional, modules written against version 1 args do not export it */
+    get_args_version = (uint32_t (*)(void))dlsym(handle, "module_get_init_args_version");
+    loader->init_args_version = (get_args_version != NULL) ? get_args_version() :
+            MODULE_INIT_ARGS_VERSION_1;
+
+    if (resolve_ops(loader, handle) != MODULE_ERR_SUCCESS) {
+        loader->get_version_func = NULL;
+        loader->init_func = NULL;
+        loader->fini_func = NULL;
+        return MODULE_ERR_VERSION_MISMATCH;
+    }
+
+    loader->hello_func = loader->ops.hello;
+    if (loader->hello_func == NULL) {
+        loader->hello_func = (void (*)(void))dlsym(handle, "mod_hello");
+    }
+    return MODULE_ERR_SUCCESS;
+}
+
+/* copy the part of the caller's args its version declares, the rest stays zero
+ * size is read from version 2 callers only, a version 1 struct may end at
+ * user_data and need not be zeroed past it */
+static void copy_init_args(module_init_args_t *dst, const module_init_args_t *src)
+{
+    size_t size;
+
+    memset(dst, 0, sizeof(*dst));
+    if (src == NULL) {
+        return;
+    }
+    size = MODULE_INIT_ARGS_SIZE_V1;
+    if (src->version >= MODULE_INIT_ARGS_VERSION_2 && src->size > size) {
+        size = (src->size < sizeof(*dst)) ? src->size : sizeof(*dst);
+    }
+    memcpy(dst, src, size);
+}
+
+/*
+ * init args in the version the module asked for. a version 1 module gets
+ * the caller's version 1 fields and no host services, it cannot reach them.
+ * a version 2 module gets the caller's fields plus the services of this
+ * loader: its own arena always, pool-backed services when there is a pool
+ */
+static module_error_t prepare_init_args(module_loader_t *loader,
+        const module_init_args_t *init_args, const module_init_args_t **args)
+{
+    *args = init_args;
+    copy_init_args(&loader->init_args, init_args);
+
+    if (loader->init_args_version < MODULE_INIT_ARGS_VERSION_2) {
+        memset((char *)&loader->init_args + MODULE_INIT_ARGS_SIZE_V1, 0,
+                sizeof(loader->init_args) - MODULE_INIT_ARGS_SIZE_V1);
+        loader->init_args.version = MODULE_INIT_ARGS_VERSION_1;
+        if (init_args != NULL) {
+            *args = &loader->init_args;
+        }
+        return MODULE_ERR_SUCCESS;
+    }
+
+    loader->init_args.version = MODULE_INIT_ARGS_VERSION_2;
+    loader->init_args.size = (uint32_t)sizeof(loader->init_args);
+
+    loader->arena = host_arena_create();
+    if (loader->arena == NULL) {
+        return MODULE_ERR_MEMORY;
+    }
+    loader->init_args.alloc = host_arena_ops(loader->arena);
+    *args = &loader->init_args;
+
+    if (loader->pool == NULL) {
+        return MODULE_ERR_SUCCESS;
+    }
+
+    loader->pool_client = host_pool_client_create(loader->pool, loader->pool_max_concurrency);
+    if (loader->pool_client == NULL) {
+        return MODULE_ERR_MEMORY;
+    }
+    host_pool_client_set_owner(loader->pool_client, loader);
+    loader->init_args.pool = host_pool_client_ops(loader->pool_client);
+
+    if (loader->timers != NULL) {
+        loader->timer_client = host_timer_client_create(loader->timers, loader->pool_client);
+        if (loader->timer_client == NULL) {
+            return MODULE_ERR_MEMORY;
+        }
+        loader->init_args.timers = host_timer_client_ops(loader->timer_client);
+    }
+
+    if (loader->reactor != NULL) {
+        loader->reactor_client = host_reactor_client_create(loader->reactor,
+                loader->pool_client);
+        if (loader->reactor_client == NULL) {
+            return MODULE_ERR_MEMORY;
+        }
+        loader->init_args.reactor = host_reactor_client_ops(loader->reactor_client);
+    }
+    return MODULE_ERR_SUCCESS;
+}
+
+/*
+ * stop the host services of the module before fini, nothing may call into
+ * module code once it is closed. a task stuck in a crashed module is given
+ * up on, its client stays allocated until the task returns
+ */
+static void close_services(module_loader_t *loader, bool crashed)
+{
+    trace_span_t span;
+    host_pool_client_stats_t pool_stats;
+
+    loader->stuck_tasks = 0U;
+    if (loader->pool_client == NULL) {
+        return;
+    }
+
+    /* event sources first, their callbacks already queued are dropped with the pool */
+    host_timer_client_close(loader->timer_client);
+    host_reactor_client_close(loader->reactor_client);
 
-    ret = loader->init_func(init_args);
+    trace_span_begin(&span, "pool_close");
+    if (!host_pool_client_close(loader->pool_client,
+                crashed ? DRAIN_CRASHED_TIMEOUT_MS : 0U)) {
+        host_pool_client_get_stats(loader->pool_client, &pool_stats);
+        loader->stuck_tasks = pool_stats.running;
+        flightrec_record(FLIGHTREC_STUCK, 0U, loader->stuck_tasks, loader->path);
+    }
+    trace_span_end(&span);
+}
+
+static void release_services(module_loader_t *loader)
+{
+    host_timer_client_destroy(loader->timer_client);
+    loader->timer_client = NULL;
+    host_reactor_client_destroy(loader->reactor_client);
+    loader->reactor_client = NULL;
+    host_pool_client_destroy(loader->pool_client);
+    loader->pool_client = NULL;
+    /* whatever the module leaked goes in one step */
+    host_arena_destroy(loader->arena);
+    loader->arena = NULL;
+    memset(&loader->init_args, 0, sizeof(loader->init_args));
+}
+
+/* dlopen mode for MODULE_LOAD_* bits */
+static int dlopen_mode(uint32_t flags)
+{
+    int mode = (flags & MODULE_LOAD_BIND_NOW) != 0U ? RTLD_NOW : RTLD_LAZY;
+
+    mode |= (flags & MODULE_LOAD_GLOBAL) != 0U ? RTLD_GLOBAL : RTLD_LOCAL;
+#ifdef RTLD_DEEPBIND
+    if ((flags & MODULE_LOAD_DEEPBIND) != 0U) {
+        mode |= RTLD_DEEPBIND;
+    }
+#endif
+    return mode;
+}
+
+static module_error_t load_locked(module_loader_t *loader, const char *path,
+        const module_init_args_t *init_args)
+{
+    const module_init_args_t *args = NULL;
+    uint64_t phase_ns[MODULE_LOAD_PHASE_COUNT] = {0};
+    module_error_t err;
+    trace_span_t span;
+    image_key_t key = {0};
+    void *handle;
+    uint64_t start_ns;
+    uint32_t module_version = 0U;
+    bool keyed;
+    int mode = dlopen_mode(loader->load_flags);
+    int ret;
+
+    if (loader->handle != NULL) {
+        return MODULE_ERR_ALREADY_LOADED;
+    }
+
+    /* an unchanged file still mapped from an earlier unload needs no dlopen */
+    keyed = image_cache_key(path, &key) == 0;
+    key.mode = (uint32_t)mode;
+    handle = keyed ? image_cache_take(path, &key) : NULL;
+    if (handle == NULL) {
+        start_ns = now_ns();
+        trace_span_begin(&span, "dlopen");
+        handle = dlopen(path, mode);
+        trace_span_end(&span);
+        phase_ns[MODULE_LOAD_PHASE_DLOPEN] = now_ns() - start_ns;
+    }
+    if (handle == NULL) {
+        return MODULE_ERR_DLOPEN_FAILED;
+    }
+
+    start_ns = now_ns();
+    trace_span_begin(&span, "resolve_symbols");
+    err = resolve_symbols(loader, handle, &module_version);
+    trace_span_end(&span);
+    phase_ns[MODULE_LOAD_PHASE_RESOLVE] = now_ns() - start_ns;
+    if (err != MODULE_ERR_SUCCESS) {
+        dlclose(handle);
+        return err;
+    }
+
+    /* before module_init, so init and the first calls run without faults */
+    memset(&loader->prefault, 0, sizeof(loader->prefault));
+    if ((loader->load_flags & (MODULE_LOAD_PREFAULT | MODULE_LOAD_HUGE_TEXT)) != 0U) {
+        start_ns = now_ns();
+        trace_span_begin(&span, "prefault");
+        prefault_image(handle, (loader->load_flags & MODULE_LOAD_HUGE_TEXT) != 0U,
+                &loader->prefault);
+        trace_span_end(&span);
+        phase_ns[MODULE_LOAD_PHASE_PREFAULT] = now_ns() - start_ns;
+    }
+
+    err = prepare_init_args(loader, init_args, &args);
+    if (err != MODULE_ERR_SUCCESS) {
+        release_services(loader);
+        dlclose(handle);
+        return err;
+    }
+
+    start_ns = now_ns();
+    trace_span_begin(&span, "module_init");
+    enter_module(loader);
+    t_in_init_or_fini = 1;
+    ret = loader->init_func(args);
+    t_in_init_or_fini = 0;
+    leave_module();
+    trace_span_end(&span);
+    phase_ns[MODULE_LOAD_PHASE_INIT] = now_ns() - start_ns;
     if (ret != 0) {
+        /* tasks queued by a failed init must not outlive the image */
+        close_services(loader, false);
+        release_services(loader);
         dlclose(handle);
-        loader->handle = NULL;
         loader->get_version_func = NULL;
         loader->init_func = NULL;
         loader->fini_func = NULL;
         loader->hello_func = NULL;
+        memset(&loader->ops, 0, sizeof(loader->ops));
         loader->interface_version = 0U;
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_INIT_FAILED;
         return MODULE_ERR_INIT_FAILED;
     }
 
-    loader->handle = handle;
+    kmod_atomic_store(&loader->handle, handle, memory_order_release);
     loader->interface_version = module_version;
+    /* a module missing from the index is only blamed for faults in pinned
+     * calls and pool tasks, its own threads crash the host */
+    loader->unindexed = module_map_add(loader, handle) != 0;
+    atomic_store(&loader->crash_pending, false);
     strncpy(loader->path, path, MODULE_PATH_MAX - 1U);
     loader->path[MODULE_PATH_MAX - 1U] = '\0';
-    loader->loaded = true;
+    loader->image_key = key;
+    loader->image_keyed = keyed;
+    memcpy(loader->load_phase_ns, phase_ns, sizeof(loader->load_phase_ns));
     loader->ref_count = 0;
-    loader->last_error = MODULE_ERR_SUCCESS;
+    loader->idle_calls = call_count(loader);
+    loader->idle_since_ns = now_ns();
+    set_state(loader, MODULE_STATE_LOADED, MODULE_ERR_SUCCESS, true);
+    return MODULE_ERR_SUCCESS;
+}
+
+module_error_t module_loader_load(module_loader_t *loader, const char *path,
+        const module_init_args_t *init_args)
+{
+    module_error_t err;
+    trace_span_t span_load;
+    trace_span_t span_lock;
+    uint64_t start_ns;
+    size_t path_len;
 
-    pthread_mutex_unlock(&loader->mutex);
+    if (loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    if (path == NULL) {
+        set_error(loader, MODULE_ERR_INVALID_PARAM);
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    path_len = strlen(path);
+    if (path_len < MODULE_PATH_MIN || path_len >= MODULE_PATH_MAX) {
+        set_error(loader, MODULE_ERR_INVALID_PARAM);
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    start_ns = now_ns();
+    trace_span_begin(&span_load, "module_loader_load");
+    trace_span_begin(&span_lock, "loader_lock_wait");
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_LOAD);
+    trace_span_end(&span_lock);
+
+    err = load_locked(loader, path, init_args);
+    set_error(loader, err);
+    if (err == MODULE_ERR_SUCCESS) {
+        /* an explicit load replaces a lazy registration */
+        loader->lazy = false;
+        loader->load_count++;
+    } else if (err != MODULE_ERR_ALREADY_LOADED) {
+        loader->load_failures++;
+    }
+
+    lock_prof_unlock(&loader->mutex);
+    trace_span_end(&span_load);
+    flightrec_record(FLIGHTREC_LOAD, (uint64_t)(int64_t)err, now_ns() - start_ns, path);
+    return err;
+}
+
+module_error_t module_loader_register_lazy(module_loader_t *loader, const char *path,
+        const module_init_args_t *init_args)
+{
+    size_t path_len;
+
+    if (loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    if (path == NULL) {
+        set_error(loader, MODULE_ERR_INVALID_PARAM);
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    path_len = strlen(path);
+    if (path_len < MODULE_PATH_MIN || path_len >= MODULE_PATH_MAX) {
+        set_error(loader, MODULE_ERR_INVALID_PARAM);
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_LOAD);
+    if (loader->handle != NULL) {
+        lock_prof_unlock(&loader->mutex);
+        set_error(loader, MODULE_ERR_ALREADY_LOADED);
+        return MODULE_ERR_ALREADY_LOADED;
+    }
+
+    memcpy(loader->lazy_path, path, path_len + 1U);
+    /* shown by stats before the first use */
+    memcpy(loader->path, path, path_len + 1U);
+    copy_init_args(&loader->lazy_args, init_args);
+    loader->lazy_has_args = init_args != NULL;
+    loader->lazy = true;
+    lock_prof_unlock(&loader->mutex);
+
+    set_error(loader, MODULE_ERR_SUCCESS);
     return MODULE_ERR_SUCCESS;
 }
 
-module_error_t module_loader_unload(module_loader_t *loader)
+bool module_loader_is_lazy(const module_loader_t *loader)
 {
-    int ref_count;
+    bool lazy;
+
+    if (loader == NULL) {
+        return false;
+    }
+    lock_prof_lock((lock_prof_mutex_t *)&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    lazy = loader->lazy;
+    lock_prof_unlock((lock_prof_mutex_t *)&loader->mutex);
+    return lazy;
+}
+
+/*
+ * first use of a lazy module, called with the mutex held: concurrent
+ * first users wait on the mutex behind a single load. a failed load is
+ * retried by the next user
+ */
+static void lazy_load_locked(module_loader_t *loader)
+{
+    module_error_t err;
+    trace_span_t span;
+    uint64_t start_ns;
+
+    if (!loader->lazy || loader->handle != NULL) {
+        return;
+    }
+
+    start_ns = now_ns();
+    trace_span_begin(&span, "lazy_load");
+    err = load_locked(loader, loader->lazy_path,
+            loader->lazy_has_args ? &loader->lazy_args : NULL);
+    trace_span_end(&span);
+    set_error(loader, err);
+    if (err == MODULE_ERR_SUCCESS) {
+        loader->load_count++;
+    } else {
+        loader->load_failures++;
+    }
+    flightrec_record(FLIGHTREC_LOAD, (uint64_t)(int64_t)err, now_ns() - start_ns,
+            loader->lazy_path);
+}
+
+/* lazy load for lock-free callers, true once the module is loaded */
+static bool lazy_load(module_loader_t *loader)
+{
+    bool loaded;
+
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_SYMBOL);
+    lazy_load_locked(loader);
+    loaded = word_state(load_word(loader)) == MODULE_STATE_LOADED;
+    lock_prof_unlock(&loader->mutex);
+    return loaded;
+}
+
+static uint32_t pin_count(module_loader_t *loader)
+{
+    uint32_t sum = 0U;
+    uint32_t i;
+
+    for (i = 0U; i < PIN_SLOTS; i++) {
+        sum += kmod_atomic_load(&loader->pins[i].count, memory_order_seq_cst);
+    }
+    return sum;
+}
+
+/* pins still expected to return, called with the mutex held */
+static uint32_t live_pins(module_loader_t *loader)
+{
+    uint32_t sum = pin_count(loader);
+
+    /* a caller given up on came back after all */
+    if (sum < loader->stuck_pins) {
+        loader->stuck_pins = sum;
+    }
+    return sum - loader->stuck_pins;
+}
+
+/*
+ * wait for calls through symbol handles to return, the state is DRAINING
+ * so no new pin can succeed. pairs with the seq_cst pin-then-check in
+ * module_symbol_pin()
+ */
+static void drain_pins(module_loader_t *loader, bool crashed)
+{
+    const struct timespec poll = {0, (long)DRAIN_POLL_US * 1000L};
+    trace_span_t span;
+    uint64_t deadline_ns = now_ns() + (uint64_t)DRAIN_CRASHED_TIMEOUT_MS * 1000000ULL;
+
+    kmod_atomic_fence(memory_order_seq_cst);
+    if (live_pins(loader) == 0U) {
+        return;
+    }
 
+    trace_span_begin(&span, "drain_pins");
+    while (live_pins(loader) != 0U) {
+        if (crashed && now_ns() >= deadline_ns) {
+            flightrec_record(FLIGHTREC_STUCK, live_pins(loader), 0U, loader->path);
+            loader->stuck_pins += live_pins(loader);
+            break;
+        }
+        nanosleep(&poll, NULL);
+    }
+    trace_span_end(&span);
+}
+
+module_error_t module_loader_set_pool(module_loader_t *loader, host_pool_t *pool,
+        uint32_t max_concurrency)
+{
     if (loader == NULL) {
         return MODULE_ERR_INVALID_PARAM;
     }
 
-    pthread_mutex_lock(&loader->mutex);
+    /* the loaded module keeps the client it got at load */
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    loader->pool = pool;
+    loader->pool_max_concurrency = max_concurrency;
+    lock_prof_unlock(&loader->mutex);
+    return MODULE_ERR_SUCCESS;
+}
 
-    if (loader->handle == NULL) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_NOT_LOADED;
-        return MODULE_ERR_NOT_LOADED;
+module_error_t module_loader_set_timers(module_loader_t *loader, host_timer_wheel_t *wheel)
+{
+    if (loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
     }
 
-    ref_count = loader->ref_count;
-    if (ref_count > 0) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_IN_USE;
-        return MODULE_ERR_IN_USE;
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    loader->timers = wheel;
+    lock_prof_unlock(&loader->mutex);
+    return MODULE_ERR_SUCCESS;
+}
+
+module_error_t module_loader_set_reactor(module_loader_t *loader, host_reactor_t *reactor)
+{
+    if (loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
     }
 
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    loader->reactor = reactor;
+    lock_prof_unlock(&loader->mutex);
+    return MODULE_ERR_SUCCESS;
+}
+
+/*
+ * drain, fini and dlclose a loaded module with no references, called with
+ * the mutex held. a lazy registration is left in place
+ */
+static void unload_locked(module_loader_t *loader)
+{
+    trace_span_t span;
+    bool crashed;
+
+    /* lock-free readers see the module go away before fini runs */
+    crashed = word_state(load_word(loader)) == MODULE_STATE_CRASHED;
+    set_state(loader, MODULE_STATE_DRAINING, MODULE_ERR_SUCCESS, false);
+    drain_pins(loader, crashed);
+    close_services(loader, crashed);
+
     if (loader->fini_func != NULL) {
+        trace_span_begin(&span, "module_fini");
+        enter_module(loader);
+        t_in_init_or_fini = 1;
         loader->fini_func();
+        t_in_init_or_fini = 0;
+        leave_module();
+        trace_span_end(&span);
     }
+    release_services(loader);
+
+    /* after fini, the module threads are gone and cannot fault anymore */
+    module_map_remove(loader);
+    loader->unindexed = false;
 
-    dlclose(loader->handle);
-    loader->handle = NULL;
+    /* a crashed image may be corrupt, never hand it out again */
+    trace_span_begin(&span, "dlclose");
+    if (crashed || !loader->image_keyed ||
+            !image_cache_put(loader->path, &loader->image_key, loader->handle)) {
+        dlclose(loader->handle);
+    }
+    trace_span_end(&span);
+    kmod_atomic_store(&loader->handle, NULL, memory_order_relaxed);
     loader->get_version_func = NULL;
     loader->init_func = NULL;
     loader->fini_func = NULL;
     loader->hello_func = NULL;
+    memset(&loader->ops, 0, sizeof(loader->ops));
+    memset(&loader->prefault, 0, sizeof(loader->prefault));
     loader->interface_version = 0U;
-    loader->loaded = false;
     loader->ref_count = 0;
-    loader->last_error = MODULE_ERR_SUCCESS;
+    set_state(loader, MODULE_STATE_UNLOADED, MODULE_ERR_SUCCESS, false);
+    loader->unload_count++;
+}
 
-    pthread_mutex_unlock(&loader->mutex);
+module_error_t module_loader_set_load_flags(module_loader_t *loader, uint32_t flags)
+{
+    if (loader == NULL || (flags & ~LOAD_FLAGS_SUPPORTED) != 0U) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    loader->load_flags = flags;
+    lock_prof_unlock(&loader->mutex);
     return MODULE_ERR_SUCCESS;
 }
 
-module_state_t module_loader_get_state(const module_loader_t *loader)
+uint32_t module_loader_get_load_flags(module_loader_t *loader)
 {
-    bool loaded;
+    uint32_t flags;
 
     if (loader == NULL) {
-        return MODULE_STATE_UNLOADED;
+        return 0U;
+    }
+
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    flags = loader->load_flags;
+    lock_prof_unlock(&loader->mutex);
+    return flags;
+}
+
+module_error_t module_loader_unload(module_loader_t *loader)
+{
+    trace_span_t span;
+    uint64_t start_ns;
+    int ref_count;
+
+    if (loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
     }
 
-    pthread_mutex_lock((pthread_mutex_t *)&loader->mutex);
-    loaded = loader->loaded;
-    pthread_mutex_unlock((pthread_mutex_t *)&loader->mutex);
+    start_ns = now_ns();
+    trace_span_begin(&span, "loader_lock_wait");
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_UNLOAD);
+    trace_span_end(&span);
+
+    if (loader->handle == NULL && loader->lazy) {
+        /* never used since registration, dropping it is the whole unload */
+        loader->lazy = false;
+        lock_prof_unlock(&loader->mutex);
+        flightrec_record(FLIGHTREC_UNLOAD, (uint64_t)(int64_t)MODULE_ERR_SUCCESS, 0U,
+                loader->lazy_path);
+        set_error(loader, MODULE_ERR_SUCCESS);
+        return MODULE_ERR_SUCCESS;
+    }
+
+    if (loader->handle == NULL) {
+        lock_prof_unlock(&loader->mutex);
+        flightrec_record(FLIGHTREC_UNLOAD, (uint64_t)(int64_t)MODULE_ERR_NOT_LOADED, 0U,
+                NULL);
+        set_error(loader, MODULE_ERR_NOT_LOADED);
+        return MODULE_ERR_NOT_LOADED;
+    }
+
+    ref_count = loader->ref_count;
+    if (ref_count > 0) {
+        flightrec_record(FLIGHTREC_UNLOAD, (uint64_t)(int64_t)MODULE_ERR_IN_USE, 0U,
+                loader->path);
+        lock_prof_unlock(&loader->mutex);
+        set_error(loader, MODULE_ERR_IN_USE);
+        return MODULE_ERR_IN_USE;
+    }
+
+    unload_locked(loader);
+    loader->lazy = false;
+    flightrec_record(FLIGHTREC_UNLOAD, (uint64_t)(int64_t)MODULE_ERR_SUCCESS,
+            now_ns() - start_ns, loader->path);
+
+    lock_prof_unlock(&loader->mutex);
+    return MODULE_ERR_SUCCESS;
+}
+
+module_error_t module_loader_reap_idle(module_loader_t *loader, uint64_t idle_ns)
+{
+    module_error_t err = MODULE_ERR_SUCCESS;
+    uint_fast64_t calls;
+    uint64_t start_ns;
+
+    if (loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    start_ns = now_ns();
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_UNLOAD);
+    calls = call_count(loader);
+    if (!loader->lazy || loader->handle == NULL ||
+            word_state(load_word(loader)) != MODULE_STATE_LOADED) {
+        /* without a registration nothing would bring the module back */
+        err = MODULE_ERR_NOT_LOADED;
+    } else if (calls != loader->idle_calls) {
+        loader->idle_calls = calls;
+        loader->idle_since_ns = start_ns;
+        err = MODULE_ERR_IN_USE;
+    } else if (loader->ref_count > 0 || live_pins(loader) != 0U ||
+            start_ns - loader->idle_since_ns < idle_ns) {
+        err = MODULE_ERR_IN_USE;
+    }
+    if (err != MODULE_ERR_SUCCESS) {
+        lock_prof_unlock(&loader->mutex);
+        return err;
+    }
+
+    /* a call racing in past the check is waited for by drain_pins */
+    unload_locked(loader);
+    loader->idle_unload_count++;
+    flightrec_record(FLIGHTREC_UNLOAD, (uint64_t)(int64_t)MODULE_ERR_SUCCESS,
+            now_ns() - start_ns, loader->path);
+    lock_prof_unlock(&loader->mutex);
+    return MODULE_ERR_SUCCESS;
+}
+
+module_state_t module_loader_get_state(const module_loader_t *loader)
+{
+    if (loader == NULL) {
+        return MODULE_STATE_UNLOADED;
+    }
+    return word_state(load_word(loader));
+}
 
-    return loaded ? MODULE_STATE_LOADED : MODULE_STATE_UNLOADED;
+uint32_t module_loader_get_generation(const module_loader_t *loader)
+{
+    if (loader == NULL) {
+        return 0U;
+    }
+    return word_generation(load_word(loader));
 }
 
 module_error_t module_loader_get_symbol(module_loader_t *loader,
         const char *name, void **symbol)
 {
+    trace_span_t span;
+
     if (loader == NULL || name == NULL || symbol == NULL) {
         return MODULE_ERR_INVALID_PARAM;
     }
 
-    pthread_mutex_lock(&loader->mutex);
+    trace_span_begin(&span, "loader_lock_wait");
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_SYMBOL);
+    trace_span_end(&span);
+    lazy_load_locked(loader);
 
-    if (!loader->loaded || loader->handle == NULL) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_NOT_LOADED;
+    if (word_state(load_word(loader)) != MODULE_STATE_LOADED) {
+        lock_prof_unlock(&loader->mutex);
+        set_error(loader, MODULE_ERR_NOT_LOADED);
+        flightrec_record(FLIGHTREC_SYMBOL, (uint64_t)(int64_t)MODULE_ERR_NOT_LOADED, 0U,
+                name);
         return MODULE_ERR_NOT_LOADED;
     }
 
     *symbol = dlsym(loader->handle, name);
     if (*symbol == NULL) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_MISSING_SYMBOL;
+        lock_prof_unlock(&loader->mutex);
+        set_error(loader, MODULE_ERR_MISSING_SYMBOL);
+        flightrec_record(FLIGHTREC_SYMBOL, (uint64_t)(int64_t)MODULE_ERR_MISSING_SYMBOL, 0U,
+                name);
         return MODULE_ERR_MISSING_SYMBOL;
     }
 
     loader->ref_count++;
-    pthread_mutex_unlock(&loader->mutex);
+    count_call(loader);
+    lock_prof_unlock(&loader->mutex);
+    flightrec_record(FLIGHTREC_SYMBOL, (uint64_t)(int64_t)MODULE_ERR_SUCCESS, 0U, name);
     return MODULE_ERR_SUCCESS;
 }
 
 module_error_t module_loader_get_error(const module_loader_t *loader)
 {
-    module_error_t err;
-
     if (loader == NULL) {
         return MODULE_ERR_INVALID_PARAM;
     }
+    return word_error(load_word(loader));
+}
+
+module_error_t module_loader_resolve(module_loader_t *loader, const char *name,
+        module_symbol_t *sym)
+{
+    uint64_t word;
+    void *addr;
+
+    if (loader == NULL || name == NULL || sym == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_SYMBOL);
+    lazy_load_locked(loader);
+
+    word = load_word(loader);
+    if (word_state(word) != MODULE_STATE_LOADED) {
+        lock_prof_unlock(&loader->mutex);
+        set_error(loader, MODULE_ERR_NOT_LOADED);
+        flightrec_record(FLIGHTREC_SYMBOL, (uint64_t)(int64_t)MODULE_ERR_NOT_LOADED, 0U,
+                name);
+        return MODULE_ERR_NOT_LOADED;
+    }
+
+    addr = dlsym(loader->handle, name);
+    lock_prof_unlock(&loader->mutex);
+    if (addr == NULL) {
+        set_error(loader, MODULE_ERR_MISSING_SYMBOL);
+        flightrec_record(FLIGHTREC_SYMBOL, (uint64_t)(int64_t)MODULE_ERR_MISSING_SYMBOL, 0U,
+                name);
+        return MODULE_ERR_MISSING_SYMBOL;
+    }
+
+    sym->loader = loader;
+    sym->addr = addr;
+    sym->generation = word_generation(word);
+    flightrec_record(FLIGHTREC_SYMBOL, (uint64_t)(int64_t)MODULE_ERR_SUCCESS, 0U, name);
+    return MODULE_ERR_SUCCESS;
+}
+
+module_error_t module_loader_resolve_ops(module_loader_t *loader, module_symbol_t *sym)
+{
+    module_error_t err = MODULE_ERR_SUCCESS;
+    uint64_t word;
+
+    if (loader == NULL || sym == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
 
-    pthread_mutex_lock((pthread_mutex_t *)&loader->mutex);
-    err = loader->last_error;
-    pthread_mutex_unlock((pthread_mutex_t *)&loader->mutex);
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_SYMBOL);
+    lazy_load_locked(loader);
+    word = load_word(loader);
+    if (word_state(word) != MODULE_STATE_LOADED) {
+        err = MODULE_ERR_NOT_LOADED;
+    } else if (loader->ops.version == 0U) {
+        err = MODULE_ERR_MISSING_SYMBOL;
+    } else {
+        /* the copy lives in the loader, the generation check covers reloads */
+        sym->loader = loader;
+        sym->addr = &loader->ops;
+        sym->generation = word_generation(word);
+    }
+    lock_prof_unlock(&loader->mutex);
 
+    if (err != MODULE_ERR_SUCCESS) {
+        set_error(loader, err);
+    }
+    flightrec_record(FLIGHTREC_SYMBOL, (uint64_t)(int64_t)err, 0U, "module_get_ops");
     return err;
 }
 
+module_error_t module_symbol_pin(const module_symbol_t *sym)
+{
+    module_loader_t *loader;
+    pin_slot_t *slot;
+    uint64_t word;
+
+    if (sym == NULL || sym->loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    /* pin first, then check: unload publishes DRAINING first, then counts pins */
+    loader = sym->loader;
+    slot = &loader->pins[pin_slot()];
+    kmod_atomic_fetch_add(&slot->count, 1U, memory_order_seq_cst);
+    word = atomic_load_explicit(&loader->state_word, memory_order_seq_cst);
+
+    if (word_state(word) == MODULE_STATE_LOADED && word_generation(word) == sym->generation) {
+        /* same line as the pin count, nothing shared with other threads */
+        kmod_atomic_fetch_add(&slot->calls, 1U, memory_order_relaxed);
+        enter_module(loader);
+        return MODULE_ERR_SUCCESS;
+    }
+
+    kmod_atomic_fetch_sub(&slot->count, 1U, memory_order_release);
+    return word_generation(word) != sym->generation ? MODULE_ERR_STALE_HANDLE :
+            MODULE_ERR_NOT_LOADED;
+}
+
+void module_symbol_unpin(const module_symbol_t *sym)
+{
+    if (sym == NULL || sym->loader == NULL) {
+        return;
+    }
+    leave_module();
+    kmod_atomic_fetch_sub(&sym->loader->pins[pin_slot()].count, 1U,
+            memory_order_release);
+}
+
 module_error_t module_loader_call_hello(module_loader_t *loader)
 {
+    module_symbol_t sym;
     void (*hello_func)(void);
 
     if (loader == NULL) {
         return MODULE_ERR_INVALID_PARAM;
     }
 
-    pthread_mutex_lock(&loader->mutex);
-
-    if (!loader->loaded || loader->hello_func == NULL) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_NOT_LOADED;
-        return MODULE_ERR_NOT_LOADED;
+    /* hello_func is set at load and cleared only after pins drain */
+    sym.loader = loader;
+    sym.addr = NULL;
+    sym.generation = module_loader_get_generation(loader);
+    if (module_symbol_pin(&sym) != MODULE_ERR_SUCCESS) {
+        /* slow path only: a lazy module is loaded here by its first call */
+        if (!lazy_load(loader)) {
+            set_error(loader, MODULE_ERR_NOT_LOADED);
+            return MODULE_ERR_NOT_LOADED;
+        }
+        sym.generation = module_loader_get_generation(loader);
+        if (module_symbol_pin(&sym) != MODULE_ERR_SUCCESS) {
+            set_error(loader, MODULE_ERR_NOT_LOADED);
+            return MODULE_ERR_NOT_LOADED;
+        }
     }
 
     hello_func = loader->hello_func;
-    loader->ref_count++;
-    pthread_mutex_unlock(&loader->mutex);
+    if (hello_func == NULL) {
+        module_symbol_unpin(&sym);
+        set_error(loader, MODULE_ERR_NOT_LOADED);
+        return MODULE_ERR_NOT_LOADED;
+    }
 
+    flightrec_record(FLIGHTREC_CALL, sym.generation, 1U, "hello");
     hello_func();
 
-    module_loader_put_ref(loader);
+    module_symbol_unpin(&sym);
     return MODULE_ERR_SUCCESS;
 }
 
 module_error_t module_loader_get_ref(module_loader_t *loader)
 {
+    int ref_count;
+
     if (loader == NULL) {
         return MODULE_ERR_INVALID_PARAM;
     }
 
-    pthread_mutex_lock(&loader->mutex);
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_REF);
+    lazy_load_locked(loader);
 
-    if (!loader->loaded) {
-        pthread_mutex_unlock(&loader->mutex);
-        loader->last_error = MODULE_ERR_NOT_LOADED;
+    if (word_state(load_word(loader)) != MODULE_STATE_LOADED) {
+        lock_prof_unlock(&loader->mutex);
+        set_error(loader, MODULE_ERR_NOT_LOADED);
         return MODULE_ERR_NOT_LOADED;
     }
 
-    loader->ref_count++;
-    pthread_mutex_unlock(&loader->mutex);
+    ref_count = ++loader->ref_count;
+    count_call(loader);
+    lock_prof_unlock(&loader->mutex);
 
+    flightrec_record(FLIGHTREC_REF_GET, (uint64_t)ref_count, 0U, NULL);
     return MODULE_ERR_SUCCESS;
 }
 
 module_error_t module_loader_put_ref(module_loader_t *loader)
 {
+    int ref_count;
+
     if (loader == NULL) {
         return MODULE_ERR_INVALID_PARAM;
     }
 
-    pthread_mutex_lock(&loader->mutex);
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_REF);
 
     if (loader->ref_count <= 0) {
         loader->ref_count = 0;
-        pthread_mutex_unlock(&loader->mutex);
+        lock_prof_unlock(&loader->mutex);
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    ref_count = --loader->ref_count;
+    lock_prof_unlock(&loader->mutex);
+
+    flightrec_record(FLIGHTREC_REF_PUT, (uint64_t)ref_count, 0U, NULL);
+    return MODULE_ERR_SUCCESS;
+}
+
+module_error_t module_loader_mark_crashed(module_loader_t *loader)
+{
+    if (loader == NULL) {
         return MODULE_ERR_INVALID_PARAM;
     }
 
-    loader->ref_count--;
-    pthread_mutex_unlock(&loader->mutex);
+    lock_prof_lock(&loader->mutex, LOCK_SITE_LOADER_REF);
+    atomic_store(&loader->crash_pending, false);
+
+    if (loader->handle == NULL) {
+        lock_prof_unlock(&loader->mutex);
+        return MODULE_ERR_NOT_LOADED;
+    }
+
+    loader->crash_count++;
+    flightrec_record(FLIGHTREC_CRASH, loader->crash_count, 0U, loader->path);
+    lock_prof_unlock(&loader->mutex);
 
     return MODULE_ERR_SUCCESS;
 }
 
+module_loader_t *module_loader_find_by_addr(uintptr_t addr)
+{
+    return (module_loader_t *)module_map_lookup(addr);
+}
+
+module_loader_t *module_loader_find_by_fault(uintptr_t pc, const siginfo_t *info)
+{
+    module_loader_t *loader = NULL;
+    bool synchronous;
+
+    if (info == NULL) {
+        return (pc != 0U) ? module_loader_find_by_addr(pc) : NULL;
+    }
+
+    /* raised by this thread: a fault, or abort() through tgkill(2) */
+    synchronous = info->si_code > 0 || (info->si_code == SI_TKILL && info->si_pid == getpid());
+    if (pc != 0U) {
+        loader = module_loader_find_by_addr(pc);
+    } else if (info->si_code > 0) {
+        loader = module_loader_find_by_addr((uintptr_t)info->si_addr);
+    }
+    if (loader != NULL || !synchronous) {
+        return loader;
+    }
+
+    /* the pc is in libc or the host, blame the module this thread runs for */
+    loader = current_module();
+    if (loader == NULL) {
+        loader = host_pool_current_owner();
+    }
+    return loader;
+}
+
+bool module_loader_in_init_or_fini(void)
+{
+    return t_in_init_or_fini != 0;
+}
+
+bool module_loader_signal_crash(module_loader_t *loader)
+{
+    uint64_t word;
+
+    if (loader == NULL) {
+        return false;
+    }
+
+    /* only a LOADED module can crash, and only once per generation */
+    word = atomic_load_explicit(&loader->state_word, memory_order_relaxed);
+    do {
+        if (word_state(word) != MODULE_STATE_LOADED) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&loader->state_word, &word,
+                word_pack(MODULE_STATE_CRASHED, word_error(word), word_generation(word)),
+                memory_order_acq_rel, memory_order_relaxed));
+
+    atomic_store(&loader->crash_pending, true);
+    return true;
+}
+
+bool module_loader_crash_pending(const module_loader_t *loader)
+{
+    if (loader == NULL) {
+        return false;
+    }
+    return atomic_load(&((module_loader_t *)loader)->crash_pending);
+}
+
+module_error_t module_loader_get_stats(const module_loader_t *loader,
+        module_loader_stats_t *stats)
+{
+    host_arena_stats_t arena;
+
+    if (loader == NULL || stats == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    lock_prof_lock((lock_prof_mutex_t *)&loader->mutex, LOCK_SITE_LOADER_QUERY);
+    stats->state = word_state(load_word(loader));
+    stats->load_count = loader->load_count;
+    stats->load_failures = loader->load_failures;
+    stats->unload_count = loader->unload_count;
+    stats->crash_count = loader->crash_count;
+    stats->idle_unload_count = loader->idle_unload_count;
+    stats->calls = call_count(loader);
+    stats->stuck_calls = pin_count((module_loader_t *)loader);
+    if (stats->stuck_calls > loader->stuck_pins) {
+        stats->stuck_calls = loader->stuck_pins;
+    }
+    stats->stuck_tasks = loader->stuck_tasks;
+    stats->unindexed = loader->unindexed;
+    stats->ref_count = loader->ref_count;
+    host_arena_get_stats(loader->arena, &arena);
+    stats->heap_bytes = arena.bytes;
+    stats->heap_objects = arena.objects;
+    stats->heap_reserved_bytes = arena.reserved_bytes;
+    stats->prefault_bytes = loader->prefault.bytes;
+    stats->huge_text_bytes = loader->prefault.huge_bytes;
+    stats->load_flags = loader->load_flags;
+    memcpy(stats->load_phase_ns, loader->load_phase_ns, sizeof(stats->load_phase_ns));
+    memcpy(stats->path, loader->path, sizeof(stats->path));
+    lock_prof_unlock((lock_prof_mutex_t *)&loader->mutex);
+
+    return MODULE_ERR_SUCCESS;
+}
@@ -1,20 +1,95 @@
 #ifndef MODULE_LOADER_H
 #define MODULE_LOADER_H
 
+#include "host_arena.h"
+#include "host_pool.h"
+#include "host_reactor.h"
+#include "host_timer.h"
 #include "module_error.h"
 #include "module_interface.h"
+#include <signal.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
     MODULE_STATE_UNLOADED = 0,
-    MODULE_STATE_LOADED = 1
+    MODULE_STATE_LOADED = 1,
+    /* unload in progress, new calls are refused */
+    MODULE_STATE_DRAINING = 2,
+    /* raised a fatal signal, waiting to be unloaded */
+    MODULE_STATE_CRASHED = 3
 } module_state_t;
 
+/* module_loader_set_load_flags() bits */
+/* map the whole image in before module_init, no page faults on first calls */
+#define MODULE_LOAD_PREFAULT 0x1U
+/* also collapse the module text onto transparent huge pages */
+#define MODULE_LOAD_HUGE_TEXT 0x2U
+/* RTLD_NOW: bind every symbol at load instead of on its first call */
+#define MODULE_LOAD_BIND_NOW 0x4U
+/* RTLD_GLOBAL: later modules may resolve against this one */
+#define MODULE_LOAD_GLOBAL 0x8U
+/* RTLD_DEEPBIND: prefer the module's own symbols and dependencies, glibc only */
+#define MODULE_LOAD_DEEPBIND 0x10U
+
+/* where a load spends its time, indexes of load_phase_ns */
+typedef enum {
+    /* dlopen with relocation and binding, 0 on an image cache hit */
+    MODULE_LOAD_PHASE_DLOPEN = 0,
+    MODULE_LOAD_PHASE_RESOLVE,
+    MODULE_LOAD_PHASE_PREFAULT,
+    MODULE_LOAD_PHASE_INIT,
+    MODULE_LOAD_PHASE_COUNT
+} module_load_phase_t;
+
+/* counters and state snapshot of a loader */
+typedef struct {
+    module_state_t state;
+    uint64_t load_count;
+    uint64_t load_failures;
+    uint64_t unload_count;
+    uint64_t crash_count;
+    /* unloads by module_loader_reap_idle(), also in unload_count */
+    uint64_t idle_unload_count;
+    uint64_t calls;
+    /* pinned calls that never returned from a crashed module */
+    uint32_t stuck_calls;
+    /* pool tasks of a crashed module still running when it was unloaded */
+    uint32_t stuck_tasks;
+    /* loaded but missing from the crash index, faults on its own threads
+     * count as host crashes */
+    bool unindexed;
+    int ref_count;
+    /* arena of the loaded module, zero while unloaded */
+    uint64_t heap_bytes;
+    uint64_t heap_objects;
+    uint64_t heap_reserved_bytes;
+    /* image mapped in at load and text on huge pages, zero while unloaded */
+    uint64_t prefault_bytes;
+    uint64_t huge_text_bytes;
+    /* MODULE_LOAD_* bits for the next load */
+    uint32_t load_flags;
+    /* phases of the last successful load */
+    uint64_t load_phase_ns[MODULE_LOAD_PHASE_COUNT];
+    char path[256];
+} module_loader_stats_t;
+
 struct module_loader;
 
 typedef struct module_loader module_loader_t;
 
+/*
+ * symbol resolved once by module_loader_resolve()
+ * valid for the module generation it was resolved in, calls through it
+ * are bracketed by module_symbol_pin() and module_symbol_unpin()
+ */
+typedef struct {
+    module_loader_t *loader;
+    void *addr;
+    uint32_t generation;
+} module_symbol_t;
+
 /**
  * create module loader instance
  * @return pointer to module loader or NULL on error
@@ -30,7 +105,7 @@ void module_loader_destroy(module_loader_t *loader);
 
 /**
  * load module from path
- * validates module interface and calls module_init
+ * validates module interface and ops table, then calls module_init
  * @param loader module loader instance
  * @param path path to module shared library
  * @param init_args initialization arguments or NULL
@@ -39,21 +114,115 @@ void module_loader_destroy(module_loader_t *loader);
 module_error_t module_loader_load(module_loader_t *loader, const char *path,
         const module_init_args_t *init_args);
 
+/**
+ * hand modules loaded from now on their own client of a host thread pool
+ * module_init gets init args with the pool filled in; at unload
+ * queued tasks are dropped and running ones waited for before module_fini
+ * @param loader module loader instance
+ * @param pool pool shared by all loaders, or NULL for none; must outlive the loader
+ * @param max_concurrency tasks of one module running at once, 0 for no cap
+ * @return error code
+ */
+module_error_t module_loader_set_pool(module_loader_t *loader, host_pool_t *pool,
+        uint32_t max_concurrency);
+
+/**
+ * hand modules loaded from now on their own timers on a shared wheel
+ * passed as module_init_args_t.timers, only together with a pool since
+ * callbacks run there; armed timers are cancelled at unload before module_fini
+ * @param loader module loader instance
+ * @param wheel wheel shared by all loaders, or NULL for none; must outlive the loader
+ * @return error code
+ */
+module_error_t module_loader_set_timers(module_loader_t *loader, host_timer_wheel_t *wheel);
+
+/**
+ * let modules loaded from now on register fds with a shared epoll reactor
+ * passed as module_init_args_t.reactor, only together with a pool since
+ * callbacks run there; registrations are removed at unload before module_fini
+ * @param loader module loader instance
+ * @param reactor reactor shared by all loaders, or NULL for none; must outlive the loader
+ * @return error code
+ */
+module_error_t module_loader_set_reactor(module_loader_t *loader, host_reactor_t *reactor);
+
+/**
+ * set how modules loaded from now on are mapped, lazy loads included
+ * MODULE_LOAD_PREFAULT maps every PT_LOAD segment in before module_init,
+ * MODULE_LOAD_HUGE_TEXT also collapses the 2 MiB aligned part of the
+ * text onto transparent huge pages where the kernel supports it.
+ * MODULE_LOAD_BIND_NOW, MODULE_LOAD_GLOBAL and MODULE_LOAD_DEEPBIND pick
+ * the dlopen mode; a file another loader already has open keeps the image
+ * it has, dlopen only upgrades it to RTLD_NOW or RTLD_GLOBAL
+ * @param loader module loader instance
+ * @param flags MODULE_LOAD_* bits, 0 for RTLD_LAZY | RTLD_LOCAL
+ * @return error code, MODULE_ERR_INVALID_PARAM for unknown or unsupported bits
+ */
+module_error_t module_loader_set_load_flags(module_loader_t *loader, uint32_t flags);
+
+/**
+ * @param loader module loader instance
+ * @return MODULE_LOAD_* bits for the next load, 0 for NULL
+ */
+uint32_t module_loader_get_load_flags(module_loader_t *loader);
+
+/**
+ * record a module to load on first use instead of now
+ * dlopen and module_init run inside the first get_symbol, resolve,
+ * resolve_ops, get_ref or call_hello; concurrent first users wait for
+ * that one load. a failed load is retried by the next user
+ * @param loader module loader instance, nothing loaded
+ * @param path path to module shared library, copied
+ * @param init_args initialization arguments or NULL, copied; user_data must
+ *        stay valid until the module is loaded
+ * @return error code
+ */
+module_error_t module_loader_register_lazy(module_loader_t *loader, const char *path,
+        const module_init_args_t *init_args);
+
+/**
+ * @param loader module loader instance
+ * @return true while a lazy registration is in place, loaded yet or not
+ */
+bool module_loader_is_lazy(const module_loader_t *loader);
+
 /**
  * unload module
- * calls module_fini before unloading
+ * calls module_fini before unloading, drops a lazy registration
  * @param loader module loader instance
  * @return error code
  */
 module_error_t module_loader_unload(module_loader_t *loader);
 
+/**
+ * unload a lazily registered module nobody used for idle_ns
+ * the registration stays, so the next user loads the module again;
+ * resolved handles go stale and are resolved again. use is sampled from
+ * the call counter at each reap_idle, call it periodically
+ * @param loader module loader instance
+ * @param idle_ns time without calls, references or pins before unloading
+ * @return MODULE_ERR_SUCCESS when unloaded, MODULE_ERR_IN_USE when used
+ *         recently or still referenced, MODULE_ERR_NOT_LOADED when not a
+ *         loaded lazy module
+ */
+module_error_t module_loader_reap_idle(module_loader_t *loader, uint64_t idle_ns);
+
 /**
  * get current module state
+ * lock-free and async-signal-safe
  * @param loader module loader instance
  * @return module state
  */
 module_state_t module_loader_get_state(const module_loader_t *loader);
 
+/**
+ * get module generation, incremented by every successful load
+ * lock-free and async-signal-safe
+ * @param loader module loader instance
+ * @return generation, 0 if nothing was ever loaded
+ */
+uint32_t module_loader_get_generation(const module_loader_t *loader);
+
 /**
  * get symbol from loaded module
  * automatically increments ref_count to prevent module unload
@@ -66,8 +235,46 @@ module_state_t module_loader_get_state(const module_loader_t *loader);
 module_error_t module_loader_get_symbol(module_loader_t *loader,
         const char *name, void **symbol);
 
+/**
+ * resolve a symbol into a handle, takes the mutex once
+ * the handle holds no reference, pin it around each call
+ * @param loader module loader instance
+ * @param name symbol name
+ * @param sym output handle
+ * @return error code
+ */
+module_error_t module_loader_resolve(module_loader_t *loader, const char *name,
+        module_symbol_t *sym);
+
+/**
+ * resolve the module ops table into a handle
+ * sym->addr then points to a const module_ops_t owned by the loader,
+ * read it only while the handle is pinned
+ * @param loader module loader instance
+ * @param sym output handle
+ * @return error code, MODULE_ERR_MISSING_SYMBOL if the module has no table
+ */
+module_error_t module_loader_resolve_ops(module_loader_t *loader, module_symbol_t *sym);
+
+/**
+ * pin the module for a call through a handle, lock-free
+ * unload waits until every pin is released
+ * must not be held across a call to module_loader_unload() on the same loader
+ * @param sym handle from module_loader_resolve()
+ * @return MODULE_ERR_SUCCESS, MODULE_ERR_STALE_HANDLE after a reload or unload,
+ *         MODULE_ERR_NOT_LOADED while the module is draining or crashed
+ */
+module_error_t module_symbol_pin(const module_symbol_t *sym);
+
+/**
+ * release a pin taken by module_symbol_pin()
+ * @param sym handle
+ */
+void module_symbol_unpin(const module_symbol_t *sym);
+
 /**
  * get last error code
+ * lock-free and async-signal-safe
  * @param loader module loader instance
  * @return error code
  */
@@ -96,4 +303,67 @@ module_error_t module_loader_get_ref(module_loader_t *loader);
  */
 module_error_t module_loader_put_ref(module_loader_t *loader);
 
+/**
+ * record that the loaded module raised a fatal signal
+ * the caller is expected to unload the module afterwards
+ * @param loader module loader instance
+ * @return error code
+ */
+module_error_t module_loader_mark_crashed(module_loader_t *loader);
+
+/**
+ * find the loader whose module image contains an address
+ * lock-free and async-signal-safe, meant for fatal signal handlers
+ * @param addr faulting pc or data address
+ * @return loader or NULL when the address belongs to the host or nothing
+ */
+module_loader_t *module_loader_find_by_addr(uintptr_t addr);
+
+/**
+ * find the loader to blame for a fatal signal, async-signal-safe
+ * the faulting pc decides; si_addr is only consulted when the pc is unknown
+ * and the kernel raised the signal (si_code > 0), so a host fault on module
+ * memory and kill(2) or sigqueue(3) are never blamed on a module;
+ * a fault or abort() of the calling thread outside every module image is
+ * blamed on the module it runs for: inside a pinned call, module_init,
+ * module_fini or a pool task of the module
+ * @param pc program counter at the fault, 0 if unknown
+ * @param info siginfo of the handler, or NULL
+ * @return loader or NULL when the host is to blame
+ */
+module_loader_t *module_loader_find_by_fault(uintptr_t pc, const siginfo_t *info);
+
+/**
+ * check whether the calling thread runs module_init or module_fini,
+ * async-signal-safe
+ * a fault there cannot be waited out, the thread would unload the module
+ * @return true inside module_init or module_fini
+ */
+bool module_loader_in_init_or_fini(void);
+
+/**
+ * flag a crash attributed to the loaded module, async-signal-safe
+ * moves the state to MODULE_STATE_CRASHED, module_loader_mark_crashed()
+ * clears the pending flag
+ * @param loader module loader instance
+ * @return true on the first call for the current generation
+ */
+bool module_loader_signal_crash(module_loader_t *loader);
+
+/**
+ * check for a crash flagged by module_loader_signal_crash()
+ * @param loader module loader instance
+ * @return true if a crash is waiting to be handled
+ */
+bool module_loader_crash_pending(const module_loader_t *loader);
+
+/**
+ * get counters and state snapshot
+ * @param loader module loader instance
+ * @param stats output snapshot
+ * @return error code
+ */
+module_error_t module_loader_get_stats(const module_loader_t *loader,
+        module_loader_stats_t *stats);
+
 #endif /* MODULE_LOADER_H */
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+#include "module_map.h"
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* a reader that keeps losing the race to a writer gives up instead of spinning */
+#define MODULE_MAP_READ_RETRIES 8U
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    const void *owner;
+} module_range_t;
+
+/*
+ * writers fill the inactive table and flip g_active, readers never block
+ * seq is odd while a table is rewritten, a reader that started on the
+ * previous table before a second flip sees it change and retries
+ */
+typedef struct {
+    atomic_uint seq;
+    size_t count;
+    module_range_t ranges[MODULE_MAP_MAX_RANGES];
+} module_table_t;
+
+typedef struct {
+    uintptr_t base;
+    const char *name;
+    size_t count;
+    module_range_t ranges[MODULE_MAP_MAX_RANGES];
+} collect_ctx_t;
+
+static module_table_t g_tables[2];
+static atomic_uint g_active = ATOMIC_VAR_INIT(0U);
+static pthread_mutex_t g_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int collect_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    collect_ctx_t *ctx = data;
+    ElfW(Half) i;
+
+    (void)size;
+
+    if (info->dlpi_addr != ctx->base || info->dlpi_name == NULL ||
+            strcmp(info->dlpi_name, ctx->name) != 0) {
+        return 0;
+    }
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0U) {
+            continue;
+        }
+        if (ctx->count == MODULE_MAP_MAX_RANGES) {
+            break;
+        }
+        ctx->ranges[ctx->count].start = (uintptr_t)(info->dlpi_addr + ph->p_vaddr);
+        ctx->ranges[ctx->count].end = ctx->ranges[ctx->count].start + ph->p_memsz;
+        ctx->count++;
+    }
+    return 1;
+}
+
+/* rewrite the inactive table from the active one, keep, then add, then publish */
+static int publish(const void *drop, const module_range_t *add, size_t add_count)
+{
+    unsigned int active = atomic_load_explicit(&g_active, memory_order_relaxed);
+    const module_table_t *cur = &g_tables[active];
+    module_table_t *next = &g_tables[active ^ 1U];
+    size_t count = 0U;
+    size_t i;
+    size_t j;
+
+    for (i = 0U; i < cur->count; i++) {
+        count += (cur->ranges[i].owner != drop) ? 1U : 0U;
+    }
+    if (count + add_count > MODULE_MAP_MAX_RANGES) {
+        return -1;
+    }
+
+    atomic_fetch_add_explicit(&next->seq, 1U, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    count = 0U;
+    for (i = 0U; i < cur->count; i++) {
+        if (cur->ranges[i].owner != drop) {
+            next->ranges[count++] = cur->ranges[i];
+        }
+    }
+    /* insertion sort, the table is small and already sorted */
+    for (i = 0U; i < add_count; i++) {
+        j = count++;
+        while (j > 0U && next->ranges[j - 1U].start > add[i].start) {
+            next->ranges[j] = next->ranges[j - 1U];
+            j--;
+        }
+        next->ranges[j] = add[i];
+    }
+    next->count = count;
+
+    atomic_fetch_add_explicit(&next->seq, 1U, memory_order_release);
+    atomic_store_explicit(&g_active, active ^ 1U, memory_order_release);
+    return 0;
+}
+
+int module_map_add(const void *owner, void *handle)
+{
+    static collect_ctx_t ctx;
+    struct link_map *lm = NULL;
+    size_t i;
+    int ret;
+
+    if (owner == NULL || handle == NULL) {
+        return -1;
+    }
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &lm) != 0 || lm == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_write_mutex);
+
+    ctx.base = (uintptr_t)lm->l_addr;
+    ctx.name = lm->l_name;
+    ctx.count = 0U;
+    dl_iterate_phdr(collect_cb, &ctx);
+    if (ctx.count == 0U) {
+        pthread_mutex_unlock(&g_write_mutex);
+        return -1;
+    }
+    for (i = 0U; i < ctx.count; i++) {
+        ctx.ranges[i].owner = owner;
+    }
+
+    /* re-adding an owner replaces its previous ranges */
+    ret = publish(owner, ctx.ranges, ctx.count);
+    pthread_mutex_unlock(&g_write_mutex);
+    return ret;
+}
+
+void module_map_remove(const void *owner)
+{
+    if (owner == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_write_mutex);
+    publish(owner, NULL, 0U);
+    pthread_mutex_unlock(&g_write_mutex);
+}
+
+/* last range starting at or below addr, then a bounds check */
+static const void *search(const module_table_t *t, uintptr_t addr)
+{
+    size_t count = t->count;
+    size_t lo = 0U;
+    size_t hi;
+    size_t mid;
+
+    if (count > MODULE_MAP_MAX_RANGES) {
+        return NULL;
+    }
+
+    hi = count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2U;
+        if (t->ranges[mid].start <= addr) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0U || addr >= t->ranges[lo - 1U].end) {
+        return NULL;
+    }
+    return t->ranges[lo - 1U].owner;
+}
+
+const void *module_map_lookup(uintptr_t addr)
+{
+    const module_table_t *t;
+    const void *owner;
+    unsigned int seq;
+    uint32_t attempt;
+
+    if (addr == 0U) {
+        return NULL;
+    }
+
+    for (attempt = 0U; attempt < MODULE_MAP_READ_RETRIES; attempt++) {
+        t = &g_tables[atomic_load_explicit(&g_active, memory_order_acquire)];
+        seq = atomic_load_explicit(&t->seq, memory_order_acquire);
+        if ((seq & 1U) != 0U) {
+            continue;
+        }
+
+        owner = search(t, addr);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&t->seq, memory_order_relaxed) == seq) {
+            return owner;
+        }
+    }
+    return NULL;
+}
+
+size_t module_map_count(void)
+{
+    const module_table_t *t;
+
+    t = &g_tables[atomic_load_explicit(&g_active, memory_order_acquire)];
+    return t->count;
+}
@@ -0,0 +1,38 @@
+#ifndef MODULE_MAP_H
+#define MODULE_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* address ranges across all loaded modules, a few PT_LOAD segments each */
+#define MODULE_MAP_MAX_RANGES 256U
+
+/**
+ * index the loaded segments of a module
+ * walks the program headers once, call after dlopen and not from a signal handler
+ * @param owner opaque owner returned by lookups, usually the loader
+ * @param handle dlopen handle of the module
+ * @return 0 on success, -1 if the module was not found or the index is full
+ */
+int module_map_add(const void *owner, void *handle);
+
+/**
+ * drop all ranges of an owner
+ * @param owner owner passed to module_map_add()
+ */
+void module_map_remove(const void *owner);
+
+/**
+ * find the module whose image contains an address
+ * lock-free binary search, async-signal-safe
+ * @param addr code or data address
+ * @return owner or NULL for host code and unmapped addresses
+ */
+const void *module_map_lookup(uintptr_t addr);
+
+/**
+ * @return number of indexed ranges
+ */
+size_t module_map_count(void);
+
+#endif /* MODULE_MAP_H */
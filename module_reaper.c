@@ -0,0 +1,193 @@
+#include "module_reaper.h"
+#include "static_pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct module_reaper {
+    pthread_t thread;
+    /* held across a scan, so remove() never races with reap_idle */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    uint64_t idle_ns;
+    uint32_t interval_ms;
+    module_reaper_stats_t stats;
+    module_loader_t *loaders[MODULE_REAPER_MAX_LOADERS];
+};
+
+#ifdef KMODLIKE_STATIC
+STATIC_POOL_DEFINE(g_reaper_pool, module_reaper_t, KMODLIKE_STATIC_REAPERS);
+
+static module_reaper_t *reaper_alloc(void)
+{
+    module_reaper_t *reaper = static_pool_get(&g_reaper_pool);
+
+    if (reaper != NULL) {
+        memset(reaper, 0, sizeof(*reaper));
+    }
+    return reaper;
+}
+
+static void reaper_free(module_reaper_t *reaper)
+{
+    static_pool_put(&g_reaper_pool, reaper);
+}
+#else
+static module_reaper_t *reaper_alloc(void)
+{
+    return calloc(1U, sizeof(module_reaper_t));
+}
+
+static void reaper_free(module_reaper_t *reaper)
+{
+    free(reaper);
+}
+#endif
+
+/* one pass over the watched loaders, called with the lock held */
+static void scan(module_reaper_t *reaper)
+{
+    uint32_t i;
+
+    for (i = 0U; i < reaper->stats.loaders; i++) {
+        if (module_loader_reap_idle(reaper->loaders[i], reaper->idle_ns) ==
+                MODULE_ERR_SUCCESS) {
+            reaper->stats.reaped++;
+        }
+    }
+    reaper->stats.scans++;
+}
+
+static void *reaper_thread(void *arg)
+{
+    module_reaper_t *reaper = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&reaper->lock);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (!reaper->stop) {
+        deadline.tv_sec += (time_t)(reaper->interval_ms / 1000U);
+        deadline.tv_nsec += (long)(reaper->interval_ms % 1000U) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!reaper->stop &&
+                pthread_cond_timedwait(&reaper->cond, &reaper->lock, &deadline) == 0) {
+        }
+        if (!reaper->stop) {
+            scan(reaper);
+        }
+    }
+    pthread_mutex_unlock(&reaper->lock);
+    return NULL;
+}
+
+module_reaper_t *module_reaper_create(uint32_t idle_ms, uint32_t interval_ms)
+{
+    module_reaper_t *reaper;
+    pthread_condattr_t attr;
+
+#ifdef KMODLIKE_SINGLE_THREADED
+    /* no threads of our own in this build */
+    return NULL;
+#endif
+    if (idle_ms == 0U) {
+        return NULL;
+    }
+    if (interval_ms == 0U) {
+        interval_ms = idle_ms / 4U > 0U ? idle_ms / 4U : 1U;
+    }
+
+    reaper = reaper_alloc();
+    if (reaper == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&reaper->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&reaper->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    reaper->stop = false;
+    reaper->idle_ns = (uint64_t)idle_ms * 1000000ULL;
+    reaper->interval_ms = interval_ms;
+    reaper->stats.idle_ms = idle_ms;
+    reaper->stats.interval_ms = interval_ms;
+
+    if (pthread_create(&reaper->thread, NULL, reaper_thread, reaper) != 0) {
+        pthread_cond_destroy(&reaper->cond);
+        pthread_mutex_destroy(&reaper->lock);
+        reaper_free(reaper);
+        return NULL;
+    }
+    return reaper;
+}
+
+void module_reaper_destroy(module_reaper_t *reaper)
+{
+    if (reaper == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+    reaper->stop = true;
+    pthread_cond_signal(&reaper->cond);
+    pthread_mutex_unlock(&reaper->lock);
+    pthread_join(reaper->thread, NULL);
+
+    pthread_cond_destroy(&reaper->cond);
+    pthread_mutex_destroy(&reaper->lock);
+    reaper_free(reaper);
+}
+
+module_error_t module_reaper_add(module_reaper_t *reaper, module_loader_t *loader)
+{
+    module_error_t err = MODULE_ERR_SUCCESS;
+
+    if (reaper == NULL || loader == NULL) {
+        return MODULE_ERR_INVALID_PARAM;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+    if (reaper->stats.loaders == MODULE_REAPER_MAX_LOADERS) {
+        err = MODULE_ERR_IN_USE;
+    } else {
+        reaper->loaders[reaper->stats.loaders++] = loader;
+    }
+    pthread_mutex_unlock(&reaper->lock);
+    return err;
+}
+
+void module_reaper_remove(module_reaper_t *reaper, module_loader_t *loader)
+{
+    uint32_t i;
+
+    if (reaper == NULL || loader == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+    for (i = 0U; i < reaper->stats.loaders; i++) {
+        if (reaper->loaders[i] == loader) {
+            reaper->loaders[i] = reaper->loaders[--reaper->stats.loaders];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&reaper->lock);
+}
+
+void module_reaper_get_stats(module_reaper_t *reaper, module_reaper_stats_t *stats)
+{
+    if (reaper == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+    *stats = reaper->stats;
+    pthread_mutex_unlock(&reaper->lock);
+}
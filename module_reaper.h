@@ -0,0 +1,67 @@
+#ifndef MODULE_REAPER_H
+#define MODULE_REAPER_H
+
+#include "module_error.h"
+#include "module_loader.h"
+#include <stdint.h>
+
+/* loaders one reaper watches */
+#define MODULE_REAPER_MAX_LOADERS 128U
+
+struct module_reaper;
+
+/*
+ * background thread unloading lazy modules that sat idle, see
+ * module_loader_reap_idle(); the next use loads them again
+ */
+typedef struct module_reaper module_reaper_t;
+
+typedef struct {
+    /* passes over the watched loaders */
+    uint64_t scans;
+    /* modules unloaded for being idle */
+    uint64_t reaped;
+    uint32_t loaders;
+    uint32_t idle_ms;
+    uint32_t interval_ms;
+} module_reaper_stats_t;
+
+/**
+ * start the reaper thread
+ * a module is unloaded between idle_ms and idle_ms + 2 * interval_ms after
+ * its last call, since use is sampled once per scan
+ * @param idle_ms time without calls before a module is unloaded, > 0
+ * @param interval_ms time between scans, 0 for idle_ms / 4
+ * @return reaper or NULL on error, always NULL with KMODLIKE_SINGLE_THREADED
+ *         where the owner calls module_loader_reap_idle() itself
+ */
+module_reaper_t *module_reaper_create(uint32_t idle_ms, uint32_t interval_ms);
+
+/**
+ * stop the reaper thread, modules stay as they are
+ * @param reaper reaper or NULL
+ */
+void module_reaper_destroy(module_reaper_t *reaper);
+
+/**
+ * watch a loader, only lazy registrations are ever unloaded
+ * @param reaper reaper instance
+ * @param loader loader, must stay valid until removed or the reaper is destroyed
+ * @return error code, MODULE_ERR_IN_USE when MODULE_REAPER_MAX_LOADERS are watched
+ */
+module_error_t module_reaper_add(module_reaper_t *reaper, module_loader_t *loader);
+
+/**
+ * stop watching a loader, waits for a scan in progress
+ * @param reaper reaper instance
+ * @param loader watched loader
+ */
+void module_reaper_remove(module_reaper_t *reaper, module_loader_t *loader);
+
+/**
+ * @param reaper reaper instance
+ * @param stats output counters
+ */
+void module_reaper_get_stats(module_reaper_t *reaper, module_reaper_stats_t *stats);
+
+#endif /* MODULE_REAPER_H */
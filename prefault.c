@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include "prefault.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <link.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* newer than some libc headers */
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+
+typedef struct {
+    uintptr_t base;
+    const char *name;
+    bool huge_text;
+    uintptr_t page_size;
+    prefault_result_t result;
+} prefault_ctx_t;
+
+/* fallback for kernels before 5.14: read ahead, then fault each page */
+static void touch_pages(uintptr_t start, uintptr_t end, uintptr_t page_size)
+{
+    uintptr_t addr;
+
+    madvise((void *)start, end - start, MADV_WILLNEED);
+    for (addr = start; addr < end; addr += page_size) {
+        (void)*(volatile const char *)addr;
+    }
+}
+
+static void collapse_text(prefault_ctx_t *ctx, uintptr_t start, uintptr_t end)
+{
+    uintptr_t huge_start = (start + PREFAULT_HUGE_PAGE_SIZE - 1U) &
+            ~(uintptr_t)(PREFAULT_HUGE_PAGE_SIZE - 1U);
+    uintptr_t huge_end = end & ~(uintptr_t)(PREFAULT_HUGE_PAGE_SIZE - 1U);
+
+    if (huge_end <= huge_start) {
+        return;
+    }
+    if (madvise((void *)huge_start, huge_end - huge_start, MADV_COLLAPSE) == 0) {
+        ctx->result.huge_bytes += huge_end - huge_start;
+    } else {
+        /* no synchronous collapse, leave it to khugepaged */
+        madvise((void *)huge_start, huge_end - huge_start, MADV_HUGEPAGE);
+    }
+}
+
+static int prefault_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    prefault_ctx_t *ctx = data;
+    uintptr_t start;
+    uintptr_t end;
+    ElfW(Half) i;
+
+    (void)size;
+
+    if (info->dlpi_addr != ctx->base || info->dlpi_name == NULL ||
+            strcmp(info->dlpi_name, ctx->name) != 0) {
+        return 0;
+    }
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0U) {
+            continue;
+        }
+        start = (uintptr_t)(info->dlpi_addr + ph->p_vaddr) & ~(ctx->page_size - 1U);
+        end = ((uintptr_t)(info->dlpi_addr + ph->p_vaddr + ph->p_memsz) +
+                ctx->page_size - 1U) & ~(ctx->page_size - 1U);
+
+        if (ctx->huge_text && (ph->p_flags & PF_X) != 0U) {
+            collapse_text(ctx, start, end);
+        }
+        /* EINVAL is a kernel without it, anything else an unreadable range */
+        if (madvise((void *)start, end - start, MADV_POPULATE_READ) != 0) {
+            if (errno != EINVAL || (ph->p_flags & PF_R) == 0U) {
+                continue;
+            }
+            touch_pages(start, end, ctx->page_size);
+        }
+        ctx->result.segments++;
+        ctx->result.bytes += end - start;
+    }
+    return 1;
+}
+
+int prefault_image(void *handle, bool huge_text, prefault_result_t *result)
+{
+    struct link_map *lm = NULL;
+    prefault_ctx_t ctx;
+    long page_size;
+
+    if (handle == NULL || dlinfo(handle, RTLD_DI_LINKMAP, &lm) != 0 || lm == NULL) {
+        return -1;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.base = (uintptr_t)lm->l_addr;
+    ctx.name = lm->l_name;
+    ctx.huge_text = huge_text;
+    ctx.page_size = page_size > 0 ? (uintptr_t)page_size : 4096U;
+    dl_iterate_phdr(prefault_cb, &ctx);
+
+    if (result != NULL) {
+        *result = ctx.result;
+    }
+    return ctx.result.segments > 0U ? 0 : -1;
+}
@@ -0,0 +1,32 @@
+#ifndef PREFAULT_H
+#define PREFAULT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* transparent huge page size the text is collapsed into */
+#define PREFAULT_HUGE_PAGE_SIZE (2U * 1024U * 1024U)
+
+typedef struct {
+    uint32_t segments;
+    /* PT_LOAD bytes mapped in up front */
+    uint64_t bytes;
+    /* text now backed by huge pages */
+    uint64_t huge_bytes;
+} prefault_result_t;
+
+/**
+ * map in every PT_LOAD segment of a loaded image so its first calls do
+ * not fault; MADV_POPULATE_READ, or MADV_WILLNEED and a read per page on
+ * kernels without it. call before the module runs, not from a signal handler
+ * @param handle dlopen handle of the module
+ * @param huge_text also collapse the 2 MiB aligned part of executable
+ *        segments onto transparent huge pages, in place so the text stays
+ *        file backed; needs CONFIG_READ_ONLY_THP_FOR_FS and a module linked
+ *        with -z max-page-size=0x200000 to cover anything
+ * @param result output counters, or NULL
+ * @return 0 on success, -1 if the image was not found
+ */
+int prefault_image(void *handle, bool huge_text, prefault_result_t *result);
+
+#endif /* PREFAULT_H */
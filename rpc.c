@@ -1,4 +1,9 @@
 #include "rpc.h"
+#include "flightrec.h"
+#include "lock_prof.h"
+#include "logger.h"
+#include "stats.h"
+#include "trace.h"
 #include <errno.h>
 #include <libgen.h>
 #include <limits.h>
@@ -25,12 +30,16 @@ typedef struct {
 
 /* Global context */
 static rpc_context_t g_ctx = {0};
+/* Reply buffer, only the server thread handles requests */
+static char g_reply_buf[RPC_MAX_REPLY_SIZE];
 static char g_socket_path[RPC_SOCKET_PATH_MAX] = {0};
-static pthread_mutex_t g_ctx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static lock_prof_mutex_t g_ctx_mutex = LOCK_PROF_MUTEX_INITIALIZER;
 
-/* Simple logging macro */
-#define RPC_LOG(fmt, ...)                                                      \
-  fprintf(stderr, "%s: " fmt "\n", __func__, ##__VA_ARGS__)
+/* Logging macros, records go to the async logger ring */
+#define RPC_LOG(fmt, ...) LOGGER_WRITE(LOGGER_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define RPC_WARN(fmt, ...) LOGGER_WRITE(LOGGER_LEVEL_WARN, fmt, ##__VA_ARGS__)
+/* Per-request lines, a single branch unless debug level is selected */
+#define RPC_DEBUG(fmt, ...) LOGGER_WRITE(LOGGER_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
 
 /* Function implementations */
 const char *help_func(int32_t argc, char **argv, char *buf, size_t bufsize) {
@@ -45,7 +54,7 @@ const char *help_func(int32_t argc, char **argv, char *buf, size_t bufsize) {
 
   buf[0] = '\0';
 
-  pthread_mutex_lock(&g_ctx_mutex);
+  lock_prof_lock(&g_ctx_mutex, LOCK_SITE_RPC_HELP);
   function_count = g_ctx.function_count;
 
   for (i = 0; i < function_count; i++) {
@@ -60,13 +69,13 @@ const char *help_func(int32_t argc, char **argv, char *buf, size_t bufsize) {
     left -= written;
     p += written;
   }
-  pthread_mutex_unlock(&g_ctx_mutex);
+  lock_prof_unlock(&g_ctx_mutex);
 
   return buf;
 }
 
 const char *hello_func(int32_t argc, char **argv, char *buf, size_t bufsize) {
-  RPC_LOG("argc=%d", argc);
+  RPC_DEBUG("argc=%d", argc);
   size_t pos = 0;
   int32_t i;
   int32_t len;
@@ -199,10 +208,10 @@ int32_t register_str_func(const char *name, rpc_string_cb func) {
     return RPC_ERR_INVALID_PARAM;
   }
 
-  pthread_mutex_lock(&g_ctx_mutex);
+  lock_prof_lock(&g_ctx_mutex, LOCK_SITE_RPC_REGISTER);
 
   if (g_ctx.function_count >= MAX_FUNCTIONS) {
-    pthread_mutex_unlock(&g_ctx_mutex);
+    lock_prof_unlock(&g_ctx_mutex);
     return RPC_ERR_MAX_FUNCTIONS_REACHED;
   }
 
@@ -217,7 +226,7 @@ int32_t register_str_func(const char *name, rpc_string_cb func) {
   g_ctx.function_count++;
 
   ret = RPC_ERR_SUCCESS;
-  pthread_mutex_unlock(&g_ctx_mutex);
+  lock_prof_unlock(&g_ctx_mutex);
 
   return ret;
 }
@@ -232,7 +241,7 @@ static const char *call_function(const char *name, int32_t argc, char **argv,
     return "-1";
   }
 
-  pthread_mutex_lock(&g_ctx_mutex);
+  lock_prof_lock(&g_ctx_mutex, LOCK_SITE_RPC_DISPATCH);
   function_count = g_ctx.function_count;
 
   for (i = 0; i < function_count; i++) {
@@ -243,7 +252,7 @@ static const char *call_function(const char *name, int32_t argc, char **argv,
       }
     }
   }
-  pthread_mutex_unlock(&g_ctx_mutex);
+  lock_prof_unlock(&g_ctx_mutex);
 
   if (func != NULL) {
     return func(argc, argv, buf, bufsize);
@@ -254,8 +263,6 @@ static const char *call_function(const char *name, int32_t argc, char **argv,
 }
 
 static void send_result(const char *result, const client_info_t *client) {
-  char buffer[RPC_MAX_PACKET_SIZE];
-  int32_t len;
   ssize_t sent_bytes;
 
   if (client == NULL) {
@@ -266,13 +273,16 @@ static void send_result(const char *result, const client_info_t *client) {
     result = "";
   }
 
-  len = snprintf(buffer, sizeof(buffer), "%s", result);
-  if ((len < 0) || ((size_t)len >= sizeof(buffer))) {
-    return;
-  }
-
-  sent_bytes = sendto(g_ctx.sock_fd, buffer, (size_t)len, 0,
+  sent_bytes = sendto(g_ctx.sock_fd, result, strnlen(result, RPC_MAX_REPLY_SIZE), 0,
                       (struct sockaddr *)&client->addr, client->addr_len);
+  if (sent_bytes < 0 && errno == EMSGSIZE) {
+    /* net.core.wmem_max capped the send buffer, say so rather than go silent */
+    RPC_WARN("reply of %zu bytes exceeds the socket send buffer",
+             strnlen(result, RPC_MAX_REPLY_SIZE));
+    result = "error: reply too large for the rpc socket, raise net.core.wmem_max";
+    sent_bytes = sendto(g_ctx.sock_fd, result, strlen(result), 0,
+                        (struct sockaddr *)&client->addr, client->addr_len);
+  }
   if (sent_bytes < 0) {
     RPC_LOG("error send res error='%s'", strerror(errno));
   }
@@ -354,12 +364,13 @@ static int32_t rpc_handle_request(char *buffer, ssize_t recv_size,
   int32_t argc = 0;
   const char *result;
   int32_t parse_result;
+  trace_span_t span;
 
   if (buffer == NULL || client == NULL) {
     return RPC_ERR_INVALID_PARAM;
   }
 
-  RPC_LOG("recv_size=%zd", recv_size);
+  RPC_DEBUG("recv_size=%zd", recv_size);
 
   /* Validate received size */
   if (recv_size < 0 || recv_size >= RPC_MAX_PACKET_SIZE) {
@@ -370,8 +381,10 @@ static int32_t rpc_handle_request(char *buffer, ssize_t recv_size,
   buffer[recv_size] = '\0';
 
   /* Parse arguments */
+  trace_span_begin(&span, "parse_args");
   parse_result =
       parse_args(buffer, (size_t)recv_size, &argc, &argv_ptr, MAX_ARGS);
+  trace_span_end(&span);
   if (parse_result != 0) {
     RPC_LOG("error parsing arguments res=%d", parse_result);
     return RPC_ERR_PARSE_ERROR;
@@ -379,11 +392,16 @@ static int32_t rpc_handle_request(char *buffer, ssize_t recv_size,
 
   /* Call the function if we have at least one argument (function name) */
   if (argc > 0 && argv[0] != NULL) {
-    char buf[4096];
-    buf[0] = '\0';
-    RPC_LOG("call func=%s argc=%d", argv[0], argc - 1);
-    result = call_function(argv[0], argc - 1, &argv[1], buf, sizeof(buf));
+    g_reply_buf[0] = '\0';
+    RPC_DEBUG("call func=%s argc=%d trace_id=%llu", argv[0], argc - 1,
+              (unsigned long long)trace_current_id());
+    trace_span_begin(&span, "call_function");
+    result = call_function(argv[0], argc - 1, &argv[1], g_reply_buf,
+                           sizeof(g_reply_buf));
+    trace_span_end(&span);
+    trace_span_begin(&span, "send_result");
     send_result(result, client);
+    trace_span_end(&span);
     return RPC_ERR_SUCCESS;
   }
 
@@ -397,6 +415,11 @@ static void *rpc_server_thread(void *arg) {
   ssize_t recv_len;
   client_info_t client;
   struct timespec timeout;
+  trace_span_t span;
+  struct timespec t_start;
+  struct timespec t_end;
+  uint64_t latency_ns;
+  int32_t ret;
 
   /* Avoid unused parameter warning */
   (void)arg;
@@ -437,8 +460,20 @@ static void *rpc_server_thread(void *arg) {
       }
 
       /* Handle the request */
-      RPC_LOG("buf=%zd '%s'", recv_len, buffer);
-      rpc_handle_request(buffer, recv_len, &client);
+      RPC_DEBUG("buf=%zd '%s'", recv_len, buffer);
+      clock_gettime(CLOCK_MONOTONIC, &t_start);
+      trace_request_begin();
+      trace_span_begin(&span, "rpc_request");
+      ret = rpc_handle_request(buffer, recv_len, &client);
+      trace_span_end(&span);
+      trace_request_end();
+      clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+      latency_ns = (uint64_t)(t_end.tv_sec - t_start.tv_sec) * 1000000000ULL +
+                   (uint64_t)t_end.tv_nsec - (uint64_t)t_start.tv_nsec;
+      stats_record_rpc(latency_ns, (uint64_t)recv_len, ret != RPC_ERR_SUCCESS);
+      /* the buffer starts with the nul-terminated command name */
+      flightrec_record(FLIGHTREC_RPC, (uint64_t)(int64_t)ret, latency_ns, buffer);
     }
   }
 
@@ -471,6 +506,7 @@ int32_t rpc_client_call(const char *socket_path, int32_t argc,
                         char **argv, char *response, size_t response_size) {
   int32_t client_sock;
   struct sockaddr_un server_addr;
+  sa_family_t autobind = AF_UNIX;
   ssize_t bytes_sent, bytes_received;
   struct timeval tv;
   char request_buffer[RPC_MAX_PACKET_SIZE];
@@ -522,6 +558,13 @@ int32_t rpc_client_call(const char *socket_path, int32_t argc,
     return RPC_ERR_SOCKET_ERROR;
   }
 
+  /* Autobind to an abstract address so the server has somewhere to reply */
+  if (bind(client_sock, (struct sockaddr *)&autobind, sizeof(autobind)) < 0) {
+    RPC_LOG("error bind socket error='%s'", strerror(errno));
+    close(client_sock);
+    return RPC_ERR_SOCKET_ERROR;
+  }
+
   /* Set socket timeout */
   tv.tv_sec = RPC_DEFAULT_TIMEOUT_SEC;
   tv.tv_usec = 0;
@@ -572,8 +615,9 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
   struct sockaddr_un server_addr;
   size_t path_len;
   const char *default_path = NULL;
+  int sndbuf;
 
-  pthread_mutex_lock(&g_ctx_mutex);
+  lock_prof_lock(&g_ctx_mutex, LOCK_SITE_RPC_LIFECYCLE);
 
   /* Initialize the keep_running flag */
   atomic_store(&g_ctx.keep_running, true);
@@ -583,7 +627,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
     if (rpc_get_default_path("kmodlike", g_socket_path,
                 sizeof(g_socket_path)) != 0) {
       RPC_LOG("error getting default socket path");
-      pthread_mutex_unlock(&g_ctx_mutex);
+      lock_prof_unlock(&g_ctx_mutex);
       return NULL;
     }
     default_path = g_socket_path;
@@ -592,7 +636,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
     size_t len = strlen(socket_path);
     if (len >= sizeof(g_socket_path)) {
         RPC_LOG("socket path too long");
-        pthread_mutex_unlock(&g_ctx_mutex);
+        lock_prof_unlock(&g_ctx_mutex);
         return NULL;
     }
     strncpy(g_socket_path, socket_path, sizeof(g_socket_path) - 1);
@@ -602,7 +646,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
   path_len = strlen(socket_path);
   if (path_len >= sizeof(server_addr.sun_path)) {
     RPC_LOG("socket path too long");
-    pthread_mutex_unlock(&g_ctx_mutex);
+    lock_prof_unlock(&g_ctx_mutex);
     return NULL;
   }
 
@@ -613,7 +657,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
   g_ctx.sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
   if (g_ctx.sock_fd < 0) {
     RPC_LOG("error create socket: %s", strerror(errno));
-    pthread_mutex_unlock(&g_ctx_mutex);
+    lock_prof_unlock(&g_ctx_mutex);
     return NULL;
   }
 
@@ -627,7 +671,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
            sizeof(server_addr)) < 0) {
     /* If bind to /var/run failed and using default path, try /tmp */
     if (default_path != NULL && errno == EACCES) {
-      RPC_LOG("cannot bind to %s, trying /tmp fallback", socket_path);
+      RPC_WARN("cannot bind to %s, trying /tmp fallback", socket_path);
       close(g_ctx.sock_fd);
 
       {
@@ -654,7 +698,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
             RPC_LOG("socket path too long");
             close(g_ctx.sock_fd);
             g_ctx.sock_fd = -1;
-            pthread_mutex_unlock(&g_ctx_mutex);
+            lock_prof_unlock(&g_ctx_mutex);
             return NULL;
           }
         } else {
@@ -662,7 +706,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
             RPC_LOG("socket path too long");
             close(g_ctx.sock_fd);
             g_ctx.sock_fd = -1;
-            pthread_mutex_unlock(&g_ctx_mutex);
+            lock_prof_unlock(&g_ctx_mutex);
             return NULL;
           }
           ret = snprintf(g_socket_path, sizeof(g_socket_path), "/tmp/%.*s.sock",
@@ -671,7 +715,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
             RPC_LOG("socket path too long");
             close(g_ctx.sock_fd);
             g_ctx.sock_fd = -1;
-            pthread_mutex_unlock(&g_ctx_mutex);
+            lock_prof_unlock(&g_ctx_mutex);
             return NULL;
           }
         }
@@ -683,7 +727,7 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
       g_ctx.sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
       if (g_ctx.sock_fd < 0) {
         RPC_LOG("error create socket: %s", strerror(errno));
-        pthread_mutex_unlock(&g_ctx_mutex);
+        lock_prof_unlock(&g_ctx_mutex);
         return NULL;
       }
 
@@ -696,18 +740,24 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
         RPC_LOG("bind socket error=%s", strerror(errno));
         close(g_ctx.sock_fd);
         g_ctx.sock_fd = -1;
-        pthread_mutex_unlock(&g_ctx_mutex);
+        lock_prof_unlock(&g_ctx_mutex);
         return NULL;
       }
     } else {
       RPC_LOG("bind socket error=%s", strerror(errno));
       close(g_ctx.sock_fd);
       g_ctx.sock_fd = -1;
-      pthread_mutex_unlock(&g_ctx_mutex);
+      lock_prof_unlock(&g_ctx_mutex);
       return NULL;
     }
   }
 
+  /* A datagram reply is bounded by the send buffer, the default is ~200 KiB */
+  sndbuf = RPC_MAX_REPLY_SIZE;
+  if (setsockopt(g_ctx.sock_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) {
+    RPC_WARN("cannot raise socket send buffer: %s", strerror(errno));
+  }
+
   /* Start server thread */
   if (pthread_create(&g_ctx.server_thread, NULL, rpc_server_thread, NULL) !=
       0) {
@@ -715,11 +765,11 @@ rpc_context_t *rpc_init(const char *socket_path, module_loader_t *module_loader)
     close(g_ctx.sock_fd);
     unlink(socket_path);
     g_ctx.sock_fd = -1;
-    pthread_mutex_unlock(&g_ctx_mutex);
+    lock_prof_unlock(&g_ctx_mutex);
     return NULL;
   }
 
-  pthread_mutex_unlock(&g_ctx_mutex);
+  lock_prof_unlock(&g_ctx_mutex);
   return &g_ctx;
 }
 
@@ -749,19 +799,19 @@ int rpc_deinit() {
     return EINVAL;
   }
 
-  pthread_mutex_lock(&g_ctx_mutex);
+  lock_prof_lock(&g_ctx_mutex, LOCK_SITE_RPC_LIFECYCLE);
 
   /* Signal the server thread to exit */
   atomic_store(&g_ctx.keep_running, false);
 
-  pthread_mutex_unlock(&g_ctx_mutex);
+  lock_prof_unlock(&g_ctx_mutex);
 
   /* Join the server thread */
   if (pthread_join(g_ctx.server_thread, NULL) != 0) {
     RPC_LOG("failed to join server thread error=%s", strerror(errno));
   }
 
-  pthread_mutex_lock(&g_ctx_mutex);
+  lock_prof_lock(&g_ctx_mutex, LOCK_SITE_RPC_LIFECYCLE);
 
   /* Close the socket */
   if (g_ctx.sock_fd >= 0) {
@@ -775,7 +825,7 @@ int rpc_deinit() {
     g_socket_path[0] = '\0';
   }
 
-  pthread_mutex_unlock(&g_ctx_mutex);
+  lock_prof_unlock(&g_ctx_mutex);
 
   return 0;
 }
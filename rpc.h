@@ -24,6 +24,8 @@ typedef struct module_loader module_loader_t;
 #define MAX_ARGS 10
 #define MAX_LINE_LENGTH 256
 #define MAX_PACKET_SIZE 4096
+/* replies may be larger than requests, a full scrape is METRICS_BUF_SIZE */
+#define RPC_MAX_REPLY_SIZE (512 * 1024)
 #define RPC_SOCKET_PATH_MAX 256
 
 /* Function typedefs */
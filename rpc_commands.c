@@ -1,12 +1,19 @@
+#include "flightrec.h"
+#include "host_clock.h"
+#include "lock_prof.h"
+#include "logger.h"
+#include "metrics.h"
 #include "module_loader.h"
 #include "module_interface.h"
 #include "rpc_commands.h"
 #include "rpc.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 static module_loader_t *get_module_loader(void)
 {
@@ -18,20 +25,13 @@ void rpc_commands_set_loader(module_loader_t *loader)
     (void)loader;
 }
 
-static int get_time_impl(struct timespec *ts)
-{
-    if (ts == NULL) {
-        return -1;
-    }
-    return clock_gettime(CLOCK_MONOTONIC, ts);
-}
-
 const char *rpc_insmod_func(int32_t argc, char **argv, char *buf, size_t bufsize)
 {
     const char *path = "mod.so";
     module_error_t err;
     module_loader_t *loader;
     module_init_args_t init_args;
+    module_loader_stats_t ls;
 
     loader = get_module_loader();
     if (loader == NULL) {
@@ -44,13 +44,21 @@ const char *rpc_insmod_func(int32_t argc, char **argv, char *buf, size_t bufsize
     }
 
     /* prepare module init args */
-    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
-    init_args.log = NULL;
-    init_args.get_time = get_time_impl;
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_2;
+    init_args.size = (uint32_t)sizeof(init_args);
+    init_args.log = logger_module_log;
+    init_args.get_time = host_clock_get_time;
+    init_args.clock = host_clock_ops();
     init_args.user_data = NULL;
+    /* host services such as the thread pool are filled in by the loader */
 
     err = module_loader_load(loader, path, &init_args);
-    if (err == MODULE_ERR_SUCCESS) {
+    stats_publish_loader(STATS_DEFAULT_SLOT, loader);
+    if (err == MODULE_ERR_SUCCESS && module_loader_get_stats(loader, &ls) == MODULE_ERR_SUCCESS &&
+            ls.unindexed) {
+        snprintf(buf, bufsize, "module loaded: %s (crash attribution unavailable)", path);
+    } else if (err == MODULE_ERR_SUCCESS) {
         snprintf(buf, bufsize, "module loaded: %s", path);
     } else {
         snprintf(buf, bufsize, "error: failed to load module: %s (%s)", path,
@@ -75,6 +83,7 @@ const char *rpc_rmmod_func(int32_t argc, char **argv, char *buf, size_t bufsize)
     }
 
     err = module_loader_unload(loader);
+    stats_publish_loader(STATS_DEFAULT_SLOT, loader);
     if (err == MODULE_ERR_SUCCESS) {
         snprintf(buf, bufsize, "module unloaded");
     } else {
@@ -85,3 +94,148 @@ const char *rpc_rmmod_func(int32_t argc, char **argv, char *buf, size_t bufsize)
     return buf;
 }
 
+
+const char *rpc_loglevel_func(int32_t argc, char **argv, char *buf, size_t bufsize)
+{
+    logger_level_t level;
+
+    if (argc > 0 && argv[0] != NULL) {
+        if (logger_level_from_string(argv[0], &level) != 0) {
+            snprintf(buf, bufsize, "error: unknown log level: %s", argv[0]);
+            return buf;
+        }
+        logger_set_level(level);
+    }
+
+    snprintf(buf, bufsize, "log level: %s dropped=%llu",
+            logger_level_to_string(logger_get_level()),
+            (unsigned long long)logger_get_dropped());
+    return buf;
+}
+
+const char *rpc_trace_func(int32_t argc, char **argv, char *buf, size_t bufsize)
+{
+    unsigned long rate;
+    char *end;
+    int events;
+
+    if (argc >= 2 && argv[0] != NULL && argv[1] != NULL &&
+            strcmp(argv[0], "rate") == 0) {
+        rate = strtoul(argv[1], &end, 10);
+        if (*end != '\0' || rate > UINT32_MAX) {
+            snprintf(buf, bufsize, "error: invalid sample rate: %s", argv[1]);
+            return buf;
+        }
+        trace_set_sample_rate((uint32_t)rate);
+    } else if (argc >= 2 && argv[0] != NULL && argv[1] != NULL &&
+            strcmp(argv[0], "dump") == 0) {
+        events = trace_dump_file(argv[1]);
+        if (events < 0) {
+            snprintf(buf, bufsize, "error: failed to write trace: %s", argv[1]);
+        } else {
+            snprintf(buf, bufsize, "trace written: %s events=%d", argv[1], events);
+        }
+        return buf;
+    } else if (argc >= 1 && argv[0] != NULL && strcmp(argv[0], "clear") == 0) {
+        trace_clear();
+    } else if (argc > 0) {
+        snprintf(buf, bufsize, "usage: trace [rate <n>|dump <path>|clear]");
+        return buf;
+    }
+
+    snprintf(buf, bufsize, "trace sample rate: 1/%u%s", trace_get_sample_rate(),
+            trace_get_sample_rate() == 0U ? " (disabled)" : "");
+    return buf;
+}
+
+_Static_assert(RPC_MAX_REPLY_SIZE >= METRICS_BUF_SIZE, "metrics reply does not fit");
+
+const char *rpc_metrics_func(int32_t argc, char **argv, char *buf, size_t bufsize)
+{
+    (void)argc;
+    (void)argv;
+
+    if (metrics_render(buf, bufsize) == 0U) {
+        snprintf(buf, bufsize, "error: metrics unavailable, stats segment disabled");
+    }
+    return buf;
+}
+
+const char *rpc_lockprof_func(int32_t argc, char **argv, char *buf, size_t bufsize)
+{
+    lock_prof_site_stats_t st;
+    size_t pos;
+    uint32_t i;
+    int len;
+
+    if (!lock_prof_is_compiled()) {
+        snprintf(buf, bufsize, "lock profiling not compiled in, build with LOCK_PROFILING=1");
+        return buf;
+    }
+
+    if (argc >= 1 && argv[0] != NULL) {
+        if (strcmp(argv[0], "on") == 0) {
+            lock_prof_set_enabled(true);
+        } else if (strcmp(argv[0], "off") == 0) {
+            lock_prof_set_enabled(false);
+        } else if (strcmp(argv[0], "reset") == 0) {
+            lock_prof_reset();
+        } else {
+            snprintf(buf, bufsize, "usage: lockprof [on|off|reset]");
+            return buf;
+        }
+    }
+
+    len = snprintf(buf, bufsize, "lock profiling: %s\n%-18s %10s %10s %12s %12s",
+            lock_prof_is_enabled() ? "enabled" : "disabled",
+            "SITE", "ACQUIRED", "CONTENDED", "WAIT_MAX_NS", "HOLD_MAX_NS");
+    if (len < 0 || (size_t)len >= bufsize) {
+        return buf;
+    }
+    pos = (size_t)len;
+
+    for (i = 0U; i < LOCK_SITE_COUNT; i++) {
+        lock_prof_read((lock_site_t)i, &st);
+        len = snprintf(buf + pos, bufsize - pos, "\n%-18s %10llu %10llu %12llu %12llu",
+                lock_prof_site_name((lock_site_t)i),
+                (unsigned long long)st.acquisitions, (unsigned long long)st.contended,
+                (unsigned long long)st.wait.max_ns, (unsigned long long)st.hold.max_ns);
+        if (len < 0 || (size_t)len >= bufsize - pos) {
+            break;
+        }
+        pos += (size_t)len;
+    }
+
+    return buf;
+}
+
+const char *rpc_flightrec_func(int32_t argc, char **argv, char *buf, size_t bufsize)
+{
+    unsigned long events = FLIGHTREC_RPC_DEFAULT_EVENTS;
+    char *end;
+    int written;
+
+    if (argc >= 2 && argv[0] != NULL && argv[1] != NULL &&
+            strcmp(argv[0], "dump") == 0) {
+        written = flightrec_dump_file(argv[1]);
+        if (written < 0) {
+            snprintf(buf, bufsize, "error: failed to write flight recorder: %s", argv[1]);
+        } else {
+            snprintf(buf, bufsize, "flight recorder written: %s events=%d", argv[1], written);
+        }
+        return buf;
+    }
+
+    if (argc >= 1 && argv[0] != NULL) {
+        events = strtoul(argv[0], &end, 10);
+        if (*end != '\0' || events == 0U || events > FLIGHTREC_EVENTS) {
+            snprintf(buf, bufsize, "usage: flightrec [<events>|dump <path>]");
+            return buf;
+        }
+    }
+
+    if (flightrec_dump_buf(buf, bufsize, (size_t)events) == 0U) {
+        snprintf(buf, bufsize, "flight recorder is empty");
+    }
+    return buf;
+}
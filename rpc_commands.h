@@ -9,5 +9,20 @@ const char *rpc_insmod_func(int32_t argc, char **argv, char *buf, size_t bufsize
 
 const char *rpc_rmmod_func(int32_t argc, char **argv, char *buf, size_t bufsize);
 
+/* get or set async logger level: loglevel [error|warn|info|debug] */
+const char *rpc_loglevel_func(int32_t argc, char **argv, char *buf, size_t bufsize);
+
+/* request tracing control: trace [rate <n>|dump <path>|clear] */
+const char *rpc_trace_func(int32_t argc, char **argv, char *buf, size_t bufsize);
+
+/* prometheus text exposition of daemon counters: metrics */
+const char *rpc_metrics_func(int32_t argc, char **argv, char *buf, size_t bufsize);
+
+/* lock contention profiling control and summary: lockprof [on|off|reset] */
+const char *rpc_lockprof_func(int32_t argc, char **argv, char *buf, size_t bufsize);
+
+/* recent loader and rpc events: flightrec [<events>|dump <path>] */
+const char *rpc_flightrec_func(int32_t argc, char **argv, char *buf, size_t bufsize);
+
 #endif /* RPC_COMMANDS_H */
 
@@ -0,0 +1,51 @@
+#include "static_pool.h"
+
+void *static_pool_get(static_pool_t *pool)
+{
+    void *obj = NULL;
+    uint32_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0U; i < pool->capacity; i++) {
+        if (!pool->used[i]) {
+            pool->used[i] = true;
+            pool->in_use++;
+            if (pool->in_use > pool->high_water) {
+                pool->high_water = pool->in_use;
+            }
+            obj = pool->storage + (size_t)i * pool->object_size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return obj;
+}
+
+void static_pool_put(static_pool_t *pool, void *obj)
+{
+    size_t offset;
+
+    if (obj == NULL) {
+        return;
+    }
+
+    offset = (size_t)((unsigned char *)obj - pool->storage);
+    pthread_mutex_lock(&pool->lock);
+    if (pool->used[offset / pool->object_size]) {
+        pool->used[offset / pool->object_size] = false;
+        pool->in_use--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void static_pool_get_usage(static_pool_t *pool, uint32_t *in_use, uint32_t *high_water)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (in_use != NULL) {
+        *in_use = pool->in_use;
+    }
+    if (high_water != NULL) {
+        *high_water = pool->high_water;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,75 @@
+#ifndef STATIC_POOL_H
+#define STATIC_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * sizes of the KMODLIKE_STATIC build, override with -D
+ * every object the loader would allocate comes from one of these pools,
+ * so the footprint is fixed at link time and nothing calls malloc at runtime
+ */
+#ifndef KMODLIKE_STATIC_LOADERS
+#define KMODLIKE_STATIC_LOADERS 16U
+#endif
+/* one arena per loaded module */
+#ifndef KMODLIKE_STATIC_ARENAS
+#define KMODLIKE_STATIC_ARENAS KMODLIKE_STATIC_LOADERS
+#endif
+/* HOST_ARENA_CHUNK_SIZE each, shared by all arenas */
+#ifndef KMODLIKE_STATIC_ARENA_CHUNKS
+#define KMODLIKE_STATIC_ARENA_CHUNKS 64U
+#endif
+#ifndef KMODLIKE_STATIC_BATCHERS
+#define KMODLIKE_STATIC_BATCHERS 4U
+#endif
+/* upper bound for batcher_create max_items in the static build */
+#ifndef KMODLIKE_STATIC_BATCH_ITEMS
+#define KMODLIKE_STATIC_BATCH_ITEMS 256U
+#endif
+#ifndef KMODLIKE_STATIC_REAPERS
+#define KMODLIKE_STATIC_REAPERS 1U
+#endif
+
+/* fixed set of equally sized objects, storage is reserved at compile time */
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned char *storage;
+    bool *used;
+    size_t object_size;
+    uint32_t capacity;
+    uint32_t in_use;
+    uint32_t high_water;
+} static_pool_t;
+
+/* pool of count objects of type, at file scope */
+#define STATIC_POOL_DEFINE(name, type, count) \
+    static type name##_storage[count]; \
+    static bool name##_used[count]; \
+    static static_pool_t name = { PTHREAD_MUTEX_INITIALIZER, \
+        (unsigned char *)name##_storage, name##_used, sizeof(type), (count), 0U, 0U }
+
+/**
+ * take a free object, its contents are whatever the last user left
+ * @param pool pool instance
+ * @return object or NULL when the pool is exhausted
+ */
+void *static_pool_get(static_pool_t *pool);
+
+/**
+ * return an object taken from the pool
+ * @param pool pool instance
+ * @param obj object or NULL
+ */
+void static_pool_put(static_pool_t *pool, void *obj);
+
+/**
+ * @param pool pool instance
+ * @param in_use output objects taken now, or NULL
+ * @param high_water output most objects taken at once, or NULL
+ */
+void static_pool_get_usage(static_pool_t *pool, uint32_t *in_use, uint32_t *high_water);
+
+#endif /* STATIC_POOL_H */
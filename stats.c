@@ -0,0 +1,513 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATS_NAME_MAX 64U
+#define STATS_READ_RETRIES 1000U
+#define STATS_SMAPS_LINE_MAX 512U
+
+static stats_segment_t *g_seg = NULL;
+static char g_name[STATS_NAME_MAX];
+/* serializes writers, readers never take it */
+static pthread_mutex_t g_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* enter seqlock write section, returns false if stats are disabled */
+static bool write_begin(void)
+{
+    uint64_t seq;
+
+    if (g_seg == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&g_write_mutex);
+    if (g_seg == NULL) {
+        pthread_mutex_unlock(&g_write_mutex);
+        return false;
+    }
+    seq = atomic_load_explicit(&g_seg->seq, memory_order_relaxed);
+    atomic_store_explicit(&g_seg->seq, seq + 1U, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return true;
+}
+
+static void write_end(void)
+{
+    uint64_t seq;
+
+    g_seg->update_ns = now_ns();
+    seq = atomic_load_explicit(&g_seg->seq, memory_order_relaxed);
+    atomic_store_explicit(&g_seg->seq, seq + 1U, memory_order_release);
+    pthread_mutex_unlock(&g_write_mutex);
+}
+
+static void latency_reset(stats_latency_t *lat)
+{
+    memset(lat, 0, sizeof(*lat));
+    lat->min_ns = UINT64_MAX;
+}
+
+int stats_init(const char *name)
+{
+    stats_segment_t *seg;
+    uint32_t i;
+    int fd;
+
+    if (name == NULL) {
+        name = STATS_SHM_DEFAULT_NAME;
+    }
+    if (g_seg != NULL || strlen(name) >= sizeof(g_name)) {
+        return -1;
+    }
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(fd, (off_t)sizeof(stats_segment_t)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    seg = mmap(NULL, sizeof(stats_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        shm_unlink(name);
+        return -1;
+    }
+
+    /* invalidate for readers of a previous instance while we rebuild */
+    seg->magic = 0U;
+    atomic_store_explicit(&seg->seq, 1U, memory_order_release);
+
+    seg->version = STATS_VERSION;
+    seg->size = (uint32_t)sizeof(stats_segment_t);
+    seg->pid = (int32_t)getpid();
+    seg->start_ns = now_ns();
+    seg->update_ns = seg->start_ns;
+    seg->module_count = 0U;
+    memset(&seg->rpc, 0, sizeof(seg->rpc));
+    latency_reset(&seg->rpc.latency);
+    memset(seg->modules, 0, sizeof(seg->modules));
+    for (i = 0U; i < STATS_MAX_MODULES; i++) {
+        latency_reset(&seg->modules[i].call_latency);
+    }
+    seg->lock_flags = 0U;
+    seg->lock_count = 0U;
+    memset(seg->locks, 0, sizeof(seg->locks));
+    seg->magic = STATS_MAGIC;
+    atomic_store_explicit(&seg->seq, 2U, memory_order_release);
+
+    strncpy(g_name, name, sizeof(g_name) - 1U);
+    g_name[sizeof(g_name) - 1U] = '\0';
+    g_seg = seg;
+    return 0;
+}
+
+void stats_deinit(void)
+{
+    stats_segment_t *seg;
+
+    pthread_mutex_lock(&g_write_mutex);
+    seg = g_seg;
+    g_seg = NULL;
+    pthread_mutex_unlock(&g_write_mutex);
+
+    if (seg == NULL) {
+        return;
+    }
+
+    munmap(seg, sizeof(stats_segment_t));
+    shm_unlink(g_name);
+    g_name[0] = '\0';
+}
+
+bool stats_is_enabled(void)
+{
+    return g_seg != NULL;
+}
+
+void stats_latency_add(stats_latency_t *lat, uint64_t ns)
+{
+    uint32_t bucket = 0U;
+    uint64_t v = ns;
+
+    while (v > 1U && bucket < STATS_LATENCY_BUCKETS - 1U) {
+        v >>= 1U;
+        bucket++;
+    }
+
+    lat->count++;
+    lat->sum_ns += ns;
+    lat->buckets[bucket]++;
+    if (ns < lat->min_ns) {
+        lat->min_ns = ns;
+    }
+    if (ns > lat->max_ns) {
+        lat->max_ns = ns;
+    }
+}
+
+uint64_t stats_latency_percentile(const stats_latency_t *lat, double pct)
+{
+    uint64_t target;
+    uint64_t seen = 0U;
+    uint32_t i;
+
+    if (lat->count == 0U || pct <= 0.0) {
+        return 0U;
+    }
+    if (pct > 100.0) {
+        pct = 100.0;
+    }
+
+    target = (uint64_t)((double)lat->count * pct / 100.0);
+    if (target == 0U) {
+        target = 1U;
+    }
+
+    for (i = 0U; i < STATS_LATENCY_BUCKETS; i++) {
+        seen += lat->buckets[i];
+        if (seen >= target) {
+            uint64_t upper = (i + 1U < 64U) ? (1ULL << (i + 1U)) : UINT64_MAX;
+            return (upper < lat->max_ns) ? upper : lat->max_ns;
+        }
+    }
+
+    return lat->max_ns;
+}
+
+void stats_record_rpc(uint64_t latency_ns, uint64_t bytes_in, bool error)
+{
+    if (!write_begin()) {
+        return;
+    }
+
+    g_seg->rpc.requests++;
+    g_seg->rpc.bytes_in += bytes_in;
+    if (error) {
+        g_seg->rpc.errors++;
+    }
+    stats_latency_add(&g_seg->rpc.latency, latency_ns);
+
+    write_end();
+}
+
+void stats_record_module_call(uint32_t slot, uint64_t latency_ns)
+{
+    if (slot >= STATS_MAX_MODULES || !write_begin()) {
+        return;
+    }
+
+    stats_latency_add(&g_seg->modules[slot].call_latency, latency_ns);
+
+    write_end();
+}
+
+void stats_publish_loader(uint32_t slot, const module_loader_t *loader)
+{
+    module_loader_stats_t ls;
+    stats_module_t *mod;
+    size_t len;
+
+    if (slot >= STATS_MAX_MODULES || g_seg == NULL ||
+            module_loader_get_stats(loader, &ls) != MODULE_ERR_SUCCESS) {
+        return;
+    }
+
+    if (!write_begin()) {
+        return;
+    }
+
+    mod = &g_seg->modules[slot];
+    mod->in_use = 1U;
+    mod->state = (uint32_t)ls.state;
+    mod->ref_count = ls.ref_count;
+    mod->load_count = ls.load_count;
+    mod->load_failures = ls.load_failures;
+    mod->unload_count = ls.unload_count;
+    mod->crash_count = ls.crash_count;
+    mod->idle_unload_count = ls.idle_unload_count;
+    mod->calls = ls.calls;
+    mod->heap_bytes = ls.heap_bytes;
+    mod->heap_objects = ls.heap_objects;
+    mod->heap_reserved_bytes = ls.heap_reserved_bytes;
+    memcpy(mod->load_phase_ns, ls.load_phase_ns, sizeof(mod->load_phase_ns));
+    len = strnlen(ls.path, sizeof(mod->path) - 1U);
+    memcpy(mod->path, ls.path, len);
+    mod->path[len] = '\0';
+    if (slot + 1U > g_seg->module_count) {
+        g_seg->module_count = slot + 1U;
+    }
+
+    write_end();
+}
+
+/* sum Rss of all mappings, and per slot of mappings backed by its image
+ * paths[i] is the real path of slot i, empty for slots without an image */
+static void sample_smaps(char paths[][PATH_MAX], uint32_t count, uint64_t *module_kb,
+        uint64_t *process_kb)
+{
+    char line[STATS_SMAPS_LINE_MAX];
+    unsigned long long kb;
+    uint32_t in_slot = count;
+    uint32_t i;
+    FILE *f;
+    char *p;
+
+    memset(module_kb, 0, count * sizeof(*module_kb));
+    *process_kb = 0U;
+
+    f = fopen("/proc/self/smaps", "re");
+    if (f == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "Rss: %llu kB", &kb) == 1) {
+            *process_kb += (uint64_t)kb;
+            if (in_slot < count) {
+                module_kb[in_slot] += (uint64_t)kb;
+            }
+            continue;
+        }
+
+        /* mapping header: "start-end perms offset dev inode [path]" */
+        if (strchr(line, '-') == NULL || strchr(line, ':') == NULL ||
+                line[0] < '0' || (line[0] > '9' && line[0] < 'a') || line[0] > 'f') {
+            continue;
+        }
+        in_slot = count;
+        p = strchr(line, '/');
+        if (p == NULL) {
+            continue;
+        }
+        p[strcspn(p, "\n")] = '\0';
+        for (i = 0U; i < count; i++) {
+            if (paths[i][0] != '\0' && strcmp(p, paths[i]) == 0) {
+                in_slot = i;
+                break;
+            }
+        }
+    }
+
+    fclose(f);
+}
+
+void stats_publish_memory(module_loader_t *const *loaders, uint32_t count)
+{
+    char real[STATS_MAX_MODULES][PATH_MAX];
+    uint64_t module_kb[STATS_MAX_MODULES];
+    module_loader_stats_t ls;
+    uint64_t process_kb;
+    uint32_t i;
+
+    if (g_seg == NULL || loaders == NULL) {
+        return;
+    }
+    if (count > STATS_MAX_MODULES) {
+        count = STATS_MAX_MODULES;
+    }
+
+    for (i = 0U; i < count; i++) {
+        real[i][0] = '\0';
+        if (loaders[i] == NULL || module_loader_get_stats(loaders[i], &ls) != MODULE_ERR_SUCCESS) {
+            continue;
+        }
+        if (ls.state != MODULE_STATE_UNLOADED && realpath(ls.path, real[i]) == NULL) {
+            real[i][0] = '\0';
+        }
+    }
+    sample_smaps(real, count, module_kb, &process_kb);
+
+    if (!write_begin()) {
+        return;
+    }
+
+    g_seg->process_rss_kb = process_kb;
+    for (i = 0U; i < count; i++) {
+        if (loaders[i] != NULL) {
+            g_seg->modules[i].rss_kb = module_kb[i];
+        }
+    }
+
+    write_end();
+}
+
+/* lock_prof keeps no count or min, derive them from the buckets */
+static void lock_hist_to_latency(const lock_prof_hist_t *h, stats_latency_t *lat)
+{
+    uint32_t i;
+
+    latency_reset(lat);
+    for (i = 0U; i < LOCK_PROF_BUCKETS && i < STATS_LATENCY_BUCKETS; i++) {
+        lat->buckets[i] = h->buckets[i];
+        lat->count += h->buckets[i];
+        if (h->buckets[i] != 0U && lat->min_ns == UINT64_MAX) {
+            lat->min_ns = (i == 0U) ? 0U : (1ULL << i);
+        }
+    }
+    lat->sum_ns = h->sum_ns;
+    lat->max_ns = h->max_ns;
+}
+
+void stats_publish_locks(void)
+{
+    lock_prof_site_stats_t sites[LOCK_SITE_COUNT];
+    stats_lock_t *lk;
+    uint32_t count;
+    uint32_t i;
+    size_t len;
+
+    if (g_seg == NULL) {
+        return;
+    }
+
+    count = (LOCK_SITE_COUNT < STATS_MAX_LOCK_SITES) ? LOCK_SITE_COUNT :
+        STATS_MAX_LOCK_SITES;
+
+    /* read outside the write section, the counters are lock-free */
+    for (i = 0U; i < count; i++) {
+        lock_prof_read((lock_site_t)i, &sites[i]);
+    }
+
+    if (!write_begin()) {
+        return;
+    }
+
+    g_seg->lock_flags = (lock_prof_is_compiled() ? STATS_LOCK_COMPILED : 0U) |
+        (lock_prof_is_enabled() ? STATS_LOCK_ENABLED : 0U);
+    g_seg->lock_count = count;
+    for (i = 0U; i < count; i++) {
+        lk = &g_seg->locks[i];
+        len = strnlen(lock_prof_site_name((lock_site_t)i), sizeof(lk->name) - 1U);
+        memcpy(lk->name, lock_prof_site_name((lock_site_t)i), len);
+        lk->name[len] = '\0';
+        lk->acquisitions = sites[i].acquisitions;
+        lk->contended = sites[i].contended;
+        lock_hist_to_latency(&sites[i].wait, &lk->wait);
+        lock_hist_to_latency(&sites[i].hold, &lk->hold);
+    }
+
+    write_end();
+}
+
+void stats_publish_image_cache(void)
+{
+    image_cache_stats_t cache;
+
+    if (g_seg == NULL) {
+        return;
+    }
+
+    image_cache_get_stats(&cache);
+    if (!write_begin()) {
+        return;
+    }
+
+    g_seg->image_cache.hits = cache.hits;
+    g_seg->image_cache.misses = cache.misses;
+    g_seg->image_cache.evictions = cache.evictions;
+    g_seg->image_cache.bytes = cache.bytes;
+    g_seg->image_cache.entries = cache.entries;
+    g_seg->image_cache.capacity = cache.capacity;
+
+    write_end();
+}
+
+int stats_snapshot(stats_segment_t *out)
+{
+    if (g_seg == NULL) {
+        return -1;
+    }
+    return stats_read_snapshot(g_seg, out);
+}
+
+const stats_segment_t *stats_open_reader(const char *name)
+{
+    const stats_segment_t *seg;
+    struct stat st;
+    int fd;
+
+    if (name == NULL) {
+        name = STATS_SHM_DEFAULT_NAME;
+    }
+
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(stats_segment_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    seg = mmap(NULL, sizeof(stats_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        return NULL;
+    }
+
+    return seg;
+}
+
+void stats_close_reader(const stats_segment_t *seg)
+{
+    if (seg != NULL) {
+        munmap((void *)seg, sizeof(stats_segment_t));
+    }
+}
+
+int stats_read_snapshot(const stats_segment_t *seg, stats_segment_t *out)
+{
+    uint64_t seq1;
+    uint64_t seq2;
+    uint32_t i;
+
+    if (seg == NULL || out == NULL) {
+        return -1;
+    }
+
+    for (i = 0U; i < STATS_READ_RETRIES; i++) {
+        seq1 = atomic_load_explicit(&seg->seq, memory_order_acquire);
+        if ((seq1 & 1U) != 0U) {
+            continue;
+        }
+
+        memcpy(out, seg, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        seq2 = atomic_load_explicit(&seg->seq, memory_order_relaxed);
+
+        if (seq1 == seq2) {
+            if (out->magic != STATS_MAGIC || out->version != STATS_VERSION ||
+                    out->size != sizeof(stats_segment_t)) {
+                return -1;
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,203 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "image_cache.h"
+#include "lock_prof.h"
+#include "module_loader.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATS_SHM_DEFAULT_NAME "/kmodlike.stats"
+#define STATS_MAGIC 0x444f4d4bU /* "KMOD" */
+#define STATS_VERSION 7U
+#define STATS_MAX_MODULES 16U
+#define STATS_LATENCY_BUCKETS 40U
+#define STATS_PATH_MAX 128U
+#define STATS_MAX_LOCK_SITES 16U
+#define STATS_LOCK_NAME_MAX 24U
+/* lock_flags bits */
+#define STATS_LOCK_COMPILED 0x1U
+#define STATS_LOCK_ENABLED 0x2U
+/* slot of the daemon's default loader */
+#define STATS_DEFAULT_SLOT 0U
+
+/* log2 latency histogram, bucket i counts samples in [2^i, 2^(i+1)) ns */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_LATENCY_BUCKETS];
+} stats_latency_t;
+
+typedef struct {
+    uint32_t in_use;
+    uint32_t state;
+    int64_t ref_count;
+    uint64_t load_count;
+    uint64_t load_failures;
+    uint64_t unload_count;
+    uint64_t crash_count;
+    /* unloaded by the idle reaper, also in unload_count */
+    uint64_t idle_unload_count;
+    uint64_t calls;
+    uint64_t rss_kb;
+    /* module arena */
+    uint64_t heap_bytes;
+    uint64_t heap_objects;
+    uint64_t heap_reserved_bytes;
+    /* phases of the last successful load, module_load_phase_t indexes */
+    uint64_t load_phase_ns[MODULE_LOAD_PHASE_COUNT];
+    stats_latency_t call_latency;
+    char path[STATS_PATH_MAX];
+} stats_module_t;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes_in;
+    stats_latency_t latency;
+} stats_rpc_t;
+
+typedef struct {
+    char name[STATS_LOCK_NAME_MAX];
+    uint64_t acquisitions;
+    uint64_t contended;
+    stats_latency_t wait;
+    stats_latency_t hold;
+} stats_lock_t;
+
+/* images kept mapped after unload, see image_cache.h */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes;
+    uint32_t entries;
+    uint32_t capacity;
+} stats_image_cache_t;
+
+/* layout of the shared memory segment, readers must check magic and version */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    int32_t pid;
+    _Atomic uint64_t seq;
+    uint64_t start_ns;
+    uint64_t update_ns;
+    uint32_t module_count;
+    uint32_t reserved;
+    uint64_t process_rss_kb;
+    stats_rpc_t rpc;
+    stats_module_t modules[STATS_MAX_MODULES];
+    uint32_t lock_flags;
+    uint32_t lock_count;
+    stats_lock_t locks[STATS_MAX_LOCK_SITES];
+    stats_image_cache_t image_cache;
+} stats_segment_t;
+
+/**
+ * create and map the stats segment (daemon side)
+ * @param name shm object name or NULL for STATS_SHM_DEFAULT_NAME
+ * @return 0 on success, -1 on error
+ */
+int stats_init(const char *name);
+
+/**
+ * unmap and remove the stats segment
+ */
+void stats_deinit(void);
+
+/**
+ * check whether the segment is published
+ * @return true after successful stats_init()
+ */
+bool stats_is_enabled(void);
+
+/**
+ * record one handled rpc request
+ * @param latency_ns time from receive to reply
+ * @param bytes_in request size
+ * @param error true if the request failed
+ */
+void stats_record_rpc(uint64_t latency_ns, uint64_t bytes_in, bool error);
+
+/**
+ * record one timed call into a module
+ * @param slot module slot
+ * @param latency_ns call duration
+ */
+void stats_record_module_call(uint32_t slot, uint64_t latency_ns);
+
+/**
+ * copy loader counters and state into a module slot
+ * @param slot module slot
+ * @param loader module loader instance
+ */
+void stats_publish_loader(uint32_t slot, const module_loader_t *loader);
+
+/**
+ * sample resident memory of the process and of every module image
+ * parses /proc/self/smaps once for all slots, call from a slow path only
+ * @param loaders loader of each slot, NULL for slots to leave alone
+ * @param count entries in loaders, slots past STATS_MAX_MODULES are ignored
+ */
+void stats_publish_memory(module_loader_t *const *loaders, uint32_t count);
+
+/**
+ * copy lock profiling counters of all sites into the segment
+ */
+void stats_publish_locks(void);
+
+/**
+ * copy the image cache counters into the segment
+ */
+void stats_publish_image_cache(void);
+
+/**
+ * copy a consistent snapshot of the daemon's own segment
+ * @param out snapshot storage
+ * @return 0 on success, -1 if stats are disabled or the segment is busy
+ */
+int stats_snapshot(stats_segment_t *out);
+
+/**
+ * map an existing stats segment read-only (reader side)
+ * @param name shm object name or NULL for STATS_SHM_DEFAULT_NAME
+ * @return mapped segment or NULL on error
+ */
+const stats_segment_t *stats_open_reader(const char *name);
+
+/**
+ * unmap a segment returned by stats_open_reader()
+ * @param seg mapped segment
+ */
+void stats_close_reader(const stats_segment_t *seg);
+
+/**
+ * copy a consistent snapshot without syscalls
+ * @param seg mapped segment
+ * @param out snapshot storage
+ * @return 0 on success, -1 if the segment is invalid or busy
+ */
+int stats_read_snapshot(const stats_segment_t *seg, stats_segment_t *out);
+
+/**
+ * add a sample to a latency histogram
+ * @param lat histogram
+ * @param ns sample in nanoseconds
+ */
+void stats_latency_add(stats_latency_t *lat, uint64_t ns);
+
+/**
+ * estimate a percentile from a latency histogram
+ * @param lat histogram
+ * @param pct percentile in (0, 100]
+ * @return upper bound of the bucket holding the percentile, in nanoseconds
+ */
+uint64_t stats_latency_percentile(const stats_latency_t *lat, double pct);
+
+#endif /* STATS_H */
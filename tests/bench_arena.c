@@ -0,0 +1,69 @@
+#include "../host_arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 20000
+#define BENCH_BATCH 256
+#define BENCH_SIZE 64U
+
+static void *g_blocks[BENCH_BATCH];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *sys_alloc(void *ctx, size_t size)
+{
+    (void)ctx;
+    return malloc(size);
+}
+
+static void sys_free(void *ctx, void *ptr)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+/* allocate a batch, free it, repeat: the churn pattern of our modules */
+static double run(const module_alloc_ops_t *ops)
+{
+    uint64_t start;
+    int round;
+    int i;
+
+    start = now_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < BENCH_BATCH; i++) {
+            g_blocks[i] = ops->alloc(ops->ctx, BENCH_SIZE);
+        }
+        for (i = 0; i < BENCH_BATCH; i++) {
+            ops->free(ops->ctx, g_blocks[i]);
+        }
+    }
+    return (double)(now_ns() - start) / ((double)BENCH_ROUNDS * BENCH_BATCH);
+}
+
+int main(void)
+{
+    module_alloc_ops_t sys = { NULL, sys_alloc, sys_free };
+    host_arena_t *arena;
+
+    arena = host_arena_create();
+    if (arena == NULL) {
+        fprintf(stderr, "failed to create arena\n");
+        return 1;
+    }
+
+    printf("%d x %d blocks of %u bytes\n", BENCH_ROUNDS, BENCH_BATCH, BENCH_SIZE);
+    printf("%-14s %6.1f ns/alloc+free\n", "malloc", run(&sys));
+    printf("%-14s %6.1f ns/alloc+free\n", "host_arena", run(host_arena_ops(arena)));
+
+    host_arena_destroy(arena);
+    return 0;
+}
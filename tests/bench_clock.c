@@ -0,0 +1,67 @@
+#include "../host_clock.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_CALLS 10000000
+
+typedef struct {
+    const char *name;
+    uint64_t (*read)(void);
+} bench_case_t;
+
+static volatile uint64_t g_sink;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* get_time through the init args, CLOCK_MONOTONIC */
+static uint64_t get_time_ns(void)
+{
+    static int (*volatile get_time)(struct timespec *ts) = host_clock_get_time;
+    struct timespec ts;
+
+    get_time(&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double run(uint64_t (*read)(void))
+{
+    uint64_t start;
+    uint64_t sum = 0;
+    int i;
+
+    start = host_clock_vdso_ns();
+    for (i = 0; i < BENCH_CALLS; i++) {
+        sum += read();
+    }
+    g_sink = sum;
+    return (double)(host_clock_vdso_ns() - start) / (double)BENCH_CALLS;
+}
+
+int main(void)
+{
+    const module_clock_ops_t *clock = host_clock_ops();
+    bench_case_t cases[] = {
+        { "clock_gettime(MONOTONIC)", monotonic_ns },
+        { "init_args.get_time", get_time_ns },
+        { "vdso raw", host_clock_vdso_ns },
+        { "clock->coarse_ns", clock->coarse_ns },
+        { "clock->now_ns", clock->now_ns },
+        { "clock->cycles", clock->cycles },
+    };
+    size_t i;
+
+    printf("clock source: %s, tsc %llu Hz, %d calls each\n",
+            host_clock_source_name(host_clock_source()),
+            (unsigned long long)host_clock_tsc_hz(), BENCH_CALLS);
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        printf("%-26s %6.1f ns/call\n", cases[i].name, run(cases[i].read));
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../module_loader.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_FIXTURE "tests/fixtures/test_mod_big.so"
+#define BENCH_REPS 20
+/* one call per function of the fixture, each on its own cold page */
+#define BENCH_FIRST_CALLS 64
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct {
+    double load_us;
+    /* part of load_us, where RTLD_NOW pays for binding */
+    double dlopen_us;
+    double first_calls_us;
+    double max_call_us;
+} bench_result_t;
+
+/* fresh dlopen each rep, the image cache is off by default */
+static int bench_first_calls(uint32_t flags, bench_result_t *result)
+{
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+    int (*call)(int, int);
+    void *symbol;
+    uint64_t start;
+    uint64_t call_start;
+    uint64_t total = 0U;
+    uint64_t max_call = 0U;
+    uint64_t load = 0U;
+    uint64_t dlopen_ns = 0U;
+    int rep;
+    int i;
+
+    for (rep = 0; rep < BENCH_REPS; rep++) {
+        loader = module_loader_create();
+        if (loader == NULL || module_loader_set_load_flags(loader, flags) != MODULE_ERR_SUCCESS) {
+            module_loader_destroy(loader);
+            return -1;
+        }
+        start = now_ns();
+        if (module_loader_load(loader, BENCH_FIXTURE, NULL) != MODULE_ERR_SUCCESS ||
+                module_loader_get_symbol(loader, "big_call", &symbol) != MODULE_ERR_SUCCESS) {
+            module_loader_destroy(loader);
+            return -1;
+        }
+        load += now_ns() - start;
+        module_loader_get_stats(loader, &stats);
+        dlopen_ns += stats.load_phase_ns[MODULE_LOAD_PHASE_DLOPEN];
+        *(void **)&call = symbol;
+
+        start = now_ns();
+        for (i = 0; i < BENCH_FIRST_CALLS; i++) {
+            call_start = now_ns();
+            call(i, rep);
+            if (now_ns() - call_start > max_call) {
+                max_call = now_ns() - call_start;
+            }
+        }
+        total += now_ns() - start;
+
+        module_loader_put_ref(loader);
+        module_loader_destroy(loader);
+    }
+
+    result->load_us = (double)load / BENCH_REPS / 1000.0;
+    result->dlopen_us = (double)dlopen_ns / BENCH_REPS / 1000.0;
+    result->first_calls_us = (double)total / BENCH_REPS / 1000.0;
+    result->max_call_us = (double)max_call / 1000.0;
+    return 0;
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        uint32_t flags;
+    } modes[] = {
+        { "plain", 0U },
+        { "bind-now", MODULE_LOAD_BIND_NOW },
+        { "prefault", MODULE_LOAD_PREFAULT },
+        { "huge-text", MODULE_LOAD_PREFAULT | MODULE_LOAD_HUGE_TEXT },
+        { "both", MODULE_LOAD_PREFAULT | MODULE_LOAD_BIND_NOW },
+    };
+    bench_result_t result;
+    size_t i;
+
+    printf("first %d calls after load, %d reps\n", BENCH_FIRST_CALLS, BENCH_REPS);
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (bench_first_calls(modes[i].flags, &result) != 0) {
+            fprintf(stderr, "failed to load %s\n", BENCH_FIXTURE);
+            return 1;
+        }
+        printf("%-10s load %8.1f us (dlopen %8.1f)  first calls %8.1f us  max call %6.1f us\n",
+                modes[i].name, result.load_us, result.dlopen_us, result.first_calls_us,
+                result.max_call_us);
+    }
+    return 0;
+}
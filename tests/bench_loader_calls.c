@@ -0,0 +1,84 @@
+#include "../module_loader.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_CALLS 5000000
+
+#ifdef KMODLIKE_SINGLE_THREADED
+#define BENCH_VARIANT "single-threaded"
+#else
+#define BENCH_VARIANT "threaded"
+#endif
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* pin, call, unpin: the symbol handle path */
+static double bench_call_hello(module_loader_t *loader)
+{
+    uint64_t start = now_ns();
+    int i;
+
+    for (i = 0; i < BENCH_CALLS; i++) {
+        module_loader_call_hello(loader);
+    }
+    return (double)(now_ns() - start) / BENCH_CALLS;
+}
+
+/* two trips through the loader mutex */
+static double bench_ref(module_loader_t *loader)
+{
+    uint64_t start = now_ns();
+    int i;
+
+    for (i = 0; i < BENCH_CALLS; i++) {
+        module_loader_get_ref(loader);
+        module_loader_put_ref(loader);
+    }
+    return (double)(now_ns() - start) / BENCH_CALLS;
+}
+
+/* one mutex round trip plus the stats copy */
+static double bench_stats(module_loader_t *loader)
+{
+    module_loader_stats_t stats;
+    uint64_t start = now_ns();
+    int i;
+
+    for (i = 0; i < BENCH_CALLS; i++) {
+        module_loader_get_stats(loader, &stats);
+    }
+    return (double)(now_ns() - start) / BENCH_CALLS;
+}
+
+int main(void)
+{
+    module_loader_t *loader;
+
+    loader = module_loader_create();
+    if (loader == NULL) {
+        fprintf(stderr, "failed to create loader\n");
+        return 1;
+    }
+    if (module_loader_load(loader, "tests/fixtures/test_mod_good.so", NULL) !=
+            MODULE_ERR_SUCCESS) {
+        fprintf(stderr, "failed to load tests/fixtures/test_mod_good.so\n");
+        module_loader_destroy(loader);
+        return 1;
+    }
+
+    printf("%s loader, %d calls each\n", BENCH_VARIANT, BENCH_CALLS);
+    printf("%-16s %6.1f ns/call\n", "call_hello", bench_call_hello(loader));
+    printf("%-16s %6.1f ns/call\n", "get_ref+put_ref", bench_ref(loader));
+    printf("%-16s %6.1f ns/call\n", "get_stats", bench_stats(loader));
+
+    module_loader_unload(loader);
+    module_loader_destroy(loader);
+    return 0;
+}
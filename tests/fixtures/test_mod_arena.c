@@ -0,0 +1,65 @@
+#include "../../module_interface.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEST_ARENA_SMALL 100
+#define TEST_ARENA_SMALL_SIZE 100U
+#define TEST_ARENA_LARGE_SIZE 10000U
+
+/* shared with tests/test_host_arena.c through init_args.user_data */
+typedef struct {
+    atomic_int has_alloc;
+} test_arena_counters_t;
+
+static void *g_blocks[TEST_ARENA_SMALL];
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_init_args_version(void)
+{
+    return MODULE_INIT_ARGS_VERSION_2;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+    test_arena_counters_t *counters;
+    int i;
+
+    if (args == NULL || args->user_data == NULL) {
+        return -1;
+    }
+    counters = args->user_data;
+
+    if (!MODULE_INIT_ARGS_HAS(args, alloc) || args->alloc == NULL) {
+        return 0;
+    }
+    atomic_store(&counters->has_alloc, 1);
+
+    /* half of the small blocks and the large one are leaked on purpose */
+    for (i = 0; i < TEST_ARENA_SMALL; i++) {
+        g_blocks[i] = args->alloc->alloc(args->alloc->ctx, TEST_ARENA_SMALL_SIZE);
+        if (g_blocks[i] == NULL) {
+            return -1;
+        }
+    }
+    for (i = 0; i < TEST_ARENA_SMALL; i += 2) {
+        args->alloc->free(args->alloc->ctx, g_blocks[i]);
+    }
+    if (args->alloc->alloc(args->alloc->ctx, TEST_ARENA_LARGE_SIZE) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
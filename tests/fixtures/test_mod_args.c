@@ -0,0 +1,37 @@
+#include "../../module_interface.h"
+#include <stdint.h>
+#include <string.h>
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_init_args_version(void)
+{
+    return MODULE_INIT_ARGS_VERSION_2;
+}
+
+/* copies the args it was given to the module_init_args_t in user_data */
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+    size_t size = MODULE_INIT_ARGS_SIZE_V1;
+
+    if (args == NULL || args->user_data == NULL) {
+        return -1;
+    }
+    if (args->version >= MODULE_INIT_ARGS_VERSION_2) {
+        size = (args->size < sizeof(*args)) ? args->size : sizeof(*args);
+    }
+    memcpy(args->user_data, args, size);
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
@@ -0,0 +1,61 @@
+#include "../../module_interface.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* items with this tag are left unprocessed, to exercise partial batches */
+#define TEST_BATCH_STOP_TAG 0xdeadU
+
+static atomic_int g_batch_calls = ATOMIC_VAR_INIT(0);
+
+/* result is the item length, or -1 for items without data */
+static size_t batch_process(const module_item_t *items, size_t n, int *results)
+{
+    size_t i;
+
+    atomic_fetch_add(&g_batch_calls, 1);
+    for (i = 0U; i < n; i++) {
+        if (items[i].tag == TEST_BATCH_STOP_TAG) {
+            break;
+        }
+        results[i] = (items[i].data != NULL) ? (int)items[i].len : -1;
+    }
+    return i;
+}
+
+static const module_ops_t g_ops = {
+    .version = MODULE_OPS_VERSION_2,
+    .size = sizeof(module_ops_t),
+    .hello = NULL,
+    .process_batch = batch_process,
+};
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    (void)init_args;
+    atomic_store(&g_batch_calls, 0);
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
+
+__attribute__((visibility("default")))
+const module_ops_t *module_get_ops(void)
+{
+    return &g_ops;
+}
+
+__attribute__((visibility("default")))
+int test_mod_batch_calls(void)
+{
+    return atomic_load(&g_batch_calls);
+}
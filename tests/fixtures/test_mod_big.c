@@ -0,0 +1,81 @@
+#include "../../module_interface.h"
+#include <stdint.h>
+
+/*
+ * text spread over many pages: every function sits on its own 64 KiB
+ * boundary, so each first call of a cold image takes its own page fault
+ * even with the kernel's fault-around. each calls an exported leaf
+ * through the PLT, bound on that first call unless loaded with RTLD_NOW
+ */
+#define BIG_FN(n) \
+    __attribute__((visibility("default"), noinline)) \
+    int big_leaf_##n(int x) \
+    { \
+        return x + n; \
+    } \
+    __attribute__((noinline, aligned(65536))) \
+    static int big_fn_##n(int x) \
+    { \
+        return big_leaf_##n(x * (n + 1)); \
+    }
+
+#define BIG_FN8(n) \
+    BIG_FN(n##0) BIG_FN(n##1) BIG_FN(n##2) BIG_FN(n##3) \
+    BIG_FN(n##4) BIG_FN(n##5) BIG_FN(n##6) BIG_FN(n##7)
+
+BIG_FN8(1)
+BIG_FN8(2)
+BIG_FN8(3)
+BIG_FN8(4)
+BIG_FN8(5)
+BIG_FN8(6)
+BIG_FN8(7)
+BIG_FN8(8)
+
+#define BIG_REF8(n) \
+    big_fn_##n##0, big_fn_##n##1, big_fn_##n##2, big_fn_##n##3, \
+    big_fn_##n##4, big_fn_##n##5, big_fn_##n##6, big_fn_##n##7
+
+static int (*const g_fns[])(int) = {
+    BIG_REF8(1), BIG_REF8(2), BIG_REF8(3), BIG_REF8(4),
+    BIG_REF8(5), BIG_REF8(6), BIG_REF8(7), BIG_REF8(8),
+};
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    (void)init_args;
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
+
+__attribute__((visibility("default")))
+int big_count(void)
+{
+    return (int)(sizeof(g_fns) / sizeof(g_fns[0]));
+}
+
+/* calls function i, -1 if out of range */
+__attribute__((visibility("default")))
+int big_call(int i, int x)
+{
+    if (i < 0 || i >= big_count()) {
+        return -1;
+    }
+    return g_fns[i](x);
+}
+
+__attribute__((visibility("default")))
+void mod_hello(void)
+{
+}
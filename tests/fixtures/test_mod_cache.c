@@ -0,0 +1,48 @@
+#include "../../module_interface.h"
+#include <stdint.h>
+
+/* survive a cached reload, start from zero after a real dlopen */
+static int g_constructed;
+static int g_inits;
+
+__attribute__((constructor))
+static void constructed(void)
+{
+    g_constructed++;
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    (void)init_args;
+    g_inits++;
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
+
+__attribute__((visibility("default")))
+int cache_constructed(void)
+{
+    return g_constructed;
+}
+
+__attribute__((visibility("default")))
+int cache_inits(void)
+{
+    return g_inits;
+}
+
+__attribute__((visibility("default")))
+void mod_hello(void)
+{
+}
@@ -0,0 +1,48 @@
+#include "../../module_interface.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/* shared with tests/test_lazy.c through init_args.user_data */
+typedef struct {
+    atomic_int inits;
+} test_lazy_counters_t;
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+    const struct timespec slow = {0, 50000000L};
+    test_lazy_counters_t *counters;
+
+    if (args == NULL || args->user_data == NULL) {
+        return -1;
+    }
+    counters = args->user_data;
+    atomic_fetch_add(&counters->inits, 1);
+    /* a slow init gives concurrent first users time to pile up */
+    nanosleep(&slow, NULL);
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
+
+__attribute__((visibility("default")))
+int lazy_answer(void)
+{
+    return 42;
+}
+
+__attribute__((visibility("default")))
+void mod_hello(void)
+{
+}
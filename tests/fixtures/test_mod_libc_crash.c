@@ -0,0 +1,65 @@
+#include "../../module_interface.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* faults raised inside libc on behalf of the module, the pc is never in the image */
+
+static const module_pool_ops_t *g_pool;
+/* called through a volatile pointer, so the compiler cannot drop a copy to NULL */
+static void *(*volatile g_memcpy)(void *dst, const void *src, size_t len) = memcpy;
+
+static void abort_task(void *arg)
+{
+    (void)arg;
+    abort();
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_init_args_version(void)
+{
+    return MODULE_INIT_ARGS_VERSION_2;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+
+    g_pool = NULL;
+    if (args != NULL && MODULE_INIT_ARGS_HAS(args, pool)) {
+        g_pool = args->pool;
+    }
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+    g_pool = NULL;
+}
+
+/* memcpy faults on the destination */
+__attribute__((visibility("default")))
+void mod_copy_to_null(void)
+{
+    static const char src[16] = "module data";
+
+    g_memcpy(NULL, src, sizeof(src));
+}
+
+/* queue a pool task that calls abort(), -1 without a pool */
+__attribute__((visibility("default")))
+int mod_abort_in_task(void)
+{
+    if (g_pool == NULL) {
+        return -1;
+    }
+    return g_pool->submit(g_pool->ctx, abort_task, NULL);
+}
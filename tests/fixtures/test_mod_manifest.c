@@ -0,0 +1,53 @@
+#include "../../module_interface.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * manifest params in init_args.user_data:
+ *   sleep_ms=<n>  spend n ms in module_init
+ *   fail          return an error from module_init
+ */
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+    const char *params;
+    const char *sleep_ms;
+    struct timespec ts;
+    long ms;
+
+    if (args == NULL || args->user_data == NULL) {
+        return 0;
+    }
+    params = args->user_data;
+    if (strstr(params, "fail") != NULL) {
+        return -1;
+    }
+    sleep_ms = strstr(params, "sleep_ms=");
+    if (sleep_ms != NULL) {
+        ms = strtol(sleep_ms + 9, NULL, 10);
+        ts.tv_sec = ms / 1000L;
+        ts.tv_nsec = (ms % 1000L) * 1000000L;
+        nanosleep(&ts, NULL);
+    }
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
+
+__attribute__((visibility("default")))
+void mod_hello(void)
+{
+}
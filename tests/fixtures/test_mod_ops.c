@@ -0,0 +1,49 @@
+#include "../../module_interface.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+static atomic_int g_hello_calls = ATOMIC_VAR_INIT(0);
+
+static void ops_hello(void)
+{
+    atomic_fetch_add(&g_hello_calls, 1);
+}
+
+/* built against version 1 of the table */
+static const module_ops_t g_ops = {
+    .version = MODULE_OPS_VERSION_1,
+    .size = MODULE_OPS_SIZE_V1,
+    .hello = ops_hello,
+};
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    (void)init_args;
+    atomic_store(&g_hello_calls, 0);
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
+
+__attribute__((visibility("default")))
+const module_ops_t *module_get_ops(void)
+{
+    return &g_ops;
+}
+
+/* lets tests check that calls went through the table */
+__attribute__((visibility("default")))
+int test_mod_ops_hello_calls(void)
+{
+    return atomic_load(&g_hello_calls);
+}
@@ -0,0 +1,33 @@
+#include "../../module_interface.h"
+#include <stdint.h>
+
+/* a table too short to hold even the version 1 slots */
+static const module_ops_t g_ops = {
+    .version = MODULE_OPS_VERSION_1,
+    .size = 4U,
+    .hello = NULL,
+};
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    (void)init_args;
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
+
+__attribute__((visibility("default")))
+const module_ops_t *module_get_ops(void)
+{
+    return &g_ops;
+}
@@ -0,0 +1,85 @@
+#include "../../module_interface.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/* tasks queued by init, more than a capped client runs before the test unloads */
+#define TEST_POOL_TASKS 64
+#define TEST_POOL_TASK_US 5000L
+#define TEST_POOL_RANGE 1000U
+
+/* shared with tests/test_host_pool.c through init_args.user_data */
+typedef struct {
+    atomic_int ran;
+    atomic_long range_sum;
+    atomic_int has_pool;
+} test_pool_counters_t;
+
+static test_pool_counters_t *g_counters;
+
+static void sleep_task(void *arg)
+{
+    const struct timespec delay = {0, TEST_POOL_TASK_US * 1000L};
+
+    (void)arg;
+    nanosleep(&delay, NULL);
+    atomic_fetch_add(&g_counters->ran, 1);
+}
+
+static void sum_range(void *arg, size_t begin, size_t end)
+{
+    long sum = 0;
+    size_t i;
+
+    (void)arg;
+    for (i = begin; i < end; i++) {
+        sum += (long)i;
+    }
+    atomic_fetch_add(&g_counters->range_sum, sum);
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_init_args_version(void)
+{
+    return MODULE_INIT_ARGS_VERSION_2;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+    const module_pool_ops_t *pool;
+    int i;
+
+    if (args == NULL || args->user_data == NULL) {
+        return -1;
+    }
+    g_counters = args->user_data;
+
+    if (!MODULE_INIT_ARGS_HAS(args, pool) || args->pool == NULL) {
+        return 0;
+    }
+    pool = args->pool;
+    atomic_store(&g_counters->has_pool, 1);
+
+    if (pool->parallel_for(pool->ctx, TEST_POOL_RANGE, 0U, sum_range, NULL) != 0) {
+        return -1;
+    }
+    for (i = 0; i < TEST_POOL_TASKS; i++) {
+        if (pool->submit(pool->ctx, sleep_task, NULL) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
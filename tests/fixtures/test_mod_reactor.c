@@ -0,0 +1,63 @@
+#include "../../module_interface.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* shared with tests/test_host_reactor.c through init_args.user_data */
+typedef struct {
+    int fd;
+    atomic_int reads;
+    atomic_int has_reactor;
+} test_reactor_counters_t;
+
+static test_reactor_counters_t *g_counters;
+
+static void on_readable(void *arg, int fd, uint32_t events)
+{
+    char buf[64];
+
+    (void)arg;
+    if ((events & MODULE_IO_READ) != 0U && read(fd, buf, sizeof(buf)) > 0) {
+        atomic_fetch_add(&g_counters->reads, 1);
+    }
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_init_args_version(void)
+{
+    return MODULE_INIT_ARGS_VERSION_2;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+
+    if (args == NULL || args->user_data == NULL) {
+        return -1;
+    }
+    g_counters = args->user_data;
+
+    if (!MODULE_INIT_ARGS_HAS(args, reactor) || args->reactor == NULL) {
+        return 0;
+    }
+    atomic_store(&g_counters->has_reactor, 1);
+
+    /* never removed here, the host does it at unload */
+    if (args->reactor->add(args->reactor->ctx, g_counters->fd, MODULE_IO_READ,
+                on_readable, NULL) <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
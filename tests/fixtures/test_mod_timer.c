@@ -0,0 +1,59 @@
+#include "../../module_interface.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define TEST_TIMER_PERIOD_MS 5U
+
+/* shared with tests/test_host_timer.c through init_args.user_data */
+typedef struct {
+    atomic_int ticks;
+    atomic_int has_timers;
+} test_timer_counters_t;
+
+static test_timer_counters_t *g_counters;
+
+static void tick(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_counters->ticks, 1);
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+__attribute__((visibility("default")))
+uint32_t module_get_init_args_version(void)
+{
+    return MODULE_INIT_ARGS_VERSION_2;
+}
+
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const module_init_args_t *args = init_args;
+
+    if (args == NULL || args->user_data == NULL) {
+        return -1;
+    }
+    g_counters = args->user_data;
+
+    if (!MODULE_INIT_ARGS_HAS(args, timers) || args->timers == NULL) {
+        return 0;
+    }
+    atomic_store(&g_counters->has_timers, 1);
+
+    /* never cancelled here, the host does it at unload */
+    if (args->timers->start(args->timers->ctx, TEST_TIMER_PERIOD_MS, TEST_TIMER_PERIOD_MS,
+                tick, NULL) <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
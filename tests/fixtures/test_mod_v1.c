@@ -0,0 +1,43 @@
+#include "../../module_interface.h"
+#include <stdint.h>
+#include <time.h>
+
+/* init args as the version 1 header declared them, before size and the
+ * host services were appended */
+typedef struct {
+    uint32_t version;
+    void (*log)(int level, const char *fmt, ...);
+    int (*get_time)(struct timespec *ts);
+    void *user_data;
+} test_v1_init_args_t;
+
+__attribute__((visibility("default")))
+uint32_t module_get_interface_version(void)
+{
+    return MODULE_INTERFACE_VERSION_CURRENT;
+}
+
+/* uses the services only on an exact version match, like modules built
+ * against the version 1 header did; user_data gets 1 when they were usable */
+__attribute__((visibility("default")))
+int module_init(const void *init_args)
+{
+    const test_v1_init_args_t *args = init_args;
+    struct timespec ts;
+
+    if (args == NULL || args->version != 1U || args->user_data == NULL) {
+        return 0;
+    }
+    if (args->log != NULL) {
+        args->log(MODULE_LOG_INFO, "v1 module initializing");
+    }
+    if (args->get_time != NULL && args->get_time(&ts) == 0) {
+        *(int *)args->user_data = 1;
+    }
+    return 0;
+}
+
+__attribute__((visibility("default")))
+void module_fini(void)
+{
+}
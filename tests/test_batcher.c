@@ -0,0 +1,193 @@
+#include "../batcher.h"
+#include "../module_loader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_ITEMS 10U
+#define TEST_BATCH_SIZE 4U
+#define TEST_DELAY_MS 20U
+#define TEST_BATCH_STOP_TAG 0xdeadU
+
+typedef struct {
+    int results[TEST_ITEMS];
+    size_t count;
+} collected_t;
+
+static int get_time_impl(struct timespec *ts)
+{
+    if (ts == NULL) {
+        return -1;
+    }
+    return clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static void collect(void *ctx, const module_item_t *item, int result)
+{
+    collected_t *c = ctx;
+
+    if (item->tag < TEST_ITEMS) {
+        c->results[item->tag] = result;
+    }
+    c->count++;
+}
+
+static module_error_t load(module_loader_t *loader, const char *path)
+{
+    module_init_args_t init_args;
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    return module_loader_load(loader, path, &init_args);
+}
+
+static int batch_calls(module_loader_t *loader)
+{
+    void *sym;
+    int calls;
+
+    if (module_loader_get_symbol(loader, "test_mod_batch_calls", &sym) != MODULE_ERR_SUCCESS) {
+        return -1;
+    }
+    calls = ((int (*)(void))sym)();
+    module_loader_put_ref(loader);
+    return calls;
+}
+
+static int test_size_bound(void)
+{
+    static const char payload[] = "0123456789";
+    module_loader_t *loader;
+    batcher_t *batcher;
+    collected_t c;
+    module_item_t item;
+    uint32_t i;
+
+    memset(&c, 0, sizeof(c));
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+    TEST_ASSERT(load(loader, "tests/fixtures/test_mod_batch.so") == MODULE_ERR_SUCCESS, "load");
+
+    batcher = batcher_create(loader, TEST_BATCH_SIZE, 0U, collect, &c);
+    TEST_ASSERT(batcher != NULL, "batcher_create");
+
+    for (i = 0U; i < TEST_ITEMS; i++) {
+        item.data = payload;
+        item.len = i;
+        item.tag = i;
+        TEST_ASSERT(batcher_submit(batcher, &item) == MODULE_ERR_SUCCESS, "submit");
+    }
+
+    TEST_ASSERT(batch_calls(loader) == 2, "two full batches dispatched");
+    TEST_ASSERT(batcher_pending(batcher) == TEST_ITEMS % TEST_BATCH_SIZE, "remainder queued");
+    TEST_ASSERT(batcher_flush(batcher) == MODULE_ERR_SUCCESS, "flush");
+    TEST_ASSERT(batch_calls(loader) == 3, "one call per batch");
+    TEST_ASSERT(c.count == TEST_ITEMS, "one result per item");
+    for (i = 0U; i < TEST_ITEMS; i++) {
+        TEST_ASSERT(c.results[i] == (int)i, "module result delivered");
+    }
+
+    batcher_destroy(batcher);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_delay_bound_and_reload(void)
+{
+    module_loader_t *loader;
+    batcher_t *batcher;
+    collected_t c;
+    module_item_t item = {NULL, 0U, 0U};
+
+    memset(&c, 0, sizeof(c));
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+    TEST_ASSERT(load(loader, "tests/fixtures/test_mod_batch.so") == MODULE_ERR_SUCCESS, "load");
+
+    batcher = batcher_create(loader, TEST_BATCH_SIZE, TEST_DELAY_MS, collect, &c);
+    TEST_ASSERT(batcher != NULL, "batcher_create");
+
+    TEST_ASSERT(batcher_submit(batcher, &item) == MODULE_ERR_SUCCESS, "submit");
+    TEST_ASSERT(batcher_poll(batcher) == MODULE_ERR_SUCCESS && c.count == 0U,
+            "young batch held back");
+    usleep(TEST_DELAY_MS * 2000U);
+    TEST_ASSERT(batcher_poll(batcher) == MODULE_ERR_SUCCESS && c.count == 1U,
+            "old batch dispatched");
+    TEST_ASSERT(c.results[0] == -1, "module error delivered");
+
+    /* the cached ops handle goes stale and is resolved again */
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+    TEST_ASSERT(load(loader, "tests/fixtures/test_mod_batch.so") == MODULE_ERR_SUCCESS,
+            "reload");
+    TEST_ASSERT(batcher_submit(batcher, &item) == MODULE_ERR_SUCCESS, "submit after reload");
+    TEST_ASSERT(batcher_flush(batcher) == MODULE_ERR_SUCCESS, "flush after reload");
+    TEST_ASSERT(batch_calls(loader) == 1, "new generation called");
+
+    /* unprocessed tail is reported busy */
+    item.tag = TEST_BATCH_STOP_TAG;
+    c.count = 0U;
+    TEST_ASSERT(batcher_submit(batcher, &item) == MODULE_ERR_SUCCESS, "submit stop item");
+    TEST_ASSERT(batcher_flush(batcher) == MODULE_ERR_SUCCESS && c.count == 1U, "flush stop");
+
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+    item.tag = 1U;
+    TEST_ASSERT(batcher_submit(batcher, &item) == MODULE_ERR_SUCCESS, "queue while unloaded");
+    TEST_ASSERT(batcher_flush(batcher) == MODULE_ERR_NOT_LOADED, "dispatch fails");
+    TEST_ASSERT(c.results[1] == MODULE_ERR_NOT_LOADED, "items get the dispatch error");
+
+    batcher_destroy(batcher);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_v1_module(void)
+{
+    module_loader_t *loader;
+    batcher_t *batcher;
+    collected_t c;
+    module_item_t item = {NULL, 0U, 2U};
+
+    memset(&c, 0, sizeof(c));
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+    TEST_ASSERT(load(loader, "tests/fixtures/test_mod_ops.so") == MODULE_ERR_SUCCESS, "load");
+
+    batcher = batcher_create(loader, TEST_BATCH_SIZE, 0U, collect, &c);
+    TEST_ASSERT(batcher != NULL, "batcher_create");
+    TEST_ASSERT(batcher_submit(batcher, &item) == MODULE_ERR_SUCCESS, "submit");
+    TEST_ASSERT(batcher_flush(batcher) == MODULE_ERR_MISSING_SYMBOL,
+            "v1 table has no process_batch");
+    TEST_ASSERT(c.results[2] == MODULE_ERR_MISSING_SYMBOL, "item reported");
+
+    batcher_destroy(batcher);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_size_bound();
+    ret |= test_delay_bound_and_reload();
+    ret |= test_v1_module();
+
+    if (ret == 0) {
+        printf("all batcher tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,161 @@
+#include "../flightrec.h"
+#include "../module_loader.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define WRITER_THREADS 4
+#define WRITER_EVENTS 20000
+
+static char g_buf[1024 * 1024];
+
+static int get_time_impl(struct timespec *ts)
+{
+    if (ts == NULL) {
+        return -1;
+    }
+    return clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static int count_lines(const char *s)
+{
+    int n = 0;
+
+    for (; *s != '\0'; s++) {
+        n += (*s == '\n') ? 1 : 0;
+    }
+    return n;
+}
+
+static int test_format(void)
+{
+    size_t n;
+
+    flightrec_record(FLIGHTREC_RPC, (uint64_t)(int64_t)-8, 1234U, "insmod");
+    flightrec_record(FLIGHTREC_SIGNAL, 11U, 0xdeadbeefU, "SIGSEGV");
+    flightrec_record(FLIGHTREC_LOAD, 0U, 10U,
+            "/a/very/long/directory/name/plugins/libexample.so");
+
+    n = flightrec_dump_buf(g_buf, sizeof(g_buf), 3U);
+    TEST_ASSERT(n == 3U, "three events");
+    TEST_ASSERT(count_lines(g_buf) == 3, "one line per event");
+    TEST_ASSERT(strstr(g_buf, " rpc insmod ret=-8 dur_ns=1234\n") != NULL, "rpc event");
+    TEST_ASSERT(strstr(g_buf, " signal SIGSEGV signo=11 addr=0xdeadbeef\n") != NULL,
+            "signal event");
+    TEST_ASSERT(strstr(g_buf, "plugins/libexample.so err=0") != NULL, "path tail kept");
+    TEST_ASSERT(strstr(g_buf, " rpc ") < strstr(g_buf, " signal "), "oldest first");
+
+    return 0;
+}
+
+static int test_loader_events(void)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    void *sym;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_good.so", &init_args) ==
+            MODULE_ERR_SUCCESS, "load");
+    TEST_ASSERT(module_loader_get_symbol(loader, "mod_hello", &sym) == MODULE_ERR_SUCCESS,
+            "get_symbol");
+    module_loader_put_ref(loader);
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+    module_loader_destroy(loader);
+
+    flightrec_dump_buf(g_buf, sizeof(g_buf), 4U);
+    TEST_ASSERT(strstr(g_buf, "test_mod_good.so err=0 dur_ns=") != NULL, "load event");
+    TEST_ASSERT(strstr(g_buf, " symbol mod_hello err=0\n") != NULL, "symbol event");
+    TEST_ASSERT(strstr(g_buf, " ref_put refs=0\n") != NULL, "ref_put event");
+    TEST_ASSERT(strstr(g_buf, " unload ") != NULL, "unload event");
+
+    return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+    int i;
+
+    (void)arg;
+
+    for (i = 0; i < WRITER_EVENTS; i++) {
+        flightrec_record(FLIGHTREC_REF_GET, (uint64_t)i, 0U, NULL);
+    }
+    return NULL;
+}
+
+static int test_concurrent_wrap(void)
+{
+    pthread_t threads[WRITER_THREADS];
+    char path[64];
+    FILE *f;
+    char line[256];
+    size_t n;
+    int lines = 0;
+    int i;
+
+    for (i = 0; i < WRITER_THREADS; i++) {
+        TEST_ASSERT(pthread_create(&threads[i], NULL, writer_thread, NULL) == 0,
+                "pthread_create");
+    }
+    for (i = 0; i < WRITER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* a writer preempted for a full lap may land an older event over a newer one */
+    n = flightrec_dump_buf(g_buf, sizeof(g_buf), 0U);
+    TEST_ASSERT(n + WRITER_THREADS >= FLIGHTREC_EVENTS, "ring retains its capacity after wrap");
+
+    snprintf(path, sizeof(path), "/tmp/kmodlike_test_flightrec_%d.txt", (int)getpid());
+    TEST_ASSERT(flightrec_dump_file(path) == (int)n, "dump to file");
+
+    f = fopen(path, "r");
+    TEST_ASSERT(f != NULL, "open dump");
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strstr(line, " ref_get refs=") == NULL) {
+            fclose(f);
+            unlink(path);
+            TEST_ASSERT(0, "unexpected line in dump");
+        }
+        lines++;
+    }
+    fclose(f);
+    unlink(path);
+    TEST_ASSERT(lines == (int)n, "all lines written");
+
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_format();
+    ret |= test_loader_events();
+    ret |= test_concurrent_wrap();
+
+    if (ret == 0) {
+        printf("all flight recorder tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,284 @@
+#include "../host_arena.h"
+#include "../module_loader.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_BLOCKS 2000
+#define TEST_MAX_SIZE 5000U
+#define TEST_THREADS 4
+#define TEST_ROUNDS 200
+#define TEST_BATCH 256
+
+typedef struct {
+    atomic_int has_alloc;
+} test_arena_counters_t;
+
+static uint32_t next_rand(uint32_t *state)
+{
+    *state = *state * 1103515245U + 12345U;
+    return *state >> 8;
+}
+
+static int test_sizes(void)
+{
+    static unsigned char *blocks[TEST_BLOCKS];
+    static size_t sizes[TEST_BLOCKS];
+    host_arena_stats_t stats;
+    host_arena_t *arena;
+    uint32_t seed = 1U;
+    size_t i;
+    size_t j;
+
+    arena = host_arena_create();
+    TEST_ASSERT(arena != NULL, "create");
+    TEST_ASSERT(host_arena_alloc(arena, 0U) == NULL, "zero size");
+    TEST_ASSERT(host_arena_alloc(arena, SIZE_MAX) == NULL, "huge size");
+    host_arena_free(arena, NULL);
+
+    for (i = 0U; i < TEST_BLOCKS; i++) {
+        sizes[i] = 1U + next_rand(&seed) % TEST_MAX_SIZE;
+        blocks[i] = host_arena_alloc(arena, sizes[i]);
+        TEST_ASSERT(blocks[i] != NULL, "alloc");
+        TEST_ASSERT(((uintptr_t)blocks[i] & 15U) == 0U, "16 byte aligned");
+        memset(blocks[i], (int)(i & 0xffU), sizes[i]);
+    }
+    host_arena_get_stats(arena, &stats);
+    TEST_ASSERT(stats.objects == TEST_BLOCKS, "objects counted");
+    TEST_ASSERT(stats.reserved_bytes >= stats.bytes, "reserved covers live bytes");
+
+    /* no block overlaps another */
+    for (i = 0U; i < TEST_BLOCKS; i++) {
+        for (j = 0U; j < sizes[i]; j++) {
+            TEST_ASSERT(blocks[i][j] == (unsigned char)(i & 0xffU), "block intact");
+        }
+    }
+
+    for (i = 0U; i < TEST_BLOCKS; i++) {
+        host_arena_free(arena, blocks[i]);
+    }
+    host_arena_get_stats(arena, &stats);
+    TEST_ASSERT(stats.objects == 0U && stats.bytes == 0U, "all freed");
+    TEST_ASSERT(stats.reserved_bytes > 0U, "small chunks kept for reuse");
+
+    host_arena_destroy(arena);
+    return 0;
+}
+
+static int test_large(void)
+{
+    host_arena_stats_t stats;
+    host_arena_t *arena;
+    void *big;
+    void *bigger;
+
+    arena = host_arena_create();
+    TEST_ASSERT(arena != NULL, "create");
+
+    big = host_arena_alloc(arena, HOST_ARENA_MAX_SMALL + 1U);
+    bigger = host_arena_alloc(arena, 4U * HOST_ARENA_CHUNK_SIZE);
+    TEST_ASSERT(big != NULL && bigger != NULL, "large alloc");
+    memset(bigger, 0xab, 4U * HOST_ARENA_CHUNK_SIZE);
+    host_arena_get_stats(arena, &stats);
+    TEST_ASSERT(stats.objects == 2U, "large objects");
+    TEST_ASSERT(stats.bytes == HOST_ARENA_MAX_SMALL + 1U + 4U * HOST_ARENA_CHUNK_SIZE,
+            "large bytes are exact");
+
+    host_arena_free(arena, bigger);
+    host_arena_free(arena, big);
+    host_arena_get_stats(arena, &stats);
+    TEST_ASSERT(stats.bytes == 0U && stats.reserved_bytes == 0U,
+            "large chunks go back at once");
+
+    host_arena_destroy(arena);
+    return 0;
+}
+
+typedef struct {
+    host_arena_t *arena;
+    void *handoff[TEST_BATCH];
+    uint32_t seed;
+    int failed;
+} worker_t;
+
+/* churn, and leave a batch for another thread to free */
+static void *churn(void *arg)
+{
+    worker_t *w = arg;
+    void *blocks[TEST_BATCH];
+    int round;
+    int i;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        for (i = 0; i < TEST_BATCH; i++) {
+            blocks[i] = host_arena_alloc(w->arena, 1U + next_rand(&w->seed) % 512U);
+            if (blocks[i] == NULL) {
+                w->failed = 1;
+                return NULL;
+            }
+        }
+        for (i = 0; i < TEST_BATCH; i++) {
+            host_arena_free(w->arena, blocks[i]);
+        }
+    }
+    for (i = 0; i < TEST_BATCH; i++) {
+        w->handoff[i] = host_arena_alloc(w->arena, 64U);
+    }
+    return NULL;
+}
+
+static void *free_handoff(void *arg)
+{
+    worker_t *w = arg;
+    int i;
+
+    for (i = 0; i < TEST_BATCH; i++) {
+        host_arena_free(w->arena, w->handoff[i]);
+    }
+    return NULL;
+}
+
+static int test_threads(void)
+{
+    static worker_t workers[TEST_THREADS];
+    pthread_t threads[TEST_THREADS];
+    host_arena_stats_t stats;
+    host_arena_t *arena;
+    int i;
+
+    arena = host_arena_create();
+    TEST_ASSERT(arena != NULL, "create");
+    for (i = 0; i < TEST_THREADS; i++) {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].arena = arena;
+        workers[i].seed = (uint32_t)i + 1U;
+        TEST_ASSERT(pthread_create(&threads[i], NULL, churn, &workers[i]) == 0, "thread");
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT(workers[i].failed == 0, "alloc under contention");
+    }
+    host_arena_get_stats(arena, &stats);
+    TEST_ASSERT(stats.objects == (uint64_t)TEST_THREADS * TEST_BATCH, "handoff blocks live");
+
+    /* each batch is freed by a thread that did not allocate it */
+    for (i = 0; i < TEST_THREADS; i++) {
+        TEST_ASSERT(pthread_create(&threads[i], NULL, free_handoff,
+                &workers[(i + 1) % TEST_THREADS]) == 0, "thread");
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    host_arena_get_stats(arena, &stats);
+    TEST_ASSERT(stats.objects == 0U && stats.bytes == 0U, "cross-thread frees");
+
+    host_arena_destroy(arena);
+    return 0;
+}
+
+static int test_cache_slots(void)
+{
+    host_arena_t *arenas[HOST_ARENA_CACHE_SLOTS + 1U];
+    host_arena_stats_t stats;
+    host_arena_t *dead;
+    void *a;
+    void *b;
+    uint32_t i;
+    int round;
+
+    /* the cache of this thread still holds blocks of the destroyed arena */
+    dead = host_arena_create();
+    TEST_ASSERT(dead != NULL, "create");
+    host_arena_free(dead, host_arena_alloc(dead, 32U));
+    host_arena_destroy(dead);
+
+    /* the first and the last arena share a cache slot */
+    for (i = 0U; i <= HOST_ARENA_CACHE_SLOTS; i++) {
+        arenas[i] = host_arena_create();
+        TEST_ASSERT(arenas[i] != NULL, "create");
+    }
+    for (round = 0; round < 100; round++) {
+        a = host_arena_alloc(arenas[0], 48U);
+        b = host_arena_alloc(arenas[HOST_ARENA_CACHE_SLOTS], 48U);
+        TEST_ASSERT(a != NULL && b != NULL && a != b, "alloc from both");
+        host_arena_free(arenas[0], a);
+        host_arena_free(arenas[HOST_ARENA_CACHE_SLOTS], b);
+    }
+    host_arena_get_stats(arenas[0], &stats);
+    TEST_ASSERT(stats.objects == 0U, "first arena balanced");
+    host_arena_get_stats(arenas[HOST_ARENA_CACHE_SLOTS], &stats);
+    TEST_ASSERT(stats.objects == 0U, "last arena balanced");
+
+    for (i = 0U; i <= HOST_ARENA_CACHE_SLOTS; i++) {
+        host_arena_destroy(arenas[i]);
+    }
+    return 0;
+}
+
+static int test_loader_arena(void)
+{
+    test_arena_counters_t counters;
+    module_init_args_t init_args;
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+
+    memset(&counters, 0, sizeof(counters));
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.user_data = &counters;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "create");
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_arena.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load");
+    TEST_ASSERT(atomic_load(&counters.has_alloc) == 1, "arena offered without a pool");
+
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS, "stats");
+    TEST_ASSERT(stats.heap_objects == 51U, "leaked objects visible");
+    TEST_ASSERT(stats.heap_bytes == 50U * 128U + 10000U, "leaked bytes visible");
+    TEST_ASSERT(stats.heap_reserved_bytes >= stats.heap_bytes, "reserved");
+
+    /* the leak goes with the module */
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS, "stats");
+    TEST_ASSERT(stats.heap_objects == 0U && stats.heap_reserved_bytes == 0U,
+            "arena released at unload");
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_arena.so",
+            &init_args) == MODULE_ERR_SUCCESS, "reload");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS, "stats");
+    TEST_ASSERT(stats.heap_objects == 51U, "fresh arena per load");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+
+    module_loader_destroy(loader);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_sizes();
+    ret |= test_large();
+    ret |= test_threads();
+    ret |= test_cache_slots();
+    ret |= test_loader_arena();
+
+    if (ret == 0) {
+        printf("all host arena tests passed\n");
+    }
+
+    return ret;
+}
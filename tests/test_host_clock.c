@@ -0,0 +1,136 @@
+#include "../host_clock.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_READS 1000000
+#define TEST_THREADS 4
+/* fine clock against CLOCK_MONOTONIC_RAW, calibration error included */
+#define TEST_FINE_SLACK_NS 200000ULL
+/* a scheduler tick at HZ=100 */
+#define TEST_COARSE_SLACK_NS 10000000ULL
+#define TEST_SLEEP_US 100000U
+
+static uint64_t read_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t distance(uint64_t a, uint64_t b)
+{
+    return (a > b) ? a - b : b - a;
+}
+
+static int test_source(void)
+{
+    host_clock_source_t source = host_clock_source();
+
+    printf("clock source: %s, tsc %llu Hz\n", host_clock_source_name(source),
+            (unsigned long long)host_clock_tsc_hz());
+    TEST_ASSERT(host_clock_ops() == host_clock_ops(), "one table");
+    TEST_ASSERT((source == HOST_CLOCK_SOURCE_TSC) == (host_clock_tsc_hz() != 0U),
+            "frequency only for the tsc");
+    TEST_ASSERT(strcmp(host_clock_source_name(HOST_CLOCK_SOURCE_VDSO), "vdso") == 0, "name");
+    return 0;
+}
+
+static int test_agrees_with_kernel(void)
+{
+    const module_clock_ops_t *clock = host_clock_ops();
+    struct timespec ts;
+    uint64_t raw;
+    uint64_t fine;
+    uint64_t c0;
+    uint64_t c1;
+    uint64_t elapsed;
+
+    raw = read_ns(CLOCK_MONOTONIC_RAW);
+    fine = clock->now_ns();
+    TEST_ASSERT(distance(raw, fine) < TEST_FINE_SLACK_NS, "fine clock on the raw clock");
+    TEST_ASSERT(distance(read_ns(CLOCK_MONOTONIC_COARSE), clock->coarse_ns()) <
+            TEST_COARSE_SLACK_NS, "coarse clock");
+
+    c0 = clock->cycles();
+    fine = clock->now_ns();
+    usleep(TEST_SLEEP_US);
+    c1 = clock->cycles();
+    elapsed = clock->now_ns() - fine;
+    TEST_ASSERT(elapsed >= TEST_SLEEP_US * 1000ULL, "slept");
+    TEST_ASSERT(distance(clock->cycles_to_ns(c1 - c0), elapsed) < TEST_FINE_SLACK_NS,
+            "cycles convert to the same interval");
+
+    /* still on the raw clock after time has passed */
+    TEST_ASSERT(distance(read_ns(CLOCK_MONOTONIC_RAW), clock->now_ns()) < TEST_FINE_SLACK_NS,
+            "no drift over the interval");
+
+    TEST_ASSERT(host_clock_get_time(NULL) == -1, "null timespec");
+    TEST_ASSERT(host_clock_get_time(&ts) == 0, "get_time");
+    TEST_ASSERT(distance((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec,
+            read_ns(CLOCK_MONOTONIC)) < TEST_FINE_SLACK_NS, "get_time on CLOCK_MONOTONIC");
+    return 0;
+}
+
+static void *monotonic_reader(void *arg)
+{
+    const module_clock_ops_t *clock = host_clock_ops();
+    uint64_t prev = 0;
+    uint64_t now;
+    int i;
+
+    for (i = 0; i < TEST_READS; i++) {
+        now = clock->now_ns();
+        if (now < prev) {
+            *(int *)arg = 1;
+            break;
+        }
+        prev = now;
+    }
+    return NULL;
+}
+
+static int test_monotonic(void)
+{
+    pthread_t threads[TEST_THREADS];
+    int backwards[TEST_THREADS];
+    int i;
+
+    memset(backwards, 0, sizeof(backwards));
+    for (i = 0; i < TEST_THREADS; i++) {
+        TEST_ASSERT(pthread_create(&threads[i], NULL, monotonic_reader, &backwards[i]) == 0,
+                "thread");
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT(backwards[i] == 0, "fine clock never goes back");
+    }
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_source();
+    ret |= test_agrees_with_kernel();
+    ret |= test_monotonic();
+
+    if (ret == 0) {
+        printf("all host clock tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,371 @@
+#include "../host_pool.h"
+#include "../module_loader.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_THREADS 4U
+#define TEST_CAP 2U
+#define TEST_TASKS 200
+#define TEST_RANGE 100000U
+/* must match tests/fixtures/test_mod_pool.c */
+#define TEST_POOL_TASKS 64
+#define TEST_POOL_RANGE 1000L
+
+typedef struct {
+    atomic_int ran;
+    atomic_long range_sum;
+    atomic_int has_pool;
+} test_pool_counters_t;
+
+static atomic_int g_ran = ATOMIC_VAR_INIT(0);
+static atomic_int g_active = ATOMIC_VAR_INIT(0);
+static atomic_int g_max_active = ATOMIC_VAR_INIT(0);
+static atomic_bool g_release = ATOMIC_VAR_INIT(false);
+static atomic_long g_sum = ATOMIC_VAR_INIT(0);
+
+static void counting_task(void *arg)
+{
+    int active = atomic_fetch_add(&g_active, 1) + 1;
+    int max = atomic_load(&g_max_active);
+
+    (void)arg;
+    while (active > max && !atomic_compare_exchange_weak(&g_max_active, &max, active)) {
+    }
+    usleep(100);
+    atomic_fetch_sub(&g_active, 1);
+    atomic_fetch_add(&g_ran, 1);
+}
+
+static void blocking_task(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&g_release)) {
+        usleep(1000);
+    }
+    atomic_fetch_add(&g_ran, 1);
+}
+
+static void sum_range(void *arg, size_t begin, size_t end)
+{
+    long sum = 0;
+    size_t i;
+
+    (void)arg;
+    for (i = begin; i < end; i++) {
+        sum += (long)i;
+    }
+    atomic_fetch_add(&g_sum, sum);
+}
+
+static int test_submit_and_cap(void)
+{
+    host_pool_t *pool;
+    host_pool_client_t *client;
+    const module_pool_ops_t *ops;
+    host_pool_client_stats_t stats;
+    int i;
+
+    pool = host_pool_create(TEST_THREADS);
+    TEST_ASSERT(pool != NULL, "create pool");
+    TEST_ASSERT(host_pool_threads(pool) == TEST_THREADS, "thread count");
+
+    client = host_pool_client_create(pool, TEST_CAP);
+    TEST_ASSERT(client != NULL, "create client");
+    ops = host_pool_client_ops(client);
+    TEST_ASSERT(ops->concurrency(ops->ctx) == TEST_CAP, "concurrency reports the cap");
+
+    atomic_store(&g_ran, 0);
+    for (i = 0; i < TEST_TASKS; i++) {
+        TEST_ASSERT(ops->submit(ops->ctx, counting_task, NULL) == 0, "submit");
+    }
+    TEST_ASSERT(ops->submit(ops->ctx, NULL, NULL) == MODULE_ERR_INVALID_PARAM, "null task");
+
+    TEST_ASSERT(host_pool_client_close(client, 0U), "close waits for tasks");
+    host_pool_client_get_stats(client, &stats);
+    TEST_ASSERT(stats.submitted == (uint64_t)TEST_TASKS, "submitted counted");
+    TEST_ASSERT(stats.completed + stats.cancelled == (uint64_t)TEST_TASKS, "every task accounted");
+    TEST_ASSERT(atomic_load(&g_ran) == (int)stats.completed, "completed tasks ran");
+    TEST_ASSERT(atomic_load(&g_max_active) <= (int)TEST_CAP, "cap respected");
+    TEST_ASSERT(ops->submit(ops->ctx, counting_task, NULL) == MODULE_ERR_NOT_LOADED,
+            "closed client refuses work");
+
+    host_pool_client_destroy(client);
+    host_pool_destroy(pool);
+    return 0;
+}
+
+static int test_parallel_for(void)
+{
+    host_pool_t *pool;
+    host_pool_client_t *client;
+    const module_pool_ops_t *ops;
+    const long expected = (long)TEST_RANGE * ((long)TEST_RANGE - 1L) / 2L;
+
+    pool = host_pool_create(TEST_THREADS);
+    TEST_ASSERT(pool != NULL, "create pool");
+    client = host_pool_client_create(pool, 0U);
+    TEST_ASSERT(client != NULL, "create client");
+    ops = host_pool_client_ops(client);
+
+    atomic_store(&g_sum, 0);
+    TEST_ASSERT(ops->parallel_for(ops->ctx, TEST_RANGE, 0U, sum_range, NULL) == 0,
+            "parallel_for default grain");
+    TEST_ASSERT(atomic_load(&g_sum) == expected, "every index visited once");
+
+    atomic_store(&g_sum, 0);
+    TEST_ASSERT(ops->parallel_for(ops->ctx, TEST_RANGE, 7U, sum_range, NULL) == 0,
+            "parallel_for uneven grain");
+    TEST_ASSERT(atomic_load(&g_sum) == expected, "tail chunk covered");
+
+    TEST_ASSERT(ops->parallel_for(ops->ctx, 0U, 0U, sum_range, NULL) == 0, "empty range");
+
+    host_pool_client_close(client, 0U);
+    host_pool_client_destroy(client);
+    host_pool_destroy(pool);
+    return 0;
+}
+
+static int test_close_cancels_queued(void)
+{
+    host_pool_t *pool;
+    host_pool_client_t *client;
+    host_pool_client_t *other;
+    const module_pool_ops_t *ops;
+    host_pool_client_stats_t stats;
+    int i;
+
+    pool = host_pool_create(TEST_THREADS);
+    TEST_ASSERT(pool != NULL, "create pool");
+    client = host_pool_client_create(pool, 1U);
+    other = host_pool_client_create(pool, 0U);
+    TEST_ASSERT(client != NULL && other != NULL, "create clients");
+    ops = host_pool_client_ops(client);
+
+    atomic_store(&g_ran, 0);
+    atomic_store(&g_release, false);
+    TEST_ASSERT(ops->submit(ops->ctx, blocking_task, NULL) == 0, "submit blocker");
+    for (i = 0; i < 10; i++) {
+        TEST_ASSERT(ops->submit(ops->ctx, counting_task, NULL) == 0, "submit queued");
+    }
+
+    /* the cap keeps the queued tasks behind the blocker, a timed close gives up */
+    usleep(20000);
+    TEST_ASSERT(!host_pool_client_close(client, 50U), "close times out on a running task");
+    host_pool_client_get_stats(client, &stats);
+    TEST_ASSERT(stats.cancelled == 10U, "queued tasks dropped");
+    TEST_ASSERT(stats.running == 1U, "blocker still running");
+
+    /* other clients keep the remaining workers */
+    atomic_store(&g_sum, 0);
+    ops = host_pool_client_ops(other);
+    TEST_ASSERT(ops->parallel_for(ops->ctx, 1000U, 10U, sum_range, NULL) == 0,
+            "other client runs");
+    TEST_ASSERT(atomic_load(&g_sum) == 499500L, "other client result");
+
+    /* destroyed while the blocker runs, freed by the worker when it returns */
+    host_pool_client_destroy(client);
+    atomic_store(&g_release, true);
+    host_pool_client_close(other, 0U);
+    host_pool_client_destroy(other);
+    host_pool_destroy(pool);
+    TEST_ASSERT(atomic_load(&g_ran) == 1, "only the blocker ran");
+    return 0;
+}
+
+static void abandon_handler(int sig)
+{
+    (void)sig;
+    host_pool_abandon_task();
+}
+
+static void faulting_task(void *arg)
+{
+    (void)arg;
+    raise(SIGUSR1);
+    atomic_fetch_add(&g_ran, 1);
+}
+
+static int test_abandon_task(void)
+{
+    struct sigaction sa;
+    struct sigaction old_sa;
+    host_pool_t *pool;
+    host_pool_client_t *client;
+    const module_pool_ops_t *ops;
+    host_pool_client_stats_t stats;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = abandon_handler;
+    sigemptyset(&sa.sa_mask);
+    TEST_ASSERT(sigaction(SIGUSR1, &sa, &old_sa) == 0, "sigaction");
+
+    pool = host_pool_create(1U);
+    TEST_ASSERT(pool != NULL, "create pool");
+    client = host_pool_client_create(pool, 0U);
+    TEST_ASSERT(client != NULL, "create client");
+    ops = host_pool_client_ops(client);
+
+    /* outside a task the call returns */
+    host_pool_abandon_task();
+
+    atomic_store(&g_ran, 0);
+    TEST_ASSERT(ops->submit(ops->ctx, faulting_task, NULL) == 0, "submit faulting task");
+    TEST_ASSERT(ops->submit(ops->ctx, counting_task, NULL) == 0, "submit after it");
+    do {
+        usleep(1000);
+        host_pool_client_get_stats(client, &stats);
+    } while (stats.completed + stats.abandoned < 2U);
+    TEST_ASSERT(host_pool_client_close(client, 0U), "close");
+
+    TEST_ASSERT(stats.abandoned == 1U, "faulting task abandoned");
+    TEST_ASSERT(stats.completed == 1U, "worker survived");
+    TEST_ASSERT(atomic_load(&g_ran) == 1, "abandoned task did not continue");
+
+    host_pool_client_destroy(client);
+    host_pool_destroy(pool);
+    sigaction(SIGUSR1, &old_sa, NULL);
+    return 0;
+}
+
+static pthread_t g_pfor_caller;
+static atomic_bool g_pfor_faulted = ATOMIC_VAR_INIT(false);
+
+/* helpers fault, the caller holds its first chunk until one has */
+static void faulting_range(void *arg, size_t begin, size_t end)
+{
+    int waited;
+
+    (void)arg;
+    (void)end;
+    if (!pthread_equal(pthread_self(), g_pfor_caller)) {
+        atomic_store(&g_pfor_faulted, true);
+        raise(SIGUSR1);
+        return;
+    }
+    for (waited = 0; begin == 0U && !atomic_load(&g_pfor_faulted) && waited < 5000; waited++) {
+        usleep(1000);
+    }
+    atomic_fetch_add(&g_ran, 1);
+}
+
+static int test_parallel_for_fault(void)
+{
+    struct sigaction sa;
+    struct sigaction old_sa;
+    host_pool_t *pool;
+    host_pool_client_t *client;
+    const module_pool_ops_t *ops;
+    host_pool_client_stats_t stats;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = abandon_handler;
+    sigemptyset(&sa.sa_mask);
+    TEST_ASSERT(sigaction(SIGUSR1, &sa, &old_sa) == 0, "sigaction");
+
+    pool = host_pool_create(TEST_THREADS);
+    TEST_ASSERT(pool != NULL, "create pool");
+    client = host_pool_client_create(pool, 0U);
+    TEST_ASSERT(client != NULL, "create client");
+    ops = host_pool_client_ops(client);
+
+    /* before the fix the caller waited forever for the abandoned chunk */
+    g_pfor_caller = pthread_self();
+    atomic_store(&g_ran, 0);
+    TEST_ASSERT(ops->parallel_for(ops->ctx, 100U, 1U, faulting_range, NULL) ==
+            MODULE_ERR_CRASHED, "a faulted chunk should fail the call");
+    TEST_ASSERT(atomic_load(&g_pfor_faulted), "a helper should have faulted");
+    TEST_ASSERT(atomic_load(&g_ran) < 100, "no more chunks after the fault");
+
+    /* helpers that faulted are counted, the pool keeps working */
+    do {
+        usleep(1000);
+        host_pool_client_get_stats(client, &stats);
+    } while (stats.running != 0U);
+    TEST_ASSERT(stats.abandoned >= 1U, "faulted helper abandoned");
+    atomic_store(&g_sum, 0);
+    TEST_ASSERT(ops->parallel_for(ops->ctx, 1000U, 10U, sum_range, NULL) == 0,
+            "parallel_for after a fault");
+    TEST_ASSERT(atomic_load(&g_sum) == 999L * 1000L / 2L, "full sum after a fault");
+
+    TEST_ASSERT(host_pool_client_close(client, 0U), "close");
+    host_pool_client_destroy(client);
+    host_pool_destroy(pool);
+    sigaction(SIGUSR1, &old_sa, NULL);
+    return 0;
+}
+
+static int test_loader_pool(void)
+{
+    test_pool_counters_t counters;
+    module_init_args_t init_args;
+    module_loader_t *loader;
+    host_pool_t *pool;
+    int ran;
+
+    memset(&counters, 0, sizeof(counters));
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_1;
+    init_args.user_data = &counters;
+
+    pool = host_pool_create(TEST_THREADS);
+    loader = module_loader_create();
+    TEST_ASSERT(pool != NULL && loader != NULL, "create pool and loader");
+
+    /* no pool configured: v1 args pass through untouched */
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_pool.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load without pool");
+    TEST_ASSERT(atomic_load(&counters.has_pool) == 0, "no pool offered");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+
+    /* v1 caller args are upgraded, the module sees the pool */
+    TEST_ASSERT(module_loader_set_pool(loader, pool, TEST_CAP) == MODULE_ERR_SUCCESS,
+            "set pool");
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_pool.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load with pool");
+    TEST_ASSERT(atomic_load(&counters.has_pool) == 1, "pool offered");
+    TEST_ASSERT(atomic_load(&counters.range_sum) == TEST_POOL_RANGE * (TEST_POOL_RANGE - 1L) / 2L,
+            "module parallel_for");
+
+    /* unload drops the queued tasks and waits for the running ones */
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload with tasks queued");
+    ran = atomic_load(&counters.ran);
+    TEST_ASSERT(ran < TEST_POOL_TASKS, "queued tasks cancelled");
+    usleep(50000);
+    TEST_ASSERT(atomic_load(&counters.ran) == ran, "no task runs after unload");
+
+    module_loader_destroy(loader);
+    host_pool_destroy(pool);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_submit_and_cap();
+    ret |= test_parallel_for();
+    ret |= test_close_cancels_queued();
+    ret |= test_abandon_task();
+    ret |= test_parallel_for_fault();
+    ret |= test_loader_pool();
+
+    if (ret == 0) {
+        printf("all host pool tests passed\n");
+    }
+
+    return ret;
+}
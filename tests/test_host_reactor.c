@@ -0,0 +1,331 @@
+#include "../host_reactor.h"
+#include "../module_loader.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_THREADS 2U
+#define TEST_WAIT_MS 2000
+#define TEST_MANY_NOTIFY 1000
+
+typedef struct {
+    int fd;
+    atomic_int reads;
+    atomic_int has_reactor;
+} test_reactor_counters_t;
+
+typedef struct {
+    atomic_int calls;
+    atomic_int bytes;
+    atomic_uint events;
+} test_hits_t;
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+/* wait until counter reaches at least want, return the final value */
+static int wait_for(atomic_int *counter, int want)
+{
+    long long start = now_ms();
+
+    while (atomic_load(counter) < want && now_ms() - start < TEST_WAIT_MS) {
+        usleep(1000);
+    }
+    return atomic_load(counter);
+}
+
+static void drain(void *arg, int fd, uint32_t events)
+{
+    test_hits_t *hits = arg;
+    char buf[64];
+    ssize_t n;
+
+    atomic_fetch_or(&hits->events, events);
+    if ((events & MODULE_IO_READ) != 0U) {
+        n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            atomic_fetch_add(&hits->bytes, (int)n);
+        }
+    }
+    atomic_fetch_add(&hits->calls, 1);
+}
+
+static void count(void *arg, int fd, uint32_t events)
+{
+    test_hits_t *hits = arg;
+
+    (void)fd;
+    atomic_fetch_or(&hits->events, events);
+    atomic_fetch_add(&hits->calls, 1);
+}
+
+typedef struct {
+    host_pool_t *pool;
+    host_pool_client_t *pool_client;
+    host_reactor_t *reactor;
+    host_reactor_client_t *client;
+    const module_reactor_ops_t *ops;
+    int pipefd[2];
+} fixture_t;
+
+static int setup(fixture_t *f)
+{
+    f->pool = host_pool_create(TEST_THREADS);
+    f->reactor = host_reactor_create();
+    if (f->pool == NULL || f->reactor == NULL || pipe(f->pipefd) != 0) {
+        return -1;
+    }
+    fcntl(f->pipefd[0], F_SETFL, O_NONBLOCK);
+    f->pool_client = host_pool_client_create(f->pool, 0U);
+    f->client = host_reactor_client_create(f->reactor, f->pool_client);
+    if (f->client == NULL) {
+        return -1;
+    }
+    f->ops = host_reactor_client_ops(f->client);
+    return 0;
+}
+
+static void teardown(fixture_t *f)
+{
+    host_reactor_client_close(f->client);
+    host_pool_client_close(f->pool_client, 0U);
+    host_reactor_client_destroy(f->client);
+    host_pool_client_destroy(f->pool_client);
+    host_reactor_destroy(f->reactor);
+    host_pool_destroy(f->pool);
+    close(f->pipefd[0]);
+    close(f->pipefd[1]);
+}
+
+static int test_fd_readiness(void)
+{
+    fixture_t f;
+    test_hits_t hits;
+    int64_t id;
+    int i;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(&hits, 0, sizeof(hits));
+
+    TEST_ASSERT(f.ops->add(f.ops->ctx, f.pipefd[0], MODULE_IO_READ, NULL, NULL) ==
+            MODULE_ERR_INVALID_PARAM, "null callback");
+    TEST_ASSERT(f.ops->add(f.ops->ctx, -1, MODULE_IO_READ, drain, &hits) ==
+            MODULE_ERR_INVALID_PARAM, "bad fd");
+    id = f.ops->add(f.ops->ctx, f.pipefd[0], MODULE_IO_READ, drain, &hits);
+    TEST_ASSERT(id > 0, "add pipe");
+    TEST_ASSERT(f.ops->add(f.ops->ctx, f.pipefd[0], MODULE_IO_READ, drain, &hits) ==
+            MODULE_ERR_INVALID_PARAM, "same fd twice");
+
+    usleep(20000);
+    TEST_ASSERT(atomic_load(&hits.calls) == 0, "no callback before data");
+
+    /* the registration is re-armed after each callback */
+    for (i = 1; i <= 3; i++) {
+        TEST_ASSERT(write(f.pipefd[1], "x", 1) == 1, "write");
+        TEST_ASSERT(wait_for(&hits.bytes, i) == i, "byte delivered");
+    }
+    TEST_ASSERT((atomic_load(&hits.events) & MODULE_IO_READ) != 0U, "read event");
+
+    TEST_ASSERT(f.ops->remove(f.ops->ctx, id) == 0, "remove");
+    TEST_ASSERT(f.ops->remove(f.ops->ctx, id) == MODULE_ERR_INVALID_PARAM, "remove twice");
+    i = atomic_load(&hits.calls);
+    TEST_ASSERT(write(f.pipefd[1], "x", 1) == 1, "write after remove");
+    usleep(50000);
+    TEST_ASSERT(atomic_load(&hits.calls) == i, "no callback after remove");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_modify(void)
+{
+    fixture_t f;
+    test_hits_t hits;
+    int64_t id;
+    int n;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(&hits, 0, sizeof(hits));
+
+    /* the write end of an empty pipe is always writable */
+    id = f.ops->add(f.ops->ctx, f.pipefd[1], 0U, count, &hits);
+    TEST_ASSERT(id > 0, "add without events");
+    usleep(20000);
+    TEST_ASSERT(atomic_load(&hits.calls) == 0, "nothing requested");
+
+    TEST_ASSERT(f.ops->modify(f.ops->ctx, id, MODULE_IO_WRITE) == 0, "modify to write");
+    TEST_ASSERT(wait_for(&hits.calls, 1) >= 1, "writable");
+    TEST_ASSERT((atomic_load(&hits.events) & MODULE_IO_WRITE) != 0U, "write event");
+
+    TEST_ASSERT(f.ops->modify(f.ops->ctx, id, 0U) == 0, "modify to none");
+    usleep(20000);
+    n = atomic_load(&hits.calls);
+    usleep(50000);
+    TEST_ASSERT(atomic_load(&hits.calls) == n, "quiet after modify");
+    TEST_ASSERT(f.ops->modify(f.ops->ctx, id, 0x80U) == MODULE_ERR_INVALID_PARAM,
+            "unknown event bit");
+    TEST_ASSERT(f.ops->modify(f.ops->ctx, id + 1, MODULE_IO_READ) ==
+            MODULE_ERR_INVALID_PARAM, "unknown id");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_events(void)
+{
+    fixture_t f;
+    test_hits_t hits;
+    int64_t id;
+    int i;
+    int n;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(&hits, 0, sizeof(hits));
+
+    id = f.ops->add_event(f.ops->ctx, count, &hits);
+    TEST_ASSERT(id > 0, "add event");
+    TEST_ASSERT(f.ops->modify(f.ops->ctx, id, MODULE_IO_WRITE) == MODULE_ERR_INVALID_PARAM,
+            "event source cannot be modified");
+
+    TEST_ASSERT(f.ops->notify(f.ops->ctx, id) == 0, "notify");
+    TEST_ASSERT(wait_for(&hits.calls, 1) == 1, "notified once");
+
+    /* notifications while a callback is pending are merged */
+    for (i = 0; i < TEST_MANY_NOTIFY; i++) {
+        TEST_ASSERT(f.ops->notify(f.ops->ctx, id) == 0, "notify many");
+    }
+    n = wait_for(&hits.calls, 2);
+    TEST_ASSERT(n >= 2 && n <= TEST_MANY_NOTIFY + 1, "merged notifications");
+    usleep(20000);
+    n = atomic_load(&hits.calls);
+    usleep(30000);
+    TEST_ASSERT(atomic_load(&hits.calls) == n, "counter was reset");
+
+    TEST_ASSERT(f.ops->remove(f.ops->ctx, id) == 0, "remove event");
+    TEST_ASSERT(f.ops->notify(f.ops->ctx, id) == MODULE_ERR_INVALID_PARAM,
+            "notify removed event");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_close_removes(void)
+{
+    fixture_t f;
+    test_hits_t hits;
+    host_reactor_stats_t stats;
+    int i;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(&hits, 0, sizeof(hits));
+
+    for (i = 0; i < 8; i++) {
+        TEST_ASSERT(f.ops->add_event(f.ops->ctx, count, &hits) > 0, "add event");
+    }
+    TEST_ASSERT(f.ops->add(f.ops->ctx, f.pipefd[0], MODULE_IO_READ, drain, &hits) > 0,
+            "add pipe");
+    host_reactor_get_stats(f.reactor, &stats);
+    TEST_ASSERT(stats.registered == 9U, "registered");
+
+    host_reactor_client_close(f.client);
+    host_reactor_get_stats(f.reactor, &stats);
+    TEST_ASSERT(stats.registered == 0U, "close removes every registration");
+    TEST_ASSERT(f.ops->add_event(f.ops->ctx, count, &hits) == MODULE_ERR_NOT_LOADED,
+            "add after close");
+
+    TEST_ASSERT(write(f.pipefd[1], "x", 1) == 1, "write after close");
+    usleep(50000);
+    TEST_ASSERT(atomic_load(&hits.calls) == 0, "no callback after close");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_loader_reactor(void)
+{
+    test_reactor_counters_t counters;
+    module_init_args_t init_args;
+    host_reactor_stats_t stats;
+    module_loader_t *loader;
+    host_pool_t *pool;
+    host_reactor_t *reactor;
+    int pipefd[2];
+    int reads;
+
+    TEST_ASSERT(pipe(pipefd) == 0, "pipe");
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+    memset(&counters, 0, sizeof(counters));
+    counters.fd = pipefd[0];
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.user_data = &counters;
+
+    pool = host_pool_create(TEST_THREADS);
+    reactor = host_reactor_create();
+    loader = module_loader_create();
+    TEST_ASSERT(pool != NULL && reactor != NULL && loader != NULL, "create");
+
+    /* callbacks need the pool to run on */
+    module_loader_set_reactor(loader, reactor);
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_reactor.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load without pool");
+    TEST_ASSERT(atomic_load(&counters.has_reactor) == 0, "no reactor without pool");
+    module_loader_unload(loader);
+
+    module_loader_set_pool(loader, pool, 2U);
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_reactor.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load with reactor");
+    TEST_ASSERT(atomic_load(&counters.has_reactor) == 1, "reactor offered");
+    TEST_ASSERT(write(pipefd[1], "x", 1) == 1, "write");
+    TEST_ASSERT(wait_for(&counters.reads, 1) == 1, "module callback runs");
+
+    /* the module never removes its fd, unload does */
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+    host_reactor_get_stats(reactor, &stats);
+    TEST_ASSERT(stats.registered == 0U, "nothing left registered");
+    reads = atomic_load(&counters.reads);
+    TEST_ASSERT(write(pipefd[1], "x", 1) == 1, "write after unload");
+    usleep(50000);
+    TEST_ASSERT(atomic_load(&counters.reads) == reads, "no callback after unload");
+
+    module_loader_destroy(loader);
+    host_reactor_destroy(reactor);
+    host_pool_destroy(pool);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_fd_readiness();
+    ret |= test_modify();
+    ret |= test_events();
+    ret |= test_close_removes();
+    ret |= test_loader_reactor();
+
+    if (ret == 0) {
+        printf("all host reactor tests passed\n");
+    }
+
+    return ret;
+}
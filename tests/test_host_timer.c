@@ -0,0 +1,272 @@
+#include "../host_timer.h"
+#include "../module_loader.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_THREADS 2U
+#define TEST_MANY_TIMERS 5000
+#define TEST_MANY_SPREAD_MS 200U
+
+typedef struct {
+    atomic_int ticks;
+    atomic_int has_timers;
+} test_timer_counters_t;
+
+typedef struct {
+    atomic_int fired;
+    atomic_llong fired_ms;
+} test_hits_t;
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+static void hit(void *arg)
+{
+    test_hits_t *hits = arg;
+
+    atomic_store(&hits->fired_ms, now_ms());
+    atomic_fetch_add(&hits->fired, 1);
+}
+
+typedef struct {
+    host_pool_t *pool;
+    host_pool_client_t *pool_client;
+    host_timer_wheel_t *wheel;
+    host_timer_client_t *client;
+    const module_timer_ops_t *ops;
+} fixture_t;
+
+static int setup(fixture_t *f)
+{
+    f->pool = host_pool_create(TEST_THREADS);
+    f->wheel = host_timer_wheel_create();
+    if (f->pool == NULL || f->wheel == NULL) {
+        return -1;
+    }
+    f->pool_client = host_pool_client_create(f->pool, 0U);
+    f->client = host_timer_client_create(f->wheel, f->pool_client);
+    if (f->client == NULL) {
+        return -1;
+    }
+    f->ops = host_timer_client_ops(f->client);
+    return 0;
+}
+
+static void teardown(fixture_t *f)
+{
+    host_timer_client_close(f->client);
+    host_pool_client_close(f->pool_client, 0U);
+    host_timer_client_destroy(f->client);
+    host_pool_client_destroy(f->pool_client);
+    host_timer_wheel_destroy(f->wheel);
+    host_pool_destroy(f->pool);
+}
+
+static int test_one_shot_and_periodic(void)
+{
+    fixture_t f;
+    test_hits_t once;
+    test_hits_t periodic;
+    test_hits_t cancelled;
+    long long start;
+    int64_t id;
+    int n;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(&once, 0, sizeof(once));
+    memset(&periodic, 0, sizeof(periodic));
+    memset(&cancelled, 0, sizeof(cancelled));
+
+    start = now_ms();
+    TEST_ASSERT(f.ops->start(f.ops->ctx, 20U, 0U, hit, &once) > 0, "start one-shot");
+    id = f.ops->start(f.ops->ctx, 10U, 10U, hit, &periodic);
+    TEST_ASSERT(id > 0, "start periodic");
+    TEST_ASSERT(f.ops->start(f.ops->ctx, 10U, 0U, NULL, NULL) == MODULE_ERR_INVALID_PARAM,
+            "null callback");
+
+    usleep(150000);
+    TEST_ASSERT(atomic_load(&once.fired) == 1, "one-shot fired once");
+    TEST_ASSERT(atomic_load(&once.fired_ms) - start >= 20, "one-shot not early");
+    n = atomic_load(&periodic.fired);
+    TEST_ASSERT(n >= 5 && n <= 15, "periodic fires every period");
+
+    TEST_ASSERT(f.ops->cancel(f.ops->ctx, id) == 0, "cancel periodic");
+    TEST_ASSERT(f.ops->cancel(f.ops->ctx, id) == MODULE_ERR_INVALID_PARAM, "cancel twice");
+    usleep(20000);
+    n = atomic_load(&periodic.fired);
+    usleep(50000);
+    TEST_ASSERT(atomic_load(&periodic.fired) == n, "periodic stopped");
+
+    id = f.ops->start(f.ops->ctx, 30U, 0U, hit, &cancelled);
+    TEST_ASSERT(f.ops->cancel(f.ops->ctx, id) == 0, "cancel one-shot");
+    usleep(60000);
+    TEST_ASSERT(atomic_load(&cancelled.fired) == 0, "cancelled one-shot never fires");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_cascade(void)
+{
+    fixture_t f;
+    test_hits_t hits;
+    long long start;
+    long long late;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(&hits, 0, sizeof(hits));
+
+    /* past the first level, the timer moves down one level before firing */
+    start = now_ms();
+    TEST_ASSERT(f.ops->start(f.ops->ctx, 300U, 0U, hit, &hits) > 0, "start");
+    while (atomic_load(&hits.fired) == 0 && now_ms() - start < 2000) {
+        usleep(5000);
+    }
+    TEST_ASSERT(atomic_load(&hits.fired) == 1, "cascaded timer fired");
+    late = atomic_load(&hits.fired_ms) - start;
+    TEST_ASSERT(late >= 300 && late < 600, "cascaded timer on time");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_many_timers(void)
+{
+    static test_hits_t hits[TEST_MANY_TIMERS];
+    host_timer_stats_t stats;
+    fixture_t f;
+    long long start;
+    int fired;
+    int i;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(hits, 0, sizeof(hits));
+
+    for (i = 0; i < TEST_MANY_TIMERS; i++) {
+        TEST_ASSERT(f.ops->start(f.ops->ctx, (uint32_t)i % TEST_MANY_SPREAD_MS, 0U, hit,
+                &hits[i]) > 0, "start");
+    }
+
+    start = now_ms();
+    do {
+        usleep(10000);
+        fired = 0;
+        for (i = 0; i < TEST_MANY_TIMERS; i++) {
+            fired += atomic_load(&hits[i].fired);
+        }
+    } while (fired < TEST_MANY_TIMERS && now_ms() - start < 5000);
+    TEST_ASSERT(fired == TEST_MANY_TIMERS, "every timer fired once");
+
+    host_timer_wheel_get_stats(f.wheel, &stats);
+    TEST_ASSERT(stats.started == (uint64_t)TEST_MANY_TIMERS, "started counted");
+    TEST_ASSERT(stats.fired == (uint64_t)TEST_MANY_TIMERS, "fired counted");
+    TEST_ASSERT(stats.armed == 0U, "nothing armed");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_close_cancels(void)
+{
+    fixture_t f;
+    test_hits_t hits;
+    int64_t id;
+    int i;
+
+    TEST_ASSERT(setup(&f) == 0, "setup");
+    memset(&hits, 0, sizeof(hits));
+
+    for (i = 0; i < 100; i++) {
+        id = f.ops->start(f.ops->ctx, 20U + (uint32_t)i, 5U, hit, &hits);
+        TEST_ASSERT(id > 0, "start");
+    }
+    host_timer_client_close(f.client);
+    TEST_ASSERT(f.ops->start(f.ops->ctx, 1U, 0U, hit, &hits) == MODULE_ERR_NOT_LOADED,
+            "closed client refuses timers");
+    TEST_ASSERT(f.ops->cancel(f.ops->ctx, id) == MODULE_ERR_INVALID_PARAM,
+            "closed timers are gone");
+    usleep(200000);
+    TEST_ASSERT(atomic_load(&hits.fired) == 0, "no timer fires after close");
+
+    teardown(&f);
+    return 0;
+}
+
+static int test_loader_timers(void)
+{
+    test_timer_counters_t counters;
+    module_init_args_t init_args;
+    module_loader_t *loader;
+    host_pool_t *pool;
+    host_timer_wheel_t *wheel;
+    int ticks;
+
+    memset(&counters, 0, sizeof(counters));
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.user_data = &counters;
+
+    pool = host_pool_create(TEST_THREADS);
+    wheel = host_timer_wheel_create();
+    loader = module_loader_create();
+    TEST_ASSERT(pool != NULL && wheel != NULL && loader != NULL, "create");
+
+    /* timers need the pool to run on */
+    module_loader_set_timers(loader, wheel);
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_timer.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load without pool");
+    TEST_ASSERT(atomic_load(&counters.has_timers) == 0, "no timers without pool");
+    module_loader_unload(loader);
+
+    module_loader_set_pool(loader, pool, 2U);
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_timer.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load with timers");
+    TEST_ASSERT(atomic_load(&counters.has_timers) == 1, "timers offered");
+    usleep(100000);
+    TEST_ASSERT(atomic_load(&counters.ticks) > 0, "module timer ticks");
+
+    /* the module never cancels its timer, unload does */
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+    ticks = atomic_load(&counters.ticks);
+    usleep(50000);
+    TEST_ASSERT(atomic_load(&counters.ticks) == ticks, "no tick after unload");
+
+    module_loader_destroy(loader);
+    host_timer_wheel_destroy(wheel);
+    host_pool_destroy(pool);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_one_shot_and_periodic();
+    ret |= test_cascade();
+    ret |= test_many_timers();
+    ret |= test_close_cancels();
+    ret |= test_loader_timers();
+
+    if (ret == 0) {
+        printf("all host timer tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,228 @@
+#include "../image_cache.h"
+#include "../module_loader.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_FIXTURE "tests/fixtures/test_mod_cache.so"
+#define TEST_COPIES 2
+
+static char g_dir[] = "/tmp/kmodlike_image_cache_XXXXXX";
+/* private copies, the test rewrites them */
+static char g_paths[TEST_COPIES][64];
+
+static int copy_file(const char *from, const char *to)
+{
+    char buf[4096];
+    FILE *in;
+    FILE *out;
+    size_t n;
+
+    in = fopen(from, "rb");
+    if (in == NULL) {
+        return -1;
+    }
+    out = fopen(to, "wb");
+    if (out == NULL) {
+        fclose(in);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0U) {
+        fwrite(buf, 1, n, out);
+    }
+    fclose(in);
+    return fclose(out);
+}
+
+static int setup_copies(void)
+{
+    int i;
+
+    if (mkdtemp(g_dir) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < TEST_COPIES; i++) {
+        snprintf(g_paths[i], sizeof(g_paths[i]), "%s/mod%d.so", g_dir, i);
+        if (copy_file(TEST_FIXTURE, g_paths[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void remove_copies(void)
+{
+    int i;
+
+    for (i = 0; i < TEST_COPIES; i++) {
+        unlink(g_paths[i]);
+    }
+    rmdir(g_dir);
+}
+
+/* value of an int (*)(void) export of the loaded module, -1 on error */
+static int call_int(module_loader_t *loader, const char *name)
+{
+    int (*fn)(void);
+    void *symbol = NULL;
+    int value;
+
+    if (module_loader_get_symbol(loader, name, &symbol) != MODULE_ERR_SUCCESS) {
+        return -1;
+    }
+    *(void **)&fn = symbol;
+    value = fn();
+    module_loader_put_ref(loader);
+    return value;
+}
+
+static int test_disabled(void)
+{
+    image_cache_stats_t stats;
+    module_loader_t *loader;
+
+    image_cache_set_capacity(0U);
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    TEST_ASSERT(module_loader_load(loader, g_paths[0], NULL) == MODULE_ERR_SUCCESS,
+            "load should succeed");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+    TEST_ASSERT(module_loader_load(loader, g_paths[0], NULL) == MODULE_ERR_SUCCESS,
+            "reload should succeed");
+    TEST_ASSERT(call_int(loader, "cache_inits") == 1, "without the cache reload starts fresh");
+    module_loader_destroy(loader);
+
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.hits == 0U && stats.misses == 0U && stats.entries == 0U,
+            "a disabled cache counts nothing");
+    return 0;
+}
+
+static int test_hit_and_changed_file(void)
+{
+    image_cache_stats_t stats;
+    module_loader_t *loader;
+    struct timespec times[2];
+
+    image_cache_set_capacity(4U);
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+
+    TEST_ASSERT(module_loader_load(loader, g_paths[0], NULL) == MODULE_ERR_SUCCESS,
+            "load should succeed");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.misses == 1U && stats.entries == 1U && stats.bytes > 0U,
+            "unload should keep the image");
+
+    TEST_ASSERT(module_loader_load(loader, g_paths[0], NULL) == MODULE_ERR_SUCCESS,
+            "reload should succeed");
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.hits == 1U && stats.entries == 0U && stats.bytes == 0U,
+            "reload should take the cached image");
+    TEST_ASSERT(call_int(loader, "cache_constructed") == 1, "no second dlopen");
+    TEST_ASSERT(call_int(loader, "cache_inits") == 2, "module_init runs again");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+
+    /* same contents, new mtime: a changed file must not hit */
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = 1000000000;
+    times[1].tv_nsec = 0;
+    TEST_ASSERT(utimensat(AT_FDCWD, g_paths[0], times, 0) == 0, "touch should succeed");
+    TEST_ASSERT(module_loader_load(loader, g_paths[0], NULL) == MODULE_ERR_SUCCESS,
+            "load of the changed file should succeed");
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.hits == 1U && stats.misses == 2U, "a changed file should miss");
+    TEST_ASSERT(stats.evictions == 1U && stats.entries == 0U,
+            "the stale image should be closed");
+    TEST_ASSERT(call_int(loader, "cache_inits") == 1, "the changed file starts fresh");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+
+    /* an image bound lazily is not handed to a loader that wants RTLD_NOW */
+    TEST_ASSERT(module_loader_set_load_flags(loader, MODULE_LOAD_BIND_NOW) == MODULE_ERR_SUCCESS,
+            "set_load_flags should succeed");
+    TEST_ASSERT(module_loader_load(loader, g_paths[0], NULL) == MODULE_ERR_SUCCESS,
+            "load with another mode should succeed");
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.hits == 1U && stats.misses == 3U && stats.evictions == 2U,
+            "another mode should miss and close the old image");
+    TEST_ASSERT(call_int(loader, "cache_inits") == 1, "the new mode starts fresh");
+
+    module_loader_destroy(loader);
+    image_cache_set_capacity(0U);
+    return 0;
+}
+
+static int test_bound_and_crash(void)
+{
+    image_cache_stats_t stats;
+    module_loader_t *a;
+    module_loader_t *b;
+
+    image_cache_set_capacity(1U);
+    a = module_loader_create();
+    b = module_loader_create();
+    TEST_ASSERT(a != NULL && b != NULL, "loaders should be created");
+    TEST_ASSERT(module_loader_load(a, g_paths[0], NULL) == MODULE_ERR_SUCCESS, "load a");
+    TEST_ASSERT(module_loader_load(b, g_paths[1], NULL) == MODULE_ERR_SUCCESS, "load b");
+    TEST_ASSERT(module_loader_unload(a) == MODULE_ERR_SUCCESS, "unload a");
+    TEST_ASSERT(module_loader_unload(b) == MODULE_ERR_SUCCESS, "unload b");
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.entries == 1U && stats.capacity == 1U, "capacity bounds the cache");
+
+    /* the oldest went first */
+    TEST_ASSERT(module_loader_load(b, g_paths[1], NULL) == MODULE_ERR_SUCCESS, "reload b");
+    TEST_ASSERT(call_int(b, "cache_inits") == 2, "the newest image was kept");
+
+    /* a crashed image is never cached */
+    TEST_ASSERT(module_loader_signal_crash(b), "crash should be flagged");
+    module_loader_mark_crashed(b);
+    TEST_ASSERT(module_loader_unload(b) == MODULE_ERR_SUCCESS, "unload after crash");
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.entries == 0U, "crashed image should be closed");
+
+    TEST_ASSERT(module_loader_load(a, g_paths[0], NULL) == MODULE_ERR_SUCCESS, "reload a");
+    TEST_ASSERT(module_loader_unload(a) == MODULE_ERR_SUCCESS, "unload a");
+    image_cache_set_capacity(0U);
+    image_cache_get_stats(&stats);
+    TEST_ASSERT(stats.entries == 0U && stats.bytes == 0U, "disabling closes every image");
+
+    module_loader_destroy(a);
+    module_loader_destroy(b);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    if (setup_copies() != 0) {
+        fprintf(stderr, "test failed: cannot copy %s\n", TEST_FIXTURE);
+        remove_copies();
+        return 1;
+    }
+
+    ret |= test_disabled();
+    ret |= test_hit_and_changed_file();
+    ret |= test_bound_and_crash();
+
+    remove_copies();
+    if (ret == 0) {
+        printf("all image cache tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,219 @@
+#include "../module_loader.h"
+#include "../module_interface.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_FIXTURE "tests/fixtures/test_mod_lazy.so"
+#define TEST_THREADS 8
+
+/* same layout as in tests/fixtures/test_mod_lazy.c */
+typedef struct {
+    atomic_int inits;
+} test_lazy_counters_t;
+
+static void init_args_for(module_init_args_t *args, test_lazy_counters_t *counters)
+{
+    memset(args, 0, sizeof(*args));
+    args->version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    args->user_data = counters;
+}
+
+static int test_register_defers_load(void)
+{
+    test_lazy_counters_t counters = {0};
+    module_loader_stats_t stats;
+    module_init_args_t args;
+    module_loader_t *loader;
+    int (*answer)(void);
+    void *symbol = NULL;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    init_args_for(&args, &counters);
+
+    TEST_ASSERT(module_loader_register_lazy(loader, TEST_FIXTURE, &args) == MODULE_ERR_SUCCESS,
+            "register should succeed");
+    /* the args are copied, the caller's struct may go away */
+    memset(&args, 0, sizeof(args));
+    TEST_ASSERT(module_loader_is_lazy(loader), "loader should be lazy");
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_UNLOADED,
+            "register should not load");
+    TEST_ASSERT(atomic_load(&counters.inits) == 0, "module_init should not run yet");
+    module_loader_get_stats(loader, &stats);
+    TEST_ASSERT(strcmp(stats.path, TEST_FIXTURE) == 0, "stats should show the path");
+
+    TEST_ASSERT(module_loader_get_symbol(loader, "lazy_answer", &symbol) == MODULE_ERR_SUCCESS,
+            "first get_symbol should load");
+    *(void **)&answer = symbol;
+    TEST_ASSERT(answer() == 42, "symbol should be callable");
+    TEST_ASSERT(atomic_load(&counters.inits) == 1, "module_init should run once");
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_LOADED, "module should be loaded");
+    TEST_ASSERT(module_loader_is_lazy(loader), "registration stays while loaded");
+    module_loader_put_ref(loader);
+
+    TEST_ASSERT(module_loader_get_ref(loader) == MODULE_ERR_SUCCESS, "get_ref should work");
+    module_loader_put_ref(loader);
+    TEST_ASSERT(atomic_load(&counters.inits) == 1, "later users should not reload");
+    TEST_ASSERT(module_loader_register_lazy(loader, TEST_FIXTURE, NULL) ==
+            MODULE_ERR_ALREADY_LOADED, "register should refuse a loaded module");
+
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+    TEST_ASSERT(!module_loader_is_lazy(loader), "unload should drop the registration");
+    TEST_ASSERT(module_loader_get_ref(loader) == MODULE_ERR_NOT_LOADED,
+            "no lazy load after unload");
+    TEST_ASSERT(atomic_load(&counters.inits) == 1, "no init after unload");
+
+    module_loader_destroy(loader);
+    return 0;
+}
+
+typedef struct {
+    module_loader_t *loader;
+    pthread_barrier_t *barrier;
+    module_error_t err;
+} first_user_t;
+
+static void *first_user(void *arg)
+{
+    first_user_t *user = arg;
+
+    pthread_barrier_wait(user->barrier);
+    user->err = module_loader_get_ref(user->loader);
+    return NULL;
+}
+
+static int test_concurrent_first_use(void)
+{
+    test_lazy_counters_t counters = {0};
+    pthread_t threads[TEST_THREADS];
+    first_user_t users[TEST_THREADS];
+    module_loader_stats_t stats;
+    pthread_barrier_t barrier;
+    module_init_args_t args;
+    module_loader_t *loader;
+    int i;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    init_args_for(&args, &counters);
+    TEST_ASSERT(module_loader_register_lazy(loader, TEST_FIXTURE, &args) == MODULE_ERR_SUCCESS,
+            "register should succeed");
+
+    pthread_barrier_init(&barrier, NULL, TEST_THREADS);
+    for (i = 0; i < TEST_THREADS; i++) {
+        users[i].loader = loader;
+        users[i].barrier = &barrier;
+        users[i].err = MODULE_ERR_INVALID_PARAM;
+        pthread_create(&threads[i], NULL, first_user, &users[i]);
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        TEST_ASSERT(users[i].err == MODULE_ERR_SUCCESS, "every first user should succeed");
+    }
+    TEST_ASSERT(atomic_load(&counters.inits) == 1, "concurrent first users share one load");
+    module_loader_get_stats(loader, &stats);
+    TEST_ASSERT(stats.load_count == 1U, "one load expected");
+    TEST_ASSERT(stats.ref_count == TEST_THREADS, "every user should hold a reference");
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        module_loader_put_ref(loader);
+    }
+    module_loader_unload(loader);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_call_hello_and_unused(void)
+{
+    test_lazy_counters_t counters = {0};
+    module_init_args_t args;
+    module_loader_t *loader;
+    module_symbol_t sym;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    init_args_for(&args, &counters);
+
+    TEST_ASSERT(module_loader_register_lazy(loader, TEST_FIXTURE, &args) == MODULE_ERR_SUCCESS,
+            "register should succeed");
+    TEST_ASSERT(module_loader_call_hello(loader) == MODULE_ERR_SUCCESS,
+            "first call_hello should load");
+    TEST_ASSERT(atomic_load(&counters.inits) == 1, "call_hello should load once");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+
+    TEST_ASSERT(module_loader_register_lazy(loader, TEST_FIXTURE, &args) == MODULE_ERR_SUCCESS,
+            "register again should succeed");
+    TEST_ASSERT(module_loader_resolve(loader, "lazy_answer", &sym) == MODULE_ERR_SUCCESS,
+            "resolve should load");
+    TEST_ASSERT(atomic_load(&counters.inits) == 2, "resolve should load once");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+
+    /* never used: unload only drops the registration */
+    TEST_ASSERT(module_loader_register_lazy(loader, TEST_FIXTURE, &args) == MODULE_ERR_SUCCESS,
+            "register again should succeed");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS,
+            "unload of an unused registration should succeed");
+    TEST_ASSERT(atomic_load(&counters.inits) == 2, "unused module should never init");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_NOT_LOADED,
+            "nothing left to unload");
+
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_failed_lazy_load(void)
+{
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+    void *symbol = NULL;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    TEST_ASSERT(module_loader_register_lazy(loader, NULL, NULL) == MODULE_ERR_INVALID_PARAM,
+            "NULL path should be rejected");
+    TEST_ASSERT(module_loader_register_lazy(loader, "tests/fixtures/nonexistent.so", NULL) ==
+            MODULE_ERR_SUCCESS, "register does not touch the file");
+
+    TEST_ASSERT(module_loader_get_symbol(loader, "lazy_answer", &symbol) ==
+            MODULE_ERR_NOT_LOADED, "failed lazy load should fail the user");
+    TEST_ASSERT(module_loader_get_ref(loader) == MODULE_ERR_NOT_LOADED,
+            "next user should retry and fail");
+    module_loader_get_stats(loader, &stats);
+    TEST_ASSERT(stats.load_failures == 2U, "each use should retry the load");
+    TEST_ASSERT(module_loader_is_lazy(loader), "registration survives a failed load");
+
+    module_loader_unload(loader);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_register_defers_load();
+    ret |= test_concurrent_first_use();
+    ret |= test_call_hello_and_unused();
+    ret |= test_failed_lazy_load();
+
+    if (ret == 0) {
+        printf("all lazy load tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,122 @@
+#include "../lock_prof.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define UNCONTENDED_ITERATIONS 1000U
+#define HOLD_SLEEP_US 50000U
+
+static lock_prof_mutex_t g_lock = LOCK_PROF_MUTEX_INITIALIZER;
+
+static uint64_t bucket_sum(const lock_prof_hist_t *h)
+{
+    uint64_t sum = 0U;
+    uint32_t i;
+
+    for (i = 0U; i < LOCK_PROF_BUCKETS; i++) {
+        sum += h->buckets[i];
+    }
+    return sum;
+}
+
+static int test_uncontended(void)
+{
+    lock_prof_site_stats_t st;
+    uint32_t i;
+
+    lock_prof_reset();
+    for (i = 0U; i < UNCONTENDED_ITERATIONS; i++) {
+        lock_prof_lock(&g_lock, LOCK_SITE_LOADER_CALL);
+        lock_prof_unlock(&g_lock);
+    }
+
+    TEST_ASSERT(lock_prof_read(LOCK_SITE_LOADER_CALL, &st) == 0, "read site");
+    TEST_ASSERT(st.acquisitions == UNCONTENDED_ITERATIONS, "acquisitions");
+    TEST_ASSERT(st.contended == 0U, "no contention");
+    TEST_ASSERT(st.wait.buckets[0] == UNCONTENDED_ITERATIONS, "zero wait");
+    TEST_ASSERT(bucket_sum(&st.hold) == UNCONTENDED_ITERATIONS, "hold samples");
+
+    return 0;
+}
+
+static void *contender_thread(void *arg)
+{
+    (void)arg;
+
+    lock_prof_lock(&g_lock, LOCK_SITE_LOADER_UNLOAD);
+    lock_prof_unlock(&g_lock);
+    return NULL;
+}
+
+static int test_contended(void)
+{
+    lock_prof_site_stats_t holder;
+    lock_prof_site_stats_t waiter;
+    pthread_t thread;
+
+    lock_prof_reset();
+
+    lock_prof_lock(&g_lock, LOCK_SITE_LOADER_LOAD);
+    TEST_ASSERT(pthread_create(&thread, NULL, contender_thread, NULL) == 0,
+            "pthread_create");
+    usleep(HOLD_SLEEP_US);
+    lock_prof_unlock(&g_lock);
+    pthread_join(thread, NULL);
+
+    lock_prof_read(LOCK_SITE_LOADER_LOAD, &holder);
+    lock_prof_read(LOCK_SITE_LOADER_UNLOAD, &waiter);
+
+    TEST_ASSERT(holder.acquisitions == 1U && holder.contended == 0U, "holder counters");
+    TEST_ASSERT(holder.hold.max_ns >= HOLD_SLEEP_US * 1000ULL, "hold time charged to holder");
+    TEST_ASSERT(waiter.acquisitions == 1U && waiter.contended == 1U, "waiter contended");
+    TEST_ASSERT(waiter.wait.max_ns >= 1000000ULL, "waiter wait time");
+
+    return 0;
+}
+
+static int test_runtime_disable(void)
+{
+    lock_prof_site_stats_t st;
+
+    TEST_ASSERT(lock_prof_is_compiled(), "built with KMODLIKE_LOCK_PROFILING");
+
+    lock_prof_reset();
+    lock_prof_set_enabled(false);
+    lock_prof_lock(&g_lock, LOCK_SITE_RPC_DISPATCH);
+    /* re-enabled while held: the hold must not be charged */
+    lock_prof_set_enabled(true);
+    lock_prof_unlock(&g_lock);
+
+    lock_prof_read(LOCK_SITE_RPC_DISPATCH, &st);
+    TEST_ASSERT(st.acquisitions == 0U, "disabled acquisitions not recorded");
+    TEST_ASSERT(bucket_sum(&st.hold) == 0U, "disabled hold not recorded");
+    TEST_ASSERT(strcmp(lock_prof_site_name(LOCK_SITE_RPC_DISPATCH), "rpc.dispatch") == 0,
+            "site name");
+
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_uncontended();
+    ret |= test_contended();
+    ret |= test_runtime_disable();
+
+    if (ret == 0) {
+        printf("all lock profiling tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,214 @@
+#include "../logger.h"
+#include "../module_interface.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_OUTPUT_MAX 8192
+#define TEST_DEINIT_WRITERS 4
+#define TEST_DEINIT_ROUNDS 50
+#define TEST_DEINIT_RUN_US 2000
+
+/* run logger into a pipe and collect everything it flushed */
+static int capture_start(int fds[2])
+{
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    return logger_init(fds[1]);
+}
+
+static size_t capture_stop(int fds[2], char *out, size_t out_size)
+{
+    ssize_t n;
+    size_t used = 0;
+
+    logger_deinit();
+    close(fds[1]);
+
+    while (used + 1 < out_size) {
+        n = read(fds[0], out + used, out_size - used - 1);
+        if (n <= 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+    out[used] = '\0';
+    close(fds[0]);
+    return used;
+}
+
+static int test_format_args(void)
+{
+    int fds[2];
+    char out[TEST_OUTPUT_MAX];
+    char volatile_str[16];
+
+    TEST_ASSERT(capture_start(fds) == 0, "logger_init should succeed");
+
+    strcpy(volatile_str, "abc");
+    logger_write(LOGGER_LEVEL_ERROR, "t1", "int=%d neg=%d u=%u", 42, -7, 7U);
+    logger_write(LOGGER_LEVEL_ERROR, "t2", "str='%s' zd=%zd zu=%zu", volatile_str,
+            (ssize_t)-3, (size_t)5);
+    /* string must be copied at record time */
+    strcpy(volatile_str, "XYZ");
+    logger_write(LOGGER_LEVEL_ERROR, "t3", "x=%08x ll=%lld pct=100%%", 0xbeefU, -9LL);
+    logger_write(LOGGER_LEVEL_ERROR, "t4", "w=[%*d] p=[%.*s] f=%.2f", 5, 1, 2, "hello", 1.5);
+
+    capture_stop(fds, out, sizeof(out));
+
+    TEST_ASSERT(strstr(out, "t1: int=42 neg=-7 u=7\n") != NULL, "integer formatting");
+    TEST_ASSERT(strstr(out, "t2: str='abc' zd=-3 zu=5\n") != NULL, "string copied at write time");
+    TEST_ASSERT(strstr(out, "t3: x=0000beef ll=-9 pct=100%\n") != NULL, "hex/ll/percent");
+    TEST_ASSERT(strstr(out, "t4: w=[    1] p=[he] f=1.50\n") != NULL, "star width/precision");
+
+    return 0;
+}
+
+static int test_level_filter(void)
+{
+    int fds[2];
+    char out[TEST_OUTPUT_MAX];
+    logger_level_t level;
+
+    TEST_ASSERT(logger_level_from_string("debug", &level) == 0, "parse debug");
+    TEST_ASSERT(level == LOGGER_LEVEL_DEBUG, "debug level value");
+    TEST_ASSERT(logger_level_from_string("1", &level) == 0, "parse numeric level");
+    TEST_ASSERT(level == LOGGER_LEVEL_WARN, "numeric level value");
+    TEST_ASSERT(logger_level_from_string("bogus", &level) != 0, "unknown level rejected");
+
+    TEST_ASSERT(capture_start(fds) == 0, "logger_init should succeed");
+
+    logger_set_level(LOGGER_LEVEL_INFO);
+    LOGGER_WRITE(LOGGER_LEVEL_DEBUG, "hidden %d", 1);
+    LOGGER_WRITE(LOGGER_LEVEL_INFO, "shown %d", 2);
+    logger_set_level(LOGGER_LEVEL_DEBUG);
+    LOGGER_WRITE(LOGGER_LEVEL_DEBUG, "debug %d", 3);
+    logger_set_level(LOGGER_LEVEL_INFO);
+
+    logger_module_log(MODULE_LOG_INFO, "module says %s", "hi");
+    logger_module_log(MODULE_LOG_DEBUG, "module debug");
+
+    capture_stop(fds, out, sizeof(out));
+
+    TEST_ASSERT(strstr(out, "hidden") == NULL, "debug line filtered at info level");
+    TEST_ASSERT(strstr(out, "test_level_filter: shown 2\n") != NULL, "info line written");
+    TEST_ASSERT(strstr(out, "test_level_filter: debug 3\n") != NULL, "debug line after level change");
+    TEST_ASSERT(strstr(out, "module: module says hi\n") != NULL, "module log preformatted");
+    TEST_ASSERT(strstr(out, "module debug") == NULL, "module debug filtered");
+
+    return 0;
+}
+
+static int test_ring_overflow(void)
+{
+    int fds[2];
+    static char out[1 << 20];
+    uint64_t dropped_before;
+    int i;
+
+    TEST_ASSERT(capture_start(fds) == 0, "logger_init should succeed");
+
+    dropped_before = logger_get_dropped();
+    for (i = 0; i < 2048; i++) {
+        logger_write(LOGGER_LEVEL_ERROR, "burst", "n=%d", i);
+    }
+
+    capture_stop(fds, out, sizeof(out));
+
+    /* never blocks: either flushed or counted as dropped */
+    TEST_ASSERT(strstr(out, "burst: n=0\n") != NULL, "first record flushed");
+    TEST_ASSERT(logger_get_dropped() >= dropped_before, "dropped counter monotonic");
+
+    return 0;
+}
+
+static atomic_bool g_writers_stop;
+
+static void *deinit_writer(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&g_writers_stop)) {
+        logger_write(LOGGER_LEVEL_ERROR, "writer", "%s %d", "racing deinit", 1);
+    }
+    return NULL;
+}
+
+/* writers that saw the logger running finish into the ring before deinit returns */
+static int test_deinit_with_writers(void)
+{
+    pthread_t threads[TEST_DEINIT_WRITERS];
+    int null_fd;
+    int saved_stderr;
+    int fd;
+    int round;
+    int i;
+    size_t depth = 0U;
+    bool init_failed = false;
+
+    /* writes after deinit go straight to stderr */
+    null_fd = open("/dev/null", O_WRONLY);
+    TEST_ASSERT(null_fd >= 0, "open /dev/null");
+    saved_stderr = dup(STDERR_FILENO);
+    TEST_ASSERT(saved_stderr >= 0, "dup stderr");
+    dup2(null_fd, STDERR_FILENO);
+
+    for (round = 0; round < TEST_DEINIT_ROUNDS && depth == 0U; round++) {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd < 0 || logger_init(fd) != 0) {
+            init_failed = true;
+            break;
+        }
+        atomic_store(&g_writers_stop, false);
+        for (i = 0; i < TEST_DEINIT_WRITERS; i++) {
+            pthread_create(&threads[i], NULL, deinit_writer, NULL);
+        }
+        usleep(TEST_DEINIT_RUN_US);
+        logger_deinit();
+        atomic_store(&g_writers_stop, true);
+        for (i = 0; i < TEST_DEINIT_WRITERS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        depth = logger_get_queue_depth();
+        close(fd);
+    }
+
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    close(null_fd);
+
+    TEST_ASSERT(!init_failed, "logger_init should succeed");
+    TEST_ASSERT(depth == 0U, "no record left in the ring after deinit");
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_format_args();
+    ret |= test_level_filter();
+    ret |= test_ring_overflow();
+    ret |= test_deinit_with_writers();
+
+    if (ret == 0) {
+        printf("all logger tests passed\n");
+    }
+
+    return ret;
+}
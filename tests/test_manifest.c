@@ -0,0 +1,408 @@
+#include "../manifest.h"
+#include "../module_loader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_FIXTURE "tests/fixtures/test_mod_manifest.so"
+#define TEST_COPIES 5
+#define MS 1000000ULL
+
+static char g_dir[] = "/tmp/kmodlike_manifest_XXXXXX";
+/* one copy per module: dlopen of the same file would share one image */
+static char g_paths[TEST_COPIES][64];
+
+static int copy_file(const char *from, const char *to)
+{
+    char buf[4096];
+    FILE *in;
+    FILE *out;
+    size_t n;
+
+    in = fopen(from, "rb");
+    if (in == NULL) {
+        return -1;
+    }
+    out = fopen(to, "wb");
+    if (out == NULL) {
+        fclose(in);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0U) {
+        fwrite(buf, 1, n, out);
+    }
+    fclose(in);
+    return fclose(out);
+}
+
+static int setup_copies(void)
+{
+    int i;
+
+    if (mkdtemp(g_dir) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < TEST_COPIES; i++) {
+        snprintf(g_paths[i], sizeof(g_paths[i]), "%s/mod%d.so", g_dir, i);
+        if (copy_file(TEST_FIXTURE, g_paths[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void remove_copies(void)
+{
+    int i;
+
+    for (i = 0; i < TEST_COPIES; i++) {
+        unlink(g_paths[i]);
+    }
+    rmdir(g_dir);
+}
+
+static int find(const manifest_t *manifest, const char *name, manifest_module_info_t *info)
+{
+    uint32_t i;
+
+    for (i = 0U; i < manifest_count(manifest); i++) {
+        manifest_get_module(manifest, i, info);
+        if (strcmp(info->name, name) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int test_parse(void)
+{
+    static const char text[] =
+        "# startup modules\n"
+        "\n"
+        "db   /opt/db.so   after=net,log  cache=64 mode=fast  \n"
+        "net  /opt/net.so\n"
+        "  log /opt/log.so level=debug\r\n";
+    manifest_module_info_t info;
+    manifest_t *manifest;
+    char error[128];
+
+    manifest = manifest_parse(text, error, sizeof(error));
+    TEST_ASSERT(manifest != NULL, "valid manifest should parse");
+    TEST_ASSERT(manifest_count(manifest) == 3U, "three modules expected");
+
+    TEST_ASSERT(find(manifest, "db", &info) == 0, "db should be listed");
+    TEST_ASSERT(strcmp(info.path, "/opt/db.so") == 0, "path should be kept");
+    TEST_ASSERT(info.dep_count == 2U, "dependencies declared later should resolve");
+    TEST_ASSERT(find(manifest, "log", &info) == 0 && info.dep_count == 0U,
+            "log has no dependencies");
+    TEST_ASSERT(info.loader == NULL, "no loader before start");
+    TEST_ASSERT(manifest_get_module(manifest, 3U, &info) == MODULE_ERR_INVALID_PARAM,
+            "index past the end should be rejected");
+
+    manifest_destroy(manifest);
+    return 0;
+}
+
+static int test_parse_errors(void)
+{
+    static const char *const bad[] = {
+        "a /a.so after=b\n",
+        "a /a.so after=b\nb /b.so after=c\nc /c.so after=a\n",
+        "a /a.so after=a\n",
+        "a /a.so\na /b.so\n",
+        "a\n",
+        "a /a.so\nb /a.so\n",
+        "a /a.so after=\n",
+        "a /a.so lazy\nb /b.so after=a\n",
+        "a /a.so bind=soon\n",
+    };
+    static const char *const expect[] = {
+        "unknown dependency 'b'",
+        "dependency cycle",
+        "dependency cycle",
+        "line 2: duplicate module 'a'",
+        "missing or too long module path",
+        "same path",
+        "bad dependency name",
+        "depends on lazy module 'a'",
+        "bind must be now or lazy",
+    };
+    char error[128];
+    size_t i;
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        error[0] = '\0';
+        TEST_ASSERT(manifest_parse(bad[i], error, sizeof(error)) == NULL,
+                "invalid manifest should be rejected");
+        TEST_ASSERT(strstr(error, expect[i]) != NULL, "error should say what is wrong");
+    }
+    TEST_ASSERT(manifest_read("/nonexistent/kmodlike.manifest", error, sizeof(error)) == NULL,
+            "missing file should be rejected");
+    return 0;
+}
+
+static int test_parallel_dag(void)
+{
+    manifest_module_info_t a;
+    manifest_module_info_t b;
+    manifest_module_info_t c;
+    manifest_report_t report;
+    manifest_t *manifest;
+    char text[1024];
+    char error[128];
+    uint32_t i;
+
+    /* chain a,b -> c: 200 ms critical path, 400 ms of inits in total */
+    snprintf(text, sizeof(text),
+            "c %s after=a,b sleep_ms=100\n"
+            "a %s sleep_ms=100\n"
+            "b %s sleep_ms=100\n"
+            "d %s sleep_ms=100\n",
+            g_paths[0], g_paths[1], g_paths[2], g_paths[3]);
+    manifest = manifest_parse(text, error, sizeof(error));
+    TEST_ASSERT(manifest != NULL, error);
+
+    TEST_ASSERT(manifest_start(manifest, NULL, NULL, NULL, 4U) == MODULE_ERR_SUCCESS,
+            "all modules should load");
+    TEST_ASSERT(manifest_start(manifest, NULL, NULL, NULL, 4U) == MODULE_ERR_INVALID_PARAM,
+            "a manifest starts once");
+
+    for (i = 0U; i < manifest_count(manifest); i++) {
+        manifest_get_module(manifest, i, &a);
+        TEST_ASSERT(a.err == MODULE_ERR_SUCCESS, "module should load");
+        TEST_ASSERT(module_loader_get_state(a.loader) == MODULE_STATE_LOADED,
+                "loader should be loaded");
+        TEST_ASSERT(a.load_ns >= 100U * MS, "load time should include module_init");
+    }
+
+    find(manifest, "a", &a);
+    find(manifest, "b", &b);
+    find(manifest, "c", &c);
+    TEST_ASSERT(c.start_ns >= a.end_ns && c.start_ns >= b.end_ns,
+            "dependent should start after its dependencies");
+
+    manifest_get_report(manifest, &report);
+    TEST_ASSERT(report.modules == 4U && report.loaded == 4U && report.failed == 0U,
+            "report should count modules");
+    TEST_ASSERT(report.threads == 4U, "four loading threads expected");
+    TEST_ASSERT(report.sum_ns >= 400U * MS, "sum should cover every init");
+    TEST_ASSERT(report.critical_path_ns >= 200U * MS &&
+            report.critical_path_ns < report.sum_ns, "critical path is the a,b -> c chain");
+    TEST_ASSERT(report.wall_ns >= report.critical_path_ns,
+            "wall time is bounded by the critical path");
+    TEST_ASSERT(report.wall_ns < 300U * MS, "independent modules should load in parallel");
+
+    manifest_stop(manifest);
+    for (i = 0U; i < manifest_count(manifest); i++) {
+        manifest_get_module(manifest, i, &a);
+        TEST_ASSERT(module_loader_get_state(a.loader) == MODULE_STATE_UNLOADED,
+                "stop should unload every module");
+    }
+    manifest_destroy(manifest);
+    return 0;
+}
+
+static int test_failed_dependency(void)
+{
+    manifest_module_info_t info;
+    manifest_report_t report;
+    manifest_t *manifest;
+    char text[1024];
+    char error[128];
+
+    snprintf(text, sizeof(text),
+            "bad %s fail\n"
+            "child %s after=bad\n"
+            "grandchild %s after=child\n"
+            "other %s\n",
+            g_paths[0], g_paths[1], g_paths[2], g_paths[3]);
+    manifest = manifest_parse(text, error, sizeof(error));
+    TEST_ASSERT(manifest != NULL, error);
+
+    TEST_ASSERT(manifest_start(manifest, NULL, NULL, NULL, 2U) == MODULE_ERR_INIT_FAILED,
+            "first failure in manifest order should be returned");
+
+    find(manifest, "bad", &info);
+    TEST_ASSERT(info.err == MODULE_ERR_INIT_FAILED, "failing init should be reported");
+    find(manifest, "child", &info);
+    TEST_ASSERT(info.err == MODULE_ERR_DEPENDENCY_FAILED, "dependent should be skipped");
+    TEST_ASSERT(module_loader_get_state(info.loader) == MODULE_STATE_UNLOADED,
+            "skipped module should not be loaded");
+    find(manifest, "grandchild", &info);
+    TEST_ASSERT(info.err == MODULE_ERR_DEPENDENCY_FAILED, "skip should propagate");
+    find(manifest, "other", &info);
+    TEST_ASSERT(info.err == MODULE_ERR_SUCCESS, "independent module should still load");
+
+    manifest_get_report(manifest, &report);
+    TEST_ASSERT(report.loaded == 1U && report.failed == 3U, "report should count failures");
+
+    manifest_destroy(manifest);
+    return 0;
+}
+
+static int test_read(void)
+{
+    manifest_module_info_t info;
+    manifest_t *manifest;
+    char path[128];
+    char error[128];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/startup.manifest", g_dir);
+    f = fopen(path, "w");
+    TEST_ASSERT(f != NULL, "manifest file should be writable");
+    fprintf(f, "one %s\ntwo %s after=one\n", g_paths[0], g_paths[4]);
+    fclose(f);
+
+    manifest = manifest_read(path, error, sizeof(error));
+    unlink(path);
+    TEST_ASSERT(manifest != NULL, error);
+    TEST_ASSERT(manifest_start(manifest, NULL, NULL, NULL, 0U) == MODULE_ERR_SUCCESS,
+            "modules should load with default thread count");
+    TEST_ASSERT(manifest_get_module(manifest, 1U, &info) == MODULE_ERR_SUCCESS &&
+            strcmp(info.name, "two") == 0, "modules keep manifest order");
+    manifest_destroy(manifest);
+    return 0;
+}
+
+static void count_setup(void *ctx, module_loader_t *loader)
+{
+    (void)loader;
+    (*(int *)ctx)++;
+}
+
+static int test_setup_callback(void)
+{
+    manifest_t *manifest;
+    char text[256];
+    char error[128];
+    int setups = 0;
+
+    snprintf(text, sizeof(text), "x %s\ny %s\n", g_paths[0], g_paths[1]);
+    manifest = manifest_parse(text, error, sizeof(error));
+    TEST_ASSERT(manifest != NULL, error);
+    TEST_ASSERT(manifest_start(manifest, NULL, count_setup, &setups, 1U) ==
+            MODULE_ERR_SUCCESS, "serial start should load");
+    TEST_ASSERT(setups == 2, "setup should run once per loader");
+    manifest_destroy(manifest);
+    return 0;
+}
+
+static int test_lazy_entries(void)
+{
+    manifest_module_info_t info;
+    manifest_report_t report;
+    manifest_t *manifest;
+    char text[512];
+    char error[128];
+
+    /* a lazy module may depend on an eager one, not the other way round */
+    snprintf(text, sizeof(text),
+            "base %s\n"
+            "rare %s after=base lazy sleep_ms=100\n",
+            g_paths[0], g_paths[1]);
+    manifest = manifest_parse(text, error, sizeof(error));
+    TEST_ASSERT(manifest != NULL, error);
+    TEST_ASSERT(manifest_start(manifest, NULL, NULL, NULL, 2U) == MODULE_ERR_SUCCESS,
+            "start should succeed");
+
+    find(manifest, "rare", &info);
+    TEST_ASSERT(info.lazy && info.err == MODULE_ERR_SUCCESS, "rare should be registered");
+    TEST_ASSERT(info.load_ns < 100U * MS, "registration should skip module_init");
+    TEST_ASSERT(module_loader_get_state(info.loader) == MODULE_STATE_UNLOADED,
+            "lazy module should not be loaded at start");
+    manifest_get_report(manifest, &report);
+    TEST_ASSERT(report.loaded == 1U && report.lazy == 1U && report.failed == 0U,
+            "report should count lazy modules apart");
+
+    TEST_ASSERT(module_loader_get_ref(info.loader) == MODULE_ERR_SUCCESS,
+            "first use should load with the manifest params");
+    module_loader_put_ref(info.loader);
+
+    manifest_stop(manifest);
+    TEST_ASSERT(!module_loader_is_lazy(info.loader), "stop should drop the registration");
+    manifest_destroy(manifest);
+    return 0;
+}
+
+/* what the daemon does: the same flags for every manifest loader */
+static void setup_prefault(void *ctx, module_loader_t *loader)
+{
+    (void)ctx;
+    module_loader_set_load_flags(loader, MODULE_LOAD_PREFAULT);
+}
+
+static int test_bind_options(void)
+{
+    manifest_module_info_t info;
+    module_loader_stats_t stats;
+    manifest_t *manifest;
+    char text[512];
+    char error[128];
+
+    snprintf(text, sizeof(text),
+            "eager %s bind=now global\n"
+            "plain %s bind=lazy\n",
+            g_paths[0], g_paths[1]);
+    manifest = manifest_parse(text, error, sizeof(error));
+    TEST_ASSERT(manifest != NULL, error);
+    find(manifest, "eager", &info);
+    TEST_ASSERT(info.load_flags == (MODULE_LOAD_BIND_NOW | MODULE_LOAD_GLOBAL),
+            "options should map to load flags");
+    TEST_ASSERT(manifest_start(manifest, NULL, setup_prefault, NULL, 2U) == MODULE_ERR_SUCCESS,
+            "start should succeed");
+
+    find(manifest, "eager", &info);
+    TEST_ASSERT(module_loader_get_load_flags(info.loader) ==
+            (MODULE_LOAD_PREFAULT | MODULE_LOAD_BIND_NOW | MODULE_LOAD_GLOBAL),
+            "options should add to the setup flags");
+    TEST_ASSERT(module_loader_get_stats(info.loader, &stats) == MODULE_ERR_SUCCESS,
+            "stats should succeed");
+    TEST_ASSERT(stats.load_phase_ns[MODULE_LOAD_PHASE_DLOPEN] > 0U &&
+            stats.load_phase_ns[MODULE_LOAD_PHASE_PREFAULT] > 0U,
+            "load phases should be timed");
+
+    find(manifest, "plain", &info);
+    TEST_ASSERT(info.load_flags == 0U, "bind=lazy is the default");
+    TEST_ASSERT(module_loader_get_load_flags(info.loader) == MODULE_LOAD_PREFAULT,
+            "setup flags should stay");
+    manifest_destroy(manifest);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    if (setup_copies() != 0) {
+        fprintf(stderr, "test failed: cannot copy %s\n", TEST_FIXTURE);
+        remove_copies();
+        return 1;
+    }
+
+    ret |= test_parse();
+    ret |= test_parse_errors();
+    ret |= test_parallel_dag();
+    ret |= test_failed_dependency();
+    ret |= test_read();
+    ret |= test_setup_callback();
+    ret |= test_lazy_entries();
+    ret |= test_bind_options();
+
+    remove_copies();
+    if (ret == 0) {
+        printf("all manifest tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,224 @@
+#include "../metrics.h"
+#include "../module_loader.h"
+#include "../stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+static char g_name[64];
+static char g_buf[METRICS_BUF_SIZE];
+
+static int get_time_impl(struct timespec *ts)
+{
+    if (ts == NULL) {
+        return -1;
+    }
+    return clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static int test_render(void)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    module_error_t err;
+    char small[64];
+    size_t len;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    err = module_loader_load(loader, "tests/fixtures/test_mod_good.so", &init_args);
+    TEST_ASSERT(err == MODULE_ERR_SUCCESS, "load should succeed");
+    TEST_ASSERT(module_loader_call_hello(loader) == MODULE_ERR_SUCCESS, "call_hello");
+
+    stats_publish_loader(STATS_DEFAULT_SLOT, loader);
+    stats_record_rpc(1500U, 10U, false);
+    stats_record_module_call(STATS_DEFAULT_SLOT, 5000U);
+
+    len = metrics_render(g_buf, sizeof(g_buf));
+    TEST_ASSERT(len > 0U && len == strlen(g_buf), "render should succeed");
+    TEST_ASSERT(strstr(g_buf, "# TYPE kmodlike_rpc_requests_total counter\n") != NULL,
+            "type line");
+    TEST_ASSERT(strstr(g_buf, "kmodlike_rpc_requests_total 1\n") != NULL, "rpc requests");
+    TEST_ASSERT(strstr(g_buf, "kmodlike_rpc_latency_seconds_bucket{le=\"+Inf\"} 1\n") != NULL,
+            "rpc histogram");
+    TEST_ASSERT(strstr(g_buf, "kmodlike_module_loaded{slot=\"0\",path=\"tests/fixtures/"
+                "test_mod_good.so\"} 1\n") != NULL, "module loaded gauge");
+    TEST_ASSERT(strstr(g_buf, "kmodlike_module_calls_total{slot=\"0\"") != NULL,
+            "module calls");
+    TEST_ASSERT(strstr(g_buf, "kmodlike_module_call_latency_seconds_count{slot=\"0\"") !=
+            NULL, "module call histogram");
+    TEST_ASSERT(strstr(g_buf, "test_mod_good.so\",phase=\"dlopen\"} ") != NULL,
+            "module load phases");
+    TEST_ASSERT(g_buf[len - 1U] == '\n', "output ends with newline");
+
+    TEST_ASSERT(metrics_render(small, sizeof(small)) == 0U, "short buffer is rejected");
+
+    module_loader_unload(loader);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int scrape(const char *path, const char *request, char *out, size_t size)
+{
+    struct sockaddr_un addr;
+    size_t used = 0U;
+    ssize_t got;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (request != NULL) {
+        send(fd, request, strlen(request), 0);
+    }
+
+    while (used + 1U < size) {
+        got = recv(fd, out + used, size - used - 1U, 0);
+        if (got <= 0) {
+            break;
+        }
+        used += (size_t)got;
+    }
+    out[used] = '\0';
+    close(fd);
+    return (int)used;
+}
+
+static int test_listener(void)
+{
+    char path[108];
+
+    snprintf(path, sizeof(path), "/tmp/kmodlike_test_metrics_%d.sock", (int)getpid());
+    TEST_ASSERT(metrics_listener_start(path) == 0, "listener should start");
+    TEST_ASSERT(metrics_listener_start(path) != 0, "second start should fail");
+
+    TEST_ASSERT(scrape(path, NULL, g_buf, sizeof(g_buf)) > 0, "plain scrape");
+    TEST_ASSERT(strncmp(g_buf, "# HELP ", 7U) == 0, "plain scrape has no http header");
+
+    TEST_ASSERT(scrape(path, "GET /metrics HTTP/1.0\r\n\r\n", g_buf, sizeof(g_buf)) > 0,
+            "http scrape");
+    TEST_ASSERT(strncmp(g_buf, "HTTP/1.0 200 OK\r\n", 17U) == 0, "http status line");
+    TEST_ASSERT(strstr(g_buf, "\r\n\r\n# HELP ") != NULL, "http body");
+
+    metrics_listener_stop();
+    TEST_ASSERT(access(path, F_OK) != 0, "socket removed on stop");
+    return 0;
+}
+
+/* every module slot rendered and nothing cut off at the end */
+static int scrape_complete(const char *text)
+{
+    const char *p = text;
+    const char *tail;
+    uint32_t modules = 0U;
+
+    while ((p = strstr(p, "kmodlike_module_call_latency_seconds_count{")) != NULL) {
+        modules++;
+        p++;
+    }
+    tail = strstr(text, "\nkmodlike_logger_dropped_total ");
+    return modules == STATS_MAX_MODULES && tail != NULL && strchr(tail + 1, '\n') != NULL &&
+            strchr(tail + 1, '\n')[1] == '\0';
+}
+
+static int test_full_slots(void)
+{
+    module_loader_t *loaders[STATS_MAX_MODULES];
+    char dir[] = "/tmp/kmodlike_metrics_XXXXXX";
+    char paths[STATS_MAX_MODULES][256];
+    char sock[108];
+    size_t len;
+    uint32_t i;
+    uint32_t j;
+    int n;
+
+    /* quotes escape to two bytes each, the longest label a path can give */
+    TEST_ASSERT(mkdtemp(dir) != NULL, "mkdtemp failed");
+    for (i = 0U; i < STATS_MAX_MODULES; i++) {
+        n = snprintf(paths[i], sizeof(paths[i]), "%s/%02u", dir, i);
+        while (n < 200) {
+            paths[i][n++] = '"';
+        }
+        memcpy(paths[i] + n, ".so", 4U);
+        TEST_ASSERT(link("tests/fixtures/test_mod_good.so", paths[i]) == 0, "link failed");
+
+        loaders[i] = module_loader_create();
+        TEST_ASSERT(loaders[i] != NULL, "module_loader_create failed");
+        TEST_ASSERT(module_loader_load(loaders[i], paths[i], NULL) == MODULE_ERR_SUCCESS,
+                "load should succeed");
+        stats_publish_loader(i, loaders[i]);
+        /* every histogram bucket in use */
+        for (j = 0U; j < STATS_LATENCY_BUCKETS; j++) {
+            stats_record_module_call(i, 1ULL << j);
+        }
+    }
+
+    len = metrics_render(g_buf, sizeof(g_buf));
+    TEST_ASSERT(len > 0U && len == strlen(g_buf), "all slots should fit");
+    TEST_ASSERT(scrape_complete(g_buf), "render should cover every slot");
+
+    snprintf(sock, sizeof(sock), "/tmp/kmodlike_test_metrics_full_%d.sock", (int)getpid());
+    TEST_ASSERT(metrics_listener_start(sock) == 0, "listener should start");
+    TEST_ASSERT(scrape(sock, NULL, g_buf, sizeof(g_buf)) > 0, "plain scrape");
+    metrics_listener_stop();
+    TEST_ASSERT(scrape_complete(g_buf), "listener should serve every slot");
+
+    for (i = 0U; i < STATS_MAX_MODULES; i++) {
+        module_loader_destroy(loaders[i]);
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    snprintf(g_name, sizeof(g_name), "/kmodlike_test_metrics_%d", (int)getpid());
+    if (stats_init(g_name) != 0) {
+        fprintf(stderr, "test failed: stats_init\n");
+        return 1;
+    }
+
+    ret |= test_render();
+    ret |= test_listener();
+    ret |= test_full_slots();
+
+    stats_deinit();
+
+    if (ret == 0) {
+        printf("all metrics tests passed\n");
+    }
+
+    return ret;
+}
@@ -1,11 +1,14 @@
 #include "../module_loader.h"
 #include "../module_interface.h"
+#include "../trace.h"
 
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #define TEST_ASSERT(cond, msg) \
     do { \
@@ -186,6 +189,311 @@ static int test_version_mismatch(void)
     return 0;
 }
 
+static int test_state_word(void)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    void *sym;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+    TEST_ASSERT(module_loader_get_generation(loader) == 0U, "no generation before load");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_bad_init.so",
+            &init_args) == MODULE_ERR_INIT_FAILED, "bad init fails");
+    TEST_ASSERT(module_loader_get_error(loader) == MODULE_ERR_INIT_FAILED, "error recorded");
+    TEST_ASSERT(module_loader_get_generation(loader) == 0U, "failed load keeps generation");
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_good.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load");
+    TEST_ASSERT(module_loader_get_generation(loader) == 1U, "first generation");
+    TEST_ASSERT(module_loader_get_error(loader) == MODULE_ERR_SUCCESS, "error cleared");
+
+    TEST_ASSERT(module_loader_get_symbol(loader, "no_such_symbol", &sym) ==
+            MODULE_ERR_MISSING_SYMBOL, "missing symbol");
+    TEST_ASSERT(module_loader_get_error(loader) == MODULE_ERR_MISSING_SYMBOL,
+            "error stored beside state");
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_LOADED,
+            "error keeps state");
+
+    TEST_ASSERT(module_loader_signal_crash(loader), "crash flagged");
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_CRASHED, "crashed state");
+    TEST_ASSERT(module_loader_get_symbol(loader, "mod_hello", &sym) == MODULE_ERR_NOT_LOADED,
+            "crashed module refuses calls");
+    TEST_ASSERT(module_loader_mark_crashed(loader) == MODULE_ERR_SUCCESS, "mark crashed");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "crashed module unloads");
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_UNLOADED, "unloaded");
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_good.so",
+            &init_args) == MODULE_ERR_SUCCESS, "reload");
+    TEST_ASSERT(module_loader_get_generation(loader) == 2U, "reload starts a generation");
+    TEST_ASSERT(!module_loader_crash_pending(loader), "reload clears the crash");
+
+    module_loader_destroy(loader);
+
+    return 0;
+}
+
+static int test_symbol_handle(void)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    module_symbol_t sym;
+    module_symbol_t fresh;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    TEST_ASSERT(module_loader_resolve(loader, "mod_hello", &sym) == MODULE_ERR_NOT_LOADED,
+            "resolve needs a loaded module");
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_good.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load");
+    TEST_ASSERT(module_loader_resolve(loader, "no_such_symbol", &sym) ==
+            MODULE_ERR_MISSING_SYMBOL, "missing symbol");
+    TEST_ASSERT(module_loader_resolve(loader, "mod_hello", &sym) == MODULE_ERR_SUCCESS,
+            "resolve");
+    TEST_ASSERT(sym.addr != NULL && sym.generation == module_loader_get_generation(loader),
+            "handle carries address and generation");
+
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_SUCCESS, "pin");
+    ((void (*)(void))sym.addr)();
+    module_symbol_unpin(&sym);
+
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS,
+            "unpinned handle does not block unload");
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_NOT_LOADED,
+            "unloaded module refuses pins");
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_good.so",
+            &init_args) == MODULE_ERR_SUCCESS, "reload");
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_STALE_HANDLE,
+            "reload invalidates old handles");
+    TEST_ASSERT(module_loader_resolve(loader, "mod_hello", &fresh) == MODULE_ERR_SUCCESS &&
+            module_symbol_pin(&fresh) == MODULE_ERR_SUCCESS, "fresh handle works");
+    module_symbol_unpin(&fresh);
+
+    module_loader_destroy(loader);
+
+    return 0;
+}
+
+static int test_ops_table(void)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    module_symbol_t sym;
+    const module_ops_t *ops;
+    int (*hello_calls)(void);
+    void *addr;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_ops_bad.so",
+            &init_args) == MODULE_ERR_VERSION_MISMATCH, "short table rejected at load");
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_good.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load module without table");
+    TEST_ASSERT(module_loader_resolve_ops(loader, &sym) == MODULE_ERR_MISSING_SYMBOL,
+            "table is optional");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_ops.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load module with table");
+    TEST_ASSERT(module_loader_resolve_ops(loader, &sym) == MODULE_ERR_SUCCESS, "resolve ops");
+
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_SUCCESS, "pin ops");
+    ops = sym.addr;
+    TEST_ASSERT(ops->version == MODULE_OPS_VERSION_1, "table version");
+    TEST_ASSERT(ops->size == MODULE_OPS_SIZE_V1 && ops->hello != NULL, "v1 slots");
+    TEST_ASSERT(ops->process_batch == NULL, "slots past a v1 table stay NULL");
+    ops->hello();
+    module_symbol_unpin(&sym);
+
+    /* the legacy entry point goes through the table too */
+    TEST_ASSERT(module_loader_call_hello(loader) == MODULE_ERR_SUCCESS, "call_hello");
+    TEST_ASSERT(module_loader_get_symbol(loader, "test_mod_ops_hello_calls", &addr) ==
+            MODULE_ERR_SUCCESS, "counter symbol");
+    hello_calls = (int (*)(void))addr;
+    TEST_ASSERT(hello_calls() == 2, "both calls reached the table slot");
+    module_loader_put_ref(loader);
+
+    module_loader_destroy(loader);
+
+    return 0;
+}
+
+static int test_init_args_versions(void)
+{
+    static const module_clock_ops_t clock_ops;
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    module_init_args_t seen;
+    int usable = 0;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+
+    /* a version 1 caller: nothing past user_data is initialized or read */
+    memset(&init_args, 0xa5, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = &seen;
+
+    memset(&seen, 0, sizeof(seen));
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_args.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load v2 module from v1 caller");
+    TEST_ASSERT(seen.version == MODULE_INIT_ARGS_VERSION_2, "module asked for version 2");
+    TEST_ASSERT(seen.size == sizeof(seen), "size set by the loader");
+    TEST_ASSERT(seen.get_time == get_time_impl, "version 1 fields passed");
+    TEST_ASSERT(seen.clock == NULL && seen.pool == NULL && seen.timers == NULL &&
+            seen.reactor == NULL, "caller bytes past user_data ignored");
+    TEST_ASSERT(seen.alloc != NULL, "loader services appended");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+
+    /* a version 2 caller passes its appended fields */
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_2;
+    init_args.size = (uint32_t)sizeof(init_args);
+    init_args.get_time = get_time_impl;
+    init_args.clock = &clock_ops;
+    init_args.user_data = &seen;
+
+    memset(&seen, 0, sizeof(seen));
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_args.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load v2 module from v2 caller");
+    TEST_ASSERT(seen.clock == &clock_ops, "caller clock passed");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+
+    /* a module that does not ask gets version 1 args it can match exactly */
+    init_args.user_data = &usable;
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_v1.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load v1 module");
+    TEST_ASSERT(usable == 1, "exact version 1 check still sees get_time");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+
+    module_loader_destroy(loader);
+
+    return 0;
+}
+
+static int test_trace_load_spans(void)
+{
+    module_loader_t *loader;
+    module_error_t err;
+    module_init_args_t init_args;
+    char path[] = "/tmp/kmodlike_trace_XXXXXX";
+    char json[16384];
+    ssize_t len;
+    int fd;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    /* unsampled request records nothing */
+    trace_set_sample_rate(0U);
+    TEST_ASSERT(trace_request_begin() != 0U, "every request gets a trace id");
+    TEST_ASSERT(!trace_is_active(), "rate 0 disables sampling");
+    trace_request_end();
+
+    trace_set_sample_rate(1U);
+    trace_request_begin();
+    TEST_ASSERT(trace_is_active(), "rate 1 samples every request");
+    err = module_loader_load(loader, "tests/fixtures/test_mod_good.so", &init_args);
+    TEST_ASSERT(err == MODULE_ERR_SUCCESS, "load should succeed");
+    err = module_loader_unload(loader);
+    TEST_ASSERT(err == MODULE_ERR_SUCCESS, "unload should succeed");
+    trace_request_end();
+    trace_set_sample_rate(0U);
+
+    fd = mkstemp(path);
+    TEST_ASSERT(fd >= 0, "mkstemp failed");
+    TEST_ASSERT(trace_dump_json(fd) >= 5, "dump should contain load phases");
+    lseek(fd, 0, SEEK_SET);
+    len = read(fd, json, sizeof(json) - 1);
+    close(fd);
+    unlink(path);
+    TEST_ASSERT(len > 0, "trace file should not be empty");
+    json[len] = '\0';
+
+    TEST_ASSERT(strstr(json, "\"traceEvents\"") != NULL, "chrome trace format");
+    TEST_ASSERT(strstr(json, "\"name\":\"dlopen\"") != NULL, "dlopen span");
+    TEST_ASSERT(strstr(json, "\"name\":\"resolve_symbols\"") != NULL, "symbol span");
+    TEST_ASSERT(strstr(json, "\"name\":\"module_init\"") != NULL, "module_init span");
+    TEST_ASSERT(strstr(json, "\"name\":\"module_fini\"") != NULL, "module_fini span");
+
+    trace_clear();
+    fd = open("/dev/null", O_WRONLY);
+    TEST_ASSERT(trace_dump_json(fd) == 0, "clear drops recorded spans");
+    close(fd);
+
+    module_loader_destroy(loader);
+
+    return 0;
+}
+
+static int test_load_flags(void)
+{
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+    void *handle;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+    TEST_ASSERT(module_loader_get_load_flags(loader) == 0U, "lazy local binding by default");
+    TEST_ASSERT(module_loader_set_load_flags(loader, 0x80000000U) == MODULE_ERR_INVALID_PARAM,
+            "unknown flags should be rejected");
+    TEST_ASSERT(module_loader_set_load_flags(loader, MODULE_LOAD_BIND_NOW | MODULE_LOAD_GLOBAL) ==
+            MODULE_ERR_SUCCESS, "set_load_flags should succeed");
+    TEST_ASSERT(module_loader_get_load_flags(loader) ==
+            (MODULE_LOAD_BIND_NOW | MODULE_LOAD_GLOBAL), "flags should be kept");
+
+    TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_good.so", NULL) ==
+            MODULE_ERR_SUCCESS, "load should succeed");
+    /* RTLD_GLOBAL puts the module in the global scope */
+    handle = dlopen(NULL, RTLD_NOW);
+    TEST_ASSERT(handle != NULL && dlsym(handle, "module_init") != NULL,
+            "a global module should be visible to everyone");
+    dlclose(handle);
+
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS,
+            "stats should succeed");
+    TEST_ASSERT(stats.load_flags == (MODULE_LOAD_BIND_NOW | MODULE_LOAD_GLOBAL),
+            "stats should report the flags");
+    TEST_ASSERT(stats.load_phase_ns[MODULE_LOAD_PHASE_DLOPEN] > 0U &&
+            stats.load_phase_ns[MODULE_LOAD_PHASE_RESOLVE] > 0U &&
+            stats.load_phase_ns[MODULE_LOAD_PHASE_INIT] > 0U, "load phases should be timed");
+    TEST_ASSERT(stats.load_phase_ns[MODULE_LOAD_PHASE_PREFAULT] == 0U,
+            "no prefault phase without the flag");
+
+    TEST_ASSERT(module_loader_set_load_flags(NULL, 0U) == MODULE_ERR_INVALID_PARAM,
+            "NULL loader should be rejected");
+    TEST_ASSERT(module_loader_get_load_flags(NULL) == 0U, "NULL loader has no flags");
+    module_loader_destroy(loader);
+    return 0;
+}
+
 int main(void)
 {
     int ret = 0;
@@ -197,6 +505,12 @@ int main(void)
     ret |= test_get_symbol();
     ret |= test_invalid_params();
     ret |= test_version_mismatch();
+    ret |= test_state_word();
+    ret |= test_symbol_handle();
+    ret |= test_ops_table();
+    ret |= test_init_args_versions();
+    ret |= test_trace_load_spans();
+    ret |= test_load_flags();
 
     if (ret == 0) {
         printf("all tests passed\n");
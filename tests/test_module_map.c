@@ -0,0 +1,483 @@
+#define _GNU_SOURCE
+#include "../module_loader.h"
+#include "../module_map.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define READER_THREADS 2
+#define RELOAD_ITERATIONS 200
+/* test_mod_crash.so faults 3 seconds after init */
+#define CRASH_WAIT_MS 6000
+
+static int get_time_impl(struct timespec *ts)
+{
+    if (ts == NULL) {
+        return -1;
+    }
+    return clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static module_loader_t *load(const char *path)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+
+    loader = module_loader_create();
+    if (loader == NULL) {
+        return NULL;
+    }
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    if (module_loader_load(loader, path, &init_args) != MODULE_ERR_SUCCESS) {
+        module_loader_destroy(loader);
+        return NULL;
+    }
+    return loader;
+}
+
+static uintptr_t symbol_addr(module_loader_t *loader, const char *name)
+{
+    void *sym = NULL;
+
+    if (module_loader_get_symbol(loader, name, &sym) != MODULE_ERR_SUCCESS) {
+        return 0U;
+    }
+    module_loader_put_ref(loader);
+    return (uintptr_t)sym;
+}
+
+static int test_lookup(void)
+{
+    module_loader_t *good;
+    module_loader_t *crash;
+    uintptr_t good_hello;
+    uintptr_t crash_hello;
+    int local = 0;
+
+    good = load("tests/fixtures/test_mod_good.so");
+    crash = load("tests/fixtures/test_mod_crash.so");
+    TEST_ASSERT(good != NULL && crash != NULL, "load fixtures");
+    TEST_ASSERT(module_map_count() >= 4U, "segments of both modules indexed");
+
+    good_hello = symbol_addr(good, "mod_hello");
+    crash_hello = symbol_addr(crash, "mod_hello");
+    TEST_ASSERT(good_hello != 0U && crash_hello != 0U, "resolve mod_hello");
+
+    TEST_ASSERT(module_loader_find_by_addr(good_hello) == good, "good module text");
+    TEST_ASSERT(module_loader_find_by_addr(crash_hello) == crash, "crash module text");
+    TEST_ASSERT(module_loader_find_by_addr((uintptr_t)&test_lookup) == NULL, "host text");
+    TEST_ASSERT(module_loader_find_by_addr((uintptr_t)&local) == NULL, "host stack");
+    TEST_ASSERT(module_loader_find_by_addr((uintptr_t)&printf) == NULL, "libc text");
+    TEST_ASSERT(module_loader_find_by_addr(0U) == NULL, "null address");
+
+    TEST_ASSERT(module_loader_unload(crash) == MODULE_ERR_SUCCESS, "unload crash");
+    TEST_ASSERT(module_loader_find_by_addr(good_hello) == good, "other module kept");
+
+    module_loader_destroy(crash);
+    module_loader_destroy(good);
+    TEST_ASSERT(module_map_count() == 0U, "index empty after unload");
+
+    return 0;
+}
+
+static atomic_bool g_stop = ATOMIC_VAR_INIT(false);
+static atomic_uintptr_t g_probe = ATOMIC_VAR_INIT(0U);
+static atomic_int g_bad_lookups = ATOMIC_VAR_INIT(0);
+static module_loader_t *g_stable;
+static module_loader_t *g_reloaded;
+
+static void *reader_thread(void *arg)
+{
+    uintptr_t stable_addr = (uintptr_t)arg;
+    const void *owner;
+
+    while (!atomic_load(&g_stop)) {
+        if (module_loader_find_by_addr(stable_addr) != g_stable) {
+            atomic_fetch_add(&g_bad_lookups, 1);
+        }
+        owner = module_loader_find_by_addr(atomic_load(&g_probe));
+        if (owner != NULL && owner != g_reloaded) {
+            atomic_fetch_add(&g_bad_lookups, 1);
+        }
+    }
+    return NULL;
+}
+
+static int test_concurrent_reload(void)
+{
+    pthread_t threads[READER_THREADS];
+    module_init_args_t init_args;
+    uintptr_t stable_addr;
+    size_t count;
+    int i;
+
+    g_stable = load("tests/fixtures/test_mod_good.so");
+    TEST_ASSERT(g_stable != NULL, "load stable module");
+    stable_addr = symbol_addr(g_stable, "mod_hello");
+
+    g_reloaded = module_loader_create();
+    TEST_ASSERT(g_reloaded != NULL, "create reloaded loader");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    for (i = 0; i < READER_THREADS; i++) {
+        TEST_ASSERT(pthread_create(&threads[i], NULL, reader_thread,
+                (void *)stable_addr) == 0, "pthread_create");
+    }
+
+    /* a module whose init fails must never become visible */
+    count = module_map_count();
+    TEST_ASSERT(module_loader_load(g_reloaded, "tests/fixtures/test_mod_bad_init.so",
+            &init_args) == MODULE_ERR_INIT_FAILED, "bad init rejected");
+    TEST_ASSERT(module_map_count() == count, "failed load not indexed");
+
+    for (i = 0; i < RELOAD_ITERATIONS; i++) {
+        if (module_loader_load(g_reloaded, "tests/fixtures/test_mod_crash.so",
+                &init_args) != MODULE_ERR_SUCCESS) {
+            break;
+        }
+        atomic_store(&g_probe, symbol_addr(g_reloaded, "mod_hello"));
+        module_loader_unload(g_reloaded);
+    }
+
+    atomic_store(&g_stop, true);
+    for (i = 0; i < READER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    TEST_ASSERT(atomic_load(&g_bad_lookups) == 0, "no misattribution during reloads");
+    TEST_ASSERT(module_loader_find_by_addr(stable_addr) == g_stable, "stable after reloads");
+
+    module_loader_destroy(g_reloaded);
+    module_loader_destroy(g_stable);
+    return 0;
+}
+
+static _Atomic(module_loader_t *) g_blamed = ATOMIC_VAR_INIT(NULL);
+
+static uintptr_t fault_pc(const void *context)
+{
+    const ucontext_t *uc = context;
+
+#if defined(__x86_64__)
+    return (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    return (uintptr_t)uc->uc_mcontext.pc;
+#else
+    (void)uc;
+    return 0U;
+#endif
+}
+
+static void fatal_signal_handler(int sig, siginfo_t *info, void *context)
+{
+    module_loader_t *loader;
+
+    (void)sig;
+
+    loader = module_loader_find_by_fault(fault_pc(context), info);
+    if (loader != NULL) {
+        atomic_store(&g_blamed, loader);
+        module_loader_signal_crash(loader);
+    }
+}
+
+static sigjmp_buf g_host_fault_env;
+static _Atomic(module_loader_t *) g_host_fault_blamed = ATOMIC_VAR_INIT(NULL);
+static atomic_uintptr_t g_host_fault_addr = ATOMIC_VAR_INIT(0U);
+
+static void host_fault_handler(int sig, siginfo_t *info, void *context)
+{
+    (void)sig;
+
+    atomic_store(&g_host_fault_addr, (uintptr_t)info->si_addr);
+    atomic_store(&g_host_fault_blamed, module_loader_find_by_fault(fault_pc(context), info));
+    siglongjmp(g_host_fault_env, 1);
+}
+
+static int test_fault_attribution(void)
+{
+    struct sigaction sa;
+    struct sigaction old_sa;
+    module_loader_t *good;
+    uintptr_t hello;
+    siginfo_t info;
+    module_loader_stats_t stats;
+    volatile char *text;
+
+    good = load("tests/fixtures/test_mod_good.so");
+    TEST_ASSERT(good != NULL, "load fixture");
+    TEST_ASSERT(module_loader_get_stats(good, &stats) == MODULE_ERR_SUCCESS && !stats.unindexed,
+            "module indexed");
+    hello = symbol_addr(good, "mod_hello");
+    TEST_ASSERT(hello != 0U, "resolve mod_hello");
+
+    /* host code writing into read-only module text faults on a module
+     * address, but the pc is in the host */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = host_fault_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    TEST_ASSERT(sigaction(SIGSEGV, &sa, &old_sa) == 0, "sigaction");
+
+    text = (volatile char *)hello;
+    if (sigsetjmp(g_host_fault_env, 1) == 0) {
+        text[0] = text[0];
+    }
+    sigaction(SIGSEGV, &old_sa, NULL);
+
+    TEST_ASSERT(atomic_load(&g_host_fault_addr) == hello, "host fault hit module text");
+#if defined(__x86_64__) || defined(__aarch64__)
+    TEST_ASSERT(atomic_load(&g_host_fault_blamed) == NULL, "host fault not blamed on module");
+#endif
+
+    /* pc known: si_addr is never consulted */
+    memset(&info, 0, sizeof(info));
+    info.si_signo = SIGSEGV;
+    info.si_code = SEGV_MAPERR;
+    info.si_addr = (void *)hello;
+    TEST_ASSERT(module_loader_find_by_fault((uintptr_t)&test_fault_attribution, &info) == NULL,
+                "host pc wins over module si_addr");
+    TEST_ASSERT(module_loader_find_by_fault(hello, &info) == good, "module pc blamed");
+
+    /* pc unknown: only a kernel generated si_addr counts */
+    TEST_ASSERT(module_loader_find_by_fault(0U, &info) == good, "kernel fault falls back to si_addr");
+    info.si_code = SI_USER;
+    TEST_ASSERT(module_loader_find_by_fault(0U, &info) == NULL, "kill(2) not blamed");
+    info.si_code = SI_QUEUE;
+    TEST_ASSERT(module_loader_find_by_fault(0U, &info) == NULL, "sigqueue(3) not blamed");
+    info.si_code = SI_TKILL;
+    TEST_ASSERT(module_loader_find_by_fault(0U, &info) == NULL, "abort() not blamed");
+    TEST_ASSERT(module_loader_find_by_fault(0U, NULL) == NULL, "no siginfo");
+
+    module_loader_destroy(good);
+    return 0;
+}
+
+static int test_signal_attribution(void)
+{
+    struct sigaction sa;
+    struct sigaction old_sa;
+    module_loader_t *good;
+    module_loader_t *crash;
+    int waited_ms = 0;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = fatal_signal_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    TEST_ASSERT(sigaction(SIGSEGV, &sa, &old_sa) == 0, "sigaction");
+
+    good = load("tests/fixtures/test_mod_good.so");
+    crash = load("tests/fixtures/test_mod_crash.so");
+    TEST_ASSERT(good != NULL && crash != NULL, "load fixtures");
+
+    while (!module_loader_crash_pending(crash) && waited_ms < CRASH_WAIT_MS) {
+        usleep(10000);
+        waited_ms += 10;
+    }
+
+    TEST_ASSERT(module_loader_crash_pending(crash), "crash attributed by pc");
+    TEST_ASSERT(atomic_load(&g_blamed) == crash, "faulting module blamed");
+    TEST_ASSERT(!module_loader_crash_pending(good), "other module untouched");
+    TEST_ASSERT(!module_loader_signal_crash(crash), "repeated faults reported once");
+
+    TEST_ASSERT(module_loader_mark_crashed(crash) == MODULE_ERR_SUCCESS, "mark crashed");
+    TEST_ASSERT(module_loader_unload(crash) == MODULE_ERR_SUCCESS, "unload crashed module");
+    TEST_ASSERT(module_loader_get_state(good) == MODULE_STATE_LOADED, "good module stays");
+
+    module_loader_destroy(crash);
+    module_loader_destroy(good);
+    sigaction(SIGSEGV, &old_sa, NULL);
+    return 0;
+}
+
+static _Atomic(module_loader_t *) g_abort_blamed = ATOMIC_VAR_INIT(NULL);
+
+static void abort_handler(int sig, siginfo_t *info, void *context)
+{
+    module_loader_t *loader;
+
+    (void)sig;
+
+    loader = module_loader_find_by_fault(fault_pc(context), info);
+    if (loader != NULL) {
+        atomic_store(&g_abort_blamed, loader);
+        module_loader_signal_crash(loader);
+        host_pool_abandon_task();
+    }
+}
+
+static void set_flag_task(void *arg)
+{
+    atomic_store((atomic_bool *)arg, true);
+}
+
+static module_loader_t *load_with_pool(const char *path, host_pool_t *pool)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+
+    loader = module_loader_create();
+    if (loader == NULL) {
+        return NULL;
+    }
+
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.get_time = get_time_impl;
+
+    if (module_loader_set_pool(loader, pool, 0U) != MODULE_ERR_SUCCESS ||
+            module_loader_load(loader, path, &init_args) != MODULE_ERR_SUCCESS) {
+        module_loader_destroy(loader);
+        return NULL;
+    }
+    return loader;
+}
+
+/* memcpy runs in libc, only the pin tells who called it */
+static int test_libc_fault_attribution(void)
+{
+    struct sigaction sa;
+    struct sigaction old_sa;
+    module_loader_t *loader;
+    module_symbol_t sym;
+    void (*copy_to_null)(void);
+
+    loader = load("tests/fixtures/test_mod_libc_crash.so");
+    TEST_ASSERT(loader != NULL, "load fixture");
+    TEST_ASSERT(module_loader_resolve(loader, "mod_copy_to_null", &sym) == MODULE_ERR_SUCCESS,
+                "resolve mod_copy_to_null");
+    copy_to_null = (void (*)(void))sym.addr;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = host_fault_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    TEST_ASSERT(sigaction(SIGSEGV, &sa, &old_sa) == 0, "sigaction");
+
+    /* unpinned, the host called into the module behind the loader's back */
+    atomic_store(&g_host_fault_blamed, loader);
+    if (sigsetjmp(g_host_fault_env, 1) == 0) {
+        copy_to_null();
+    }
+#if defined(__x86_64__) || defined(__aarch64__)
+    TEST_ASSERT(atomic_load(&g_host_fault_blamed) == NULL, "unpinned libc fault not blamed");
+#endif
+
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_SUCCESS, "pin");
+    if (sigsetjmp(g_host_fault_env, 1) == 0) {
+        copy_to_null();
+    }
+    module_symbol_unpin(&sym);
+    sigaction(SIGSEGV, &old_sa, NULL);
+    TEST_ASSERT(atomic_load(&g_host_fault_blamed) == loader, "libc fault in pinned call blamed");
+
+    module_loader_destroy(loader);
+    return 0;
+}
+
+/* abort() from a pool task of the module, the worker survives */
+static int test_abort_attribution(void)
+{
+    struct sigaction sa;
+    struct sigaction old_sa;
+    module_loader_t *loader;
+    host_pool_t *pool;
+    host_pool_client_t *client;
+    host_pool_client_stats_t pool_stats;
+    module_loader_stats_t stats;
+    atomic_bool ran = ATOMIC_VAR_INIT(false);
+    module_symbol_t sym;
+    int waited_ms = 0;
+
+    pool = host_pool_create(1U);
+    TEST_ASSERT(pool != NULL, "create pool");
+    loader = load_with_pool("tests/fixtures/test_mod_libc_crash.so", pool);
+    TEST_ASSERT(loader != NULL, "load fixture");
+    TEST_ASSERT(module_loader_resolve(loader, "mod_abort_in_task", &sym) == MODULE_ERR_SUCCESS,
+                "resolve mod_abort_in_task");
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = abort_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    TEST_ASSERT(sigaction(SIGABRT, &sa, &old_sa) == 0, "sigaction");
+
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_SUCCESS, "pin");
+    TEST_ASSERT(((int (*)(void))sym.addr)() == 0, "submit abort task");
+    module_symbol_unpin(&sym);
+
+    while (!module_loader_crash_pending(loader) && waited_ms < CRASH_WAIT_MS) {
+        usleep(10000);
+        waited_ms += 10;
+    }
+    sigaction(SIGABRT, &old_sa, NULL);
+    TEST_ASSERT(atomic_load(&g_abort_blamed) == loader, "abort() in pool task blamed");
+    TEST_ASSERT(module_loader_crash_pending(loader), "crash flagged");
+
+    TEST_ASSERT(module_loader_mark_crashed(loader) == MODULE_ERR_SUCCESS, "mark crashed");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload crashed module");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS &&
+            stats.stuck_tasks == 0U, "the abandoned task is not stuck");
+    module_loader_destroy(loader);
+
+    /* the only worker left the task and still runs others */
+    client = host_pool_client_create(pool, 0U);
+    TEST_ASSERT(client != NULL, "create client");
+    TEST_ASSERT(host_pool_client_submit(client, set_flag_task, &ran, NULL) == 0, "submit");
+    waited_ms = 0;
+    while (!atomic_load(&ran) && waited_ms < CRASH_WAIT_MS) {
+        usleep(10000);
+        waited_ms += 10;
+    }
+    TEST_ASSERT(host_pool_client_close(client, 0U), "close client");
+    host_pool_client_get_stats(client, &pool_stats);
+    TEST_ASSERT(atomic_load(&ran) && pool_stats.completed == 1U, "worker survived abort()");
+    host_pool_client_destroy(client);
+    host_pool_destroy(pool);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_lookup();
+    ret |= test_concurrent_reload();
+    ret |= test_fault_attribution();
+    ret |= test_signal_attribution();
+    ret |= test_libc_fault_attribution();
+    ret |= test_abort_attribution();
+
+    if (ret == 0) {
+        printf("all module map tests passed\n");
+    }
+
+    return ret;
+}
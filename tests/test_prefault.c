@@ -0,0 +1,128 @@
+#include "../module_loader.h"
+#include "../prefault.h"
+
+#include <stdio.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_FIXTURE "tests/fixtures/test_mod_big.so"
+
+/* calls every function of the fixture, each answers its own increasing id */
+static int call_all(module_loader_t *loader)
+{
+    int (*call)(int, int);
+    void *symbol = NULL;
+    int last = 0;
+    int i;
+
+    if (module_loader_get_symbol(loader, "big_call", &symbol) != MODULE_ERR_SUCCESS) {
+        return -1;
+    }
+    *(void **)&call = symbol;
+    for (i = 0; i < 64; i++) {
+        if (call(i, 0) <= last) {
+            break;
+        }
+        last = call(i, 0);
+    }
+    module_loader_put_ref(loader);
+    return i == 64 ? 0 : -1;
+}
+
+static int test_plain_load(void)
+{
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    TEST_ASSERT(module_loader_load(loader, TEST_FIXTURE, NULL) == MODULE_ERR_SUCCESS,
+            "load should succeed");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS,
+            "stats should succeed");
+    TEST_ASSERT(stats.prefault_bytes == 0U && stats.huge_text_bytes == 0U,
+            "nothing is prefaulted without the flag");
+    TEST_ASSERT(call_all(loader) == 0, "calls should work");
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_prefault_load(void)
+{
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    TEST_ASSERT(module_loader_set_load_flags(loader, MODULE_LOAD_PREFAULT) ==
+            MODULE_ERR_SUCCESS, "set_load_flags should succeed");
+    TEST_ASSERT(module_loader_load(loader, TEST_FIXTURE, NULL) == MODULE_ERR_SUCCESS,
+            "load should succeed");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS,
+            "stats should succeed");
+    /* 64 functions on 64 KiB boundaries */
+    TEST_ASSERT(stats.prefault_bytes >= 64U * 65536U, "the whole text should be prefaulted");
+    TEST_ASSERT(stats.huge_text_bytes == 0U, "no huge pages unless asked");
+    TEST_ASSERT(call_all(loader) == 0, "calls should work");
+
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS,
+            "stats should succeed");
+    TEST_ASSERT(stats.prefault_bytes == 0U, "unload should reset the counters");
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_huge_text(void)
+{
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    TEST_ASSERT(module_loader_set_load_flags(loader, MODULE_LOAD_HUGE_TEXT) ==
+            MODULE_ERR_SUCCESS, "set_load_flags should succeed");
+    TEST_ASSERT(module_loader_load(loader, TEST_FIXTURE, NULL) == MODULE_ERR_SUCCESS,
+            "load should succeed");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS,
+            "stats should succeed");
+    /* huge pages depend on the kernel and filesystem, prefaulting does not */
+    TEST_ASSERT(stats.prefault_bytes > 0U, "huge text implies prefault");
+    TEST_ASSERT(stats.huge_text_bytes <= stats.prefault_bytes,
+            "huge text is part of the prefaulted image");
+    TEST_ASSERT(call_all(loader) == 0, "calls should work");
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_invalid(void)
+{
+    prefault_result_t result;
+
+    TEST_ASSERT(prefault_image(NULL, false, &result) == -1, "NULL handle should fail");
+    TEST_ASSERT(module_loader_set_load_flags(NULL, MODULE_LOAD_PREFAULT) ==
+            MODULE_ERR_INVALID_PARAM, "NULL loader should fail");
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_plain_load();
+    ret |= test_prefault_load();
+    ret |= test_huge_text();
+    ret |= test_invalid();
+
+    if (ret == 0) {
+        printf("all prefault tests passed\n");
+    }
+
+    return ret;
+}
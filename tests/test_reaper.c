@@ -0,0 +1,236 @@
+#include "../module_loader.h"
+#include "../module_reaper.h"
+#include "../module_interface.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_FIXTURE "tests/fixtures/test_mod_lazy.so"
+#define TEST_EAGER_FIXTURE "tests/fixtures/test_mod_good.so"
+#define MS 1000000ULL
+#define TEST_HANG_SEC 10U
+
+/* same layout as in tests/fixtures/test_mod_lazy.c */
+typedef struct {
+    atomic_int inits;
+} test_lazy_counters_t;
+
+static void sleep_ms(uint32_t ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ms / 1000U);
+    ts.tv_nsec = (long)(ms % 1000U) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static module_loader_t *create_lazy(test_lazy_counters_t *counters)
+{
+    module_init_args_t args;
+    module_loader_t *loader;
+
+    loader = module_loader_create();
+    if (loader == NULL) {
+        return NULL;
+    }
+    memset(&args, 0, sizeof(args));
+    args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    args.user_data = counters;
+    if (module_loader_register_lazy(loader, TEST_FIXTURE, &args) != MODULE_ERR_SUCCESS) {
+        module_loader_destroy(loader);
+        return NULL;
+    }
+    return loader;
+}
+
+static int test_reap_idle(void)
+{
+    test_lazy_counters_t counters = {0};
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+    module_symbol_t sym;
+    module_symbol_t old;
+
+    loader = create_lazy(&counters);
+    TEST_ASSERT(loader != NULL, "lazy loader should be created");
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_NOT_LOADED,
+            "nothing to reap before first use");
+
+    TEST_ASSERT(module_loader_get_ref(loader) == MODULE_ERR_SUCCESS, "first use should load");
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_IN_USE,
+            "a call since the last look counts as use");
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_IN_USE,
+            "a held reference keeps the module");
+    module_loader_put_ref(loader);
+    TEST_ASSERT(module_loader_reap_idle(loader, 1000U * MS) == MODULE_ERR_IN_USE,
+            "not idle for long enough");
+
+    TEST_ASSERT(module_loader_resolve(loader, "lazy_answer", &sym) == MODULE_ERR_SUCCESS,
+            "resolve should succeed");
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_SUCCESS, "pin should succeed");
+    module_loader_reap_idle(loader, 0U);
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_IN_USE,
+            "a call in flight keeps the module");
+    module_symbol_unpin(&sym);
+
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_SUCCESS,
+            "an idle module should be reaped");
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_UNLOADED, "module unloaded");
+    TEST_ASSERT(module_loader_is_lazy(loader), "the registration stays");
+    module_loader_get_stats(loader, &stats);
+    TEST_ASSERT(stats.idle_unload_count == 1U && stats.unload_count == 1U,
+            "reap counts as an idle unload");
+    TEST_ASSERT(module_symbol_pin(&sym) != MODULE_ERR_SUCCESS, "old handles stop working");
+
+    old = sym;
+    TEST_ASSERT(module_loader_resolve(loader, "lazy_answer", &sym) == MODULE_ERR_SUCCESS,
+            "next use should reload");
+    TEST_ASSERT(atomic_load(&counters.inits) == 2, "module_init should run again");
+    TEST_ASSERT(module_symbol_pin(&old) == MODULE_ERR_STALE_HANDLE,
+            "handle of the reaped instance is stale");
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_SUCCESS, "new handle should work");
+    module_symbol_unpin(&sym);
+
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload should succeed");
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_NOT_LOADED,
+            "nothing to reap after unload");
+    module_loader_destroy(loader);
+    return 0;
+}
+
+/* a pin left behind by a caller that faulted in the module never drops */
+static int test_stuck_pin(void)
+{
+    test_lazy_counters_t counters = {0};
+    module_init_args_t args;
+    module_loader_t *loader;
+    module_symbol_t sym;
+    module_loader_stats_t stats;
+
+    /* a hang fails the test instead of the whole run */
+    alarm(TEST_HANG_SEC);
+
+    loader = create_lazy(&counters);
+    TEST_ASSERT(loader != NULL, "lazy loader should be created");
+    TEST_ASSERT(module_loader_resolve(loader, "lazy_answer", &sym) == MODULE_ERR_SUCCESS,
+            "resolve should succeed");
+    TEST_ASSERT(module_symbol_pin(&sym) == MODULE_ERR_SUCCESS, "pin should succeed");
+
+    TEST_ASSERT(module_loader_signal_crash(loader), "crash should be flagged");
+    TEST_ASSERT(module_loader_mark_crashed(loader) == MODULE_ERR_SUCCESS, "mark crashed");
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS,
+            "crashed unload gives up on the pin");
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS &&
+            stats.stuck_calls == 1U, "the stuck pin is counted");
+
+    memset(&args, 0, sizeof(args));
+    args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    args.user_data = &counters;
+    TEST_ASSERT(module_loader_register_lazy(loader, TEST_FIXTURE, &args) == MODULE_ERR_SUCCESS,
+            "register again");
+    TEST_ASSERT(module_loader_get_ref(loader) == MODULE_ERR_SUCCESS, "reload on use");
+    module_loader_put_ref(loader);
+
+    module_loader_reap_idle(loader, 0U);
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_SUCCESS,
+            "the stuck pin does not keep the reloaded module");
+    TEST_ASSERT(module_loader_get_ref(loader) == MODULE_ERR_SUCCESS, "reload after reap");
+    module_loader_put_ref(loader);
+    TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS,
+            "a normal unload does not wait for the stuck pin");
+
+    alarm(0U);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_reap_eager(void)
+{
+    module_loader_t *loader;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader should be created");
+    TEST_ASSERT(module_loader_load(loader, TEST_EAGER_FIXTURE, NULL) == MODULE_ERR_SUCCESS,
+            "load should succeed");
+    module_loader_reap_idle(loader, 0U);
+    TEST_ASSERT(module_loader_reap_idle(loader, 0U) == MODULE_ERR_NOT_LOADED,
+            "without a registration the module is never reaped");
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_LOADED, "module stays loaded");
+    module_loader_destroy(loader);
+    return 0;
+}
+
+static int test_reaper_thread(void)
+{
+    test_lazy_counters_t counters = {0};
+    module_reaper_stats_t stats;
+    module_reaper_t *reaper;
+    module_loader_t *loader;
+    int i;
+
+    TEST_ASSERT(module_reaper_create(0U, 0U) == NULL, "idle time must be positive");
+    loader = create_lazy(&counters);
+    TEST_ASSERT(loader != NULL, "lazy loader should be created");
+    reaper = module_reaper_create(50U, 10U);
+    TEST_ASSERT(reaper != NULL, "reaper should start");
+    TEST_ASSERT(module_reaper_add(reaper, loader) == MODULE_ERR_SUCCESS, "add should succeed");
+
+    /* called every 5 ms, never idle for 50 */
+    for (i = 0; i < 30; i++) {
+        TEST_ASSERT(module_loader_call_hello(loader) == MODULE_ERR_SUCCESS,
+                "call should succeed");
+        sleep_ms(5U);
+    }
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_LOADED,
+            "a busy module should stay loaded");
+    TEST_ASSERT(atomic_load(&counters.inits) == 1, "a busy module loads once");
+
+    sleep_ms(300U);
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_UNLOADED,
+            "an idle module should be reaped");
+    module_reaper_get_stats(reaper, &stats);
+    TEST_ASSERT(stats.reaped == 1U && stats.scans > 0U && stats.loaders == 1U,
+            "reaper stats should count the reap");
+
+    TEST_ASSERT(module_loader_call_hello(loader) == MODULE_ERR_SUCCESS,
+            "next call should reload transparently");
+    TEST_ASSERT(atomic_load(&counters.inits) == 2, "module_init should run again");
+
+    module_reaper_remove(reaper, loader);
+    module_reaper_get_stats(reaper, &stats);
+    TEST_ASSERT(stats.loaders == 0U, "remove should stop watching");
+    sleep_ms(150U);
+    TEST_ASSERT(module_loader_get_state(loader) == MODULE_STATE_LOADED,
+            "a removed loader is left alone");
+
+    module_reaper_destroy(reaper);
+    module_loader_destroy(loader);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_reap_idle();
+    ret |= test_reap_eager();
+    ret |= test_stuck_pin();
+    ret |= test_reaper_thread();
+
+    if (ret == 0) {
+        printf("all reaper tests passed\n");
+    }
+
+    return ret;
+}
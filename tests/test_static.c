@@ -0,0 +1,189 @@
+#include "../batcher.h"
+#include "../host_arena.h"
+#include "../module_loader.h"
+#include "../static_pool.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define TEST_LOAD_CYCLES 100
+
+#ifndef KMODLIKE_STATIC
+#error "tests/test_static.c is built with -DKMODLIKE_STATIC"
+#endif
+
+/*
+ * the binary is linked with --wrap for the allocator, so every call made by
+ * the loader sources lands here; calls inside libc (dlopen) are not counted
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t align, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+int __wrap_posix_memalign(void **ptr, size_t align, size_t size);
+
+static atomic_int g_alloc_calls;
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add(&g_alloc_calls, 1);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add(&g_alloc_calls, 1);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&g_alloc_calls, 1);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t align, size_t size)
+{
+    atomic_fetch_add(&g_alloc_calls, 1);
+    return __real_posix_memalign(ptr, align, size);
+}
+
+static int test_loader_pool(void)
+{
+    module_loader_t *loaders[KMODLIKE_STATIC_LOADERS];
+    uint32_t i;
+
+    for (i = 0U; i < KMODLIKE_STATIC_LOADERS; i++) {
+        loaders[i] = module_loader_create();
+        TEST_ASSERT(loaders[i] != NULL, "loader from the pool");
+    }
+    TEST_ASSERT(module_loader_create() == NULL, "pool exhausted");
+
+    module_loader_destroy(loaders[0]);
+    loaders[0] = module_loader_create();
+    TEST_ASSERT(loaders[0] != NULL, "slot reused");
+    TEST_ASSERT(module_loader_get_state(loaders[0]) == MODULE_STATE_UNLOADED,
+            "reused slot starts clean");
+
+    for (i = 0U; i < KMODLIKE_STATIC_LOADERS; i++) {
+        module_loader_destroy(loaders[i]);
+    }
+    return 0;
+}
+
+static int test_arena_chunks(void)
+{
+    host_arena_stats_t stats;
+    host_arena_t *arena;
+    host_arena_t *other;
+    uint64_t blocks = 0U;
+    void *large;
+
+    arena = host_arena_create();
+    TEST_ASSERT(arena != NULL, "arena from the pool");
+    TEST_ASSERT(host_arena_alloc(arena, HOST_ARENA_CHUNK_SIZE) == NULL,
+            "large blocks are limited to one chunk");
+    large = host_arena_alloc(arena, HOST_ARENA_CHUNK_SIZE / 2U);
+    TEST_ASSERT(large != NULL, "large block within a chunk");
+    host_arena_free(arena, large);
+
+    /* every chunk of the build, then nothing */
+    while (host_arena_alloc(arena, HOST_ARENA_MAX_SMALL) != NULL) {
+        blocks++;
+    }
+    host_arena_get_stats(arena, &stats);
+    TEST_ASSERT(stats.reserved_bytes ==
+            (uint64_t)KMODLIKE_STATIC_ARENA_CHUNKS * HOST_ARENA_CHUNK_SIZE,
+            "all chunks taken");
+    TEST_ASSERT(blocks > 0U, "small blocks");
+
+    other = host_arena_create();
+    TEST_ASSERT(other != NULL, "second arena");
+    TEST_ASSERT(host_arena_alloc(other, 64U) == NULL, "chunks are shared");
+
+    /* bulk release returns the chunks to the pool */
+    host_arena_destroy(arena);
+    TEST_ASSERT(host_arena_alloc(other, 64U) != NULL, "chunks back after destroy");
+    host_arena_destroy(other);
+    return 0;
+}
+
+static int test_batcher_pool(void)
+{
+    batcher_t *batchers[KMODLIKE_STATIC_BATCHERS];
+    module_loader_t *loader;
+    uint32_t i;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader");
+    TEST_ASSERT(batcher_create(loader, KMODLIKE_STATIC_BATCH_ITEMS + 1U, 0U, NULL, NULL) ==
+            NULL, "batch larger than a slot");
+    for (i = 0U; i < KMODLIKE_STATIC_BATCHERS; i++) {
+        batchers[i] = batcher_create(loader, KMODLIKE_STATIC_BATCH_ITEMS, 0U, NULL, NULL);
+        TEST_ASSERT(batchers[i] != NULL, "batcher from the pool");
+    }
+    TEST_ASSERT(batcher_create(loader, 1U, 0U, NULL, NULL) == NULL, "pool exhausted");
+    for (i = 0U; i < KMODLIKE_STATIC_BATCHERS; i++) {
+        batcher_destroy(batchers[i]);
+    }
+    module_loader_destroy(loader);
+    return 0;
+}
+
+/* arenas and chunks go back to their pools on every unload */
+static int test_load_cycles(void)
+{
+    module_init_args_t init_args;
+    module_loader_stats_t stats;
+    module_loader_t *loader;
+    int has_alloc = 0;
+    int i;
+
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.user_data = &has_alloc;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "loader");
+    for (i = 0; i < TEST_LOAD_CYCLES; i++) {
+        TEST_ASSERT(module_loader_load(loader, "tests/fixtures/test_mod_arena.so",
+                &init_args) == MODULE_ERR_SUCCESS, "load");
+        TEST_ASSERT(module_loader_call_hello(loader) != MODULE_ERR_DLOPEN_FAILED, "call");
+        TEST_ASSERT(module_loader_unload(loader) == MODULE_ERR_SUCCESS, "unload");
+    }
+    TEST_ASSERT(module_loader_get_stats(loader, &stats) == MODULE_ERR_SUCCESS, "stats");
+    TEST_ASSERT(stats.load_count == TEST_LOAD_CYCLES, "every load succeeded");
+    module_loader_destroy(loader);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    ret |= test_loader_pool();
+    ret |= test_arena_chunks();
+    ret |= test_batcher_pool();
+    ret |= test_load_cycles();
+
+    printf("allocator calls from loader code: %d\n", atomic_load(&g_alloc_calls));
+    TEST_ASSERT(atomic_load(&g_alloc_calls) == 0, "no allocation in the static build");
+
+    if (ret == 0) {
+        printf("all static build tests passed\n");
+    }
+
+    return ret;
+}
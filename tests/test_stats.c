@@ -0,0 +1,224 @@
+#include "../module_loader.h"
+#include "../stats.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "test failed: %s:%d: %s\n", __FILE__, __LINE__, msg); \
+            return 1; \
+        } \
+    } while (0)
+
+#define WRITER_ITERATIONS 200000
+
+static char g_name[64];
+static atomic_bool g_writer_done = ATOMIC_VAR_INIT(false);
+
+static int get_time_impl(struct timespec *ts)
+{
+    if (ts == NULL) {
+        return -1;
+    }
+    return clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static int test_publish_and_read(void)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    const stats_segment_t *seg;
+    stats_segment_t snap;
+    module_error_t err;
+
+    loader = module_loader_create();
+    TEST_ASSERT(loader != NULL, "module_loader_create failed");
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    err = module_loader_load(loader, "tests/fixtures/test_mod_good.so", &init_args);
+    TEST_ASSERT(err == MODULE_ERR_SUCCESS, "load should succeed");
+    TEST_ASSERT(module_loader_call_hello(loader) == MODULE_ERR_SUCCESS, "call_hello");
+    TEST_ASSERT(module_loader_mark_crashed(loader) == MODULE_ERR_SUCCESS, "mark_crashed");
+
+    stats_publish_loader(STATS_DEFAULT_SLOT, loader);
+    stats_record_rpc(1500U, 10U, false);
+    stats_record_rpc(3000U, 20U, true);
+    stats_record_module_call(STATS_DEFAULT_SLOT, 700U);
+
+    seg = stats_open_reader(g_name);
+    TEST_ASSERT(seg != NULL, "reader should map the segment");
+    TEST_ASSERT(stats_read_snapshot(seg, &snap) == 0, "snapshot should succeed");
+
+    TEST_ASSERT(snap.pid == (int32_t)getpid(), "pid published");
+    TEST_ASSERT(snap.module_count == 1U, "one module slot in use");
+    TEST_ASSERT(snap.modules[0].state == MODULE_STATE_LOADED, "module state");
+    TEST_ASSERT(snap.modules[0].load_count == 1U, "load count");
+    TEST_ASSERT(snap.modules[0].crash_count == 1U, "crash count");
+    TEST_ASSERT(snap.modules[0].calls == 1U, "call count");
+    TEST_ASSERT(strstr(snap.modules[0].path, "test_mod_good.so") != NULL, "module path");
+    TEST_ASSERT(snap.modules[0].call_latency.count == 1U, "module call latency");
+    TEST_ASSERT(snap.rpc.requests == 2U, "rpc requests");
+    TEST_ASSERT(snap.rpc.errors == 1U, "rpc errors");
+    TEST_ASSERT(snap.rpc.bytes_in == 30U, "rpc bytes");
+    TEST_ASSERT(snap.rpc.latency.min_ns == 1500U, "rpc latency min");
+    TEST_ASSERT(snap.rpc.latency.max_ns == 3000U, "rpc latency max");
+
+    err = module_loader_unload(loader);
+    TEST_ASSERT(err == MODULE_ERR_SUCCESS, "unload should succeed");
+    stats_publish_loader(STATS_DEFAULT_SLOT, loader);
+    TEST_ASSERT(stats_read_snapshot(seg, &snap) == 0, "snapshot should succeed");
+    TEST_ASSERT(snap.modules[0].state == MODULE_STATE_UNLOADED, "state after unload");
+    TEST_ASSERT(snap.modules[0].unload_count == 1U, "unload count");
+
+    stats_close_reader(seg);
+    module_loader_destroy(loader);
+
+    return 0;
+}
+
+static int test_publish_memory(void)
+{
+    module_loader_t *slots[3] = { NULL, NULL, NULL };
+    module_init_args_t init_args;
+    const stats_segment_t *seg;
+    stats_segment_t snap;
+    uint32_t i;
+
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.get_time = get_time_impl;
+
+    slots[0] = module_loader_create();
+    slots[2] = module_loader_create();
+    TEST_ASSERT(slots[0] != NULL && slots[2] != NULL, "module_loader_create failed");
+    TEST_ASSERT(module_loader_load(slots[0], "tests/fixtures/test_mod_good.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load first module");
+    TEST_ASSERT(module_loader_load(slots[2], "tests/fixtures/test_mod_ops.so",
+            &init_args) == MODULE_ERR_SUCCESS, "load second module");
+
+    /* one smaps pass fills every slot that has a loader */
+    stats_publish_memory(slots, 3U);
+
+    seg = stats_open_reader(g_name);
+    TEST_ASSERT(seg != NULL, "reader should map the segment");
+    TEST_ASSERT(stats_read_snapshot(seg, &snap) == 0, "snapshot should succeed");
+    TEST_ASSERT(snap.modules[0].rss_kb > 0U, "first module image resident");
+    TEST_ASSERT(snap.modules[1].rss_kb == 0U, "slot without loader untouched");
+    TEST_ASSERT(snap.modules[2].rss_kb > 0U, "second module image resident");
+    TEST_ASSERT(snap.process_rss_kb >= snap.modules[0].rss_kb + snap.modules[2].rss_kb,
+            "process rss covers the images");
+
+    /* an unloaded module has no image left */
+    TEST_ASSERT(module_loader_unload(slots[2]) == MODULE_ERR_SUCCESS, "unload");
+    stats_publish_memory(slots, 3U);
+    TEST_ASSERT(stats_read_snapshot(seg, &snap) == 0, "snapshot should succeed");
+    TEST_ASSERT(snap.modules[0].rss_kb > 0U, "first module still resident");
+    TEST_ASSERT(snap.modules[2].rss_kb == 0U, "unloaded module has no rss");
+
+    stats_close_reader(seg);
+    for (i = 0U; i < 3U; i++) {
+        module_loader_destroy(slots[i]);
+    }
+
+    return 0;
+}
+
+static int test_percentiles(void)
+{
+    stats_latency_t lat;
+    int i;
+
+    memset(&lat, 0, sizeof(lat));
+    lat.min_ns = UINT64_MAX;
+
+    for (i = 0; i < 99; i++) {
+        stats_latency_add(&lat, 1000U);
+    }
+    stats_latency_add(&lat, 1000000U);
+
+    TEST_ASSERT(stats_latency_percentile(&lat, 50.0) <= 2048U, "p50 in 1us bucket");
+    TEST_ASSERT(stats_latency_percentile(&lat, 99.0) <= 2048U, "p99 in 1us bucket");
+    TEST_ASSERT(stats_latency_percentile(&lat, 100.0) == 1000000U, "p100 is max");
+
+    return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+    int i;
+
+    (void)arg;
+
+    for (i = 0; i < WRITER_ITERATIONS; i++) {
+        stats_record_rpc(1U, 1U, false);
+    }
+    atomic_store(&g_writer_done, true);
+    return NULL;
+}
+
+static int test_consistent_snapshots(void)
+{
+    const stats_segment_t *seg;
+    stats_segment_t base;
+    stats_segment_t snap;
+    pthread_t thread;
+    int snapshots = 0;
+
+    seg = stats_open_reader(g_name);
+    TEST_ASSERT(seg != NULL, "reader should map the segment");
+    TEST_ASSERT(stats_read_snapshot(seg, &base) == 0, "baseline snapshot");
+
+    TEST_ASSERT(pthread_create(&thread, NULL, writer_thread, NULL) == 0, "pthread_create");
+
+    while (!atomic_load(&g_writer_done)) {
+        if (stats_read_snapshot(seg, &snap) != 0) {
+            continue;
+        }
+        /* every counter is bumped in one write section */
+        TEST_ASSERT(snap.rpc.bytes_in - base.rpc.bytes_in ==
+                snap.rpc.requests - base.rpc.requests, "torn byte count");
+        TEST_ASSERT(snap.rpc.latency.count == snap.rpc.requests, "torn latency count");
+        snapshots++;
+    }
+
+    pthread_join(thread, NULL);
+    stats_close_reader(seg);
+
+    printf("stats: %d consistent snapshots during concurrent writes\n", snapshots);
+    return 0;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    snprintf(g_name, sizeof(g_name), "/kmodlike_test_stats_%d", (int)getpid());
+    if (stats_init(g_name) != 0) {
+        fprintf(stderr, "test failed: stats_init\n");
+        return 1;
+    }
+
+    ret |= test_publish_and_read();
+    ret |= test_publish_memory();
+    ret |= test_percentiles();
+    ret |= test_consistent_snapshots();
+
+    stats_deinit();
+
+    if (ret == 0) {
+        printf("all stats tests passed\n");
+    }
+
+    return ret;
+}
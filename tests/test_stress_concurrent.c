@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,8 @@
 #define NUM_THREADS 5
 #define ITERATIONS_PER_THREAD 20
 #define TEST_MODULE_PATH "tests/fixtures/test_mod_good.so"
+#define RELOAD_CYCLES 50
+#define RELOAD_INTERVAL_US 2000
 
 typedef struct {
     module_loader_t *loader;
@@ -279,6 +282,113 @@ static int test_concurrent_call_hello(void)
     return ret;
 }
 
+static atomic_bool g_reloads_done = ATOMIC_VAR_INIT(false);
+static atomic_int g_stale_count = ATOMIC_VAR_INIT(0);
+
+static void *stress_pinned_call_thread(void *arg)
+{
+    thread_arg_t *targ = (thread_arg_t *)arg;
+    module_symbol_t sym;
+    module_error_t err;
+    bool resolved = false;
+
+    while (!atomic_load(&g_reloads_done)) {
+        if (!resolved) {
+            resolved = module_loader_resolve(targ->loader, "mod_hello", &sym) ==
+                    MODULE_ERR_SUCCESS;
+            if (!resolved) {
+                continue;
+            }
+        }
+
+        err = module_symbol_pin(&sym);
+        if (err == MODULE_ERR_SUCCESS) {
+            /* unload must not dlclose under a pinned call */
+            ((void (*)(void))sym.addr)();
+            module_symbol_unpin(&sym);
+            atomic_fetch_add(targ->success_count, 1);
+        } else if (err == MODULE_ERR_STALE_HANDLE) {
+            atomic_fetch_add(&g_stale_count, 1);
+            resolved = false;
+        } else if (err != MODULE_ERR_NOT_LOADED) {
+            atomic_fetch_add(targ->error_count, 1);
+        }
+    }
+
+    return NULL;
+}
+
+static int test_pinned_calls_during_reload(void)
+{
+    module_loader_t *loader;
+    module_init_args_t init_args;
+    pthread_t threads[NUM_THREADS];
+    thread_arg_t args[NUM_THREADS];
+    atomic_int success_count = ATOMIC_VAR_INIT(0);
+    atomic_int error_count = ATOMIC_VAR_INIT(0);
+    int created = 0;
+    int reloads = 0;
+    int i;
+
+    loader = module_loader_create();
+    if (loader == NULL) {
+        fprintf(stderr, "failed to create module loader\n");
+        return 1;
+    }
+
+    init_args.version = MODULE_INIT_ARGS_VERSION_CURRENT;
+    init_args.log = NULL;
+    init_args.get_time = get_time_impl;
+    init_args.user_data = NULL;
+
+    if (module_loader_load(loader, TEST_MODULE_PATH, &init_args) != MODULE_ERR_SUCCESS) {
+        fprintf(stderr, "failed to load module for test\n");
+        module_loader_destroy(loader);
+        return 1;
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        args[i].loader = loader;
+        args[i].thread_id = i;
+        args[i].success_count = &success_count;
+        args[i].error_count = &error_count;
+
+        if (pthread_create(&threads[i], NULL, stress_pinned_call_thread, &args[i]) != 0) {
+            fprintf(stderr, "failed to create thread %d\n", i);
+            break;
+        }
+        created++;
+    }
+
+    for (i = 0; i < RELOAD_CYCLES; i++) {
+        usleep(RELOAD_INTERVAL_US);
+        if (module_loader_unload(loader) == MODULE_ERR_SUCCESS &&
+                module_loader_load(loader, TEST_MODULE_PATH, &init_args) ==
+                MODULE_ERR_SUCCESS) {
+            reloads++;
+        }
+    }
+    atomic_store(&g_reloads_done, true);
+
+    for (i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    printf("pinned calls during reload: calls=%d stale=%d reloads=%d errors=%d\n",
+            atomic_load(&success_count), atomic_load(&g_stale_count), reloads,
+            atomic_load(&error_count));
+
+    module_loader_destroy(loader);
+
+    if (created != NUM_THREADS || reloads != RELOAD_CYCLES ||
+            atomic_load(&error_count) != 0 || atomic_load(&success_count) == 0 ||
+            atomic_load(&g_stale_count) == 0) {
+        fprintf(stderr, "pinned call test failed\n");
+        return 1;
+    }
+
+    return 0;
+}
 
 int main(void)
 {
@@ -289,6 +399,7 @@ int main(void)
     ret |= test_concurrent_load_unload();
     ret |= test_concurrent_get_symbol();
     ret |= test_concurrent_call_hello();
+    ret |= test_pinned_calls_during_reload();
 
     if (ret == 0) {
         printf("all stress tests passed\n");
@@ -0,0 +1,243 @@
+#include "top.h"
+#include "module_loader.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TOP_NS_BUF 16U
+
+static atomic_bool g_top_stop = ATOMIC_VAR_INIT(false);
+
+/* snapshots are large, keep them off the stack */
+static stats_segment_t g_cur;
+static stats_segment_t g_prev;
+
+static void top_sigint_handler(int sig)
+{
+    (void)sig;
+    atomic_store(&g_top_stop, true);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static const char *fmt_ns(uint64_t ns, char *buf, size_t size)
+{
+    if (ns == 0U) {
+        snprintf(buf, size, "-");
+    } else if (ns < 1000U) {
+        snprintf(buf, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000U) {
+        snprintf(buf, size, "%.1fus", (double)ns / 1e3);
+    } else if (ns < 1000000000U) {
+        snprintf(buf, size, "%.1fms", (double)ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fs", (double)ns / 1e9);
+    }
+    return buf;
+}
+
+static const char *state_name(uint32_t state)
+{
+    switch (state) {
+    case MODULE_STATE_LOADED:
+        return "loaded";
+    case MODULE_STATE_UNLOADED:
+        return "unloaded";
+    case MODULE_STATE_DRAINING:
+        return "draining";
+    case MODULE_STATE_CRASHED:
+        return "crashed";
+    default:
+        return "unknown";
+    }
+}
+
+/* histogram of samples added between two snapshots */
+static void latency_window(const stats_latency_t *cur, const stats_latency_t *prev,
+        stats_latency_t *out)
+{
+    uint32_t i;
+
+    memset(out, 0, sizeof(*out));
+    out->count = cur->count - prev->count;
+    out->sum_ns = cur->sum_ns - prev->sum_ns;
+    out->min_ns = cur->min_ns;
+    out->max_ns = cur->max_ns;
+    for (i = 0U; i < STATS_LATENCY_BUCKETS; i++) {
+        out->buckets[i] = cur->buckets[i] - prev->buckets[i];
+    }
+
+    /* no new samples in this window: fall back to totals */
+    if (out->count == 0U) {
+        *out = *cur;
+    }
+}
+
+static void render(const stats_segment_t *cur, const stats_segment_t *prev,
+        bool have_prev, double dt_sec, bool tty)
+{
+    stats_latency_t win;
+    char b1[TOP_NS_BUF];
+    char b2[TOP_NS_BUF];
+    char b3[TOP_NS_BUF];
+    double rate;
+    uint32_t i;
+    bool alive;
+
+    alive = (kill((pid_t)cur->pid, 0) == 0 || errno == EPERM);
+
+    if (tty) {
+        fputs("\033[H\033[2J", stdout);
+    }
+
+    rate = (have_prev && dt_sec > 0.0) ?
+        (double)(cur->rpc.requests - prev->rpc.requests) / dt_sec : 0.0;
+    if (have_prev) {
+        latency_window(&cur->rpc.latency, &prev->rpc.latency, &win);
+    } else {
+        win = cur->rpc.latency;
+    }
+
+    printf("kmodlike top - pid %d%s  uptime %llus  rss %llu kB\n",
+            (int)cur->pid, alive ? "" : " (not running)",
+            (unsigned long long)((cur->update_ns - cur->start_ns) / 1000000000ULL),
+            (unsigned long long)cur->process_rss_kb);
+    printf("rpc: %llu requests (%llu errors)  %.1f req/s  p50 %s  p99 %s  max %s\n\n",
+            (unsigned long long)cur->rpc.requests, (unsigned long long)cur->rpc.errors,
+            rate, fmt_ns(stats_latency_percentile(&win, 50.0), b1, sizeof(b1)),
+            fmt_ns(stats_latency_percentile(&win, 99.0), b2, sizeof(b2)),
+            fmt_ns(win.max_ns, b3, sizeof(b3)));
+
+    printf("%-4s %-9s %9s %8s %8s %6s %6s %6s %8s %8s  %s\n",
+            "SLOT", "STATE", "CALLS/s", "P50", "P99", "LOADS", "CRASH", "REFS",
+            "RSS(kB)", "HEAP(kB)", "PATH");
+
+    for (i = 0U; i < cur->module_count && i < STATS_MAX_MODULES; i++) {
+        const stats_module_t *m = &cur->modules[i];
+
+        if (m->in_use == 0U) {
+            continue;
+        }
+
+        rate = (have_prev && dt_sec > 0.0) ?
+            (double)(m->calls - prev->modules[i].calls) / dt_sec : 0.0;
+        if (have_prev) {
+            latency_window(&m->call_latency, &prev->modules[i].call_latency, &win);
+        } else {
+            win = m->call_latency;
+        }
+
+        /* only the daemon's own calls are timed, leave the columns empty
+         * for modules it never called rather than showing a zero latency */
+        if (m->call_latency.count == 0U) {
+            b1[0] = '\0';
+            b2[0] = '\0';
+        } else {
+            fmt_ns(stats_latency_percentile(&win, 50.0), b1, sizeof(b1));
+            fmt_ns(stats_latency_percentile(&win, 99.0), b2, sizeof(b2));
+        }
+
+        printf("%-4u %-9s %9.1f %8s %8s %6llu %6llu %6lld %8llu %8llu  %s\n",
+                i, state_name(m->state), rate, b1, b2,
+                (unsigned long long)m->load_count,
+                (unsigned long long)m->crash_count,
+                (long long)m->ref_count,
+                (unsigned long long)m->rss_kb,
+                (unsigned long long)(m->heap_bytes / 1024U),
+                m->path[0] != '\0' ? m->path : "-");
+    }
+
+    if ((cur->lock_flags & STATS_LOCK_COMPILED) != 0U) {
+        printf("\n%-18s %9s %7s %8s %8s\n", "LOCK SITE", "ACQ/s", "CONT%", "WAIT P99",
+                "HOLD P99");
+        for (i = 0U; i < cur->lock_count && i < STATS_MAX_LOCK_SITES; i++) {
+            const stats_lock_t *lk = &cur->locks[i];
+
+            if (lk->acquisitions == 0U) {
+                continue;
+            }
+            rate = (have_prev && dt_sec > 0.0) ?
+                (double)(lk->acquisitions - prev->locks[i].acquisitions) / dt_sec : 0.0;
+            printf("%-18s %9.1f %6.2f%% %8s %8s\n", lk->name, rate,
+                    100.0 * (double)lk->contended / (double)lk->acquisitions,
+                    fmt_ns(stats_latency_percentile(&lk->wait, 99.0), b1, sizeof(b1)),
+                    fmt_ns(stats_latency_percentile(&lk->hold, 99.0), b2, sizeof(b2)));
+        }
+    }
+
+    if (!tty) {
+        putchar('\n');
+    }
+    fflush(stdout);
+}
+
+int top_run(const char *shm_name, uint32_t interval_ms, uint32_t iterations)
+{
+    const stats_segment_t *seg;
+    struct sigaction sa;
+    struct timespec ts;
+    uint64_t t_prev = 0U;
+    uint64_t t_cur;
+    uint32_t n = 0U;
+    bool have_prev = false;
+    bool tty;
+
+    seg = stats_open_reader(shm_name);
+    if (seg == NULL) {
+        fprintf(stderr, "stats segment %s not available, is the daemon running?\n",
+                shm_name != NULL ? shm_name : STATS_SHM_DEFAULT_NAME);
+        return 1;
+    }
+
+    if (interval_ms == 0U) {
+        interval_ms = TOP_DEFAULT_INTERVAL_MS;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = top_sigint_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    tty = (isatty(STDOUT_FILENO) != 0);
+
+    while (!atomic_load(&g_top_stop)) {
+        if (stats_read_snapshot(seg, &g_cur) != 0) {
+            fprintf(stderr, "stats segment is invalid or busy\n");
+            stats_close_reader(seg);
+            return 1;
+        }
+        t_cur = now_ns();
+
+        render(&g_cur, &g_prev, have_prev, (double)(t_cur - t_prev) / 1e9, tty);
+
+        g_prev = g_cur;
+        t_prev = t_cur;
+        have_prev = true;
+
+        n++;
+        if (iterations != 0U && n >= iterations) {
+            break;
+        }
+
+        ts.tv_sec = (time_t)(interval_ms / 1000U);
+        ts.tv_nsec = (long)(interval_ms % 1000U) * 1000000L;
+        nanosleep(&ts, NULL);
+    }
+
+    stats_close_reader(seg);
+    return 0;
+}
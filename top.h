@@ -0,0 +1,18 @@
+#ifndef TOP_H
+#define TOP_H
+
+#include <stdint.h>
+
+#define TOP_DEFAULT_INTERVAL_MS 1000U
+
+/**
+ * live monitor reading the daemon's stats segment
+ * refreshes every interval_ms until interrupted or iterations are done
+ * @param shm_name stats segment name or NULL for the default
+ * @param interval_ms refresh interval in milliseconds
+ * @param iterations number of refreshes, 0 runs until SIGINT
+ * @return 0 on success, 1 if the segment cannot be read
+ */
+int top_run(const char *shm_name, uint32_t interval_ms, uint32_t iterations);
+
+#endif /* TOP_H */
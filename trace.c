@@ -0,0 +1,300 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_MAX_THREADS 32U
+#define TRACE_BUFFER_EVENTS 2048U
+#define TRACE_JSON_CHUNK 65536U
+#define TRACE_JSON_EVENT_MAX 256U
+
+typedef struct {
+    atomic_uint_fast64_t seq;
+    const char *name;
+    uint64_t trace_id;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+} trace_event_t;
+
+/* single-producer ring owned by one thread, read by the dumper */
+typedef struct {
+    atomic_uint_fast64_t head;
+    atomic_uint_fast64_t start;
+    int32_t tid;
+    trace_event_t events[TRACE_BUFFER_EVENTS];
+} trace_buffer_t;
+
+static trace_buffer_t g_buffers[TRACE_MAX_THREADS];
+static atomic_uint g_buffer_count = ATOMIC_VAR_INIT(0);
+static atomic_uint g_sample_rate = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t g_request_seq = ATOMIC_VAR_INIT(0);
+
+static _Thread_local trace_buffer_t *t_buffer = NULL;
+static _Thread_local bool t_buffer_exhausted = false;
+static _Thread_local uint64_t t_trace_id = 0;
+static _Thread_local bool t_sampled = false;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static trace_buffer_t *thread_buffer(void)
+{
+    unsigned int idx;
+
+    if (t_buffer != NULL || t_buffer_exhausted) {
+        return t_buffer;
+    }
+
+    idx = atomic_fetch_add(&g_buffer_count, 1U);
+    if (idx >= TRACE_MAX_THREADS) {
+        t_buffer_exhausted = true;
+        return NULL;
+    }
+
+    t_buffer = &g_buffers[idx];
+    t_buffer->tid = (int32_t)syscall(SYS_gettid);
+    return t_buffer;
+}
+
+void trace_set_sample_rate(uint32_t one_in_n)
+{
+    atomic_store_explicit(&g_sample_rate, one_in_n, memory_order_relaxed);
+}
+
+uint32_t trace_get_sample_rate(void)
+{
+    return atomic_load_explicit(&g_sample_rate, memory_order_relaxed);
+}
+
+uint64_t trace_request_begin(void)
+{
+    uint64_t seq;
+    uint32_t rate;
+
+    seq = atomic_fetch_add_explicit(&g_request_seq, 1U, memory_order_relaxed);
+    rate = atomic_load_explicit(&g_sample_rate, memory_order_relaxed);
+
+    t_trace_id = seq + 1U;
+    t_sampled = (rate != 0U) && ((seq % rate) == 0U);
+    return t_trace_id;
+}
+
+void trace_request_end(void)
+{
+    t_trace_id = 0U;
+    t_sampled = false;
+}
+
+uint64_t trace_current_id(void)
+{
+    return t_trace_id;
+}
+
+bool trace_is_active(void)
+{
+    return t_sampled;
+}
+
+void trace_span_begin(trace_span_t *span, const char *name)
+{
+    if (!t_sampled) {
+        span->name = NULL;
+        return;
+    }
+
+    span->name = name;
+    span->start_ns = now_ns();
+}
+
+void trace_span_end(const trace_span_t *span)
+{
+    trace_buffer_t *buf;
+    trace_event_t *ev;
+    uint64_t idx;
+    uint64_t end;
+
+    if (span->name == NULL) {
+        return;
+    }
+
+    end = now_ns();
+    buf = thread_buffer();
+    if (buf == NULL) {
+        return;
+    }
+
+    idx = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    ev = &buf->events[idx % TRACE_BUFFER_EVENTS];
+
+    atomic_store_explicit(&ev->seq, 0U, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    ev->name = span->name;
+    ev->trace_id = t_trace_id;
+    ev->start_ns = span->start_ns;
+    ev->dur_ns = end - span->start_ns;
+    atomic_store_explicit(&ev->seq, idx + 1U, memory_order_release);
+    atomic_store_explicit(&buf->head, idx + 1U, memory_order_release);
+}
+
+static int flush_chunk(int fd, const char *chunk, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0U) {
+        ret = write(fd, chunk, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        chunk += ret;
+        len -= (size_t)ret;
+    }
+    return 0;
+}
+
+int trace_dump_json(int fd)
+{
+    static const char header[] = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    static const char footer[] = "\n]}\n";
+    char chunk[TRACE_JSON_CHUNK];
+    size_t used = 0U;
+    unsigned int count;
+    unsigned int b;
+    uint64_t head;
+    uint64_t first;
+    uint64_t i;
+    int events = 0;
+    int pid;
+    int len;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    pid = (int)getpid();
+    memcpy(chunk, header, sizeof(header) - 1U);
+    used = sizeof(header) - 1U;
+
+    count = atomic_load(&g_buffer_count);
+    if (count > TRACE_MAX_THREADS) {
+        count = TRACE_MAX_THREADS;
+    }
+
+    for (b = 0U; b < count; b++) {
+        trace_buffer_t *buf = &g_buffers[b];
+
+        head = atomic_load_explicit(&buf->head, memory_order_acquire);
+        first = atomic_load_explicit(&buf->start, memory_order_relaxed);
+        if (head - first > TRACE_BUFFER_EVENTS) {
+            first = head - TRACE_BUFFER_EVENTS;
+        }
+
+        for (i = first; i < head; i++) {
+            const trace_event_t *ev = &buf->events[i % TRACE_BUFFER_EVENTS];
+            trace_event_t copy;
+            uint64_t seq;
+
+            seq = atomic_load_explicit(&ev->seq, memory_order_acquire);
+            if (seq != i + 1U) {
+                continue;
+            }
+            copy.name = ev->name;
+            copy.trace_id = ev->trace_id;
+            copy.start_ns = ev->start_ns;
+            copy.dur_ns = ev->dur_ns;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&ev->seq, memory_order_relaxed) != seq) {
+                continue;
+            }
+
+            if (sizeof(chunk) - used < TRACE_JSON_EVENT_MAX) {
+                if (flush_chunk(fd, chunk, used) != 0) {
+                    return -1;
+                }
+                used = 0U;
+            }
+
+            len = snprintf(&chunk[used], sizeof(chunk) - used,
+                    "%s\n{\"name\":\"%s\",\"cat\":\"kmodlike\",\"ph\":\"X\","
+                    "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"trace_id\":%llu}}",
+                    (events == 0) ? "" : ",", copy.name,
+                    (unsigned long long)(copy.start_ns / 1000U),
+                    (unsigned long long)(copy.start_ns % 1000U),
+                    (unsigned long long)(copy.dur_ns / 1000U),
+                    (unsigned long long)(copy.dur_ns % 1000U),
+                    pid, (int)buf->tid, (unsigned long long)copy.trace_id);
+            if (len < 0 || (size_t)len >= sizeof(chunk) - used) {
+                continue;
+            }
+            used += (size_t)len;
+            events++;
+        }
+    }
+
+    if (sizeof(chunk) - used < sizeof(footer)) {
+        if (flush_chunk(fd, chunk, used) != 0) {
+            return -1;
+        }
+        used = 0U;
+    }
+    memcpy(&chunk[used], footer, sizeof(footer) - 1U);
+    used += sizeof(footer) - 1U;
+
+    if (flush_chunk(fd, chunk, used) != 0) {
+        return -1;
+    }
+
+    return events;
+}
+
+int trace_dump_file(const char *path)
+{
+    int fd;
+    int ret;
+
+    if (path == NULL) {
+        return -1;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    ret = trace_dump_json(fd);
+    if (close(fd) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+void trace_clear(void)
+{
+    unsigned int count;
+    unsigned int b;
+
+    count = atomic_load(&g_buffer_count);
+    if (count > TRACE_MAX_THREADS) {
+        count = TRACE_MAX_THREADS;
+    }
+
+    for (b = 0U; b < count; b++) {
+        atomic_store_explicit(&g_buffers[b].start,
+                atomic_load_explicit(&g_buffers[b].head, memory_order_acquire),
+                memory_order_relaxed);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* timed span, lives on the caller's stack between begin and end */
+typedef struct {
+    const char *name;
+    uint64_t start_ns;
+} trace_span_t;
+
+/**
+ * set request sampling rate
+ * @param one_in_n trace one of every n requests, 0 disables tracing
+ */
+void trace_set_sample_rate(uint32_t one_in_n);
+
+/**
+ * get request sampling rate
+ * @return current rate, 0 if disabled
+ */
+uint32_t trace_get_sample_rate(void);
+
+/**
+ * start a request on the calling thread
+ * every request gets a trace id, spans are recorded only if sampled
+ * @return trace id of the new request
+ */
+uint64_t trace_request_begin(void);
+
+/**
+ * finish the current request on the calling thread
+ */
+void trace_request_end(void);
+
+/**
+ * get trace id of the request running on the calling thread
+ * @return trace id or 0 if no request is active
+ */
+uint64_t trace_current_id(void);
+
+/**
+ * check whether the calling thread records spans
+ * @return true if the current request is sampled
+ */
+bool trace_is_active(void);
+
+/**
+ * start a span, a no-op unless the current request is sampled
+ * @param span span storage
+ * @param name static span name
+ */
+void trace_span_begin(trace_span_t *span, const char *name);
+
+/**
+ * finish a span and append it to the per-thread buffer
+ * @param span span started by trace_span_begin()
+ */
+void trace_span_end(const trace_span_t *span);
+
+/**
+ * write recorded spans as Chrome/Perfetto trace-event JSON
+ * @param fd output file descriptor
+ * @return number of events written or -1 on error
+ */
+int trace_dump_json(int fd);
+
+/**
+ * write recorded spans to a file
+ * @param path output file path
+ * @return number of events written or -1 on error
+ */
+int trace_dump_file(const char *path);
+
+/**
+ * discard all recorded spans
+ */
+void trace_clear(void);
+
+#endif /* TRACE_H */